@@ -1,21 +1,29 @@
+#include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/shm.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
 
 #include "hamster.h"
+#include "shm_lz.h"
+#include "shm_bloom.h"
+#include "shm_numa.h"
+#include "shm_pool.h"
+#include "shm_notify.h"
+#include "shm_replog.h"
 #include "shm_crc32.h"
 #include "shm_error.h"
 #include "shm_config.h"
+#include "shm_art.h"
 #include "shm_rb_tree.h"
 #include "shm_segments.h"
-
-struct h_value_t {
-  /* pointer to value */
-  void* ptr;
-  /* size of this value */
-  uint32_t size;
-  /* max size of this value */
-  uint32_t max_size; 
-};
+#include "shm_timer_wheel.h"
 
 /*
  * layout
@@ -32,14 +40,96 @@ struct h_value_t {
  * +-----------+---------------------------------------+---+
  */
 
+/*
+ * checksum covers total_size and everything after it, flags and next are
+ * left out: linking a new record only stores next, and the commit marker of
+ * the segment (see shmseg_commit) is what makes the link durable. version
+ * is left out too, it only matters to hamster_cas
+ */
 struct shm_data_header {
   int checksum;
+  uint32_t flags;
+  struct shmseg_ptr_base next;
+  uint64_t version;  /* shard clock of the last write, see data_version */
   uint32_t total_size;
   uint32_t data_size;
-  struct shmseg_ptr_base next;
+  uint64_t expire;  /* deadline in CLOCK_MONOTONIC ms, 0 for never */
+  uint32_t raw_size;  /* size before compression, 0 if value is stored raw */
+  uint32_t pad_size;  /* bytes between key and value, aligning counters */
 };
 
 #define hdr_size sizeof(struct shm_data_header)
+#define hdr_checksum_off offsetof(struct shm_data_header, total_size)
+
+/* value is being rewritten in place, checksum can not be trusted */
+#define HDR_F_DIRTY 0x1
+/* expired, the record stays in the chain and its space waits to be reused */
+#define HDR_F_FREE  0x2
+/* read since the clock hand passed by last time, see data_evict */
+#define HDR_F_REF   0x4
+/* failed its checksum, the record only keeps the chain behind it reachable */
+#define HDR_F_QUARANTINE 0x8
+/* updated in write-combining mode, its checksum is stale until shard_seal */
+#define HDR_F_UNSEALED 0x10
+/* a piece of a chunked value, out of the index, its key is the one it belongs to */
+#define HDR_F_CHUNK 0x20
+/* the value is a chunk_table, see data_new_chunked */
+#define HDR_F_CHUNKED 0x40
+/* the record was sized for a compressed value, see data_outgrown */
+#define HDR_F_PACKED 0x80
+/*
+ * counter adds which have not patched the checksum yet, counted in the high
+ * half of flags, see counter_add. the checksum can not be trusted while any
+ * is, one left by a crash is computed again by recovery
+ */
+#define HDR_F_ADDING 0xffff0000u
+#define HDR_ADDING_ONE 0x10000u
+
+/* compressed values must save at least 1/8 of their size */
+#define compress_cap(size) ((size) - (size) / 8)
+
+/* free records are kept in lists by floor(log2(total_size)) */
+#define FREE_CLASSES 32
+
+/*
+ * value of a chunked record, aligned on 8 by its pad_size. the bytes of the
+ * value are in the chunks, in order, chunk_size of them in each but the last
+ */
+struct chunk_table {
+  uint32_t size;
+  uint32_t chunk_size;
+  uint32_t count;
+  uint32_t pad;
+  struct shmseg_ptr_base chunks[];
+};
+
+#define chunk_table_size(count) \
+  (sizeof(struct chunk_table) + (count) * sizeof(struct shmseg_ptr_base))
+
+/* bytes of value a chunk of a key of key_size bytes holds, 0 if too long a key */
+#define chunk_room(key_size) \
+  ((key_size) + hdr_size <= SHM_CHUNK_SIZE / 2 ? SHM_CHUNK_SIZE - hdr_size - (key_size) : 0)
+
+/* a chunk record recovery walked, see data_chunks_sort */
+struct chunk_ref {
+  struct shmseg_ptr_base base;
+  uint32_t               handle;
+  bool                   live;
+};
+
+struct chunk_sort {
+  struct shard_t*   sh;
+  struct chunk_ref* refs;
+  uint32_t          count;
+};
+
+/* position in the buffers of an iovec array, see iov_gather */
+struct iov_cursor {
+  const struct iovec* iov;
+  int                 iovcnt;
+  int                 i;
+  size_t              off;  /* in iov[i] */
+};
 
 shm_internal uint32_t hdr_key_size(struct shm_data_header* hdr);
 shm_internal const char* hdr_key(struct shm_data_header* hdr);
@@ -47,68 +137,554 @@ shm_internal uint32_t hdr_value_size(struct shm_data_header* hdr);
 shm_internal uint32_t hdr_value_maxsize(struct shm_data_header* hdr);
 shm_internal void* hdr_value(struct shm_data_header* hdr);
 
+/*
+ * descriptor of a record, they live in the descs pool of their shard and
+ * never move, a free or quarantined one is linked to the next by handle
+ */
 struct data_t {
   struct shmseg_ptr base_sptr;
   const char* key;
   struct h_value_t value;
+  union {
+    struct timer_node* timer;      /* scheduled expiry, NULL for never */
+    uint32_t           next_free;  /* next free record of the same class */
+  };
+};
+
+#define data_at(sh, h) ((struct data_t*)shm_pool_ptr(&(sh)->descs, (h)))
+#define data_handle(sh, d) shm_pool_handle(&(sh)->descs, (d))
+
+/*
+ * a shard owns an independent index, segment chain and lock, keys are
+ * routed to shards by hash, so writers of different shards never meet
+ */
+struct shard_t {
+  pthread_rwlock_t    lock;
+  struct shmseg_chain segs;
+  struct rb_tree*     tree;      /* index, NULL with HAMSTER_INDEX_ART */
+  struct art_tree*    art;       /* index of HAMSTER_INDEX_ART */
+  struct shm_pool     descs;     /* data_t of every record */
+  struct data_t*      tail;
+  struct data_t       tail_chunk;  /* the tail if it is a chunk, see chunk_forget */
+  struct timer_wheel* wheel;
+  struct timer_node*  timer_spare;  /* taken ahead by shard_reserve, see data_timer */
+  uint32_t            free_list[FREE_CLASSES];
+  uint64_t            capacity;  /* bytes of segments, 0 for unbounded */
+  uint64_t            budget_soft;   /* bytes of segments, 0 for none */
+  uint64_t            budget_hard;
+  bool                budget_hit;    /* grew beyond soft, the hook is due */
+  bool                budget_full;   /* refused a write, until one takes room or room is freed */
+  uint64_t            rejected;      /* writes refused at the hard budget */
+  struct shmseg_ptr   hand;      /* clock hand over the record chain */
+  struct shmseg_ptr   scrub;     /* scrubber cursor over the record chain */
+  uint32_t            quarantine;  /* quarantined records, linked by next_free */
+  uint64_t            hits;
+  uint64_t            misses;
+  uint64_t            evictions;
+  uint64_t            expirations;
+  uint64_t            quarantined;
+  uint64_t            scrubbed;
+  uint64_t            clock;     /* last version given to a write */
+  struct shm_bloom*   filter;    /* keys of the index, NULL if off */
+  uint32_t            filter_bits;   /* bits per key, 0 if off */
+  uint32_t            filter_cap;    /* keys the filter is sized for */
+  uint32_t            filter_keys;   /* keys added since it was built */
+  uint32_t            filter_stale;  /* keys dropped since it was built */
+  uint64_t            filter_skips;
+  uint64_t            filter_false_positives;
+  struct shm_replog*  replog;    /* log of the store, NULL if none or a replica but the first */
+  bool                combine;   /* updates leave their checksum to shard_seal */
+  uint64_t*           unsealed;  /* bitmap of the descriptor handles to seal */
+  uint32_t            unsealed_words;
+  uint32_t            unsealed_count;  /* bits set in unsealed */
+  uint64_t            sealed;
+  bool                loading;   /* in shard_init, chunks are sorted out after the walk */
+};
+
+/*
+ * a store is an independent set of shards on its own range of shm keys,
+ * with its own sizing and policies, a process might open several of them
+ */
+struct hamster_store {
+  char*                 name;
+  uint32_t              key;           /* first shm key of the range */
+  uint32_t              shard_count;
+  struct shard_t*       shards;
+  size_t                segment_min;
+  size_t                segment_max;
+  uint32_t              segment_flags;
+  uint32_t              numa_policy;
+  uint32_t              numa_node;
+  uint32_t              compress_min;
+  uint32_t              chunk_min;     /* see hamster_set_chunking */
+  uint32_t              filter_bits;   /* see hamster_set_filter */
+  uint32_t              index;         /* HAMSTER_INDEX_* */
+  pthread_mutex_t       scrub_lock;    /* serialises scrub steps */
+  pthread_cond_t        scrub_cond;    /* wakes the scrubber to stop */
+  pthread_t             scrub_thread;
+  bool                  scrub_running;
+  bool                  scrub_stop;
+  uint64_t              scrub_rate;    /* bytes per second of the scrubber */
+  hamster_corrupt_fn    scrub_fn;
+  void*                 scrub_ctx;
+  hamster_budget_fn     budget_fn;     /* see hamster_set_budget */
+  void*                 budget_ctx;
+  uint32_t              scrub_shard;   /* shard the next scrub step starts at */
+  pthread_mutex_t       seal_lock;
+  pthread_cond_t        seal_cond;     /* wakes the sealer to stop */
+  pthread_t             seal_thread;
+  bool                  seal_running;
+  bool                  seal_stop;
+  uint32_t              seal_ms;       /* see hamster_set_sealing */
+  struct shm_notify*    notify;        /* change ring, see notify_key */
+  struct shm_replog*    replog;        /* replication log, see replog_key */
+  struct hamster_store* next;          /* next open store */
+};
+
+/*
+ * writes staged by hamster_batch_set, keys and values are copied back to
+ * back into buf, ops refer to them by offset as buf grows
+ */
+struct batch_op {
+  size_t   key_off;
+  size_t   val_off;
+  uint32_t key_size;  /* with the terminating 0 */
+  uint32_t val_size;
+  uint32_t max_size;
+  uint32_t ttl_ms;
+  uint32_t raw_size;  /* size before compression, 0 if value is raw */
+  uint64_t expire;    /* deadline taking the place of ttl_ms, see batch_add */
+};
+
+/* records batch_reserve wrote for the ops of one shard, see batch_link */
+struct batch_resv {
+  struct data_t**     ds;
+  struct timer_node** timers;
+  uint32_t            n;
+};
+
+struct hamster_batch {
+  char*            buf;
+  size_t           size;
+  size_t           cap;
+  struct batch_op* ops;
+  uint32_t         count;
+  uint32_t         ops_cap;
+};
+
+/*
+ * a watcher only attaches the change ring of a store
+ */
+struct hamster_watch {
+  struct shm_notify* notify;
+};
+
+/*
+ * a write as the replication log and snapshots carry it: the stored value
+ * of key, with key and value following. it is the whole value after the
+ * write, a counter add too, so it can be applied any number of times. a
+ * record of the log holds one op, or all the ops of a batch
+ */
+struct repl_op {
+  uint32_t key_size;  /* with the terminating 0, 0 ends a snapshot */
+  uint32_t val_size;
+  uint32_t max_size;
+  uint32_t raw_size;  /* size before compression, 0 if value is raw */
+  uint64_t expire;    /* deadline in CLOCK_MONOTONIC ms, 0 for never */
+  uint32_t checksum;  /* crc of the op, key and value in a snapshot, 0 in the log */
+  uint32_t pad;
+};
+
+/*
+ * a follower applies the log of a leader to its own store, batch is where
+ * it stages the ops of a batch
+ */
+struct hamster_follower {
+  struct shm_replog*    log;
+  struct hamster_store* st;
+  uint64_t              pos;  /* end of the records applied */
+  uint64_t              lsn;  /* lsn of the last record applied */
+  char*                 buf;
+  uint32_t              cap;
+  struct hamster_batch* batch;
+};
+
+/* head of a snapshot file, repl_ops follow up to one with key_size 0 */
+struct snap_header {
+  char     magic[8];
+  uint64_t pos;  /* end of the log when the snapshot started */
+  uint64_t lsn;
+};
+
+#define SNAP_MAGIC "HMSNAP1"
+
+/* state of hamster_store_snapshot, see snap_write */
+struct snap_ctx {
+  struct shard_t* sh;
+  FILE*           f;
+  uint64_t        now;
+  char*           buf;
+  uint32_t        cap;
+  int             ec;
+};
+
+/*
+ * a reader attaches the segment chains of a store read only and walks the
+ * records of each one, it takes no lock. a record is copied out first, and
+ * only the copy is looked at
+ */
+struct hamster_reader {
+  uint32_t             shard_count;
+  struct shmseg_chain* chains;
+  uint32_t             shard;  /* shard being walked */
+  struct shmseg_ptr    at;     /* next record of it, shm_key -1 past the last */
+  uint64_t             steps;  /* records walked in it */
+  uint64_t             now;
+  char*                buf;    /* copy of the last record */
+  uint32_t             cap;
+  char*                val;    /* value of the last record gathered from its chunks */
+  uint32_t             val_cap;
 };
 
-shm_internal bool g_init;
-shm_internal struct data_t* g_data_tail;
-shm_internal struct rb_tree* g_data_tree;
+/* what reader_step finds */
+#define READ_LIVE 0
+#define READ_FREE 1  /* free or expired */
+#define READ_BAD  2  /* quarantined, or the copy fails its checksum */
+#define READ_END  3
+
+/*
+ * the last key of the range of shard 0 holds the change ring of a store,
+ * the one before it the replication log, segment chains leave both out
+ */
+#define notify_key(key) ((key) + SHM_KEY_RANGE - 1)
+#define replog_key(key) ((key) + SHM_KEY_RANGE - 2)
+
+/* bytes batch_log needs for the ops of b */
+#define batch_scratch(b) ((b)->count * (sizeof(struct repl_op) + 3 * sizeof(struct iovec)))
+
+shm_internal bool g_recovery_verify_all = SHM_RECOVERY_VERIFY_ALL;
+shm_internal pthread_mutex_t g_stores_lock = PTHREAD_MUTEX_INITIALIZER;
+shm_internal struct hamster_store* g_stores;
+/* store of hamster_init and the calls without a store */
+shm_internal struct hamster_store* g_default;
+
+shm_internal uint32_t key_hash(const char* key);
+shm_internal uint64_t key_hash64(const char* key);
+shm_internal uint32_t store_key(const char* name, key_t key);
+shm_internal uint64_t store_owner(const char* name);
+shm_internal struct shard_t* shard_of(struct hamster_store* st, const char* key);
+shm_internal struct shard_t* shard_read(struct hamster_store* st, const char* key);
+shm_internal int  shard_set(struct shard_t* sh, const char* key, struct h_value_t* val, 
+                            uint32_t raw_size, uint64_t expire, uint64_t* version);
+shm_internal int  shard_setv(struct shard_t* sh, const char* key, const struct iovec* iov, int iovcnt, 
+                             uint32_t size, uint64_t expire, uint64_t* version);
+shm_internal int  shard_add(struct shard_t* sh, const char* key, int64_t delta, int64_t* value);
+shm_internal int  shard_put(struct shard_t* sh, const char* key, struct h_value_t* val, 
+                            uint32_t raw_size, uint64_t expire, uint64_t* version);
+shm_internal int  shard_putv(struct shard_t* sh, const char* key, const struct iovec* iov, int iovcnt, 
+                             uint32_t size, uint64_t expire, uint64_t* version, 
+                             struct chunk_table* table, struct iovec* parts);
+shm_internal int  shard_put_sum(struct shard_t* sh, const char* key, int64_t delta, int64_t* value);
+shm_internal void replica_lock(struct hamster_store* st);
+shm_internal void replica_unlock(struct hamster_store* st);
+shm_internal int  replica_reserve(struct hamster_store* st, const char* key, uint32_t size, uint64_t total,
+                                  uint32_t records, uint64_t expire);
+shm_internal int  shard_reserve(struct shard_t* sh, uint32_t records, uint64_t total, uint64_t expire);
+shm_internal int  shard_probe(uint32_t key, uint32_t shards);
+shm_internal int  shard_init(struct hamster_store* st, uint32_t i);
+shm_internal void shard_free(struct shard_t* sh);
+shm_internal int  shard_filter(struct shard_t* sh, uint32_t bits_per_key);
+shm_internal void shard_filter_add(void* data, void* ctx);
+shm_internal size_t shard_scrub(struct hamster_store* st, struct shard_t* sh, size_t budget, 
+                                hamster_corrupt_fn fn, void* ctx, bool* wrapped);
+
+shm_internal size_t scrub_step(struct hamster_store* st, size_t budget, 
+                               hamster_corrupt_fn fn, void* ctx);
+shm_internal void*  scrub_main(void* arg);
+shm_internal size_t shard_seal(struct shard_t* sh);
+shm_internal void   store_combine(struct hamster_store* st, bool on);
+shm_internal void   seal_join(struct hamster_store* st);
+shm_internal void*  seal_main(void* arg);
 
-shm_internal int  data_load(struct data_t** d, struct shmseg_ptr* base_sptr);
-shm_internal int  data_add(struct data_t* data_ptr);
+shm_internal int  store_register(struct hamster_store* st);
+shm_internal void store_unregister(struct hamster_store* st);
+shm_internal void store_free(struct hamster_store* st);
+shm_internal uint64_t batch_route(struct hamster_store* st, struct hamster_batch* b, uint32_t* shard_of_op);
+shm_internal int  batch_prepare(struct hamster_store* st, struct hamster_batch* b, const uint32_t* shard_of_op, 
+                                uint64_t shards, uint64_t now, struct batch_resv* rs);
+shm_internal int  batch_check(struct shard_t* sh, struct hamster_batch* b, const uint32_t* shard_of_op, 
+                              uint32_t i);
+shm_internal int  batch_reserve(struct shard_t* sh, struct hamster_batch* b, const uint32_t* shard_of_op, 
+                                uint32_t i, uint64_t now, struct batch_resv* r);
+shm_internal int  batch_link(struct shard_t* sh, struct batch_resv* r);
+shm_internal int  batch_index(struct shard_t* sh, struct batch_resv* r);
+shm_internal void batch_cancel(struct shard_t* sh, struct batch_resv* r);
+shm_internal void batch_release(struct shard_t* sh, struct batch_resv* r);
+shm_internal int  batch_anchor(struct shard_t* sh);
+shm_internal void batch_log(struct shm_replog* l, struct hamster_batch* b, uint64_t now, void* scratch);
+shm_internal int  store_set(struct hamster_store* st, const char* key, struct h_value_t* val, 
+                            uint64_t expire, uint64_t* version);
+shm_internal void store_budget_hook(struct hamster_store* st, struct shard_t* sh);
+shm_internal uint64_t store_used(struct hamster_store* st);
+shm_internal int  store_put(struct hamster_store* st, const char* key, struct h_value_t* stored, 
+                            uint32_t raw_size, uint64_t expire, uint64_t* version);
+shm_internal int  store_putv(struct hamster_store* st, const char* key, const struct iovec* iov, 
+                             int iovcnt, uint32_t size, uint64_t expire, uint64_t* version);
+shm_internal bool store_chunked(struct hamster_store* st, const char* key, uint32_t size);
+shm_internal int  batch_add(struct hamster_batch* b, const char* key, struct h_value_t* val, 
+                            uint32_t ttl_ms, uint64_t expire, uint32_t raw_size);
+
+/** replication **/
+shm_internal void repl_log(struct shm_replog* l, const char* key, struct h_value_t* val, 
+                           uint32_t raw_size, uint64_t expire);
+shm_internal void repl_logv(struct shm_replog* l, const char* key, const struct iovec* iov, int iovcnt, 
+                            uint32_t size, uint64_t expire, struct iovec* parts);
+shm_internal int  repl_apply(struct hamster_follower* f, const char* rec, uint32_t size);
+shm_internal void snap_write(void* data, void* ctx);
+shm_internal uint32_t snap_checksum(struct repl_op* op, const char* key, const char* value);
+shm_internal int  snap_begin(FILE* f, uint64_t pos, uint64_t lsn);
+shm_internal int  snap_put(FILE* f, const char* key, const void* value, uint32_t size, 
+                           uint32_t max_size, uint32_t raw_size, uint64_t expire);
+shm_internal int  snap_end(FILE* f);
+shm_internal int  snap_load(struct hamster_store* st, FILE* f, uint64_t* pos, uint64_t* lsn);
+shm_internal int  reader_step(struct hamster_reader* r, struct shmseg_chain* c, 
+                             struct shmseg_ptr* at, uint64_t* steps);
+shm_internal int  reader_gather(struct hamster_reader* r, struct shmseg_chain* c);
+
+shm_internal int  data_load(struct shard_t* sh, struct data_t** d, struct shmseg_ptr* base_sptr);
+shm_internal int  data_verify(struct shard_t* sh, struct shmseg_ptr* base_sptr, struct shm_data_header* hdr);
+shm_internal bool data_intact(struct shmseg_chain* c, struct shmseg_ptr* base_sptr, struct shm_data_header* hdr);
+shm_internal bool data_next_valid(struct shard_t* sh, struct shm_data_header* hdr);
+shm_internal int  data_add(struct shard_t* sh, struct data_t* data_ptr);
+shm_internal void data_link(struct shard_t* sh, struct data_t* data_ptr);
+shm_internal int  data_commit(struct shard_t* sh, struct data_t* data_ptr);
+shm_internal int  data_lock(struct shard_t* sh);
+shm_internal int  data_budget(struct shard_t* sh, uint64_t size);
 shm_internal int  data_less(void* left, void* right);
-shm_internal void data_release(void* data) { free(data); }
-shm_internal struct shm_data_header* data_hdr(struct data_t* d);
+shm_internal const char* data_key(void* data);
+shm_internal void data_release(void* data);
+shm_internal struct data_t* data_alloc(struct shard_t* sh);
+shm_internal void data_fill(struct shard_t* sh, struct data_t* data_ptr, const char* key, uint32_t key_size, 
+                            struct h_value_t* val, uint32_t raw_size, uint64_t expire, uint32_t pad_size);
+shm_internal void data_filter_add(struct shard_t* sh, struct data_t* data_ptr);
+shm_internal int  data_supersede(struct shard_t* sh, struct data_t* data_ptr);
+shm_internal struct shm_data_header* data_hdr(struct shard_t* sh, struct data_t* d);
 shm_internal int  data_checksum(struct shm_data_header* hdr);
-shm_internal int  data_update(struct data_t* data_ptr, struct h_value_t* val);
-shm_internal int  data_new(const char* key, struct h_value_t* val);
-shm_internal void data_set_next(struct data_t* data_ptr, struct shmseg_ptr_base* base_sptr);
+shm_internal int  data_update(struct shard_t* sh, struct data_t* data_ptr, struct h_value_t* val, uint32_t raw_size, uint64_t expire);
+shm_internal int  data_defer(struct shard_t* sh, struct data_t* data_ptr);
+shm_internal int  data_defer_room(struct shard_t* sh, uint32_t h);
+shm_internal int  data_place(struct shard_t* sh, uint32_t* total_size, struct data_t** d);
+shm_internal int  data_new(struct shard_t* sh, const char* key, struct h_value_t* val, uint32_t raw_size, uint64_t expire, 
+                           uint32_t pad_size, uint32_t flags);
+shm_internal int  data_replace(struct shard_t* sh, struct data_t* old, const char* key, struct h_value_t* val, 
+                               uint32_t raw_size, uint64_t expire, uint32_t pad_size, uint32_t flags);
+shm_internal bool data_outgrown(struct shard_t* sh, struct data_t* d, struct h_value_t* val);
+shm_internal uint32_t data_value_size(struct shard_t* sh, struct data_t* d);
+shm_internal int  data_read(struct shard_t* sh, struct data_t* d, uint32_t off, struct iov_cursor* cur, uint32_t n);
+shm_internal int  data_find(struct shard_t* sh, const char* key, struct data_t** d);
+shm_internal int  data_lookup(struct shard_t* sh, const char* key, struct data_t** d);
+shm_internal void data_version(struct shard_t* sh, struct shm_data_header* hdr);
+shm_internal char* data_compress(struct h_value_t* val, struct h_value_t* stored, uint32_t* raw_size);
+shm_internal void data_set_next(struct shard_t* sh, struct data_t* data_ptr, struct shmseg_ptr_base* base_sptr);
 
-int hamster_init() {
-  int ec = E_SHM_OK;
-  struct shmseg_ptr sptr = { { -1, 0 }, NULL };
-  struct data_t* data_ptr = NULL;
-  struct shmseg_ptr_base end = { -1, 0 };
+/** index **/
+shm_internal int    index_add(struct shard_t* sh, struct data_t* d);
+shm_internal int    index_reserve(struct shard_t* sh);
+shm_internal int    index_query(struct shard_t* sh, void** d);
+shm_internal int    index_del(struct shard_t* sh, void** d);
+shm_internal void   index_foreach(struct shard_t* sh, void (*fn)(void* data, void* ctx), void* ctx);
+shm_internal size_t index_count(struct shard_t* sh);
+shm_internal size_t index_bytes(struct shard_t* sh);
 
-  if (g_init)
-    return E_SHM_INIT_ONLY_ONCE;
+/** expiry **/
+shm_internal uint64_t now_ms();
+shm_internal uint64_t ms_to_tick(uint64_t ms);
+shm_internal bool data_expired(struct shard_t* sh, struct data_t* d, uint64_t now);
+shm_internal void data_touch(struct shard_t* sh, struct data_t* d);
+shm_internal int  data_schedule(struct shard_t* sh, struct data_t* d, uint64_t expire);
+shm_internal int  data_timer(struct shard_t* sh, uint64_t expire, struct timer_node** t);
+shm_internal void data_arm(struct shard_t* sh, struct data_t* d, uint64_t expire, struct timer_node* t);
+shm_internal void data_expire(struct timer_node* n, void* ctx);
+shm_internal void data_free(struct shard_t* sh, struct data_t* d);
+shm_internal void data_drop(struct shard_t* sh, struct data_t* d);
+shm_internal void data_retire(struct shard_t* sh, struct data_t* d);
+shm_internal void data_unindex(struct shard_t* sh, struct data_t* d);
+shm_internal void data_quarantine(struct shard_t* sh, struct data_t* d);
+shm_internal char* data_quarantine_at(struct shard_t* sh, struct shmseg_ptr* base_sptr, struct shm_data_header* hdr);
+shm_internal struct data_t* data_evict(struct shard_t* sh, uint32_t total_size);
+shm_internal void data_free_push(struct shard_t* sh, struct data_t* d);
+shm_internal struct data_t* data_free_pop(struct shard_t* sh, uint32_t total_size);
 
-  if (E_SHM_OK != (ec = shmseg_init(SHM_KEY)))
+/** chunks **/
+shm_internal struct chunk_table* hdr_chunks(struct shm_data_header* hdr);
+shm_internal struct chunk_table* chunk_table_new(const char* key, uint32_t size);
+shm_internal int  data_new_chunked(struct shard_t* sh, const char* key, struct iov_cursor* cur, 
+                                   struct chunk_table* table, uint64_t expire);
+shm_internal int  data_chunk(struct shard_t* sh, const char* key, uint32_t key_size, 
+                             struct iov_cursor* cur, uint32_t n, struct data_t** d);
+shm_internal int  data_chunks_sort(struct shard_t* sh, uint32_t chunks);
+shm_internal void chunk_mark(void* data, void* ctx);
+shm_internal int  chunk_ref_cmp(const void* left, const void* right);
+shm_internal void chunk_forget(struct shard_t* sh, struct data_t* d);
+shm_internal int  chunk_read(struct shmseg_chain* c, struct shm_data_header* hdr, uint32_t off, 
+                             struct iov_cursor* cur, uint32_t n);
+shm_internal void iov_init(struct iov_cursor* cur, const struct iovec* iov, int iovcnt);
+shm_internal uint64_t iov_size(const struct iovec* iov, int iovcnt);
+shm_internal void iov_gather(struct iov_cursor* cur, char* dst, size_t n);
+shm_internal void iov_scatter(struct iov_cursor* cur, const char* src, size_t n);
+
+/** counters **/
+shm_internal bool counter_of(struct data_t* d, struct shm_data_header* hdr);
+shm_internal bool counter_aligned(struct data_t* d);
+shm_internal uint32_t counter_pad(const char* key);
+shm_internal int64_t counter_add(struct shard_t* sh, struct data_t* d, int64_t delta);
+
+int hamster_open(const char* name, const struct hamster_options* opts, 
+                 struct hamster_store** store) {
+  int ec = E_SHM_OK, shard_ec = E_SHM_OK;
+  uint32_t i = 0;
+  struct hamster_store* st = NULL;
+
+  if (name == NULL || store == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  if (opts != NULL && opts->shards > SHM_SHARDS_MAX)
+    return E_SHM_INVALID_PARAMS;
+
+  // replicas would evict different keys
+  if (opts != NULL && opts->numa_policy == HAMSTER_NUMA_PER_NODE && opts->capacity > 0)
+    return E_SHM_INVALID_PARAMS;
+
+  if (NULL == (st = (struct hamster_store*)calloc(1, sizeof(struct hamster_store))))
+    return E_SHM_SYSTEM;
+
+  if (NULL == (st->name = strdup(name))) {
+    free(st);
+    return E_SHM_SYSTEM;
+  }
+  pthread_mutex_init(&st->scrub_lock, NULL);
+  pthread_cond_init(&st->scrub_cond, NULL);
+  pthread_mutex_init(&st->seal_lock, NULL);
+  pthread_cond_init(&st->seal_cond, NULL);
+
+  st->numa_policy  = opts != NULL ? opts->numa_policy : HAMSTER_NUMA_NONE;
+  st->numa_node    = opts != NULL ? opts->numa_node : 0;
+  if (st->numa_policy == HAMSTER_NUMA_PER_NODE)
+    st->shard_count = shm_numa_nodes() < SHM_SHARDS_MAX ? shm_numa_nodes() : SHM_SHARDS_MAX;
+  else
+    st->shard_count = opts != NULL && opts->shards > 0 ? opts->shards : 1;
+  st->segment_min  = opts != NULL ? opts->segment_min : 0;
+  st->segment_max  = opts != NULL ? opts->segment_max : 0;
+  st->segment_flags = opts != NULL ? opts->segment_flags : 0;
+  st->compress_min = opts != NULL ? opts->compress_min : 0;
+  st->chunk_min = opts != NULL ? opts->chunk_min : 0;
+  st->filter_bits  = opts != NULL ? opts->filter_bits : 0;
+  st->index        = opts != NULL ? opts->index : HAMSTER_INDEX_RB_TREE;
+  st->key = store_key(name, opts != NULL ? opts->key : 0);
+
+  if (E_SHM_OK != (ec = store_register(st))) {
+    store_free(st);
     return ec;
+  }
 
-  if (NULL == (g_data_tree = rb_tree_new(data_less, data_release)))
-    return E_SHM_TREE_NEW_FAILED;
+  if (E_SHM_OK != (ec = shard_probe(st->key, st->shard_count)) ||
+      NULL == (st->shards = (struct shard_t*)calloc(st->shard_count, sizeof(struct shard_t)))) {
+    store_unregister(st);
+    store_free(st);
+    return ec != E_SHM_OK ? ec : E_SHM_SYSTEM;
+  }
 
-  shmseg_ptr_reset(&sptr);
-  if (E_SHM_OK != (ec = shmseg_first_ptr(&sptr))) {
-    if (ec == E_SHM_EMPTY)
-      ec = E_SHM_OK;
-  } else {
-    do {
-      if (E_SHM_OK != (ec = data_load(&data_ptr, &sptr)) || 
-          E_SHM_OK != (ec = data_add(data_ptr))) {
-        data_set_next(g_data_tail, &end);
-        break;
+  for (i = 0; i < st->shard_count; ++i) {
+    shard_ec = shard_init(st, i);
+    st->shards[i].capacity = opts != NULL ? opts->capacity / st->shard_count : 0;
+    st->shards[i].budget_soft = opts != NULL ? opts->budget_soft / st->shard_count : 0;
+    st->shards[i].budget_hard = opts != NULL ? opts->budget_hard / st->shard_count : 0;
+    if (shard_ec == E_SHM_DATA_CORRUPTED) {
+      // keep recovering the other shards, report it when all done
+      ec = shard_ec;
+    } else if (shard_ec != E_SHM_OK) {
+      // keep the shm of the shards opened so far for a later try
+      for (; i != (uint32_t)-1; --i) {
+        shard_free(&st->shards[i]);
+        shmseg_detach(&st->shards[i].segs);
       }
+      store_unregister(st);
+      store_free(st);
+      return shard_ec;
+    }
+  }
 
-      shmseg_ptr_reset(&sptr);
-      *(struct shmseg_ptr_base*)&sptr = data_hdr(data_ptr)->next;
-    } while (sptr.base.shm_key != -1);
+  if (E_SHM_OK != (shard_ec = shm_notify_attach(notify_key(st->key), true, &st->notify)) ||
+      (opts != NULL && opts->replog_size > 0 &&
+       E_SHM_OK != (shard_ec = shm_replog_attach(replog_key(st->key), opts->replog_size, 
+                                                 &st->replog)))) {
+    shm_notify_detach(st->notify, false);
+    for (i = 0; i < st->shard_count; ++i) {
+      shard_free(&st->shards[i]);
+      shmseg_detach(&st->shards[i].segs);
+    }
+    store_unregister(st);
+    store_free(st);
+    return shard_ec;
+  }
+
+  // replicas apply the same writes, the first one logs them
+  for (i = 0; i < st->shard_count; ++i) {
+    if (i == 0 || st->numa_policy != HAMSTER_NUMA_PER_NODE)
+      st->shards[i].replog = st->replog;
+  }
+
+  if (opts != NULL && opts->seal_ms > 0 &&
+      E_SHM_OK != (shard_ec = hamster_store_set_sealing(st, opts->seal_ms))) {
+    hamster_detach(st);
+    return shard_ec;
   }
 
-  g_init = (ec == E_SHM_OK);
+  // a corrupted store is still usable, the damaged records are quarantined
+  *store = st;
   return ec;
 }
 
-void hamster_shutdown() {
-  if (g_init) {
-    g_init = false;
-    rb_tree_free(g_data_tree);
-    shmseg_shutdown();
+void hamster_close(struct hamster_store* st) {
+  uint32_t i = 0;
+
+  if (st == NULL)
+    return;
+
+  hamster_store_scrub_stop(st);
+  seal_join(st);
+  store_unregister(st);
+  for (i = 0; i < st->shard_count; ++i) {
+    shard_free(&st->shards[i]);
+    shmseg_shutdown(&st->shards[i].segs);
   }
+  shm_notify_detach(st->notify, true);
+  shm_replog_detach(st->replog, true);
+  store_free(st);
+}
+
+int hamster_init() {
+  return hamster_init_sharded(1);
+}
+
+int hamster_init_sharded(uint32_t shards) {
+  struct hamster_options opts;
+
+  if (g_default != NULL)
+    return E_SHM_INIT_ONLY_ONCE;
+
+  if (shards == 0)
+    return E_SHM_INVALID_PARAMS;
+
+  memset(&opts, 0, sizeof(opts));
+  opts.key = SHM_KEY;
+  opts.shards = shards;
+  return hamster_open("default", &opts, &g_default);
+}
+
+void hamster_shutdown() {
+  hamster_close(g_default);
+  g_default = NULL;
 }
 
 struct h_value_t* hamster_value_new(void* ptr, uint32_t size, uint32_t max_size) {
@@ -142,205 +718,4117 @@ void hamster_value_free(struct h_value_t* val) {
   if (val) free(val);
 }
 
-// TODO: thread-safe
 int hamster_set(const char* key, struct h_value_t* val) {
-  int ec = E_SHM_OK;
-  struct data_t stub, *target = &stub;
-
-  if (key == NULL || val == NULL)
-    return E_SHM_INVALID_PARAMS;
+  return hamster_store_set_ttl(g_default, key, val, 0);
+}
 
-  stub.key = key;
-  if (E_SHM_OK == (ec = rb_tree_query(g_data_tree, (void**)&target))) {
-    return data_update(target, val);
-  } else if (E_SHM_KEY_NOT_FOUND == ec) {
-    return data_new(key, val);
-  } else {
-    return ec;
-  }
+int hamster_set_ttl(const char* key, struct h_value_t* val, uint32_t ttl_ms) {
+  return hamster_store_set_ttl(g_default, key, val, ttl_ms);
 }
 
-// TODO: thread-safe, rw_lock may be?
 int hamster_get(const char* key, struct h_value_t* val) {
-  int ec;
-  struct data_t stub, *target = &stub;
+  return hamster_store_get(g_default, key, val);
+}
 
-  if (key == NULL || val == NULL)
-    return E_SHM_INVALID_PARAMS;
+int hamster_get_copy(const char* key, void* buf, uint32_t* size) {
+  return hamster_store_get_copy(g_default, key, buf, size);
+}
 
-  stub.key = key;
-  if (E_SHM_OK == (ec = rb_tree_query(g_data_tree, (void**)&target))) {
-    *val = target->value;
-    return E_SHM_OK;
-  }
-  return ec;
+int hamster_setv(const char* key, const struct iovec* iov, int iovcnt, uint32_t ttl_ms) {
+  return hamster_store_setv(g_default, key, iov, iovcnt, ttl_ms);
 }
 
-size_t hamster_count() {
-  return g_data_tree->count;
+int hamster_getv(const char* key, uint32_t off, const struct iovec* iov, int iovcnt, 
+                 uint32_t* size) {
+  return hamster_store_getv(g_default, key, off, iov, iovcnt, size);
 }
 
-shm_internal uint32_t hdr_key_size(struct shm_data_header* hdr) {
-  return strlen((char*)(hdr + 1)) + 1;
+int hamster_get_version(const char* key, struct h_value_t* val, uint64_t* version) {
+  return hamster_store_get_version(g_default, key, val, version);
 }
 
-shm_internal const char* hdr_key(struct shm_data_header* hdr) {
-  return (const char*)(hdr + 1);
+int hamster_cas(const char* key, struct h_value_t* val, uint64_t* version) {
+  return hamster_store_cas(g_default, key, val, version);
 }
 
-shm_internal uint32_t hdr_value_size(struct shm_data_header* hdr) {
-  return hdr->data_size - hdr_key_size(hdr);
+int hamster_add(const char* key, int64_t delta, int64_t* value) {
+  return hamster_store_add(g_default, key, delta, value);
 }
 
-shm_internal uint32_t hdr_value_maxsize(struct shm_data_header* hdr) {
-  return hdr->total_size - hdr_size - hdr_key_size(hdr);
+int hamster_incr(const char* key, int64_t* value) {
+  return hamster_store_add(g_default, key, 1, value);
 }
 
-shm_internal void* hdr_value(struct shm_data_header* hdr) {
-  return (char*)hdr_key(hdr) + hdr_key_size(hdr);
+int hamster_write(struct hamster_batch* b) {
+  return hamster_store_write(g_default, b);
 }
 
-shm_internal int data_load(struct data_t** d, struct shmseg_ptr* base_sptr) {
-  void* base_ptr = NULL;
-  struct data_t* data_ptr = NULL;
-  struct shm_data_header* hdr = NULL;
+size_t hamster_expire() {
+  return hamster_store_expire(g_default);
+}
 
-  *d = NULL;
-  if (NULL == (base_ptr = shmseg_ptr_ptr(base_sptr)))
-    return E_SHM_PTR_INVALID;
+int hamster_set_capacity(uint64_t bytes) {
+  return hamster_store_set_capacity(g_default, bytes);
+}
 
-  hdr = (struct shm_data_header*)base_ptr;
-  if (hdr->checksum != data_checksum(hdr))
-    return E_SHM_DATA_CORRUPTED;
+int hamster_set_budget(uint64_t soft, uint64_t hard, hamster_budget_fn fn, void* ctx) {
+  return hamster_store_set_budget(g_default, soft, hard, fn, ctx);
+}
 
-  if (NULL == (data_ptr = (struct data_t*)calloc(1, sizeof(struct data_t))))
-    return E_SHM_SYSTEM;
+int hamster_budget(struct hamster_budget* b) {
+  return hamster_store_budget(g_default, b);
+}
 
-  data_ptr->base_sptr = *base_sptr;
-  data_ptr->key = hdr_key(hdr);
-  data_ptr->value.ptr = hdr_value(hdr);
-  data_ptr->value.size = hdr_value_size(hdr);
-  data_ptr->value.max_size = hdr_value_maxsize(hdr);
+int hamster_set_filter(uint32_t bits_per_key) {
+  return hamster_store_set_filter(g_default, bits_per_key);
+}
 
-  *d = data_ptr;
-  return E_SHM_OK;
+void hamster_set_compression(uint32_t min_size) {
+  hamster_store_set_compression(g_default, min_size);
 }
 
-shm_internal struct shm_data_header* data_hdr(struct data_t* d) {
-  return (struct shm_data_header*)shmseg_ptr_ptr(&d->base_sptr);
+void hamster_set_chunking(uint32_t min_size) {
+  hamster_store_set_chunking(g_default, min_size);
 }
 
-shm_internal int data_checksum(struct shm_data_header* hdr) {
-  return shm_crc32((char*)hdr + sizeof(int),
-                   sizeof(*hdr) + hdr->data_size - sizeof(int));
+int hamster_stat(struct hamster_stat* st) {
+  return hamster_store_stat(g_default, st);
 }
 
-shm_internal int data_less(void* left, void* right) {
-  return strcmp(((struct data_t*)left)->key, ((struct data_t*)right)->key) < 0
-         ? true : false;
+size_t hamster_count() {
+  return hamster_store_count(g_default);
 }
 
-// TODO: thread-safe
-shm_internal int data_add(struct data_t* data_ptr) {
-  int ec = E_SHM_OK;
+uint32_t hamster_shard_count() {
+  return hamster_store_shard_count(g_default);
+}
 
-  if (E_SHM_OK != (ec = rb_tree_add(g_data_tree, data_ptr))) 
-    return ec;
+int hamster_snapshot(const char* path) {
+  return hamster_store_snapshot(g_default, path);
+}
 
-  data_set_next(g_data_tail, (struct shmseg_ptr_base*)(&data_ptr->base_sptr));
-  g_data_tail = data_ptr;
-  return E_SHM_OK;
+int hamster_scrub_start(uint64_t bytes_per_sec, hamster_corrupt_fn fn, void* ctx) {
+  return hamster_store_scrub_start(g_default, bytes_per_sec, fn, ctx);
 }
 
-shm_internal int data_update(struct data_t* data_ptr, struct h_value_t* val) {
-  struct shm_data_header* hdr = data_hdr(data_ptr);
+void hamster_scrub_stop() {
+  hamster_store_scrub_stop(g_default);
+}
 
-  if (val->size <= data_ptr->value.max_size) {
-    // copy data
-    memcpy(data_ptr->value.ptr, val->ptr, val->size);
-    // update header
-    hdr->data_size += val->size - data_ptr->value.size;
-    data_ptr->value.size = val->size;
-    // update checksum
-    hdr->checksum = data_checksum(hdr);
-    return E_SHM_OK;
-  } else {
-    return E_SHM_VAL_UPDATE_EXCEED_MAX_SIZE;
-  }
+size_t hamster_scrub(size_t max_bytes, hamster_corrupt_fn fn, void* ctx) {
+  return hamster_store_scrub(g_default, max_bytes, fn, ctx);
+}
+
+int hamster_set_sealing(uint32_t interval_ms) {
+  return hamster_store_set_sealing(g_default, interval_ms);
+}
+
+size_t hamster_seal() {
+  return hamster_store_seal(g_default);
+}
+
+int hamster_store_set(struct hamster_store* st, const char* key, struct h_value_t* val) {
+  return hamster_store_set_ttl(st, key, val, 0);
+}
+
+int hamster_store_set_ttl(struct hamster_store* st, const char* key, 
+                          struct h_value_t* val, uint32_t ttl_ms) {
+  if (st == NULL || key == NULL || val == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  return store_set(st, key, val, ttl_ms > 0 ? now_ms() + ttl_ms : 0, NULL);
+}
+
+int hamster_store_cas(struct hamster_store* st, const char* key, 
+                      struct h_value_t* val, uint64_t* version) {
+  if (st == NULL || key == NULL || val == NULL || version == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  return store_set(st, key, val, 0, version);
 }
 
-shm_internal int data_new(const char* key, struct h_value_t* val) {
+int hamster_store_add(struct hamster_store* st, const char* key, int64_t delta, int64_t* value) {
   int ec = E_SHM_OK;
-  void* base_ptr = NULL;
-  char* data_key = NULL;
-  void* data_val = NULL;
-  struct data_t* data_ptr = NULL;
-  uint32_t key_size = 0, total_size = 0;
-  struct shmseg_ptr sptr = { { -1, 0 }, NULL };
-  struct shm_data_header* hdr = NULL;
+  uint32_t i = 0;
+  int64_t n = 0;
 
-  key_size = strlen(key) + 1;
-  if (key_size == 1)
-    return E_SHM_KEY_ZERO_LENGTH;
+  if (st == NULL || key == NULL)
+    return E_SHM_INVALID_PARAMS;
 
-  if (val->max_size < val->size)
-    return E_SHM_VAL_SIZE_INVALID;
+  if (st->numa_policy != HAMSTER_NUMA_PER_NODE) {
+    ec = shard_add(shard_of(st, key), key, delta, &n);
+    store_budget_hook(st, shard_of(st, key));
+  } else {
+    replica_lock(st);
+    ec = replica_reserve(st, key, sizeof(n), 
+                         (uint64_t)hdr_size + strlen(key) + 1 + counter_pad(key) + sizeof(n), 1, 0);
+    for (i = 0; i < st->shard_count && ec == E_SHM_OK; ++i)
+      ec = shard_put_sum(&st->shards[i], key, delta, &n);
+    replica_unlock(st);
+    if (ec != E_SHM_OK && i > 1)
+      ec = E_SHM_REPLICA_PARTIAL;
+    for (i = 0; i < st->shard_count; ++i)
+      store_budget_hook(st, &st->shards[i]);
+  }
 
-  total_size = hdr_size + key_size + val->max_size;
-  if (E_SHM_OK != (ec = shmseg_get(&total_size, &sptr)))
-    return ec;
+  if (ec == E_SHM_OK) {
+    shm_notify_publish(st->notify, key, key_hash(key));
+    if (value != NULL)
+      *value = n;
+  }
+  return ec;
+}
 
-  val->max_size = total_size - hdr_size - key_size;
+int hamster_store_incr(struct hamster_store* st, const char* key, int64_t* value) {
+  return hamster_store_add(st, key, 1, value);
+}
 
-  if (NULL == (base_ptr = shmseg_ptr_ptr(&sptr)))
-    return E_SHM_PTR_INVALID;
+int hamster_batch_new(struct hamster_batch** b) {
+  if (b == NULL)
+    return E_SHM_INVALID_PARAMS;
 
-  if (NULL == (data_ptr = (struct data_t*)calloc(1, sizeof(struct data_t))))
+  if (NULL == (*b = (struct hamster_batch*)calloc(1, sizeof(struct hamster_batch))))
     return E_SHM_SYSTEM;
+  return E_SHM_OK;
+}
 
-  data_key = (char*)base_ptr + hdr_size;
-  data_val = (char*)data_key + key_size;
-
-  // set key
-  memcpy(data_key, key, key_size);
-  // set value
-  memcpy(data_val, val->ptr, val->size);
+void hamster_batch_free(struct hamster_batch* b) {
+  if (b == NULL)
+    return;
 
-  hdr = (struct shm_data_header*)base_ptr;
-  hdr->total_size = total_size;
-  hdr->data_size = key_size + val->size;
-  hdr->next.shm_key = -1;
-  hdr->next.off = 0;
-  hdr->checksum = data_checksum(hdr); 
+  free(b->buf);
+  free(b->ops);
+  free(b);
+}
 
-  data_ptr->base_sptr = sptr;
-  data_ptr->key = data_key;
-  data_ptr->value = *val;
-  data_ptr->value.ptr = data_val;
+void hamster_batch_clear(struct hamster_batch* b) {
+  if (b != NULL)
+    b->size = b->count = 0;
+}
 
-  return data_add(data_ptr);
+uint32_t hamster_batch_count(struct hamster_batch* b) {
+  return b != NULL ? b->count : 0;
 }
 
-shm_internal void data_set_next(struct data_t* data_ptr, struct shmseg_ptr_base* base_sptr) {
-  struct shm_data_header* hdr = NULL;
+int hamster_batch_set(struct hamster_batch* b, const char* key, struct h_value_t* val) {
+  return hamster_batch_set_ttl(b, key, val, 0);
+}
 
-  if (data_ptr != NULL) {
-    hdr = data_hdr(data_ptr);
-    hdr->next = *base_sptr;
-    hdr->checksum = data_checksum(hdr);
-  }
+int hamster_batch_set_ttl(struct hamster_batch* b, const char* key, 
+                          struct h_value_t* val, uint32_t ttl_ms) {
+  return batch_add(b, key, val, ttl_ms, 0, 0);
 }
 
-#ifdef UNITTEST
-shm_internal void unittest_shmseg_sim_crash();
-shm_internal void unittest_hamster_sim_crash() {
-  rb_tree_free(g_data_tree);
-  g_data_tree = NULL;
-  g_data_tail = NULL;
-  g_init = false;
-  unittest_shmseg_sim_crash();
+/*
+ * every shard the batch goes to is write locked, in order, for the whole
+ * write, and checked before any of them is written. all of them reserve
+ * and write their records before any is linked, a shard which fails gives
+ * back what the others reserved, and readers see all of the batch or none
+ */
+int hamster_store_write(struct hamster_store* st, struct hamster_batch* b) {
+  int ec = E_SHM_OK, rc = E_SHM_OK;
+  uint32_t i = 0, op = 0, *shard_of_op = NULL;
+  uint64_t shards = 0, now = now_ms();
+  struct batch_resv* rs = NULL;
+  void* scratch = NULL;
+
+  if (st == NULL || b == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  if (b->count == 0)
+    return E_SHM_OK;
+
+  if (NULL == (shard_of_op = (uint32_t*)malloc(b->count * sizeof(uint32_t))))
+    return E_SHM_SYSTEM;
+
+  if (NULL == (rs = (struct batch_resv*)calloc(st->shard_count, sizeof(struct batch_resv))) ||
+      (st->replog != NULL && NULL == (scratch = malloc(batch_scratch(b))))) {
+    free(rs);
+    free(shard_of_op);
+    return E_SHM_SYSTEM;
+  }
+
+  shards = batch_route(st, b, shard_of_op);
+  for (i = 0; i < st->shard_count; ++i) {
+    if (shards & ((uint64_t)1 << i))
+      pthread_rwlock_wrlock(&st->shards[i].lock);
+  }
+
+  // once the first shard is linked, every other one is
+  ec = batch_prepare(st, b, shard_of_op, shards, now, rs);
+  for (i = 0; i < st->shard_count; ++i) {
+    if (rs[i].ds != NULL && E_SHM_OK != (rc = batch_link(&st->shards[i], &rs[i])) && ec == E_SHM_OK)
+      ec = rc;
+  }
+  for (i = 0; i < st->shard_count; ++i) {
+    if (rs[i].ds != NULL && E_SHM_OK != (rc = batch_index(&st->shards[i], &rs[i])) && ec == E_SHM_OK)
+      ec = rc;
+  }
+  if (ec == E_SHM_OK && st->replog != NULL)
+    batch_log(st->replog, b, now, scratch);
+
+  for (i = st->shard_count; i-- > 0; ) {
+    if (shards & ((uint64_t)1 << i))
+      pthread_rwlock_unlock(&st->shards[i].lock);
+  }
+  free(shard_of_op);
+  free(scratch);
+  free(rs);
+
+  for (i = 0; i < st->shard_count; ++i) {
+    if (shards & ((uint64_t)1 << i))
+      store_budget_hook(st, &st->shards[i]);
+  }
+
+  if (ec == E_SHM_OK) {
+    for (op = 0; op < b->count; ++op)
+      shm_notify_publish(st->notify, b->buf + b->ops[op].key_off, 
+                         key_hash(b->buf + b->ops[op].key_off));
+  }
+  return ec;
+}
+
+int hamster_store_get(struct hamster_store* st, const char* key, struct h_value_t* val) {
+  int ec;
+  struct shard_t* sh = NULL;
+  struct data_t* target = NULL;
+
+  if (st == NULL || key == NULL || val == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  sh = shard_read(st, key);
+  pthread_rwlock_rdlock(&sh->lock);
+  if (E_SHM_OK == (ec = data_find(sh, key, &target))) {
+    if (data_hdr(sh, target)->raw_size != 0)
+      ec = E_SHM_VAL_COMPRESSED;
+    else if (data_hdr(sh, target)->flags & HDR_F_CHUNKED)
+      ec = E_SHM_VAL_CHUNKED;
+    else
+      *val = target->value;
+  }
+  pthread_rwlock_unlock(&sh->lock);
+  return ec;
+}
+
+int hamster_store_get_version(struct hamster_store* st, const char* key, 
+                              struct h_value_t* val, uint64_t* version) {
+  int ec;
+  struct shard_t* sh = NULL;
+  struct data_t* target = NULL;
+
+  if (st == NULL || key == NULL || val == NULL || version == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  sh = shard_read(st, key);
+  pthread_rwlock_rdlock(&sh->lock);
+  if (E_SHM_OK == (ec = data_find(sh, key, &target))) {
+    *version = __atomic_load_n(&data_hdr(sh, target)->version, __ATOMIC_ACQUIRE);
+    if (data_hdr(sh, target)->raw_size != 0)
+      ec = E_SHM_VAL_COMPRESSED;
+    else if (data_hdr(sh, target)->flags & HDR_F_CHUNKED)
+      ec = E_SHM_VAL_CHUNKED;
+    else
+      *val = target->value;
+  }
+  pthread_rwlock_unlock(&sh->lock);
+  return ec;
+}
+
+int hamster_store_get_copy(struct hamster_store* st, const char* key, 
+                           void* buf, uint32_t* size) {
+  int ec, n;
+  bool compressed = false;
+  uint32_t raw_size = 0;
+  struct shard_t* sh = NULL;
+  struct data_t* target = NULL;
+  struct iovec iov;
+  struct iov_cursor cur;
+
+  if (st == NULL || key == NULL || size == NULL || (buf == NULL && *size > 0))
+    return E_SHM_INVALID_PARAMS;
+
+  sh = shard_read(st, key);
+  pthread_rwlock_rdlock(&sh->lock);
+  if (E_SHM_OK == (ec = data_find(sh, key, &target))) {
+    compressed = (raw_size = data_hdr(sh, target)->raw_size) != 0;
+    if (!compressed)
+      raw_size = data_value_size(sh, target);
+
+    if (raw_size > *size) {
+      ec = E_SHM_VAL_BUFFER_TOO_SMALL;
+    } else if (!compressed) {
+      iov.iov_base = buf;
+      iov.iov_len = raw_size;
+      iov_init(&cur, &iov, 1);
+      ec = data_read(sh, target, 0, &cur, raw_size);
+    } else {
+      n = shm_lz_decompress((const char*)target->value.ptr, target->value.size, 
+                            (char*)buf, raw_size);
+      if (n != (int)raw_size)
+        ec = E_SHM_DATA_CORRUPTED;
+    }
+    *size = raw_size;
+  }
+  pthread_rwlock_unlock(&sh->lock);
+  return ec;
+}
+
+int hamster_store_setv(struct hamster_store* st, const char* key, 
+                       const struct iovec* iov, int iovcnt, uint32_t ttl_ms) {
+  int ec = E_SHM_OK;
+  uint64_t size = 0, expire = 0;
+  char* buf = NULL;
+  struct h_value_t val;
+  struct iov_cursor cur;
+
+  if (st == NULL || key == NULL || 
+      (size = iov_size(iov, iovcnt)) == 0 || size > UINT32_MAX / 2)
+    return E_SHM_INVALID_PARAMS;
+
+  expire = ttl_ms > 0 ? now_ms() + ttl_ms : 0;
+  if (store_chunked(st, key, (uint32_t)size))
+    return store_putv(st, key, iov, iovcnt, (uint32_t)size, expire, NULL);
+
+  // a record in one piece, put together first
+  if (NULL == (buf = (char*)malloc(size)))
+    return E_SHM_SYSTEM;
+  iov_init(&cur, iov, iovcnt);
+  iov_gather(&cur, buf, size);
+  val.ptr = buf;
+  val.size = val.max_size = (uint32_t)size;
+  ec = store_set(st, key, &val, expire, NULL);
+  free(buf);
+  return ec;
+}
+
+int hamster_store_getv(struct hamster_store* st, const char* key, uint32_t off, 
+                       const struct iovec* iov, int iovcnt, uint32_t* size) {
+  int ec;
+  uint32_t n = 0;
+  uint64_t room = 0;
+  struct shard_t* sh = NULL;
+  struct data_t* target = NULL;
+  struct iov_cursor cur;
+
+  if (st == NULL || key == NULL || size == NULL || 
+      (room = iov_size(iov, iovcnt)) == UINT64_MAX)
+    return E_SHM_INVALID_PARAMS;
+
+  sh = shard_read(st, key);
+  pthread_rwlock_rdlock(&sh->lock);
+  if (E_SHM_OK == (ec = data_find(sh, key, &target))) {
+    if (data_hdr(sh, target)->raw_size != 0) {
+      ec = E_SHM_VAL_COMPRESSED;
+    } else {
+      n = data_value_size(sh, target);
+      off = off < n ? off : n;
+      n -= off;
+      if (n > room)
+        n = (uint32_t)room;
+      iov_init(&cur, iov, iovcnt);
+      if (E_SHM_OK == (ec = data_read(sh, target, off, &cur, n)))
+        *size = n;
+    }
+  }
+  pthread_rwlock_unlock(&sh->lock);
+  return ec;
+}
+
+size_t hamster_store_expire(struct hamster_store* st) {
+  size_t expired = 0;
+  uint32_t i = 0;
+  uint64_t now = now_ms() / SHM_TTL_TICK_MS;
+
+  if (st == NULL)
+    return 0;
+
+  for (i = 0; i < st->shard_count; ++i) {
+    pthread_rwlock_wrlock(&st->shards[i].lock);
+    expired += timer_wheel_advance(st->shards[i].wheel, now, 
+                                   data_expire, &st->shards[i]);
+    pthread_rwlock_unlock(&st->shards[i].lock);
+  }
+  return expired;
+}
+
+int hamster_store_set_capacity(struct hamster_store* st, uint64_t bytes) {
+  uint32_t i = 0;
+
+  if (st == NULL || (st->numa_policy == HAMSTER_NUMA_PER_NODE && bytes > 0))
+    return E_SHM_INVALID_PARAMS;
+
+  for (i = 0; i < st->shard_count; ++i) {
+    pthread_rwlock_wrlock(&st->shards[i].lock);
+    st->shards[i].capacity = bytes / st->shard_count;
+    pthread_rwlock_unlock(&st->shards[i].lock);
+  }
+  return E_SHM_OK;
+}
+
+int hamster_store_set_budget(struct hamster_store* st, uint64_t soft, uint64_t hard, 
+                             hamster_budget_fn fn, void* ctx) {
+  uint32_t i = 0;
+
+  if (st == NULL || (hard > 0 && soft > hard))
+    return E_SHM_INVALID_PARAMS;
+
+  for (i = 0; i < st->shard_count; ++i) {
+    pthread_rwlock_wrlock(&st->shards[i].lock);
+    if (i == 0) {
+      st->budget_fn = fn;
+      st->budget_ctx = ctx;
+    }
+    st->shards[i].budget_soft = soft / st->shard_count;
+    st->shards[i].budget_hard = hard / st->shard_count;
+    st->shards[i].budget_hit = false;
+    st->shards[i].budget_full = false;
+    pthread_rwlock_unlock(&st->shards[i].lock);
+  }
+  return E_SHM_OK;
+}
+
+int hamster_store_budget(struct hamster_store* st, struct hamster_budget* b) {
+  uint32_t i = 0;
+  struct shard_t* sh = NULL;
+
+  if (st == NULL || b == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  memset(b, 0, sizeof(struct hamster_budget));
+  b->used = store_used(st);
+  for (i = 0; i < st->shard_count; ++i) {
+    sh = &st->shards[i];
+    b->soft += __atomic_load_n(&sh->budget_soft, __ATOMIC_RELAXED);
+    b->hard += __atomic_load_n(&sh->budget_hard, __ATOMIC_RELAXED);
+    b->rejected += __atomic_load_n(&sh->rejected, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&sh->budget_full, __ATOMIC_RELAXED))
+      b->level = HAMSTER_BUDGET_HARD;
+  }
+
+  if (b->level != HAMSTER_BUDGET_HARD && b->soft > 0 && b->used > b->soft)
+    b->level = HAMSTER_BUDGET_SOFT;
+  return E_SHM_OK;
+}
+
+void hamster_store_set_compression(struct hamster_store* st, uint32_t min_size) {
+  if (st != NULL)
+    st->compress_min = min_size;
+}
+
+void hamster_store_set_chunking(struct hamster_store* st, uint32_t min_size) {
+  if (st != NULL)
+    st->chunk_min = min_size;
+}
+
+int hamster_store_set_filter(struct hamster_store* st, uint32_t bits_per_key) {
+  int ec = E_SHM_OK;
+  uint32_t i = 0;
+
+  if (st == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  st->filter_bits = bits_per_key;
+  for (i = 0; i < st->shard_count && ec == E_SHM_OK; ++i) {
+    pthread_rwlock_wrlock(&st->shards[i].lock);
+    ec = shard_filter(&st->shards[i], bits_per_key);
+    pthread_rwlock_unlock(&st->shards[i].lock);
+  }
+  return ec;
+}
+
+int hamster_store_stat(struct hamster_store* st, struct hamster_stat* stat) {
+  uint32_t i = 0;
+  uint64_t head = 0, lsn = 0, acked = 0, acked_lsn = 0;
+  struct shard_t* sh = NULL;
+
+  if (st == NULL || stat == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  memset(stat, 0, sizeof(struct hamster_stat));
+  for (i = 0; i < st->shard_count; ++i) {
+    sh = &st->shards[i];
+    pthread_rwlock_rdlock(&sh->lock);
+    stat->hits        += __atomic_load_n(&sh->hits, __ATOMIC_RELAXED);
+    stat->misses      += __atomic_load_n(&sh->misses, __ATOMIC_RELAXED);
+    stat->evictions   += sh->evictions;
+    stat->expirations += sh->expirations;
+    stat->bytes       += sh->segs.size;
+    stat->capacity    += sh->capacity;
+    stat->quarantined += sh->quarantined;
+    stat->scrubbed    += sh->scrubbed;
+    stat->sealed      += sh->sealed;
+    stat->unsealed    += sh->unsealed_count;
+    stat->index_bytes += shm_pool_bytes(&sh->descs) + index_bytes(sh);
+    stat->filter_skips += __atomic_load_n(&sh->filter_skips, __ATOMIC_RELAXED);
+    stat->filter_false_positives += 
+        __atomic_load_n(&sh->filter_false_positives, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&sh->lock);
+  }
+
+  if (st->replog != NULL) {
+    head = shm_replog_head(st->replog, &lsn);
+    acked = shm_replog_acked(st->replog, &acked_lsn);
+    stat->replog_lag_bytes = head > acked ? head - acked : 0;
+    stat->replog_lag_records = lsn > acked_lsn ? lsn - acked_lsn : 0;
+  }
+
+  if (stat->hits + stat->misses > 0)
+    stat->hit_ratio = (double)stat->hits / (stat->hits + stat->misses);
+  if (stat->filter_skips + stat->filter_false_positives > 0)
+    stat->filter_fp_rate = (double)stat->filter_false_positives / 
+                           (stat->filter_skips + stat->filter_false_positives);
+  return E_SHM_OK;
+}
+
+size_t hamster_store_count(struct hamster_store* st) {
+  size_t count = 0;
+  uint32_t i = 0;
+  struct shard_t* sh = NULL;
+
+  if (st == NULL)
+    return 0;
+
+  // replicas hold the same keys, the one lookups go to is counted
+  if (st->numa_policy == HAMSTER_NUMA_PER_NODE) {
+    sh = &st->shards[shm_numa_node() % st->shard_count];
+    pthread_rwlock_rdlock(&sh->lock);
+    count = index_count(sh);
+    pthread_rwlock_unlock(&sh->lock);
+    return count;
+  }
+
+  for (i = 0; i < st->shard_count; ++i) {
+    pthread_rwlock_rdlock(&st->shards[i].lock);
+    count += index_count(&st->shards[i]);
+    pthread_rwlock_unlock(&st->shards[i].lock);
+  }
+  return count;
+}
+
+uint32_t hamster_store_shard_count(struct hamster_store* st) {
+  return st != NULL ? st->shard_count : 0;
+}
+
+const char* hamster_store_name(struct hamster_store* st) {
+  return st != NULL ? st->name : NULL;
+}
+
+int hamster_store_scrub_start(struct hamster_store* st, uint64_t bytes_per_sec, 
+                              hamster_corrupt_fn fn, void* ctx) {
+  int ec = E_SHM_OK;
+
+  if (st == NULL || bytes_per_sec == 0)
+    return E_SHM_INVALID_PARAMS;
+
+  pthread_mutex_lock(&st->scrub_lock);
+  if (st->scrub_running) {
+    ec = E_SHM_INIT_ONLY_ONCE;
+  } else {
+    st->scrub_rate = bytes_per_sec;
+    st->scrub_fn = fn;
+    st->scrub_ctx = ctx;
+    st->scrub_stop = false;
+    if (0 == pthread_create(&st->scrub_thread, NULL, scrub_main, st))
+      st->scrub_running = true;
+    else
+      ec = E_SHM_SYSTEM;
+  }
+  pthread_mutex_unlock(&st->scrub_lock);
+  return ec;
+}
+
+void hamster_store_scrub_stop(struct hamster_store* st) {
+  bool running = false;
+
+  if (st == NULL)
+    return;
+
+  pthread_mutex_lock(&st->scrub_lock);
+  if ((running = st->scrub_running)) {
+    st->scrub_stop = true;
+    st->scrub_running = false;
+    pthread_cond_signal(&st->scrub_cond);
+  }
+  pthread_mutex_unlock(&st->scrub_lock);
+
+  if (running)
+    pthread_join(st->scrub_thread, NULL);
+}
+
+size_t hamster_store_scrub(struct hamster_store* st, size_t max_bytes, 
+                           hamster_corrupt_fn fn, void* ctx) {
+  size_t n = 0;
+
+  if (st == NULL)
+    return 0;
+
+  pthread_mutex_lock(&st->scrub_lock);
+  n = scrub_step(st, max_bytes, fn, ctx);
+  pthread_mutex_unlock(&st->scrub_lock);
+  return n;
+}
+
+int hamster_store_set_sealing(struct hamster_store* st, uint32_t interval_ms) {
+  int ec = E_SHM_OK;
+
+  if (st == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  seal_join(st);
+  store_combine(st, interval_ms > 0);
+  if (interval_ms == 0)
+    return E_SHM_OK;
+
+  pthread_mutex_lock(&st->seal_lock);
+  st->seal_ms = interval_ms;
+  st->seal_stop = false;
+  if (0 == pthread_create(&st->seal_thread, NULL, seal_main, st))
+    st->seal_running = true;
+  else
+    ec = E_SHM_SYSTEM;
+  pthread_mutex_unlock(&st->seal_lock);
+
+  // nothing would seal the updates
+  if (ec != E_SHM_OK)
+    store_combine(st, false);
+  return ec;
+}
+
+size_t hamster_store_seal(struct hamster_store* st) {
+  size_t n = 0;
+  uint32_t i = 0;
+  struct shard_t* sh = NULL;
+
+  if (st == NULL)
+    return 0;
+
+  for (i = 0; i < st->shard_count; ++i) {
+    sh = &st->shards[i];
+    if (0 == __atomic_load_n(&sh->unsealed_count, __ATOMIC_RELAXED))
+      continue;
+    pthread_rwlock_wrlock(&sh->lock);
+    n += shard_seal(sh);
+    pthread_rwlock_unlock(&sh->lock);
+  }
+  return n;
+}
+
+int hamster_watch_open(const char* name, key_t key, struct hamster_watch** w) {
+  int ec = E_SHM_OK;
+
+  if ((name == NULL && key == 0) || w == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  if (NULL == (*w = (struct hamster_watch*)calloc(1, sizeof(struct hamster_watch))))
+    return E_SHM_SYSTEM;
+
+  // a watcher does not create the ring, the store might never be opened
+  if (E_SHM_OK != (ec = shm_notify_attach(notify_key(store_key(name, key)), false, &(*w)->notify))) {
+    free(*w);
+    *w = NULL;
+  }
+  return ec;
+}
+
+void hamster_watch_close(struct hamster_watch* w) {
+  if (w != NULL) {
+    shm_notify_detach(w->notify, false);
+    free(w);
+  }
+}
+
+uint64_t hamster_watch_seq(struct hamster_watch* w) {
+  return w != NULL ? shm_notify_seq(w->notify) : 0;
+}
+
+int hamster_watch_wait(struct hamster_watch* w, uint64_t seq, uint32_t timeout_ms) {
+  if (w == NULL)
+    return E_SHM_INVALID_PARAMS;
+  return shm_notify_wait(w->notify, seq, timeout_ms);
+}
+
+int hamster_watch_next(struct hamster_watch* w, uint64_t seq, struct hamster_change* c) {
+  int ec = E_SHM_OK;
+  struct shm_change change;
+
+  if (w == NULL || c == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  if (E_SHM_OK == (ec = shm_notify_read(w->notify, seq + 1, &change))) {
+    c->seq = change.seq;
+    c->hash = change.hash;
+    c->key_size = change.key_size;
+    memcpy(c->key, change.key, sizeof(c->key));
+  }
+  return ec;
+}
+
+int hamster_store_snapshot(struct hamster_store* st, const char* path) {
+  uint32_t i = 0, n = 0;
+  uint64_t pos = 0, lsn = 0;
+  char* tmp = NULL;
+  struct snap_ctx ctx;
+
+  if (st == NULL || path == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  if (NULL == (tmp = (char*)malloc(strlen(path) + 5)))
+    return E_SHM_SYSTEM;
+
+  sprintf(tmp, "%s.tmp", path);
+  memset(&ctx, 0, sizeof(ctx));
+  if (NULL == (ctx.f = fopen(tmp, "wb"))) {
+    free(tmp);
+    return E_SHM_SYSTEM;
+  }
+
+  // a write is logged under the lock of its shard, after it is done, so the
+  // writes logged from here on are the ones the snapshot might miss
+  if (st->replog != NULL)
+    pos = shm_replog_head(st->replog, &lsn);
+  ctx.ec = snap_begin(ctx.f, pos, lsn);
+
+  // replicas hold the same keys
+  ctx.now = now_ms();
+  n = st->numa_policy == HAMSTER_NUMA_PER_NODE ? 1 : st->shard_count;
+  for (i = 0; i < n && ctx.ec == E_SHM_OK; ++i) {
+    ctx.sh = &st->shards[i];
+    pthread_rwlock_rdlock(&ctx.sh->lock);
+    index_foreach(ctx.sh, snap_write, &ctx);
+    pthread_rwlock_unlock(&ctx.sh->lock);
+  }
+
+  if (ctx.ec == E_SHM_OK && 
+      (E_SHM_OK != (ctx.ec = snap_end(ctx.f)) || fsync(fileno(ctx.f)) != 0))
+    ctx.ec = E_SHM_SYSTEM;
+  if (fclose(ctx.f) != 0 && ctx.ec == E_SHM_OK)
+    ctx.ec = E_SHM_SYSTEM;
+
+  // a snapshot is replaced as a whole
+  if (ctx.ec == E_SHM_OK && rename(tmp, path) != 0)
+    ctx.ec = E_SHM_SYSTEM;
+  if (ctx.ec != E_SHM_OK)
+    unlink(tmp);
+  free(ctx.buf);
+  free(tmp);
+  return ctx.ec;
+}
+
+int hamster_follow(const char* name, key_t key, struct hamster_store* st, 
+                   struct hamster_follower** f) {
+  int ec = E_SHM_OK;
+
+  if ((name == NULL && key == 0) || st == NULL || f == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  if (NULL == (*f = (struct hamster_follower*)calloc(1, sizeof(struct hamster_follower))))
+    return E_SHM_SYSTEM;
+
+  (*f)->st = st;
+  if (E_SHM_OK != (ec = hamster_batch_new(&(*f)->batch)) ||
+      E_SHM_OK != (ec = shm_replog_attach(replog_key(store_key(name, key)), 0, &(*f)->log))) {
+    hamster_follower_close(*f);
+    *f = NULL;
+  }
+  return ec;
+}
+
+void hamster_follower_close(struct hamster_follower* f) {
+  if (f == NULL)
+    return;
+
+  shm_replog_detach(f->log, false);
+  hamster_batch_free(f->batch);
+  free(f->buf);
+  free(f);
+}
+
+int hamster_follower_poll(struct hamster_follower* f, uint32_t max, uint32_t* applied) {
+  int ec = E_SHM_OK;
+  uint32_t n = 0, size = 0;
+  uint64_t pos = 0, lsn = 0;
+  char* buf = NULL;
+
+  if (f == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  while (max == 0 || n < max) {
+    pos = f->pos;
+    size = f->cap;
+    ec = shm_replog_read(f->log, &pos, f->buf, &size, &lsn);
+    if (ec == E_SHM_VAL_BUFFER_TOO_SMALL) {
+      if (NULL == (buf = (char*)realloc(f->buf, size))) {
+        ec = E_SHM_SYSTEM;
+        break;
+      }
+      f->buf = buf;
+      f->cap = size;
+      continue;
+    }
+
+    // a record which fails to apply is tried again by the next poll
+    if (ec != E_SHM_OK || E_SHM_OK != (ec = repl_apply(f, f->buf, size)))
+      break;
+
+    f->pos = pos;
+    f->lsn = lsn;
+    ++n;
+  }
+
+  if (n > 0)
+    shm_replog_ack(f->log, f->pos, f->lsn);
+  if (applied != NULL)
+    *applied = n;
+  return ec == E_SHM_EMPTY ? E_SHM_OK : ec;
+}
+
+int hamster_follower_wait(struct hamster_follower* f, uint32_t timeout_ms) {
+  if (f == NULL)
+    return E_SHM_INVALID_PARAMS;
+  return shm_replog_wait(f->log, f->pos, timeout_ms);
+}
+
+int hamster_follower_restore(struct hamster_follower* f, const char* path) {
+  int ec = E_SHM_OK;
+  uint64_t pos = 0, lsn = 0;
+  FILE* fp = NULL;
+
+  if (f == NULL || path == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  if (NULL == (fp = fopen(path, "rb")))
+    return E_SHM_SYSTEM;
+
+  if (E_SHM_OK == (ec = snap_load(f->st, fp, &pos, &lsn))) {
+    f->pos = pos;
+    f->lsn = lsn;
+    shm_replog_ack(f->log, pos, lsn);
+  }
+  fclose(fp);
+  return ec;
+}
+
+int hamster_follower_lag(struct hamster_follower* f, struct hamster_lag* lag) {
+  uint64_t head = 0, lsn = 0;
+
+  if (f == NULL || lag == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  head = shm_replog_head(f->log, &lsn);
+  lag->bytes = head > f->pos ? head - f->pos : 0;
+  lag->records = lsn > f->lsn ? lsn - f->lsn : 0;
+  return E_SHM_OK;
+}
+
+void hamster_detach(struct hamster_store* st) {
+  uint32_t i = 0;
+
+  if (st == NULL)
+    return;
+
+  hamster_store_scrub_stop(st);
+  // the next one to open it finds every checksum sealed
+  seal_join(st);
+  hamster_store_seal(st);
+  store_unregister(st);
+  for (i = 0; i < st->shard_count; ++i) {
+    shard_free(&st->shards[i]);
+    shmseg_detach(&st->shards[i].segs);
+  }
+  shm_notify_detach(st->notify, false);
+  shm_replog_detach(st->replog, false);
+  store_free(st);
+}
+
+int hamster_store_load(struct hamster_store* st, int fd) {
+  int ec = E_SHM_OK, dup_fd = -1;
+  uint64_t pos = 0, lsn = 0;
+  FILE* f = NULL;
+
+  if (st == NULL || fd < 0)
+    return E_SHM_INVALID_PARAMS;
+
+  // the caller keeps fd
+  if ((dup_fd = dup(fd)) < 0)
+    return E_SHM_SYSTEM;
+  if (NULL == (f = fdopen(dup_fd, "rb"))) {
+    close(dup_fd);
+    return E_SHM_SYSTEM;
+  }
+
+  ec = snap_load(st, f, &pos, &lsn);
+  fclose(f);
+  return ec;
+}
+
+int hamster_reader_open(const char* name, key_t key, struct hamster_reader** r) {
+  int ec = E_SHM_OK;
+  uint32_t i = 0, n = 0, first = 0;
+
+  if ((name == NULL && key == 0) || r == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  first = store_key(name, key);
+  while (n < SHM_SHARDS_MAX && shmget(first + n * SHM_KEY_RANGE, 0, 0600) >= 0)
+    ++n;
+  if (n == 0)
+    return E_SHM_EMPTY;
+
+  if (NULL == (*r = (struct hamster_reader*)calloc(1, sizeof(struct hamster_reader))) ||
+      NULL == ((*r)->chains = (struct shmseg_chain*)calloc(n, sizeof(struct shmseg_chain)))) {
+    free(*r);
+    return E_SHM_SYSTEM;
+  }
+
+  for (i = 0; i < n; ++i) {
+    if (E_SHM_OK != (ec = shmseg_attach(&(*r)->chains[i], first + i * SHM_KEY_RANGE, 
+                                        SHM_KEY_RANGE - 2))) {
+      (*r)->shard_count = i;
+      hamster_reader_close(*r);
+      return ec;
+    }
+  }
+
+  // the chains of another store whose name picked the same keys
+  if (name != NULL && shmseg_owner(&(*r)->chains[0]) != 0 && 
+      shmseg_owner(&(*r)->chains[0]) != store_owner(name)) {
+    (*r)->shard_count = n;
+    hamster_reader_close(*r);
+    return E_SHM_NAME_MISMATCH;
+  }
+
+  (*r)->shard_count = n;
+  (*r)->shard = (uint32_t)-1;
+  (*r)->at.base.shm_key = -1;
+  (*r)->now = now_ms();
+  return E_SHM_OK;
+}
+
+void hamster_reader_close(struct hamster_reader* r) {
+  uint32_t i = 0;
+
+  if (r == NULL)
+    return;
+
+  for (i = 0; i < r->shard_count; ++i)
+    shmseg_detach(&r->chains[i]);
+  free(r->chains);
+  free(r->buf);
+  free(r->val);
+  free(r);
+}
+
+uint32_t hamster_reader_shards(struct hamster_reader* r) {
+  return r != NULL ? r->shard_count : 0;
+}
+
+int hamster_reader_next(struct hamster_reader* r, struct hamster_record* rec) {
+  int found = READ_END;
+  struct shm_data_header* hdr = NULL;
+
+  if (r == NULL || rec == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  // goes on with the shard of the last record
+  if (r->shard < r->shard_count)
+    found = READ_LIVE;
+
+  for (;;) {
+    if (found == READ_END) {
+      if (r->shard + 1 >= r->shard_count) {
+        r->shard = r->shard_count;
+        return E_SHM_EMPTY;
+      }
+      ++r->shard;
+      r->steps = 0;
+      shmseg_ptr_reset(&r->at);
+      if (E_SHM_OK != shmseg_first_ptr(&r->chains[r->shard], &r->at))
+        r->at.base.shm_key = -1;
+    }
+    // a chunk comes with the record of its key, which is lost with a bad one
+    if (READ_LIVE == (found = reader_step(r, &r->chains[r->shard], &r->at, &r->steps)) &&
+        E_SHM_OK == reader_gather(r, &r->chains[r->shard]))
+      break;
+  }
+
+  hdr = (struct shm_data_header*)r->buf;
+  rec->key = hdr_key(hdr);
+  if (hdr->flags & HDR_F_CHUNKED) {
+    rec->value = r->val;
+    rec->size = rec->max_size = hdr_chunks(hdr)->size;
+  } else {
+    rec->value = hdr_value(hdr);
+    rec->size = hdr_value_size(hdr);
+    rec->max_size = hdr_value_maxsize(hdr);
+  }
+  rec->raw_size = hdr->raw_size;
+  rec->shard = r->shard;
+  rec->expire = hdr->expire;
+  rec->version = hdr->version;
+  return E_SHM_OK;
+}
+
+int hamster_reader_occupancy(struct hamster_reader* r, uint32_t shard, 
+                             struct hamster_occupancy* o) {
+  struct shmseg_chain* c = NULL;
+  struct shmseg_ptr at;
+  struct shmseg_info info;
+  struct shm_data_header* hdr = NULL;
+  uint64_t steps = 0;
+  int found = READ_END;
+
+  if (r == NULL || o == NULL || shard >= r->shard_count)
+    return E_SHM_INVALID_PARAMS;
+
+  c = &r->chains[shard];
+  memset(o, 0, sizeof(*o));
+  for (; E_SHM_OK == shmseg_info(c, o->segments, &info); ++o->segments) {
+    o->bytes += info.size;
+    o->used += info.used;
+  }
+
+  shmseg_ptr_reset(&at);
+  if (E_SHM_OK != shmseg_first_ptr(c, &at))
+    return E_SHM_OK;
+
+  while (READ_END != (found = reader_step(r, c, &at, &steps))) {
+    hdr = (struct shm_data_header*)r->buf;
+    ++o->records;
+    if (found == READ_LIVE) {
+      ++o->live;
+      o->live_bytes += hdr->total_size;
+      o->value_bytes += hdr_value_size(hdr);
+    } else if (found == READ_FREE) {
+      ++o->free;
+      o->free_bytes += hdr->total_size;
+    } else {
+      ++o->bad;
+    }
+  }
+  return E_SHM_OK;
+}
+
+int hamster_reader_segment(struct hamster_reader* r, uint32_t shard, uint32_t i, 
+                           struct hamster_segment* seg) {
+  int ec = E_SHM_OK;
+  struct shmseg_info info;
+
+  if (r == NULL || seg == NULL || shard >= r->shard_count)
+    return E_SHM_INVALID_PARAMS;
+
+  if (E_SHM_OK != (ec = shmseg_info(&r->chains[shard], i, &info)))
+    return ec;
+
+  seg->shm_key = info.shm_key;
+  seg->size = info.size;
+  seg->used = info.used;
+  seg->committed = info.committed;
+  return E_SHM_OK;
+}
+
+int hamster_reader_dump(struct hamster_reader* r, int fd) {
+  int ec = E_SHM_OK, dup_fd = -1;
+  FILE* f = NULL;
+  struct hamster_record rec;
+
+  if (r == NULL || fd < 0)
+    return E_SHM_INVALID_PARAMS;
+
+  if ((dup_fd = dup(fd)) < 0)
+    return E_SHM_SYSTEM;
+  if (NULL == (f = fdopen(dup_fd, "wb"))) {
+    close(dup_fd);
+    return E_SHM_SYSTEM;
+  }
+
+  // in the format of a snapshot, with no log position
+  ec = snap_begin(f, 0, 0);
+  while (ec == E_SHM_OK && E_SHM_OK == (ec = hamster_reader_next(r, &rec)))
+    ec = snap_put(f, rec.key, rec.value, rec.size, rec.max_size, rec.raw_size, rec.expire);
+  if (ec == E_SHM_EMPTY)
+    ec = snap_end(f);
+  if (fclose(f) != 0 && ec == E_SHM_OK)
+    ec = E_SHM_SYSTEM;
+  return ec;
+}
+
+/* FNV-1a */
+shm_internal uint32_t key_hash(const char* key) {
+  uint32_t h = 2166136261u;
+  for (; *key; ++key)
+    h = (h ^ (uint8_t)*key) * 16777619u;
+  return h;
+}
+
+/* FNV-1a, 64 bits for the filter, which splits it in two */
+shm_internal uint64_t key_hash64(const char* key) {
+  uint64_t h = 14695981039346656037ull;
+  for (; *key; ++key)
+    h = (h ^ (uint8_t)*key) * 1099511628211ull;
+  return h;
+}
+
+/* a slot of SHM_SHARDS_MAX key ranges picked by name, never IPC_PRIVATE */
+shm_internal uint32_t store_key(const char* name, key_t key) {
+  uint32_t k = 0;
+
+  if (key != 0)
+    return (uint32_t)key;
+
+  k = key_hash(name) & ~(uint32_t)(SHM_SHARDS_MAX * SHM_KEY_RANGE - 1);
+  return k != 0 ? k : SHM_SHARDS_MAX * SHM_KEY_RANGE;
+}
+
+/*
+ * the chains of a store are tagged with the full hash of its name, few names
+ * pick a slot of keys each and two of them might pick the same one
+ */
+shm_internal uint64_t store_owner(const char* name) {
+  uint64_t h = key_hash64(name);
+  return h != 0 ? h : 1;
+}
+
+shm_internal struct shard_t* shard_of(struct hamster_store* st, const char* key) {
+  return st->shard_count == 1
+      ? st->shards
+      : &st->shards[key_hash(key) % st->shard_count];
+}
+
+/* the shard to read key from, the replica of the local node if per node */
+shm_internal struct shard_t* shard_read(struct hamster_store* st, const char* key) {
+  return st->numa_policy == HAMSTER_NUMA_PER_NODE
+      ? &st->shards[shm_numa_node() % st->shard_count]
+      : shard_of(st, key);
+}
+
+/*
+ * replicas are write locked together, always in the same order, so they
+ * apply the writes of concurrent callers in the same order
+ */
+shm_internal void replica_lock(struct hamster_store* st) {
+  uint32_t i = 0;
+
+  for (i = 0; i < st->shard_count; ++i)
+    pthread_rwlock_wrlock(&st->shards[i].lock);
+}
+
+shm_internal void replica_unlock(struct hamster_store* st) {
+  uint32_t i = 0;
+
+  for (i = st->shard_count; i > 0; --i)
+    pthread_rwlock_unlock(&st->shards[i - 1].lock);
+}
+
+/*
+ * take on every replica what a write of a value of size bytes of key can
+ * run out of, before any is written, so it goes to all of them or none. a
+ * replica which can not take it in place needs records of total bytes
+ * together, E_SHM_BUDGET_EXCEEDED is returned if they grow it beyond its
+ * hard budget. the replicas are locked
+ */
+shm_internal int replica_reserve(struct hamster_store* st, const char* key, uint32_t size, uint64_t total,
+                                 uint32_t records, uint64_t expire) {
+  int ec = E_SHM_OK;
+  uint32_t i = 0;
+  size_t grow = 0;
+  bool in_place = false;
+  struct shard_t* sh = NULL;
+  struct data_t stub, *target = NULL;
+
+  for (i = 0; i < st->shard_count && ec == E_SHM_OK; ++i) {
+    sh = &st->shards[i];
+    stub.key = key;
+    target = &stub;
+    in_place = false;
+    if (E_SHM_OK == index_query(sh, (void**)&target)) {
+      if (data_hdr(sh, target)->flags & HDR_F_QUARANTINE)
+        return E_SHM_DATA_CORRUPTED;
+      in_place = !(data_hdr(sh, target)->flags & HDR_F_CHUNKED) && size <= target->value.max_size;
+    }
+
+    if (!in_place && sh->budget_hard > 0 &&
+        (total > UINT32_MAX / 2 ||
+         ((grow = shmseg_grow_size(&sh->segs, (uint32_t)total)) > 0 &&
+          sh->segs.size + grow > sh->budget_hard))) {
+      __atomic_store_n(&sh->rejected, sh->rejected + 1, __ATOMIC_RELAXED);
+      return E_SHM_BUDGET_EXCEEDED;
+    }
+    ec = shard_reserve(sh, in_place ? 0 : records, total, expire);
+  }
+  return ec;
+}
+
+/*
+ * take what a write of records new records of total bytes together needs,
+ * and the timer of an expire, so none of it can fail once the write starts.
+ * call with the write lock of sh held
+ */
+shm_internal int shard_reserve(struct shard_t* sh, uint32_t records, uint64_t total, uint64_t expire) {
+  int ec = E_SHM_OK;
+
+  // every record is rounded up on its own
+  total += (uint64_t)records * 16;
+  if (records > 0 &&
+      (E_SHM_OK != (ec = shm_pool_reserve(&sh->descs, records)) ||
+       E_SHM_OK != (ec = index_reserve(sh)) ||
+       (total <= UINT32_MAX / 2 && E_SHM_OK != (ec = shmseg_room(&sh->segs, (uint32_t)total)))))
+    return ec;
+
+  if (sh->combine && E_SHM_OK != (ec = data_defer_room(sh, sh->descs.top + records)))
+    return ec;
+
+  if (expire != 0 && sh->timer_spare == NULL &&
+      NULL == (sh->timer_spare = (struct timer_node*)calloc(1, sizeof(struct timer_node))))
+    return E_SHM_SYSTEM;
+  return E_SHM_OK;
+}
+
+/*
+ * write key, if version is not NULL, only if the version of key is still
+ * *version (0 for a missing or expired key), and *version is set to the
+ * version of key after the call
+ */
+shm_internal int shard_set(struct shard_t* sh, const char* key, struct h_value_t* val, 
+                           uint32_t raw_size, uint64_t expire, uint64_t* version) {
+  int ec = E_SHM_OK;
+
+  pthread_rwlock_wrlock(&sh->lock);
+  ec = shard_put(sh, key, val, raw_size, expire, version);
+  pthread_rwlock_unlock(&sh->lock);
+  return ec;
+}
+
+/* shard_set with the write lock of sh held */
+shm_internal int shard_put(struct shard_t* sh, const char* key, struct h_value_t* val, 
+                           uint32_t raw_size, uint64_t expire, uint64_t* version) {
+  int ec = E_SHM_OK;
+  uint64_t current = 0;
+  struct data_t stub, *target = &stub;
+
+  stub.key = key;
+  if (E_SHM_OK == (ec = index_query(sh, (void**)&target))) {
+    if (target->timer == NULL || !data_expired(sh, target, now_ms()))
+      current = data_hdr(sh, target)->version;
+    // a quarantined record whose key was too damaged to unindex it
+    if (data_hdr(sh, target)->flags & HDR_F_QUARANTINE)
+      ec = E_SHM_DATA_CORRUPTED;
+    else if (version != NULL && *version != current)
+      ec = E_SHM_VERSION_MISMATCH;
+    else if ((data_hdr(sh, target)->flags & HDR_F_CHUNKED) || data_outgrown(sh, target, val))
+      ec = data_replace(sh, target, key, val, raw_size, expire, 0, 0);
+    else
+      ec = data_update(sh, target, val, raw_size, expire);
+  } else if (E_SHM_KEY_NOT_FOUND == ec) {
+    if (version != NULL && *version != current)
+      ec = E_SHM_VERSION_MISMATCH;
+    else
+      ec = data_new(sh, key, val, raw_size, expire, 0, 0);
+  }
+
+  // logged under the lock, so the log has the writes of a key in order
+  if (ec == E_SHM_OK && sh->replog != NULL)
+    repl_log(sh->replog, key, val, raw_size, expire);
+
+  // the write took the last version of the clock
+  if (version != NULL)
+    *version = ec == E_SHM_OK ? sh->clock : current;
+  return ec;
+}
+
+/*
+ * shard_set of a chunked value, from the buffers of iov. the chunk table and
+ * the parts of the record of the log are taken before the lock, see
+ * batch_scratch
+ */
+shm_internal int shard_setv(struct shard_t* sh, const char* key, const struct iovec* iov, int iovcnt, 
+                            uint32_t size, uint64_t expire, uint64_t* version) {
+  int ec = E_SHM_OK;
+  struct chunk_table* table = NULL;
+  struct iovec* parts = NULL;
+
+  if (NULL == (table = chunk_table_new(key, size)) ||
+      (sh->replog != NULL && 
+       NULL == (parts = (struct iovec*)malloc((iovcnt + 2) * sizeof(struct iovec))))) {
+    free(table);
+    return E_SHM_SYSTEM;
+  }
+
+  pthread_rwlock_wrlock(&sh->lock);
+  ec = shard_putv(sh, key, iov, iovcnt, size, expire, version, table, parts);
+  pthread_rwlock_unlock(&sh->lock);
+  free(parts);
+  free(table);
+  return ec;
+}
+
+/*
+ * shard_setv with the write lock of sh held, table is of chunk_table_new,
+ * parts is NULL if sh is not logged
+ */
+shm_internal int shard_putv(struct shard_t* sh, const char* key, const struct iovec* iov, int iovcnt, 
+                            uint32_t size, uint64_t expire, uint64_t* version, 
+                            struct chunk_table* table, struct iovec* parts) {
+  int ec = E_SHM_OK;
+  uint64_t current = 0;
+  struct iov_cursor cur;
+  struct data_t stub, *target = &stub;
+
+  stub.key = key;
+  if (E_SHM_OK == (ec = index_query(sh, (void**)&target))) {
+    if (target->timer == NULL || !data_expired(sh, target, now_ms()))
+      current = data_hdr(sh, target)->version;
+    if (data_hdr(sh, target)->flags & HDR_F_QUARANTINE)
+      ec = E_SHM_DATA_CORRUPTED;
+  } else if (E_SHM_KEY_NOT_FOUND == ec) {
+    ec = E_SHM_OK;
+  }
+
+  if (ec == E_SHM_OK && version != NULL && *version != current)
+    ec = E_SHM_VERSION_MISMATCH;
+  if (ec == E_SHM_OK) {
+    iov_init(&cur, iov, iovcnt);
+    ec = data_new_chunked(sh, key, &cur, table, expire);
+  }
+
+  if (ec == E_SHM_OK && sh->replog != NULL)
+    repl_logv(sh->replog, key, iov, iovcnt, size, expire, parts);
+
+  if (version != NULL)
+    *version = ec == E_SHM_OK ? sh->clock : current;
+  return ec;
+}
+
+/*
+ * an aligned counter is added to under the read lock, so increments of
+ * different keys, or even the same key, never wait for each other. a new
+ * counter, or one stored unaligned by hamster_set, takes the write lock, and
+ * so does every add to a logged shard, for the log to get the sums in order
+ */
+shm_internal int shard_add(struct shard_t* sh, const char* key, int64_t delta, int64_t* value) {
+  int ec = E_SHM_KEY_NOT_FOUND;
+  struct data_t* target = NULL;
+
+  if (sh->replog != NULL)
+    goto locked;
+
+  pthread_rwlock_rdlock(&sh->lock);
+  if (E_SHM_OK == (ec = data_lookup(sh, key, &target))) {
+    if (!counter_of(target, data_hdr(sh, target)))
+      ec = E_SHM_VAL_NOT_COUNTER;
+    else if (counter_aligned(target))
+      *value = counter_add(sh, target, delta);
+    else
+      ec = E_SHM_KEY_NOT_FOUND;
+  }
+  pthread_rwlock_unlock(&sh->lock);
+
+  if (ec != E_SHM_KEY_NOT_FOUND)
+    return ec;
+
+locked:
+  pthread_rwlock_wrlock(&sh->lock);
+  ec = shard_put_sum(sh, key, delta, value);
+  pthread_rwlock_unlock(&sh->lock);
+  return ec;
+}
+
+/* the write locked part of shard_add, the sum is set to *value */
+shm_internal int shard_put_sum(struct shard_t* sh, const char* key, int64_t delta, int64_t* value) {
+  int ec = E_SHM_OK;
+  int64_t n = 0;
+  uint64_t expire = 0;
+  struct h_value_t val = { &n, sizeof(n), sizeof(n) };
+  struct data_t stub, *target = &stub;
+  struct shm_data_header* hdr = NULL;
+
+  stub.key = key;
+  if (E_SHM_OK == (ec = index_query(sh, (void**)&target))) {
+    hdr = data_hdr(sh, target);
+    n = delta;
+    if (hdr->flags & HDR_F_QUARANTINE) {
+      ec = E_SHM_DATA_CORRUPTED;
+    } else if (target->timer != NULL && data_expired(sh, target, now_ms())) {
+      // an expired key counts from 0 again, and does not expire any more
+      ec = hdr->flags & HDR_F_CHUNKED
+          ? data_replace(sh, target, key, &val, 0, 0, counter_pad(key), 0)
+          : data_update(sh, target, &val, 0, 0);
+    } else if (!counter_of(target, hdr)) {
+      ec = E_SHM_VAL_NOT_COUNTER;
+    } else if (counter_aligned(target)) {
+      expire = hdr->expire;
+      n = counter_add(sh, target, delta);
+    } else {
+      expire = hdr->expire;
+      memcpy(&n, target->value.ptr, sizeof(n));
+      n += delta;
+      ec = data_update(sh, target, &val, 0, expire);
+    }
+  } else if (E_SHM_KEY_NOT_FOUND == ec) {
+    n = delta;
+    ec = data_new(sh, key, &val, 0, 0, counter_pad(key), 0);
+  }
+
+  // the sum is logged, not the delta
+  if (ec == E_SHM_OK && sh->replog != NULL) {
+    val.size = val.max_size = sizeof(n);
+    repl_log(sh->replog, key, &val, 0, expire);
+  }
+
+  if (ec == E_SHM_OK)
+    *value = n;
+  return ec;
+}
+
+/*
+ * keys are routed by hash % shards, so a store must always be reopened with
+ * the shard count it was created with: either none of the shard chains
+ * exists yet, or exactly the first `shards` of them do. the range after the
+ * last possible shard belongs to whatever store comes next
+ */
+shm_internal int shard_probe(uint32_t key, uint32_t shards) {
+  uint32_t i = 0, exist = 0;
+
+  for (i = 0; i <= shards && i < SHM_SHARDS_MAX; ++i) {
+    if (shmget(key + i * SHM_KEY_RANGE, 0, 0600) >= 0)
+      exist = i < shards ? exist + 1 : shards + 1;
+  }
+
+  return exist == 0 || exist == shards ? E_SHM_OK : E_SHM_SHARDS_MISMATCH;
+}
+
+/*
+ * key ranges of open stores must not overlap, otherwise two stores would
+ * share segment chains
+ */
+shm_internal int store_register(struct hamster_store* st) {
+  int ec = E_SHM_OK;
+  uint32_t span = st->shard_count * SHM_KEY_RANGE;
+  struct hamster_store* it = NULL;
+
+  pthread_mutex_lock(&g_stores_lock);
+  for (it = g_stores; it != NULL; it = it->next) {
+    if (st->key - it->key < it->shard_count * SHM_KEY_RANGE ||
+        it->key - st->key < span) {
+      ec = E_SHM_INIT_ONLY_ONCE;
+      break;
+    }
+  }
+
+  if (ec == E_SHM_OK) {
+    st->next = g_stores;
+    g_stores = st;
+  }
+  pthread_mutex_unlock(&g_stores_lock);
+  return ec;
+}
+
+shm_internal void store_unregister(struct hamster_store* st) {
+  struct hamster_store** pp = NULL;
+
+  pthread_mutex_lock(&g_stores_lock);
+  for (pp = &g_stores; *pp != NULL; pp = &(*pp)->next) {
+    if (*pp == st) {
+      *pp = st->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&g_stores_lock);
+}
+
+/*
+ * compress val outside of the lock, and write it
+ */
+shm_internal int store_set(struct hamster_store* st, const char* key, struct h_value_t* val, 
+                           uint64_t expire, uint64_t* version) {
+  int ec = E_SHM_OK;
+  uint32_t raw_size = 0;
+  char* buf = NULL;
+  struct h_value_t stored;
+
+  stored = *val;
+  if (st->compress_min > 0 && val->size >= st->compress_min && val->size <= val->max_size &&
+      !store_chunked(st, key, val->size))
+    buf = data_compress(val, &stored, &raw_size);
+
+  ec = store_put(st, key, &stored, raw_size, expire, version);
+
+  // max_size of a new raw value is rounded up
+  if (ec == E_SHM_OK && raw_size == 0)
+    val->max_size = stored.max_size;
+  free(buf);
+  return ec;
+}
+
+/*
+ * write a value as stored, compressed if raw_size is not 0, to its shard or
+ * to every replica. only the first replica checks the version, the others
+ * follow it. a raw value of the chunking size goes into chunks. what the
+ * write takes is reserved on every replica first, see replica_reserve, so
+ * only a broken chain fails a replica after the first, which returns
+ * E_SHM_REPLICA_PARTIAL
+ */
+shm_internal int store_put(struct hamster_store* st, const char* key, struct h_value_t* stored, 
+                           uint32_t raw_size, uint64_t expire, uint64_t* version) {
+  int ec = E_SHM_OK;
+  uint32_t i = 0;
+  struct iovec iov;
+
+  if (raw_size == 0 && stored->size <= stored->max_size && 
+      store_chunked(st, key, stored->size)) {
+    iov.iov_base = stored->ptr;
+    iov.iov_len = stored->size;
+    return store_putv(st, key, &iov, 1, stored->size, expire, version);
+  }
+
+  if (st->numa_policy != HAMSTER_NUMA_PER_NODE) {
+    ec = shard_set(shard_of(st, key), key, stored, raw_size, expire, version);
+    store_budget_hook(st, shard_of(st, key));
+  } else {
+    // every node keeps a replica
+    replica_lock(st);
+    ec = replica_reserve(st, key, stored->size, 
+                         (uint64_t)hdr_size + strlen(key) + 1 + stored->max_size, 1, expire);
+    for (i = 0; i < st->shard_count && ec == E_SHM_OK; ++i)
+      ec = shard_put(&st->shards[i], key, stored, raw_size, expire, i == 0 ? version : NULL);
+    replica_unlock(st);
+    if (ec != E_SHM_OK && i > 1)
+      ec = E_SHM_REPLICA_PARTIAL;
+    for (i = 0; i < st->shard_count; ++i)
+      store_budget_hook(st, &st->shards[i]);
+  }
+
+  if (ec == E_SHM_OK)
+    shm_notify_publish(st->notify, key, key_hash(key));
+  return ec;
+}
+
+/* store_put of a chunked value, from the buffers of iov */
+shm_internal int store_putv(struct hamster_store* st, const char* key, const struct iovec* iov, 
+                            int iovcnt, uint32_t size, uint64_t expire, uint64_t* version) {
+  int ec = E_SHM_OK;
+  uint32_t i = 0;
+  struct chunk_table* table = NULL;
+  struct iovec* parts = NULL;
+
+  if (st->numa_policy != HAMSTER_NUMA_PER_NODE) {
+    ec = shard_setv(shard_of(st, key), key, iov, iovcnt, size, expire, version);
+    store_budget_hook(st, shard_of(st, key));
+  } else {
+    // one table for every replica, the first one logs it
+    if (NULL == (table = chunk_table_new(key, size)) ||
+        (st->shards[0].replog != NULL && 
+         NULL == (parts = (struct iovec*)malloc((iovcnt + 2) * sizeof(struct iovec))))) {
+      free(table);
+      return E_SHM_SYSTEM;
+    }
+
+    // chunks always take new records
+    replica_lock(st);
+    ec = replica_reserve(st, key, UINT32_MAX, (uint64_t)table->count * SHM_CHUNK_SIZE + hdr_size + 
+                         strlen(key) + 1 + counter_pad(key) + chunk_table_size(table->count),
+                         table->count + 1, expire);
+    for (i = 0; i < st->shard_count && ec == E_SHM_OK; ++i)
+      ec = shard_putv(&st->shards[i], key, iov, iovcnt, size, expire, i == 0 ? version : NULL, 
+                      table, st->shards[i].replog != NULL ? parts : NULL);
+    replica_unlock(st);
+    free(parts);
+    free(table);
+    if (ec != E_SHM_OK && i > 1)
+      ec = E_SHM_REPLICA_PARTIAL;
+    for (i = 0; i < st->shard_count; ++i)
+      store_budget_hook(st, &st->shards[i]);
+  }
+
+  if (ec == E_SHM_OK)
+    shm_notify_publish(st->notify, key, key_hash(key));
+  return ec;
+}
+
+/* a value of size bytes of key is stored in chunks, see hamster_set_chunking */
+shm_internal bool store_chunked(struct hamster_store* st, const char* key, uint32_t size) {
+  return st->chunk_min > 0 && size >= st->chunk_min && chunk_room(strlen(key) + 1) > 0;
+}
+
+/*
+ * call the budget hook of st if a write grew sh beyond its soft budget,
+ * with no lock held
+ */
+shm_internal void store_budget_hook(struct hamster_store* st, struct shard_t* sh) {
+  hamster_budget_fn fn = st->budget_fn;
+
+  if (__atomic_exchange_n(&sh->budget_hit, false, __ATOMIC_RELAXED) && fn != NULL)
+    fn(st, store_used(st), st->budget_ctx);
+}
+
+/* bytes of the segments of st, as the writers last left them */
+shm_internal uint64_t store_used(struct hamster_store* st) {
+  uint64_t used = 0;
+  uint32_t i = 0;
+
+  for (i = 0; i < st->shard_count; ++i)
+    used += __atomic_load_n(&st->shards[i].segs.size, __ATOMIC_RELAXED);
+  return used;
+}
+
+/*
+ * stage a write of key. a value loaded or applied as stored elsewhere comes
+ * with its deadline, which takes the place of ttl_ms if not 0, and might be
+ * compressed already
+ */
+shm_internal int batch_add(struct hamster_batch* b, const char* key, struct h_value_t* val, 
+                           uint32_t ttl_ms, uint64_t expire, uint32_t raw_size) {
+  size_t key_size = 0, need = 0, cap = 0;
+  uint32_t ops_cap = 0;
+  char* buf = NULL;
+  struct batch_op* ops = NULL;
+  struct batch_op* op = NULL;
+
+  if (b == NULL || key == NULL || val == NULL)
+    return E_SHM_INVALID_PARAMS;
+
+  if ((key_size = strlen(key) + 1) == 1)
+    return E_SHM_KEY_ZERO_LENGTH;
+
+  if (val->max_size < val->size)
+    return E_SHM_VAL_SIZE_INVALID;
+
+  if ((need = b->size + key_size + val->size) > b->cap) {
+    for (cap = b->cap > 0 ? b->cap : 256; cap < need; cap *= 2)
+      ;
+    if (NULL == (buf = (char*)realloc(b->buf, cap)))
+      return E_SHM_SYSTEM;
+    b->buf = buf;
+    b->cap = cap;
+  }
+
+  if (b->count == b->ops_cap) {
+    ops_cap = b->ops_cap > 0 ? b->ops_cap * 2 : 16;
+    if (NULL == (ops = (struct batch_op*)realloc(b->ops, ops_cap * sizeof(struct batch_op))))
+      return E_SHM_SYSTEM;
+    b->ops = ops;
+    b->ops_cap = ops_cap;
+  }
+
+  op = &b->ops[b->count++];
+  op->key_off = b->size;
+  op->val_off = b->size + key_size;
+  op->key_size = (uint32_t)key_size;
+  op->val_size = val->size;
+  op->max_size = val->max_size;
+  op->ttl_ms = ttl_ms;
+  op->raw_size = raw_size;
+  op->expire = expire;
+  memcpy(b->buf + op->key_off, key, key_size);
+  memcpy(b->buf + op->val_off, val->ptr, val->size);
+  b->size = need;
+  return E_SHM_OK;
+}
+
+#define batch_of(shard_of_op, op, i) ((shard_of_op)[op] == (i) || (shard_of_op)[op] == UINT32_MAX)
+#define batch_expire(op, now) \
+  ((op)->expire != 0 ? (op)->expire : (op)->ttl_ms > 0 ? (now) + (op)->ttl_ms : 0)
+#define batch_total(op) \
+  ((((uint64_t)hdr_size + (op)->key_size + (op)->max_size + 15) >> 4) << 4)
+
+/*
+ * note the shard of each op of b in shard_of_op, and return the set of
+ * shards the batch writes. replicas take every op, UINT32_MAX stands for any
+ * shard then
+ */
+shm_internal uint64_t batch_route(struct hamster_store* st, struct hamster_batch* b, uint32_t* shard_of_op) {
+  uint32_t op = 0;
+  uint64_t shards = 0;
+  bool per_node = st->numa_policy == HAMSTER_NUMA_PER_NODE;
+
+  for (op = 0; op < b->count; ++op) {
+    shard_of_op[op] = per_node 
+        ? UINT32_MAX 
+        : (uint32_t)(shard_of(st, b->buf + b->ops[op].key_off) - st->shards);
+    shards |= per_node ? ~(uint64_t)0 : (uint64_t)1 << shard_of_op[op];
+  }
+  return shards;
+}
+
+/*
+ * check the ops of every shard of shards, then reserve and write them, see
+ * batch_reserve. a shard which fails gives back what the others reserved,
+ * and rs is left empty. call with the write locks of shards held
+ */
+shm_internal int batch_prepare(struct hamster_store* st, struct hamster_batch* b, const uint32_t* shard_of_op, 
+                               uint64_t shards, uint64_t now, struct batch_resv* rs) {
+  int ec = E_SHM_OK;
+  uint32_t i = 0;
+
+  for (i = 0; i < st->shard_count && ec == E_SHM_OK; ++i) {
+    if (shards & ((uint64_t)1 << i))
+      ec = batch_check(&st->shards[i], b, shard_of_op, i);
+  }
+  for (i = 0; i < st->shard_count && ec == E_SHM_OK; ++i) {
+    if (shards & ((uint64_t)1 << i))
+      ec = batch_reserve(&st->shards[i], b, shard_of_op, i, now, &rs[i]);
+  }
+
+  if (ec != E_SHM_OK) {
+    for (i = 0; i < st->shard_count; ++i) {
+      if (rs[i].ds != NULL)
+        batch_cancel(&st->shards[i], &rs[i]);
+    }
+  }
+  return ec;
+}
+
+/*
+ * the ops of shard i must fit in a segment and in the capacity of sh, and
+ * must not replace a quarantined record
+ */
+shm_internal int batch_check(struct shard_t* sh, struct hamster_batch* b, const uint32_t* shard_of_op, 
+                             uint32_t i) {
+  uint32_t op = 0;
+  uint64_t total = 0;
+  size_t grow = 0;
+  struct data_t stub, *target = NULL;
+
+  for (op = 0; op < b->count; ++op) {
+    if (!batch_of(shard_of_op, op, i))
+      continue;
+
+    total += batch_total(&b->ops[op]);
+    stub.key = b->buf + b->ops[op].key_off;
+    target = &stub;
+    if (E_SHM_OK == index_query(sh, (void**)&target) &&
+        (data_hdr(sh, target)->flags & HDR_F_QUARANTINE))
+      return E_SHM_DATA_CORRUPTED;
+  }
+
+  // room for the anchor of an empty chain too
+  total += ((hdr_size + 15) >> 4) << 4;
+  if (total > UINT32_MAX / 2)
+    return E_SHM_VAL_SIZE_INVALID;
+
+  if (sh->capacity > 0 && 
+      (grow = shmseg_grow_size(&sh->segs, (uint32_t)total)) > 0 &&
+      sh->segs.size + grow > sh->capacity)
+    return E_SHM_CAPACITY_EXCEEDED;
+  return data_budget(sh, total);
+}
+
+/*
+ * the ops of shard i are written to one reservation, in order, each record
+ * linked to the next, but not yet linked to the chain. neither readers nor
+ * recovery can reach any of them, and the chain lock of sh is held until
+ * batch_link or batch_cancel. on failure nothing is left reserved
+ */
+shm_internal int batch_reserve(struct shard_t* sh, struct hamster_batch* b, const uint32_t* shard_of_op, 
+                               uint32_t i, uint64_t now, struct batch_resv* r) {
+  int ec = E_SHM_OK;
+  uint32_t op = 0, n = 0, total = 0, k = 0;
+  struct shmseg_ptr sptr = { { -1, 0 }, NULL };
+  struct data_t* d = NULL;
+  struct shm_data_header* hdr = NULL;
+  struct h_value_t val;
+  struct batch_op* o = NULL;
+  char* base_ptr = NULL;
+
+  memset(r, 0, sizeof(struct batch_resv));
+  for (op = 0; op < b->count; ++op) {
+    if (batch_of(shard_of_op, op, i)) {
+      total += (uint32_t)batch_total(&b->ops[op]);
+      ++n;
+    }
+  }
+
+  if (sh->tail == NULL && E_SHM_OK != (ec = batch_anchor(sh)))
+    return ec;
+
+  // descriptors and timers are taken first, nothing fails once linked
+  if (NULL == (r->ds = (struct data_t**)calloc(n, sizeof(struct data_t*))) ||
+      NULL == (r->timers = (struct timer_node**)calloc(n, sizeof(struct timer_node*)))) {
+    free(r->ds);
+    r->ds = NULL;
+    return E_SHM_SYSTEM;
+  }
+  r->n = n;
+
+  for (op = 0, k = 0; op < b->count; ++op) {
+    if (!batch_of(shard_of_op, op, i))
+      continue;
+    if (NULL == (r->ds[k] = data_alloc(sh)) ||
+        E_SHM_OK != data_timer(sh, batch_expire(&b->ops[op], now), &r->timers[k])) {
+      ec = E_SHM_SYSTEM;
+      goto out;
+    }
+    ++k;
+  }
+
+  if (E_SHM_OK != (ec = data_lock(sh)))
+    goto out;
+
+  if (E_SHM_OK != (ec = shmseg_get(&sh->segs, &total, &sptr))) {
+    shmseg_unlock(&sh->segs);
+    goto out;
+  }
+
+  if (NULL == (base_ptr = (char*)shmseg_ptr_ptr(&sh->segs, &sptr))) {
+    shmseg_unget(&sh->segs);
+    shmseg_unlock(&sh->segs);
+    ec = E_SHM_PTR_INVALID;
+    goto out;
+  }
+
+  for (op = 0, k = 0; op < b->count; ++op) {
+    if (!batch_of(shard_of_op, op, i))
+      continue;
+
+    o = &b->ops[op];
+    d = r->ds[k];
+    d->base_sptr = sptr;
+    d->base_sptr.cache_ptr = base_ptr;
+    hdr = (struct shm_data_header*)base_ptr;
+    hdr->flags = o->raw_size != 0 ? HDR_F_PACKED : 0;
+    hdr->next.shm_key = -1;
+    hdr->next.off = 0;
+    hdr->total_size = (uint32_t)batch_total(o);
+
+    val.ptr = b->buf + o->val_off;
+    val.size = o->val_size;
+    val.max_size = o->max_size;
+    data_fill(sh, d, b->buf + o->key_off, o->key_size, &val, o->raw_size, batch_expire(o, now), 0);
+
+    sptr.base.off += hdr->total_size;
+    base_ptr += hdr->total_size;
+    if (++k < n)
+      hdr->next = sptr.base;
+  }
+  return E_SHM_OK;
+
+out:
+  batch_release(sh, r);
+  return ec;
+}
+
+/*
+ * link the records batch_reserve wrote for sh to the chain, with a single
+ * store which makes all of them reachable at once, and release the chain
+ * lock. r is kept for batch_index
+ */
+shm_internal int batch_link(struct shard_t* sh, struct batch_resv* r) {
+  int ec = E_SHM_OK;
+
+  data_link(sh, r->ds[0]);
+  sh->tail = r->ds[r->n - 1];
+  ec = data_commit(sh, r->ds[r->n - 1]);
+  shmseg_unlock(&sh->segs);
+  return ec;
+}
+
+/*
+ * index the records batch_link linked for sh, and drop the records they
+ * replace. a crash before leaves two records of a key, and recovery keeps
+ * the later version, see data_supersede
+ */
+shm_internal int batch_index(struct shard_t* sh, struct batch_resv* r) {
+  int ec = E_SHM_OK;
+  uint32_t k = 0;
+  struct data_t* d = NULL;
+
+  for (k = 0; k < r->n; ++k) {
+    d = r->ds[k];
+    if (E_SHM_OK != (ec = data_supersede(sh, d)))
+      break;
+    r->ds[k] = NULL;
+    data_filter_add(sh, d);
+    data_arm(sh, d, data_hdr(sh, d)->expire, r->timers[k]);
+    r->timers[k] = NULL;
+  }
+
+  // a record which could not be indexed is lost, its space is reused
+  for (; k < r->n; ++k) {
+    if (r->ds[k] != NULL) {
+      data_hdr(sh, r->ds[k])->flags |= HDR_F_FREE;
+      data_free_push(sh, r->ds[k]);
+      r->ds[k] = NULL;
+    }
+  }
+  batch_release(sh, r);
+  return ec;
+}
+
+/* give back what batch_reserve took for sh, before batch_link */
+shm_internal void batch_cancel(struct shard_t* sh, struct batch_resv* r) {
+  shmseg_unget(&sh->segs);
+  shmseg_unlock(&sh->segs);
+  batch_release(sh, r);
+}
+
+/* free the descriptors and timers left in r */
+shm_internal void batch_release(struct shard_t* sh, struct batch_resv* r) {
+  uint32_t k = 0;
+
+  for (k = 0; k < r->n; ++k) {
+    free(r->timers[k]);
+    if (r->ds[k] != NULL)
+      shm_pool_free(&sh->descs, data_handle(sh, r->ds[k]));
+  }
+  free(r->timers);
+  free(r->ds);
+  memset(r, 0, sizeof(struct batch_resv));
+}
+
+/*
+ * log the ops of a batch as one record, so a follower applies them as a
+ * batch too. scratch has room for batch_scratch(b), it is taken before the
+ * batch is written, so a batch that is written is logged
+ */
+shm_internal void batch_log(struct shm_replog* l, struct hamster_batch* b, uint64_t now, void* scratch) {
+  uint32_t op = 0;
+  struct batch_op* o = NULL;
+  struct repl_op* rops = (struct repl_op*)scratch;
+  struct iovec* iov = (struct iovec*)(rops + b->count);
+
+  for (op = 0; op < b->count; ++op) {
+    o = &b->ops[op];
+    memset(&rops[op], 0, sizeof(struct repl_op));
+    rops[op].key_size = o->key_size;
+    rops[op].val_size = o->val_size;
+    rops[op].max_size = o->max_size;
+    rops[op].raw_size = o->raw_size;
+    rops[op].expire = batch_expire(o, now);
+    iov[3 * op].iov_base = &rops[op];
+    iov[3 * op].iov_len = sizeof(struct repl_op);
+    iov[3 * op + 1].iov_base = b->buf + o->key_off;
+    iov[3 * op + 1].iov_len = o->key_size;
+    iov[3 * op + 2].iov_base = b->buf + o->val_off;
+    iov[3 * op + 2].iov_len = o->val_size;
+  }
+  shm_replog_append(l, iov, 3 * (int)b->count);
+}
+
+/*
+ * the first record of an empty chain is reached by its place, not by a link,
+ * so a batch first commits a free record to link to
+ */
+shm_internal int batch_anchor(struct shard_t* sh) {
+  int ec = E_SHM_OK;
+  uint32_t total = hdr_size;
+  struct data_t* d = NULL;
+  struct shm_data_header* hdr = NULL;
+  struct shmseg_ptr sptr = { { -1, 0 }, NULL };
+
+  if (NULL == (d = data_alloc(sh)))
+    return E_SHM_SYSTEM;
+
+  if (E_SHM_OK != (ec = data_lock(sh))) {
+    shm_pool_free(&sh->descs, data_handle(sh, d));
+    return ec;
+  }
+
+  if (E_SHM_OK != (ec = shmseg_get(&sh->segs, &total, &sptr)) ||
+      NULL == (hdr = (struct shm_data_header*)shmseg_ptr_ptr(&sh->segs, &sptr))) {
+    shmseg_unlock(&sh->segs);
+    shm_pool_free(&sh->descs, data_handle(sh, d));
+    return ec != E_SHM_OK ? ec : E_SHM_PTR_INVALID;
+  }
+
+  memset(hdr, 0, hdr_size);
+  hdr->flags = HDR_F_FREE;
+  hdr->next.shm_key = -1;
+  hdr->total_size = hdr_size;
+  hdr->checksum = data_checksum(hdr);
+  d->base_sptr = sptr;
+  data_link(sh, d);
+  data_free_push(sh, d);
+  ec = data_commit(sh, d);
+  shmseg_unlock(&sh->segs);
+  return ec;
+}
+
+#undef batch_of
+#undef batch_total
+#undef batch_expire
+
+shm_internal void store_free(struct hamster_store* st) {
+  pthread_cond_destroy(&st->scrub_cond);
+  pthread_mutex_destroy(&st->scrub_lock);
+  pthread_cond_destroy(&st->seal_cond);
+  pthread_mutex_destroy(&st->seal_lock);
+  free(st->shards);
+  free(st->name);
+  free(st);
+}
+
+shm_internal int shard_init(struct hamster_store* st, uint32_t i) {
+  int ec = E_SHM_OK, rec_ec = E_SHM_OK;
+  uint32_t flags = 0, chunks = 0;
+  struct shard_t* sh = &st->shards[i];
+  uint64_t now = now_ms();
+  struct shmseg_ptr sptr = { { -1, 0 }, NULL };
+  struct data_t* data_ptr = NULL;
+  struct shm_data_header* hdr = NULL;
+  struct shmseg_ptr_base end = { -1, 0 };
+
+  if (0 != pthread_rwlock_init(&sh->lock, NULL))
+    return E_SHM_SYSTEM;
+
+  shmseg_ptr_reset(&sh->hand);
+  shmseg_ptr_reset(&sh->scrub);
+  shm_pool_init(&sh->descs, sizeof(struct data_t));
+
+  // the last keys of a range are left for notify_key and replog_key
+  if (E_SHM_OK != (ec = shmseg_init(&sh->segs, st->key + i * SHM_KEY_RANGE, SHM_KEY_RANGE - 2, 
+                                    st->segment_min, st->segment_max)) ||
+      E_SHM_OK != (ec = shmseg_claim(&sh->segs, store_owner(st->name))))
+    return ec;
+
+  // HAMSTER_SEG_* are the same flags as SHMSEG_F_*
+  flags = st->segment_flags;
+  if (st->numa_policy == HAMSTER_NUMA_BIND || st->numa_policy == HAMSTER_NUMA_PER_NODE)
+    flags |= SHMSEG_F_NUMA_BIND;
+  else if (st->numa_policy == HAMSTER_NUMA_INTERLEAVE)
+    flags |= SHMSEG_F_NUMA_INTERLEAVE;
+  shmseg_set_flags(&sh->segs, flags, 
+                   st->numa_policy == HAMSTER_NUMA_PER_NODE ? (int)i : (int)st->numa_node);
+
+  if (st->index == HAMSTER_INDEX_ART 
+      ? NULL == (sh->art = art_new(data_key, data_release))
+      : NULL == (sh->tree = rb_tree_new(data_less, data_release)))
+    return E_SHM_TREE_NEW_FAILED;
+
+  if (NULL == (sh->wheel = timer_wheel_new(now / SHM_TTL_TICK_MS)))
+    return E_SHM_SYSTEM;
+
+  // a process killed in the middle of a write is undone first, it never
+  // returned, and the chain is followed as it was before
+  if (E_SHM_OK != (ec = shmseg_lock(&sh->segs, NULL)) && ec != E_SHM_OWNER_DEAD)
+    return ec;
+  ec = E_SHM_OK;
+
+  sh->loading = true;
+  shmseg_ptr_reset(&sptr);
+  if (E_SHM_OK != (ec = shmseg_first_ptr(&sh->segs, &sptr))) {
+    if (ec == E_SHM_EMPTY)
+      ec = E_SHM_OK;
+  } else {
+    do {
+      if (E_SHM_OK != (rec_ec = data_load(sh, &data_ptr, &sptr))) {
+        if (rec_ec != E_SHM_DATA_CORRUPTED || data_ptr == NULL ||
+            !data_next_valid(sh, data_hdr(sh, data_ptr))) {
+          // the chain can not be followed beyond it. out of memory the
+          // open fails instead, and the chain is left for a later one
+          ec = rec_ec;
+          if (data_ptr != NULL)
+            shm_pool_free(&sh->descs, data_handle(sh, data_ptr));
+          if (rec_ec != E_SHM_SYSTEM)
+            data_set_next(sh, sh->tail, &end);
+          break;
+        }
+        // reported once, when it is found
+        if (!(data_hdr(sh, data_ptr)->flags & HDR_F_QUARANTINE))
+          ec = rec_ec;
+      }
+
+      // the wheel is rebuilt from the deadlines stored in shm
+      hdr = data_hdr(sh, data_ptr);
+      if (rec_ec == E_SHM_OK && hdr->version > sh->clock)
+        sh->clock = hdr->version;
+      if (rec_ec != E_SHM_OK) {
+        // lose the record only, the ones behind it are still good
+        data_link(sh, data_ptr);
+        data_quarantine(sh, data_ptr);
+      } else if ((hdr->flags & HDR_F_FREE) ||
+          (hdr->expire != 0 && hdr->expire <= now)) {
+        hdr->flags |= HDR_F_FREE;
+        data_link(sh, data_ptr);
+        data_free_push(sh, data_ptr);
+      } else if (hdr->flags & HDR_F_CHUNK) {
+        // kept or freed once the tables of the index are known
+        data_link(sh, data_ptr);
+        data_ptr->next_free = chunks;
+        chunks = data_handle(sh, data_ptr);
+      } else if (E_SHM_SAME_KEY_EXIST == (rec_ec = data_supersede(sh, data_ptr))) {
+        // the older of two records a batch left of a key, see batch_index
+        data_link(sh, data_ptr);
+      } else if (rec_ec != E_SHM_OK) {
+        // out of memory, the open fails and the chain is left as it is
+        ec = rec_ec;
+        break;
+      } else {
+        data_link(sh, data_ptr);
+        if (E_SHM_OK != (rec_ec = data_schedule(sh, data_ptr, hdr->expire))) {
+          ec = rec_ec;
+          break;
+        }
+      }
+
+      shmseg_ptr_reset(&sptr);
+      *(struct shmseg_ptr_base*)&sptr = data_hdr(sh, data_ptr)->next;
+    } while (sptr.base.shm_key != -1);
+  }
+  if (E_SHM_OK != (rec_ec = data_chunks_sort(sh, chunks)))
+    ec = rec_ec;
+  sh->loading = false;
+  shmseg_unlock(&sh->segs);
+
+  // without memory for a filter lookups go to the index, only slower
+  if (st->filter_bits > 0)
+    shard_filter(sh, st->filter_bits);
+  return ec;
+}
+
+shm_internal void shard_free(struct shard_t* sh) {
+  if (sh->tree != NULL)
+    rb_tree_free(sh->tree);
+  if (sh->art != NULL)
+    art_free(sh->art);
+  if (sh->wheel != NULL)
+    timer_wheel_free(sh->wheel);
+  free(sh->timer_spare);
+  shm_bloom_free(sh->filter);
+  free(sh->unsealed);
+  // descriptors of the index and the lists all go with the pool
+  shm_pool_destroy(&sh->descs);
+  memset(sh->free_list, 0, sizeof(sh->free_list));
+  sh->quarantine = 0;
+  sh->tree = NULL;
+  sh->art = NULL;
+  sh->wheel = NULL;
+  sh->timer_spare = NULL;
+  sh->filter = NULL;
+  sh->tail = NULL;
+  sh->unsealed = NULL;
+  sh->unsealed_words = 0;
+  sh->unsealed_count = 0;
+  pthread_rwlock_destroy(&sh->lock);
+}
+
+/*
+ * build the filter of sh from its index, sized for twice the keys it holds
+ * so it takes as many more before the next rebuild. call with the write lock
+ * of sh held
+ */
+shm_internal int shard_filter(struct shard_t* sh, uint32_t bits_per_key) {
+  struct shm_bloom* filter = NULL;
+  uint32_t cap = 0;
+
+  if (bits_per_key > 0) {
+    cap = index_count(sh) * 2 > SHM_FILTER_MIN_KEYS ? index_count(sh) * 2 : SHM_FILTER_MIN_KEYS;
+    if (NULL == (filter = shm_bloom_new(cap, bits_per_key)))
+      return E_SHM_SYSTEM;
+    index_foreach(sh, shard_filter_add, filter);
+  }
+
+  shm_bloom_free(sh->filter);
+  sh->filter = filter;
+  sh->filter_bits = bits_per_key;
+  sh->filter_cap = cap;
+  sh->filter_keys = index_count(sh);
+  sh->filter_stale = 0;
+  return E_SHM_OK;
+}
+
+shm_internal void shard_filter_add(void* data, void* ctx) {
+  shm_bloom_add((struct shm_bloom*)ctx, key_hash64(((struct data_t*)data)->key));
+}
+
+/*
+ * verify about budget bytes of records from the scrub cursor on, under the
+ * read lock, a bad record found is quarantined under the write lock and ends
+ * the step. wrapped is set once the cursor passes the tail
+ */
+shm_internal size_t shard_scrub(struct hamster_store* st, struct shard_t* sh, size_t budget, 
+                                hamster_corrupt_fn fn, void* ctx, bool* wrapped) {
+  size_t done = 0;
+  bool bad = false, report = false;
+  char* key = NULL;
+  struct shmseg_ptr at = { { -1, 0 }, NULL };
+  struct shm_data_header* hdr = NULL;
+
+  *wrapped = false;
+  pthread_rwlock_rdlock(&sh->lock);
+  while (done < budget && !bad) {
+    if (sh->scrub.base.shm_key == -1 &&
+        E_SHM_OK != shmseg_first_ptr(&sh->segs, &sh->scrub)) {
+      *wrapped = true;
+      break;
+    }
+
+    at = sh->scrub;
+    if (NULL == (hdr = (struct shm_data_header*)shmseg_ptr_ptr(&sh->segs, &at))) {
+      shmseg_ptr_reset(&sh->scrub);
+      *wrapped = true;
+      break;
+    }
+    shmseg_ptr_reset(&sh->scrub);
+    sh->scrub.base = hdr->next;
+
+    // records never leave the chain, the cursor stays valid without the lock
+    if (hdr->flags & (HDR_F_FREE | HDR_F_QUARANTINE)) {
+      done += hdr_size;
+    } else {
+      done += hdr->total_size;
+      // the checksum of an unsealed record is stale, see hamster_set_sealing,
+      // and so is that of a counter being added to
+      bad = !(hdr->flags & (HDR_F_UNSEALED | HDR_F_ADDING)) && !data_intact(&sh->segs, &at, hdr);
+    }
+
+    if (sh->scrub.base.shm_key == -1) {
+      *wrapped = true;
+      break;
+    }
+  }
+  __atomic_fetch_add(&sh->scrubbed, done, __ATOMIC_RELAXED);
+  pthread_rwlock_unlock(&sh->lock);
+
+  if (bad) {
+    pthread_rwlock_wrlock(&sh->lock);
+    hdr = (struct shm_data_header*)shmseg_ptr_ptr(&sh->segs, &at);
+    // it might be rewritten in between
+    if (!(hdr->flags & (HDR_F_FREE | HDR_F_QUARANTINE | HDR_F_UNSEALED | HDR_F_ADDING)) && 
+        !data_intact(&sh->segs, &at, hdr)) {
+      key = data_quarantine_at(sh, &at, hdr);
+      report = true;
+    }
+    pthread_rwlock_unlock(&sh->lock);
+
+    if (report && fn != NULL)
+      fn(st, key, ctx);
+    free(key);
+  }
+  return done;
+}
+
+/*
+ * scrub about budget bytes, going on with the next shard whenever one is
+ * done, every shard is visited once at most. call with scrub_lock held
+ */
+shm_internal size_t scrub_step(struct hamster_store* st, size_t budget, 
+                               hamster_corrupt_fn fn, void* ctx) {
+  size_t done = 0;
+  uint32_t i = 0;
+  bool wrapped = false;
+
+  for (i = 0; i < st->shard_count && done < budget; ++i) {
+    done += shard_scrub(st, &st->shards[st->scrub_shard], budget - done, fn, ctx, &wrapped);
+    if (wrapped)
+      st->scrub_shard = (st->scrub_shard + 1) % st->shard_count;
+  }
+  return done;
+}
+
+/*
+ * the scrubber runs at the lowest priority, in steps of 1/10 second worth of
+ * bytes, and sleeps as long as the bytes of a step take at its rate
+ */
+shm_internal void* scrub_main(void* arg) {
+  struct hamster_store* st = (struct hamster_store*)arg;
+  size_t step = 0, n = 0;
+  uint64_t wait_ns = 0;
+  struct timespec ts;
+
+  setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+  step = st->scrub_rate / 10 > 0 ? st->scrub_rate / 10 : 1;
+
+  pthread_mutex_lock(&st->scrub_lock);
+  while (!st->scrub_stop) {
+    n = scrub_step(st, step, st->scrub_fn, st->scrub_ctx);
+    // an empty store is looked at again 1/10 second later
+    wait_ns = n > 0 ? (uint64_t)((double)n / st->scrub_rate * 1e9) : 100000000;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec  += (wait_ns + ts.tv_nsec) / 1000000000;
+    ts.tv_nsec  = (wait_ns + ts.tv_nsec) % 1000000000;
+    while (!st->scrub_stop &&
+           0 == pthread_cond_timedwait(&st->scrub_cond, &st->scrub_lock, &ts))
+      ;
+  }
+  pthread_mutex_unlock(&st->scrub_lock);
+  return NULL;
+}
+
+/*
+ * checksum the records noted by data_defer, once for all their updates since
+ * the last time. a record freed or rewritten whole meanwhile has no
+ * HDR_F_UNSEALED any more. call with the write lock of sh held, return the
+ * records sealed
+ */
+shm_internal size_t shard_seal(struct shard_t* sh) {
+  size_t n = 0;
+  uint32_t i = 0;
+  uint64_t bits = 0;
+  struct shm_data_header* hdr = NULL;
+
+  for (i = 0; i < sh->unsealed_words && sh->unsealed_count > 0; ++i) {
+    for (bits = sh->unsealed[i]; bits != 0; bits &= bits - 1) {
+      hdr = data_hdr(sh, data_at(sh, i * 64 + __builtin_ctzll(bits)));
+      if ((hdr->flags & (HDR_F_UNSEALED | HDR_F_DIRTY | HDR_F_FREE | HDR_F_QUARANTINE)) == 
+          HDR_F_UNSEALED) {
+        hdr->checksum = data_checksum(hdr);
+        __sync_synchronize();
+        hdr->flags &= ~HDR_F_UNSEALED;
+        ++n;
+      }
+    }
+    sh->unsealed[i] = 0;
+  }
+  __atomic_store_n(&sh->unsealed_count, 0, __ATOMIC_RELAXED);
+  sh->sealed += n;
+  return n;
+}
+
+/* turn write-combining of every shard on or off, what is pending is sealed then */
+shm_internal void store_combine(struct hamster_store* st, bool on) {
+  uint32_t i = 0;
+
+  for (i = 0; i < st->shard_count; ++i) {
+    pthread_rwlock_wrlock(&st->shards[i].lock);
+    if (!on)
+      shard_seal(&st->shards[i]);
+    st->shards[i].combine = on;
+    pthread_rwlock_unlock(&st->shards[i].lock);
+  }
+}
+
+/* stop the sealer thread, if it runs, and wait for it */
+shm_internal void seal_join(struct hamster_store* st) {
+  bool running = false;
+
+  pthread_mutex_lock(&st->seal_lock);
+  if ((running = st->seal_running)) {
+    st->seal_stop = true;
+    st->seal_running = false;
+    pthread_cond_signal(&st->seal_cond);
+  }
+  pthread_mutex_unlock(&st->seal_lock);
+
+  if (running)
+    pthread_join(st->seal_thread, NULL);
+}
+
+/* the sealer seals every shard once per seal_ms */
+shm_internal void* seal_main(void* arg) {
+  struct hamster_store* st = (struct hamster_store*)arg;
+  uint64_t wait_ns = (uint64_t)st->seal_ms * 1000000;
+  struct timespec ts;
+
+  pthread_mutex_lock(&st->seal_lock);
+  while (!st->seal_stop) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec  += (wait_ns + ts.tv_nsec) / 1000000000;
+    ts.tv_nsec  = (wait_ns + ts.tv_nsec) % 1000000000;
+    while (!st->seal_stop &&
+           0 == pthread_cond_timedwait(&st->seal_cond, &st->seal_lock, &ts))
+      ;
+    if (!st->seal_stop)
+      hamster_store_seal(st);
+  }
+  pthread_mutex_unlock(&st->seal_lock);
+  return NULL;
+}
+
+shm_internal uint32_t hdr_key_size(struct shm_data_header* hdr) {
+  return strlen((char*)(hdr + 1)) + 1;
+}
+
+shm_internal const char* hdr_key(struct shm_data_header* hdr) {
+  return (const char*)(hdr + 1);
+}
+
+shm_internal uint32_t hdr_value_size(struct shm_data_header* hdr) {
+  return hdr->data_size - hdr_key_size(hdr) - hdr->pad_size;
+}
+
+shm_internal uint32_t hdr_value_maxsize(struct shm_data_header* hdr) {
+  return hdr->total_size - hdr_size - hdr_key_size(hdr) - hdr->pad_size;
+}
+
+shm_internal void* hdr_value(struct shm_data_header* hdr) {
+  return (char*)hdr_key(hdr) + hdr_key_size(hdr) + hdr->pad_size;
+}
+
+shm_internal int data_load(struct shard_t* sh, struct data_t** d, struct shmseg_ptr* base_sptr) {
+  void* base_ptr = NULL;
+  struct data_t* data_ptr = NULL;
+  struct shm_data_header* hdr = NULL;
+
+  *d = NULL;
+  if (NULL == (base_ptr = shmseg_ptr_ptr(&sh->segs, base_sptr)))
+    return E_SHM_PTR_INVALID;
+
+  hdr = (struct shm_data_header*)base_ptr;
+  if (NULL == (data_ptr = data_alloc(sh)))
+    return E_SHM_SYSTEM;
+
+  data_ptr->base_sptr = *base_sptr;
+  if (E_SHM_OK != data_verify(sh, base_sptr, hdr)) {
+    // the caller might quarantine it, nothing but its place can be trusted
+    *d = data_ptr;
+    return E_SHM_DATA_CORRUPTED;
+  }
+
+  data_ptr->key = hdr_key(hdr);
+  data_ptr->value.ptr = hdr_value(hdr);
+  data_ptr->value.size = hdr_value_size(hdr);
+  data_ptr->value.max_size = hdr_value_maxsize(hdr);
+
+  *d = data_ptr;
+  return E_SHM_OK;
+}
+
+/*
+ * records covered by a commit marker are trusted without a checksum pass,
+ * unless an in-place update of it was interrupted. an unsealed record is
+ * sealed here, if its last update completed
+ */
+shm_internal int data_verify(struct shard_t* sh, struct shmseg_ptr* base_sptr, struct shm_data_header* hdr) {
+  // quarantined once already, it is not going to get better
+  if (hdr->flags & HDR_F_QUARANTINE)
+    return E_SHM_DATA_CORRUPTED;
+
+  // content of a free record does not matter, it might be half reused
+  if ((hdr->flags & HDR_F_FREE) && shmseg_committed(&sh->segs, base_sptr))
+    return E_SHM_OK;
+
+  // a combined update completed and only waited to be sealed, or a counter
+  // add died before it patched the checksum, an 8 bytes value is whole
+  // either way. trust it
+  if (!(hdr->flags & (HDR_F_DIRTY | HDR_F_FREE)) && 
+      (hdr->flags & (HDR_F_UNSEALED | HDR_F_ADDING))) {
+    if (hdr->total_size < hdr_size || hdr->data_size > hdr->total_size - hdr_size ||
+        !shmseg_valid(&sh->segs, base_sptr, hdr->total_size))
+      return E_SHM_DATA_CORRUPTED;
+    hdr->checksum = data_checksum(hdr);
+    __sync_synchronize();
+    hdr->flags &= ~(HDR_F_UNSEALED | HDR_F_ADDING);
+    return E_SHM_OK;
+  }
+
+  if (!g_recovery_verify_all && 
+      !(hdr->flags & HDR_F_DIRTY) && 
+      shmseg_committed(&sh->segs, base_sptr))
+    return E_SHM_OK;
+
+  if (!data_intact(&sh->segs, base_sptr, hdr))
+    return E_SHM_DATA_CORRUPTED;
+
+  // the update has completed, only the flag was not cleared
+  hdr->flags &= ~(HDR_F_DIRTY | HDR_F_UNSEALED);
+  return E_SHM_OK;
+}
+
+/*
+ * the sizes are checked first, so a damaged data_size can not take the
+ * checksum out of the segment
+ */
+shm_internal bool data_intact(struct shmseg_chain* c, struct shmseg_ptr* base_sptr, struct shm_data_header* hdr) {
+  return hdr->total_size >= hdr_size &&
+         hdr->data_size <= hdr->total_size - hdr_size &&
+         shmseg_valid(c, base_sptr, hdr->total_size) &&
+         hdr->checksum == data_checksum(hdr);
+}
+
+/* next is not covered by the checksum, it is good if it leads to a header */
+shm_internal bool data_next_valid(struct shard_t* sh, struct shm_data_header* hdr) {
+  struct shmseg_ptr next = { hdr->next, NULL };
+  return next.base.shm_key == -1 || shmseg_valid(&sh->segs, &next, hdr_size);
+}
+
+shm_internal struct shm_data_header* data_hdr(struct shard_t* sh, struct data_t* d) {
+  return (struct shm_data_header*)shmseg_ptr_ptr(&sh->segs, &d->base_sptr);
+}
+
+shm_internal int data_checksum(struct shm_data_header* hdr) {
+  return shm_crc32((char*)hdr + hdr_checksum_off,
+                   hdr_size + hdr->data_size - hdr_checksum_off);
+}
+
+shm_internal int data_less(void* left, void* right) {
+  return strcmp(((struct data_t*)left)->key, ((struct data_t*)right)->key) < 0
+         ? true : false;
+}
+
+shm_internal const char* data_key(void* data) {
+  return ((struct data_t*)data)->key;
+}
+
+shm_internal int data_add(struct shard_t* sh, struct data_t* data_ptr) {
+  int ec = E_SHM_OK;
+
+  if (E_SHM_OK != (ec = index_add(sh, data_ptr))) 
+    return ec;
+
+  data_link(sh, data_ptr);
+  return E_SHM_OK;
+}
+
+shm_internal void data_link(struct shard_t* sh, struct data_t* data_ptr) {
+  data_set_next(sh, sh->tail, (struct shmseg_ptr_base*)(&data_ptr->base_sptr));
+  sh->tail = data_ptr;
+}
+
+/* release_fn of the index, the descriptor itself goes with its pool */
+shm_internal void data_release(void* data) {
+  struct data_t* d = (struct data_t*)data;
+  if (d->timer != NULL)
+    free(d->timer);
+}
+
+shm_internal struct data_t* data_alloc(struct shard_t* sh) {
+  return data_at(sh, shm_pool_alloc(&sh->descs));
+}
+
+shm_internal int data_commit(struct shard_t* sh, struct data_t* data_ptr) {
+  return shmseg_commit(&sh->segs, &data_ptr->base_sptr, 
+                       data_hdr(sh, data_ptr)->total_size);
+}
+
+/*
+ * take the chain lock of sh for a record linked behind its tail, see
+ * shmseg_lock. the link of a holder which died is reset by then, and the
+ * chain ends at sh->tail again
+ */
+shm_internal int data_lock(struct shard_t* sh) {
+  struct shmseg_ptr_base link = { -1, 0 };
+  int ec = E_SHM_OK;
+
+  if (sh->tail != NULL) {
+    link = sh->tail->base_sptr.base;
+    link.off += offsetof(struct shm_data_header, next);
+  }
+  ec = shmseg_lock(&sh->segs, sh->tail != NULL ? &link : NULL);
+  return ec == E_SHM_OWNER_DEAD ? E_SHM_OK : ec;
+}
+
+/*
+ * check the growth size bytes of records would take against the budgets of
+ * sh, E_SHM_BUDGET_EXCEEDED is returned beyond the hard one. beyond the soft
+ * one the hook of the store is due, see store_budget_hook
+ */
+shm_internal int data_budget(struct shard_t* sh, uint64_t size) {
+  size_t grow = 0;
+
+  if ((sh->budget_soft == 0 && sh->budget_hard == 0) || size > UINT32_MAX / 2)
+    return E_SHM_OK;
+
+  if ((grow = shmseg_grow_size(&sh->segs, (uint32_t)size)) > 0) {
+    if (sh->budget_hard > 0 && sh->segs.size + grow > sh->budget_hard) {
+      __atomic_store_n(&sh->budget_full, true, __ATOMIC_RELAXED);
+      __atomic_store_n(&sh->rejected, sh->rejected + 1, __ATOMIC_RELAXED);
+      return E_SHM_BUDGET_EXCEEDED;
+    }
+    if (sh->budget_soft > 0 && sh->segs.size + grow > sh->budget_soft)
+      sh->budget_hit = true;
+  }
+
+  // a write which fits again ends the hard level
+  __atomic_store_n(&sh->budget_full, false, __ATOMIC_RELAXED);
+  return E_SHM_OK;
+}
+
+shm_internal int data_update(struct shard_t* sh, struct data_t* data_ptr, struct h_value_t* val, uint32_t raw_size, uint64_t expire) {
+  int ec = E_SHM_OK;
+  struct timer_node* timer = NULL;
+  struct shm_data_header* hdr = data_hdr(sh, data_ptr);
+
+  if (val->size <= data_ptr->value.max_size) {
+    if ((sh->combine && E_SHM_OK != (ec = data_defer(sh, data_ptr))) ||
+        (data_ptr->timer == NULL && E_SHM_OK != (ec = data_timer(sh, expire, &timer))))
+      return ec;
+    // mark the record, so recovery checks it even if it is committed
+    hdr->flags |= sh->combine ? HDR_F_DIRTY | HDR_F_UNSEALED : HDR_F_DIRTY;
+    __sync_synchronize();
+    // copy data
+    memcpy(data_ptr->value.ptr, val->ptr, val->size);
+    // update header
+    hdr->data_size += val->size - data_ptr->value.size;
+    hdr->expire = expire;
+    hdr->raw_size = raw_size;
+    data_ptr->value.size = val->size;
+    data_version(sh, hdr);
+    // update checksum, unless shard_seal does it for all updates meanwhile
+    if (!sh->combine)
+      hdr->checksum = data_checksum(hdr);
+    __sync_synchronize();
+    hdr->flags &= sh->combine ? ~HDR_F_DIRTY : ~(HDR_F_DIRTY | HDR_F_UNSEALED);
+    data_arm(sh, data_ptr, expire, timer);
+    return E_SHM_OK;
+  } else {
+    return E_SHM_VAL_UPDATE_EXCEED_MAX_SIZE;
+  }
+}
+
+/*
+ * note the record of data_ptr for shard_seal, the bitmap grows with the
+ * handles of the descriptors. call with the write lock of sh held
+ */
+shm_internal int data_defer(struct shard_t* sh, struct data_t* data_ptr) {
+  int ec = E_SHM_OK;
+  uint32_t h = data_handle(sh, data_ptr);
+
+  if (E_SHM_OK != (ec = data_defer_room(sh, h)))
+    return ec;
+
+  if (!(sh->unsealed[h / 64] & (1ull << h % 64))) {
+    sh->unsealed[h / 64] |= 1ull << h % 64;
+    __atomic_store_n(&sh->unsealed_count, sh->unsealed_count + 1, __ATOMIC_RELAXED);
+  }
+  return E_SHM_OK;
+}
+
+/* grow the bitmap of data_defer up to the handle h */
+shm_internal int data_defer_room(struct shard_t* sh, uint32_t h) {
+  uint32_t words = 0;
+  uint64_t* bits = NULL;
+
+  if (h / 64 < sh->unsealed_words)
+    return E_SHM_OK;
+
+  for (words = sh->unsealed_words > 0 ? sh->unsealed_words : 16; h / 64 >= words; words *= 2)
+    ;
+  if (NULL == (bits = (uint64_t*)realloc(sh->unsealed, words * sizeof(uint64_t))))
+    return E_SHM_SYSTEM;
+  memset(bits + sh->unsealed_words, 0, (words - sh->unsealed_words) * sizeof(uint64_t));
+  sh->unsealed = bits;
+  sh->unsealed_words = words;
+  return E_SHM_OK;
+}
+
+/*
+ * find room for a record of *total_size bytes: an expired or evicted record,
+ * which is linked and committed already, or new space behind the tail, with
+ * the chain lock held until it is committed. *total_size is set to the size
+ * of the record, a reused one is flagged free and dirty, a new one has no
+ * flags
+ */
+shm_internal int data_place(struct shard_t* sh, uint32_t* total_size, struct data_t** d) {
+  int ec = E_SHM_OK;
+  void* base_ptr = NULL;
+  struct data_t* data_ptr = NULL;
+  struct shmseg_ptr sptr = { { -1, 0 }, NULL };
+  struct shm_data_header* hdr = NULL;
+
+  if (NULL == (data_ptr = data_free_pop(sh, *total_size)) &&
+      sh->budget_soft > 0 &&
+      shmseg_grow_size(&sh->segs, *total_size) > 0 &&
+      sh->segs.size + shmseg_grow_size(&sh->segs, *total_size) > sh->budget_soft) {
+    // beyond the soft budget, the space of expired keys is reused first
+    timer_wheel_advance(sh->wheel, now_ms() / SHM_TTL_TICK_MS, data_expire, sh);
+    data_ptr = data_free_pop(sh, *total_size);
+  }
+  if (data_ptr == NULL &&
+      sh->capacity > 0 &&
+      shmseg_grow_size(&sh->segs, *total_size) > 0 &&
+      sh->segs.size + shmseg_grow_size(&sh->segs, *total_size) > sh->capacity) {
+    // at capacity, take over the space of a victim instead of growing
+    if (NULL == (data_ptr = data_evict(sh, *total_size)))
+      return E_SHM_CAPACITY_EXCEEDED;
+  }
+
+  if (data_ptr != NULL) {
+    // recovery keeps treating it as free until it is completely rewritten
+    hdr = data_hdr(sh, data_ptr);
+    hdr->flags = HDR_F_FREE | HDR_F_DIRTY;
+    __sync_synchronize();
+    *total_size = hdr->total_size;
+  } else {
+    if (E_SHM_OK != (ec = data_budget(sh, *total_size)) ||
+        E_SHM_OK != (ec = data_lock(sh)))
+      return ec;
+
+    if (E_SHM_OK != (ec = shmseg_get(&sh->segs, total_size, &sptr)) ||
+        NULL == (base_ptr = shmseg_ptr_ptr(&sh->segs, &sptr)) ||
+        NULL == (data_ptr = data_alloc(sh))) {
+      shmseg_unlock(&sh->segs);
+      return ec != E_SHM_OK ? ec : base_ptr == NULL ? E_SHM_PTR_INVALID : E_SHM_SYSTEM;
+    }
+
+    hdr = (struct shm_data_header*)base_ptr;
+    hdr->flags = 0;
+    hdr->next.shm_key = -1;
+    hdr->next.off = 0;
+    data_ptr->base_sptr = sptr;
+  }
+
+  hdr->total_size = *total_size;
+  *d = data_ptr;
+  return E_SHM_OK;
+}
+
+shm_internal int data_new(struct shard_t* sh, const char* key, struct h_value_t* val, uint32_t raw_size, uint64_t expire, 
+                          uint32_t pad_size, uint32_t flags) {
+  int ec = E_SHM_OK;
+  struct data_t* data_ptr = NULL;
+  struct timer_node* timer = NULL;
+  uint32_t key_size = 0, total_size = 0;
+  struct shm_data_header* hdr = NULL;
+
+  key_size = strlen(key) + 1;
+  if (key_size == 1)
+    return E_SHM_KEY_ZERO_LENGTH;
+
+  if (val->max_size < val->size)
+    return E_SHM_VAL_SIZE_INVALID;
+
+  total_size = hdr_size + key_size + pad_size + val->max_size;
+  if (E_SHM_OK != (ec = data_timer(sh, expire, &timer)))
+    return ec;
+  if (E_SHM_OK != (ec = data_place(sh, &total_size, &data_ptr))) {
+    free(timer);
+    return ec;
+  }
+  if (raw_size != 0)
+    flags |= HDR_F_PACKED;
+
+  hdr = data_hdr(sh, data_ptr);
+  data_fill(sh, data_ptr, key, key_size, val, raw_size, expire, pad_size);
+
+  if (hdr->flags & HDR_F_FREE) {
+    __sync_synchronize();
+    hdr->flags = flags;
+    if (E_SHM_OK != (ec = index_add(sh, data_ptr))) {
+      hdr->flags = HDR_F_FREE;
+      data_free_push(sh, data_ptr);
+      free(timer);
+      return ec;
+    }
+  } else {
+    hdr->flags = flags;
+    if (E_SHM_OK != (ec = data_add(sh, data_ptr))) {
+      shmseg_unlock(&sh->segs);
+      shm_pool_free(&sh->descs, data_handle(sh, data_ptr));
+      free(timer);
+      return ec;
+    }
+    ec = data_commit(sh, data_ptr);
+    shmseg_unlock(&sh->segs);
+  }
+
+  // nothing can fail from here on, a record in the index is looked up and
+  // expires like any other
+  data_filter_add(sh, data_ptr);
+  data_arm(sh, data_ptr, expire, timer);
+  return ec;
+}
+
+/*
+ * write key in a new record in place of old, which is retired once the new
+ * one is in the index, and stays as it was otherwise. a chunked value and a
+ * plain one never take over the record of each other in place. call with the
+ * write lock of sh held
+ */
+shm_internal int data_replace(struct shard_t* sh, struct data_t* old, const char* key, struct h_value_t* val, 
+                              uint32_t raw_size, uint64_t expire, uint32_t pad_size, uint32_t flags) {
+  int ec = E_SHM_OK;
+
+  data_unindex(sh, old);
+  if (E_SHM_OK != (ec = data_new(sh, key, val, raw_size, expire, pad_size, flags))) {
+    index_add(sh, old);
+    data_schedule(sh, old, data_hdr(sh, old)->expire);
+    return ec;
+  }
+
+  // a crash before this leaves two records of key, recovery keeps the later
+  data_retire(sh, old);
+  data_free_push(sh, old);
+  return E_SHM_OK;
+}
+
+/*
+ * a value which does not fit into a record sized for a compressed one. the
+ * room of the record came from the compressed size, not from the max_size
+ * of the value, so the value gets a new record rather than failing
+ */
+shm_internal bool data_outgrown(struct shard_t* sh, struct data_t* d, struct h_value_t* val) {
+  return val->size > d->value.max_size && (data_hdr(sh, d)->flags & HDR_F_PACKED);
+}
+
+/* bytes of the value of d, a chunked one is the size of its chunks together */
+shm_internal uint32_t data_value_size(struct shard_t* sh, struct data_t* d) {
+  struct shm_data_header* hdr = data_hdr(sh, d);
+  struct chunk_table* table = NULL;
+
+  if (!(hdr->flags & HDR_F_CHUNKED))
+    return d->value.size;
+  return NULL != (table = hdr_chunks(hdr)) ? table->size : 0;
+}
+
+/*
+ * copy n bytes of the raw value of d from byte off on to cur, gathering them
+ * from the chunks of a chunked one. call with the lock of sh held
+ */
+shm_internal int data_read(struct shard_t* sh, struct data_t* d, uint32_t off, struct iov_cursor* cur, uint32_t n) {
+  struct shm_data_header* hdr = data_hdr(sh, d);
+
+  if (hdr->flags & HDR_F_CHUNKED)
+    return chunk_read(&sh->segs, hdr, off, cur, n);
+  iov_scatter(cur, (const char*)d->value.ptr + off, n);
+  return E_SHM_OK;
+}
+
+/*
+ * write key and val into the record of data_ptr, which has its total_size
+ * set already, and set val->max_size to the room it leaves for the value
+ */
+shm_internal void data_fill(struct shard_t* sh, struct data_t* data_ptr, const char* key, uint32_t key_size, 
+                            struct h_value_t* val, uint32_t raw_size, uint64_t expire, uint32_t pad_size) {
+  struct shm_data_header* hdr = data_hdr(sh, data_ptr);
+  char* data_key = (char*)hdr + hdr_size;
+  char* data_val = data_key + key_size + pad_size;
+
+  val->max_size = hdr->total_size - hdr_size - key_size - pad_size;
+
+  // set key
+  memcpy(data_key, key, key_size);
+  memset(data_key + key_size, 0, pad_size);
+  // set value
+  memcpy(data_val, val->ptr, val->size);
+
+  hdr->data_size = key_size + pad_size + val->size;
+  hdr->expire = expire;
+  hdr->raw_size = raw_size;
+  hdr->pad_size = pad_size;
+  hdr->version = 0;
+  data_version(sh, hdr);
+  hdr->checksum = data_checksum(hdr); 
+
+  data_ptr->key = data_key;
+  data_ptr->value = *val;
+  data_ptr->value.ptr = data_val;
+}
+
+/*
+ * a filter grown full, or holding too many dropped keys, loses precision and
+ * is rebuilt. one which can not be rebuilt keeps taking keys as it is, the
+ * record is in the index already and must not be missed by lookups
+ */
+shm_internal void data_filter_add(struct shard_t* sh, struct data_t* data_ptr) {
+  if (sh->filter == NULL)
+    return;
+
+  if ((++sh->filter_keys > sh->filter_cap || sh->filter_stale > sh->filter_cap / 2) &&
+      E_SHM_OK == shard_filter(sh, sh->filter_bits))
+    return;
+
+  shm_bloom_add(sh->filter, key_hash64(data_ptr->key));
+}
+
+/*
+ * index data_ptr in place of an older record of its key, which is dropped
+ * and its space reused. if the record in the index has a later version, as
+ * recovery might find, data_ptr is the one dropped, and E_SHM_SAME_KEY_EXIST
+ * is returned
+ */
+shm_internal int data_supersede(struct shard_t* sh, struct data_t* data_ptr) {
+  struct data_t* old = data_ptr;
+
+  if (E_SHM_OK == index_query(sh, (void**)&old)) {
+    if (data_hdr(sh, old)->version > data_hdr(sh, data_ptr)->version) {
+      data_hdr(sh, data_ptr)->flags |= HDR_F_FREE;
+      data_free_push(sh, data_ptr);
+      return E_SHM_SAME_KEY_EXIST;
+    }
+    data_free(sh, old);
+  }
+  return index_add(sh, data_ptr);
+}
+
+/*
+ * look key up for a reader, an expired key is a miss even before it is
+ * reclaimed. call with the lock of sh held
+ */
+shm_internal int data_find(struct shard_t* sh, const char* key, struct data_t** d) {
+  int ec;
+
+  if (E_SHM_OK == (ec = data_lookup(sh, key, d))) {
+    __atomic_fetch_add(&sh->hits, 1, __ATOMIC_RELAXED);
+    if (sh->capacity > 0)
+      data_touch(sh, *d);
+  } else if (ec == E_SHM_KEY_NOT_FOUND) {
+    __atomic_fetch_add(&sh->misses, 1, __ATOMIC_RELAXED);
+  }
+  return ec;
+}
+
+/* data_find without counting a hit or miss */
+shm_internal int data_lookup(struct shard_t* sh, const char* key, struct data_t** d) {
+  int ec;
+  struct data_t stub, *target = &stub;
+
+  if (sh->filter != NULL && !shm_bloom_maybe(sh->filter, key_hash64(key))) {
+    __atomic_fetch_add(&sh->filter_skips, 1, __ATOMIC_RELAXED);
+    return E_SHM_KEY_NOT_FOUND;
+  }
+
+  stub.key = key;
+  if (E_SHM_KEY_NOT_FOUND == (ec = index_query(sh, (void**)&target))) {
+    if (sh->filter != NULL)
+      __atomic_fetch_add(&sh->filter_false_positives, 1, __ATOMIC_RELAXED);
+  } else if (E_SHM_OK == ec) {
+    if (target->timer != NULL && data_expired(sh, target, now_ms()))
+      ec = E_SHM_KEY_NOT_FOUND;
+    else if (data_hdr(sh, target)->flags & HDR_F_QUARANTINE)
+      ec = E_SHM_KEY_NOT_FOUND;
+  }
+
+  if (ec == E_SHM_OK)
+    *d = target;
+  return ec;
+}
+
+/*
+ * give the record the next version of the shard clock. versions only grow,
+ * also over a crash, so a key set again after it expired never gets a
+ * version it had before. counters take it under the read lock, the later of
+ * two racing versions wins
+ */
+shm_internal void data_version(struct shard_t* sh, struct shm_data_header* hdr) {
+  uint64_t v = __atomic_add_fetch(&sh->clock, 1, __ATOMIC_SEQ_CST);
+  uint64_t cur = __atomic_load_n(&hdr->version, __ATOMIC_RELAXED);
+
+  while (cur < v && 
+         !__atomic_compare_exchange_n(&hdr->version, &cur, v, true, 
+                                      __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    ;
+}
+
+/*
+ * compress val into a new buffer described by stored, the record keeps room
+ * for the growth val->max_size allows on top of the compressed size. return
+ * the buffer to free, or NULL if val is stored raw
+ */
+shm_internal char* data_compress(struct h_value_t* val, struct h_value_t* stored, uint32_t* raw_size) {
+  uint32_t n = 0;
+  char* buf = NULL;
+
+  if (NULL == (buf = (char*)malloc(compress_cap(val->size))))
+    return NULL;
+
+  n = shm_lz_compress((const char*)val->ptr, val->size, buf, compress_cap(val->size));
+  if (n == 0) {
+    free(buf);
+    return NULL;
+  }
+
+  stored->ptr = buf;
+  stored->size = n;
+  stored->max_size = n + (val->max_size - val->size);
+  *raw_size = val->size;
+  return buf;
+}
+
+shm_internal void data_set_next(struct shard_t* sh, struct data_t* data_ptr, struct shmseg_ptr_base* base_sptr) {
+  struct shm_data_header* hdr = NULL;
+
+  if (data_ptr != NULL) {
+    hdr = data_hdr(sh, data_ptr);
+    hdr->next = *base_sptr;
+  }
+}
+
+/*
+ * the index of a shard is a red-black tree or an adaptive radix tree, with
+ * the same interface, see HAMSTER_INDEX_*
+ */
+shm_internal int index_add(struct shard_t* sh, struct data_t* d) {
+  return sh->art != NULL ? art_add(sh->art, d) : rb_tree_add(sh->tree, d);
+}
+
+/* make sure the next index_add does not run out of memory */
+shm_internal int index_reserve(struct shard_t* sh) {
+  return sh->art != NULL ? art_reserve(sh->art) : rb_tree_reserve(sh->tree);
+}
+
+shm_internal int index_query(struct shard_t* sh, void** d) {
+  return sh->art != NULL ? art_query(sh->art, d) : rb_tree_query(sh->tree, d);
+}
+
+shm_internal int index_del(struct shard_t* sh, void** d) {
+  return sh->art != NULL ? art_del(sh->art, d) : rb_tree_del(sh->tree, d);
+}
+
+shm_internal void index_foreach(struct shard_t* sh, void (*fn)(void* data, void* ctx), void* ctx) {
+  if (sh->art != NULL)
+    art_foreach(sh->art, fn, ctx);
+  else
+    rb_tree_foreach(sh->tree, fn, ctx);
+}
+
+shm_internal size_t index_count(struct shard_t* sh) {
+  return sh->art != NULL ? sh->art->count : sh->tree->count;
+}
+
+shm_internal size_t index_bytes(struct shard_t* sh) {
+  return sh->art != NULL ? art_bytes(sh->art) : shm_pool_bytes(&sh->tree->nodes);
+}
+
+shm_internal uint64_t now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* round up, so a timer never fires before its deadline */
+shm_internal uint64_t ms_to_tick(uint64_t ms) {
+  return (ms + SHM_TTL_TICK_MS - 1) / SHM_TTL_TICK_MS;
+}
+
+shm_internal bool data_expired(struct shard_t* sh, struct data_t* d, uint64_t now) {
+  return data_hdr(sh, d)->expire <= now;
+}
+
+shm_internal int data_schedule(struct shard_t* sh, struct data_t* d, uint64_t expire) {
+  struct timer_node* t = NULL;
+
+  if (d->timer == NULL && E_SHM_OK != data_timer(sh, expire, &t))
+    return E_SHM_SYSTEM;
+  data_arm(sh, d, expire, t);
+  return E_SHM_OK;
+}
+
+/*
+ * a timer node for a deadline of expire, NULL for none, taken before a
+ * record is written so scheduling it can not fail once it is committed;
+ * the spare of shard_reserve is used first
+ */
+shm_internal int data_timer(struct shard_t* sh, uint64_t expire, struct timer_node** t) {
+  *t = NULL;
+  if (expire == 0)
+    return E_SHM_OK;
+  if (NULL != (*t = sh->timer_spare)) {
+    sh->timer_spare = NULL;
+    return E_SHM_OK;
+  }
+  if (NULL == (*t = (struct timer_node*)calloc(1, sizeof(struct timer_node))))
+    return E_SHM_SYSTEM;
+  return E_SHM_OK;
+}
+
+/* data_schedule with t of data_timer, it is freed if d has a timer already */
+shm_internal void data_arm(struct shard_t* sh, struct data_t* d, uint64_t expire, struct timer_node* t) {
+  if (d->timer != NULL) {
+    timer_wheel_del(sh->wheel, d->timer);
+    free(t);
+    t = d->timer;
+    d->timer = NULL;
+  }
+
+  if (expire == 0) {
+    free(t);
+    return;
+  }
+
+  d->timer = t;
+  t->data = d;
+  t->expire = ms_to_tick(expire);
+  timer_wheel_add(sh->wheel, t);
+}
+
+/* set the reference bit for the clock hand, avoid dirtying the line twice */
+shm_internal void data_touch(struct shard_t* sh, struct data_t* d) {
+  struct shm_data_header* hdr = data_hdr(sh, d);
+  if (!(hdr->flags & HDR_F_REF))
+    __sync_fetch_and_or(&hdr->flags, HDR_F_REF);
+}
+
+/* expire_fn of the timer wheel */
+shm_internal void data_expire(struct timer_node* n, void* ctx) {
+  struct shard_t* sh = (struct shard_t*)ctx;
+  data_free(sh, (struct data_t*)n->data);
+  ++sh->expirations;
+}
+
+/* drop d and keep its space in the free lists */
+shm_internal void data_free(struct shard_t* sh, struct data_t* d) {
+  data_drop(sh, d);
+  data_free_push(sh, d);
+}
+
+/*
+ * drop d from the index, flagging the record is a single store, so a crash
+ * leaves it either alive or free
+ */
+shm_internal void data_drop(struct shard_t* sh, struct data_t* d) {
+  data_retire(sh, d);
+  data_unindex(sh, d);
+}
+
+/*
+ * flag the record of d free, and the chunks of its value after it. a crash
+ * in between leaves chunks no record refers to, which recovery frees, and
+ * recovery sorts the chunks out on its own, see data_chunks_sort. chunks
+ * quarantined already stay aside
+ */
+shm_internal void data_retire(struct shard_t* sh, struct data_t* d) {
+  uint32_t i = 0;
+  struct data_t* chunk = NULL;
+  struct chunk_table* table = NULL;
+  struct shm_data_header* hdr = data_hdr(sh, d);
+  struct shmseg_ptr sptr = { { -1, 0 }, NULL };
+
+  hdr->flags |= HDR_F_FREE;
+  if (!(hdr->flags & HDR_F_CHUNKED) || sh->loading || NULL == (table = hdr_chunks(hdr)))
+    return;
+
+  for (i = 0; i < table->count; ++i) {
+    sptr.base = table->chunks[i];
+    sptr.cache_ptr = NULL;
+    if (!shmseg_valid(&sh->segs, &sptr, hdr_size))
+      continue;
+    hdr = (struct shm_data_header*)shmseg_ptr_ptr(&sh->segs, &sptr);
+    if ((hdr->flags & (HDR_F_CHUNK | HDR_F_FREE | HDR_F_QUARANTINE)) != HDR_F_CHUNK)
+      continue;
+    hdr->flags |= HDR_F_FREE;
+    if (NULL != (chunk = data_alloc(sh))) {
+      chunk->base_sptr = sptr;
+      data_free_push(sh, chunk);
+    }
+  }
+}
+
+shm_internal void data_unindex(struct shard_t* sh, struct data_t* d) {
+  void* removed = d;
+
+  if (E_SHM_OK == index_del(sh, &removed))
+    ++sh->filter_stale;
+  if (d->timer != NULL) {
+    timer_wheel_del(sh->wheel, d->timer);
+    free(d->timer);
+  }
+  d->timer = NULL;
+}
+
+/*
+ * take a bad record out of use for good: its sizes can not be trusted, so its
+ * space is never reused, and it stays in the chain to keep the records behind
+ * it reachable. d must not be in the index
+ */
+shm_internal void data_quarantine(struct shard_t* sh, struct data_t* d) {
+  data_hdr(sh, d)->flags |= HDR_F_QUARANTINE;
+  d->next_free = sh->quarantine;
+  sh->quarantine = data_handle(sh, d);
+  ++sh->quarantined;
+}
+
+/*
+ * quarantine the live record at base_sptr found bad by the scrubber, the key
+ * indexes it as long as the key itself is intact. return a copy of the key to
+ * report, NULL if it can not be read
+ */
+shm_internal char* data_quarantine_at(struct shard_t* sh, struct shmseg_ptr* base_sptr, struct shm_data_header* hdr) {
+  char* key = NULL;
+  uint32_t n = hdr->data_size;
+  struct data_t stub, *d = NULL;
+
+  if (n > 0 && n <= UINT32_MAX - hdr_size &&
+      shmseg_valid(&sh->segs, base_sptr, hdr_size + n) &&
+      memchr(hdr_key(hdr), 0, n) != NULL) {
+    key = strdup(hdr_key(hdr));
+    stub.key = hdr_key(hdr);
+    d = &stub;
+    if (E_SHM_OK == index_query(sh, (void**)&d) &&
+        d->base_sptr.base.shm_key == base_sptr->base.shm_key &&
+        d->base_sptr.base.off == base_sptr->base.off) {
+      data_unindex(sh, d);
+    } else {
+      d = NULL;
+    }
+  }
+
+  // a record the index lost track of still has to be kept aside
+  if (d == NULL && NULL != (d = data_alloc(sh)))
+    d->base_sptr = *base_sptr;
+
+  if (d != NULL)
+    data_quarantine(sh, d);
+  else
+    hdr->flags |= HDR_F_QUARANTINE;
+  return key;
+}
+
+/*
+ * CLOCK over the record chain: the hand clears the reference bit of the
+ * records it passes, and takes the first unreferenced one which is big
+ * enough for total_size. it gives up after passing every live record twice
+ */
+shm_internal struct data_t* data_evict(struct shard_t* sh, uint32_t total_size) {
+  size_t limit = 2 * index_count(sh);
+  struct shm_data_header* hdr = NULL;
+  struct data_t stub, *d = NULL;
+
+  total_size = ((total_size + 15) >> 4) << 4;
+  while (limit > 0) {
+    if (sh->hand.base.shm_key == -1 &&
+        E_SHM_OK != shmseg_first_ptr(&sh->segs, &sh->hand))
+      return NULL;
+
+    hdr = (struct shm_data_header*)shmseg_ptr_ptr(&sh->segs, &sh->hand);
+    shmseg_ptr_reset(&sh->hand);
+    sh->hand.base = hdr->next;
+
+    // a chunk goes with the record of its key
+    if (hdr->flags & (HDR_F_FREE | HDR_F_QUARANTINE | HDR_F_CHUNK))
+      continue;
+
+    --limit;
+    if (hdr->flags & HDR_F_REF) {
+      hdr->flags &= ~HDR_F_REF;
+      continue;
+    }
+
+    stub.key = hdr_key(hdr);
+    d = &stub;
+    if (hdr->total_size < total_size || 
+        E_SHM_OK != index_query(sh, (void**)&d))
+      continue;
+
+    data_drop(sh, d);
+    ++sh->evictions;
+    return d;
+  }
+  return NULL;
+}
+
+shm_internal void data_free_push(struct shard_t* sh, struct data_t* d) {
+  int c = 31 - __builtin_clz(data_hdr(sh, d)->total_size);
+  d->next_free = sh->free_list[c];
+  sh->free_list[c] = data_handle(sh, d);
+  // room for the next write, which the hard budget might have refused
+  __atomic_store_n(&sh->budget_full, false, __ATOMIC_RELAXED);
+}
+
+/*
+ * first fit in the class of total_size, otherwise any record of the next
+ * class, which wastes less than 4 times of the size
+ */
+shm_internal struct data_t* data_free_pop(struct shard_t* sh, uint32_t total_size) {
+  int c = 0;
+  uint32_t* pp = NULL;
+  struct data_t* d = NULL;
+
+  total_size = ((total_size + 15) >> 4) << 4;
+  c = 31 - __builtin_clz(total_size);
+  for (pp = &sh->free_list[c]; *pp != 0; pp = &data_at(sh, *pp)->next_free) {
+    if (data_hdr(sh, data_at(sh, *pp))->total_size >= total_size)
+      break;
+  }
+
+  if (*pp == 0 && c + 1 < FREE_CLASSES)
+    pp = &sh->free_list[c + 1];
+
+  if ((d = data_at(sh, *pp)) != NULL) {
+    *pp = d->next_free;
+    d->timer = NULL;
+  }
+  return d;
+}
+
+/* table of a chunked record, NULL if its sizes do not add up */
+shm_internal struct chunk_table* hdr_chunks(struct shm_data_header* hdr) {
+  struct chunk_table* table = (struct chunk_table*)hdr_value(hdr);
+  uint32_t size = hdr_value_size(hdr);
+
+  if (size < sizeof(struct chunk_table) || 
+      table->count != (size - sizeof(struct chunk_table)) / sizeof(struct shmseg_ptr_base) ||
+      table->chunk_size == 0 || 
+      (uint64_t)table->chunk_size * table->count < table->size)
+    return NULL;
+  return table;
+}
+
+/*
+ * the table of a chunked value of size bytes of key, its chunks are filled
+ * in by data_new_chunked. NULL if out of memory
+ */
+shm_internal struct chunk_table* chunk_table_new(const char* key, uint32_t size) {
+  uint32_t room = chunk_room(strlen(key) + 1), count = room > 0 ? (size + room - 1) / room : 0;
+  struct chunk_table* table = NULL;
+
+  if (NULL == (table = (struct chunk_table*)calloc(1, chunk_table_size(count))))
+    return NULL;
+  table->size = size;
+  table->chunk_size = room;
+  table->count = count;
+  return table;
+}
+
+/*
+ * write the table->size bytes at cur to key as a chunked value: the chunks
+ * first, each linked and committed like any record but left out of the
+ * index, then the record of key with their table, in place of the one key
+ * had. a crash in between leaves the old record in the index, and chunks
+ * recovery frees again. the chunks of a failed write are freed right away.
+ * call with the write lock of sh held
+ */
+shm_internal int data_new_chunked(struct shard_t* sh, const char* key, struct iov_cursor* cur, 
+                                  struct chunk_table* table, uint64_t expire) {
+  int ec = E_SHM_OK;
+  uint32_t key_size = strlen(key) + 1, room = table->chunk_size, size = table->size;
+  uint32_t count = table->count, i = 0, n = 0, written = 0;
+  struct data_t stub, *old = &stub, *d = NULL;
+  struct h_value_t val;
+
+  if (key_size == 1)
+    return E_SHM_KEY_ZERO_LENGTH;
+  if (room == 0 || size == 0)
+    return E_SHM_INVALID_PARAMS;
+
+  // the budgets are checked for the whole value up front, like a batch
+  ec = data_budget(sh, (uint64_t)count * SHM_CHUNK_SIZE + hdr_size + key_size + chunk_table_size(count));
+  for (i = 0; i < count && ec == E_SHM_OK; ++i) {
+    n = size - i * room < room ? size - i * room : room;
+    ec = data_chunk(sh, key, key_size, cur, n, &d);
+    if (d != NULL) {
+      table->chunks[i] = d->base_sptr.base;
+      d->next_free = written;
+      written = data_handle(sh, d);
+    }
+  }
+
+  if (ec == E_SHM_OK) {
+    val.ptr = table;
+    val.size = val.max_size = chunk_table_size(count);
+    stub.key = key;
+    if (E_SHM_OK == index_query(sh, (void**)&old))
+      ec = data_replace(sh, old, key, &val, 0, expire, counter_pad(key), HDR_F_CHUNKED);
+    else
+      ec = data_new(sh, key, &val, 0, expire, counter_pad(key), HDR_F_CHUNKED);
+  }
+
+  // the chunks are reached by the table from now on, the descriptors go
+  while (written != 0) {
+    d = data_at(sh, written);
+    written = d->next_free;
+    if (ec == E_SHM_OK) {
+      chunk_forget(sh, d);
+    } else {
+      data_hdr(sh, d)->flags |= HDR_F_FREE;
+      data_free_push(sh, d);
+    }
+  }
+  return ec;
+}
+
+/*
+ * write a chunk of key with the next n bytes at cur, in a record of
+ * SHM_CHUNK_SIZE bytes. *d is set once the record is placed, NULL before
+ */
+shm_internal int data_chunk(struct shard_t* sh, const char* key, uint32_t key_size, 
+                            struct iov_cursor* cur, uint32_t n, struct data_t** d) {
+  int ec = E_SHM_OK;
+  uint32_t total_size = SHM_CHUNK_SIZE;
+  struct shm_data_header* hdr = NULL;
+
+  *d = NULL;
+  if (E_SHM_OK != (ec = data_place(sh, &total_size, d)))
+    return ec;
+
+  hdr = data_hdr(sh, *d);
+  memcpy(hdr + 1, key, key_size);
+  iov_gather(cur, (char*)(hdr + 1) + key_size, n);
+  hdr->data_size = key_size + n;
+  hdr->expire = 0;
+  hdr->raw_size = 0;
+  hdr->pad_size = 0;
+  // a new version for every write, see chunk_read
+  hdr->version = 0;
+  data_version(sh, hdr);
+  hdr->checksum = data_checksum(hdr);
+
+  if (hdr->flags & HDR_F_FREE) {
+    __sync_synchronize();
+    hdr->flags = HDR_F_CHUNK;
+    return E_SHM_OK;
+  }
+
+  hdr->flags = HDR_F_CHUNK;
+  data_link(sh, *d);
+  ec = data_commit(sh, *d);
+  shmseg_unlock(&sh->segs);
+  return ec;
+}
+
+/*
+ * after the walk of shard_init, keep the chunks the table of a record in the
+ * index refers to, out of any list, and free the others, which a crash left
+ * of a write or a free. chunks is the list of the chunk records walked,
+ * linked by next_free
+ */
+shm_internal int data_chunks_sort(struct shard_t* sh, uint32_t chunks) {
+  uint32_t i = 0, h = 0;
+  struct data_t* d = NULL;
+  struct chunk_sort sort;
+
+  memset(&sort, 0, sizeof(sort));
+  for (h = chunks; h != 0; h = data_at(sh, h)->next_free)
+    ++sort.count;
+  if (sort.count == 0)
+    return E_SHM_OK;
+
+  if (NULL == (sort.refs = (struct chunk_ref*)calloc(sort.count, sizeof(struct chunk_ref))))
+    return E_SHM_SYSTEM;
+  for (h = chunks, i = 0; h != 0; h = data_at(sh, h)->next_free, ++i) {
+    sort.refs[i].base = data_at(sh, h)->base_sptr.base;
+    sort.refs[i].handle = h;
+  }
+
+  qsort(sort.refs, sort.count, sizeof(struct chunk_ref), chunk_ref_cmp);
+  sort.sh = sh;
+  index_foreach(sh, chunk_mark, &sort);
+
+  for (i = 0; i < sort.count; ++i) {
+    d = data_at(sh, sort.refs[i].handle);
+    if (sort.refs[i].live) {
+      chunk_forget(sh, d);
+    } else {
+      data_hdr(sh, d)->flags |= HDR_F_FREE;
+      data_free_push(sh, d);
+    }
+  }
+  free(sort.refs);
+  return E_SHM_OK;
+}
+
+/* index_foreach callback of data_chunks_sort, mark the chunks of data */
+shm_internal void chunk_mark(void* data, void* ctx) {
+  struct chunk_sort* sort = (struct chunk_sort*)ctx;
+  struct shm_data_header* hdr = data_hdr(sort->sh, (struct data_t*)data);
+  struct chunk_table* table = NULL;
+  struct chunk_ref key, *ref = NULL;
+  uint32_t i = 0;
+
+  if (!(hdr->flags & HDR_F_CHUNKED) || NULL == (table = hdr_chunks(hdr)))
+    return;
+
+  for (i = 0; i < table->count; ++i) {
+    key.base = table->chunks[i];
+    ref = (struct chunk_ref*)bsearch(&key, sort->refs, sort->count, 
+                                     sizeof(struct chunk_ref), chunk_ref_cmp);
+    if (ref != NULL)
+      ref->live = true;
+  }
+}
+
+/*
+ * let the descriptor of a live chunk go, the table of its key reaches it. a
+ * chunk at the tail leaves a copy behind, the tail is only a position
+ */
+shm_internal void chunk_forget(struct shard_t* sh, struct data_t* d) {
+  if (sh->tail == d) {
+    sh->tail_chunk = *d;
+    sh->tail = &sh->tail_chunk;
+  }
+  shm_pool_free(&sh->descs, data_handle(sh, d));
+}
+
+shm_internal int chunk_ref_cmp(const void* left, const void* right) {
+  const struct shmseg_ptr_base* l = &((const struct chunk_ref*)left)->base;
+  const struct shmseg_ptr_base* r = &((const struct chunk_ref*)right)->base;
+
+  if (l->shm_key != r->shm_key)
+    return l->shm_key < r->shm_key ? -1 : 1;
+  return l->off < r->off ? -1 : l->off > r->off ? 1 : 0;
+}
+
+/*
+ * copy n bytes of the chunked value of hdr from byte off on to cur. every
+ * chunk read from is checked against its checksum, and its flags and version
+ * are taken again after the copy: a reader of another process might see a
+ * chunk the owner frees and writes again meanwhile, which always takes a new
+ * version. hdr might be a copy
+ */
+shm_internal int chunk_read(struct shmseg_chain* c, struct shm_data_header* hdr, uint32_t off, 
+                            struct iov_cursor* cur, uint32_t n) {
+  uint32_t i = 0, at = 0, k = 0, flags = 0;
+  uint64_t version = 0;
+  struct chunk_table* table = hdr_chunks(hdr);
+  struct shm_data_header* chunk = NULL;
+  struct shmseg_ptr sptr = { { -1, 0 }, NULL };
+
+  if (table == NULL || off > table->size || n > table->size - off)
+    return E_SHM_DATA_CORRUPTED;
+
+  for (i = off / table->chunk_size, at = off % table->chunk_size; n > 0; ++i, at = 0) {
+    if (i >= table->count)
+      return E_SHM_DATA_CORRUPTED;
+    sptr.base = table->chunks[i];
+    sptr.cache_ptr = NULL;
+    if (!shmseg_valid(c, &sptr, hdr_size))
+      return E_SHM_DATA_CORRUPTED;
+
+    chunk = (struct shm_data_header*)shmseg_ptr_ptr(c, &sptr);
+    flags = __atomic_load_n(&chunk->flags, __ATOMIC_ACQUIRE);
+    version = __atomic_load_n(&chunk->version, __ATOMIC_ACQUIRE);
+    k = table->chunk_size - at < n ? table->chunk_size - at : n;
+    if ((flags & (HDR_F_CHUNK | HDR_F_FREE | HDR_F_DIRTY | HDR_F_QUARANTINE)) != HDR_F_CHUNK ||
+        !data_intact(c, &sptr, chunk) ||
+        chunk->data_size < hdr_key_size(chunk) + at + k)
+      return E_SHM_DATA_CORRUPTED;
+
+    iov_scatter(cur, (const char*)hdr_value(chunk) + at, k);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (flags != __atomic_load_n(&chunk->flags, __ATOMIC_RELAXED) ||
+        version != __atomic_load_n(&chunk->version, __ATOMIC_RELAXED))
+      return E_SHM_DATA_CORRUPTED;
+    n -= k;
+  }
+  return E_SHM_OK;
+}
+
+shm_internal void iov_init(struct iov_cursor* cur, const struct iovec* iov, int iovcnt) {
+  cur->iov = iov;
+  cur->iovcnt = iovcnt;
+  cur->i = 0;
+  cur->off = 0;
+}
+
+/* bytes of the buffers of iov, UINT64_MAX if iov is not valid */
+shm_internal uint64_t iov_size(const struct iovec* iov, int iovcnt) {
+  uint64_t size = 0;
+  int i = 0;
+
+  if (iov == NULL || iovcnt < 0)
+    return UINT64_MAX;
+
+  for (i = 0; i < iovcnt; ++i) {
+    if (iov[i].iov_base == NULL && iov[i].iov_len > 0)
+      return UINT64_MAX;
+    size += iov[i].iov_len;
+  }
+  return size;
+}
+
+/* copy n bytes out of the buffers at cur to dst, and move cur past them */
+shm_internal void iov_gather(struct iov_cursor* cur, char* dst, size_t n) {
+  size_t k = 0;
+
+  for (; n > 0 && cur->i < cur->iovcnt; cur->off = 0, ++cur->i) {
+    k = cur->iov[cur->i].iov_len - cur->off;
+    if (k > n)
+      k = n;
+    memcpy(dst, (const char*)cur->iov[cur->i].iov_base + cur->off, k);
+    dst += k;
+    n -= k;
+    if (cur->off + k < cur->iov[cur->i].iov_len) {
+      cur->off += k;
+      break;
+    }
+  }
+}
+
+/* copy n bytes of src into the buffers at cur, and move cur past them */
+shm_internal void iov_scatter(struct iov_cursor* cur, const char* src, size_t n) {
+  size_t k = 0;
+
+  for (; n > 0 && cur->i < cur->iovcnt; cur->off = 0, ++cur->i) {
+    k = cur->iov[cur->i].iov_len - cur->off;
+    if (k > n)
+      k = n;
+    memcpy((char*)cur->iov[cur->i].iov_base + cur->off, src, k);
+    src += k;
+    n -= k;
+    if (cur->off + k < cur->iov[cur->i].iov_len) {
+      cur->off += k;
+      break;
+    }
+  }
+}
+
+/* a counter is a raw value of 8 bytes */
+shm_internal bool counter_of(struct data_t* d, struct shm_data_header* hdr) {
+  return hdr->raw_size == 0 && d->value.size == sizeof(int64_t);
+}
+
+shm_internal bool counter_aligned(struct data_t* d) {
+  return ((uintptr_t)d->value.ptr & (sizeof(int64_t) - 1)) == 0;
+}
+
+/* records start on 16 bytes, pad the key to put the value on 8 */
+shm_internal uint32_t counter_pad(const char* key) {
+  return (sizeof(int64_t) - (hdr_size + strlen(key) + 1) % sizeof(int64_t)) % sizeof(int64_t);
+}
+
+/*
+ * add to an aligned counter with atomics. the value is the tail of the bytes
+ * the checksum covers, and crc32 is affine, so the checksum is patched with
+ * the crc of the flipped bits (minus the crc of as many zeros) instead of
+ * being computed over the record again. the add is counted in HDR_F_ADDING
+ * until the patch is done, a crash in between leaves the count behind, and
+ * recovery computes the checksum again then, see data_verify
+ */
+shm_internal int64_t counter_add(struct shard_t* sh, struct data_t* d, int64_t delta) {
+  struct shm_data_header* hdr = data_hdr(sh, d);
+  int64_t old = 0;
+  uint64_t flipped = 0, zero = 0;
+
+  __atomic_fetch_add(&hdr->flags, HDR_ADDING_ONE, __ATOMIC_SEQ_CST);
+  old = __atomic_fetch_add((int64_t*)d->value.ptr, delta, __ATOMIC_SEQ_CST);
+  flipped = (uint64_t)old ^ (uint64_t)(old + delta);
+  __atomic_fetch_xor(&hdr->checksum, 
+                     (int)(shm_crc32((char*)&flipped, sizeof(flipped)) ^ 
+                           shm_crc32((char*)&zero, sizeof(zero))), 
+                     __ATOMIC_SEQ_CST);
+  __atomic_fetch_sub(&hdr->flags, HDR_ADDING_ONE, __ATOMIC_SEQ_CST);
+  data_version(sh, hdr);
+  return old + delta;
+}
+
+shm_internal void repl_log(struct shm_replog* l, const char* key, struct h_value_t* val, 
+                           uint32_t raw_size, uint64_t expire) {
+  struct repl_op op;
+  struct iovec iov[3];
+
+  memset(&op, 0, sizeof(op));
+  op.key_size = (uint32_t)strlen(key) + 1;
+  op.val_size = val->size;
+  op.max_size = val->max_size;
+  op.raw_size = raw_size;
+  op.expire = expire;
+  iov[0].iov_base = &op;
+  iov[0].iov_len = sizeof(op);
+  iov[1].iov_base = (void*)key;
+  iov[1].iov_len = op.key_size;
+  iov[2].iov_base = val->ptr;
+  iov[2].iov_len = val->size;
+  shm_replog_append(l, iov, 3);
+}
+
+/*
+ * repl_log of a value in the buffers of iov, parts has room for iovcnt + 2
+ * of them. followers get it in one piece
+ */
+shm_internal void repl_logv(struct shm_replog* l, const char* key, const struct iovec* iov, int iovcnt, 
+                            uint32_t size, uint64_t expire, struct iovec* parts) {
+  struct repl_op op;
+
+  memset(&op, 0, sizeof(op));
+  op.key_size = (uint32_t)strlen(key) + 1;
+  op.val_size = size;
+  op.max_size = size;
+  op.expire = expire;
+  parts[0].iov_base = &op;
+  parts[0].iov_len = sizeof(op);
+  parts[1].iov_base = (void*)key;
+  parts[1].iov_len = op.key_size;
+  memcpy(parts + 2, iov, iovcnt * sizeof(struct iovec));
+  shm_replog_append(l, parts, iovcnt + 2);
+}
+
+/*
+ * apply a record of the log, a single op as a set, several as a batch
+ */
+shm_internal int repl_apply(struct hamster_follower* f, const char* rec, uint32_t size) {
+  int ec = E_SHM_OK;
+  uint32_t off = 0, n = 0;
+  const char* key = NULL;
+  struct repl_op op;
+  struct h_value_t val;
+
+  hamster_batch_clear(f->batch);
+  while (off < size) {
+    if (size - off < sizeof(op))
+      return E_SHM_DATA_CORRUPTED;
+
+    memcpy(&op, rec + off, sizeof(op));
+    off += sizeof(op);
+    if (op.key_size < 2 || op.val_size > op.max_size || 
+        (uint64_t)op.key_size + op.val_size > size - off || rec[off + op.key_size - 1] != '\0')
+      return E_SHM_DATA_CORRUPTED;
+
+    key = rec + off;
+    val.ptr = (void*)(rec + off + op.key_size);
+    val.size = op.val_size;
+    val.max_size = op.max_size;
+    off += op.key_size + op.val_size;
+
+    if (n == 0 && off == size)
+      return store_put(f->st, key, &val, op.raw_size, op.expire, NULL);
+
+    if (E_SHM_OK != (ec = batch_add(f->batch, key, &val, 0, op.expire, op.raw_size)))
+      return ec;
+    ++n;
+  }
+  return hamster_store_write(f->st, f->batch);
+}
+
+/* crc of op, with checksum as 0, key and value */
+shm_internal uint32_t snap_checksum(struct repl_op* op, const char* key, const char* value) {
+  struct repl_op head = *op;
+  uint32_t crc = 0;
+
+  head.checksum = 0;
+  crc = shm_crc32((char*)&head, sizeof(head));
+  crc = shm_crc32_update(crc, (char*)key, op->key_size);
+  return shm_crc32_update(crc, (char*)value, op->val_size);
+}
+
+/*
+ * write the record of d to a snapshot, a copy of its value is what the
+ * checksum covers, counters might be added to meanwhile
+ */
+shm_internal void snap_write(void* data, void* ctx) {
+  struct snap_ctx* c = (struct snap_ctx*)ctx;
+  struct data_t* d = (struct data_t*)data;
+  struct shm_data_header* hdr = data_hdr(c->sh, d);
+  uint32_t size = 0;
+  char* buf = NULL;
+  struct iovec iov;
+  struct iov_cursor cur;
+
+  if (c->ec != E_SHM_OK || (hdr->flags & HDR_F_QUARANTINE) ||
+      (d->timer != NULL && data_expired(c->sh, d, c->now)))
+    return;
+
+  size = data_value_size(c->sh, d);
+  if (size > c->cap) {
+    if (NULL == (buf = (char*)realloc(c->buf, size))) {
+      c->ec = E_SHM_SYSTEM;
+      return;
+    }
+    c->buf = buf;
+    c->cap = size;
+  }
+
+  // a chunked value is written in one piece, a bad chunk loses it like a
+  // quarantined record
+  iov.iov_base = c->buf;
+  iov.iov_len = size;
+  iov_init(&cur, &iov, 1);
+  if (E_SHM_OK != data_read(c->sh, d, 0, &cur, size))
+    return;
+  c->ec = snap_put(c->f, d->key, c->buf, size, 
+                   hdr->flags & HDR_F_CHUNKED ? size : d->value.max_size, 
+                   hdr->raw_size, hdr->expire);
+}
+
+shm_internal int snap_begin(FILE* f, uint64_t pos, uint64_t lsn) {
+  struct snap_header hdr;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic));
+  hdr.pos = pos;
+  hdr.lsn = lsn;
+  return fwrite(&hdr, sizeof(hdr), 1, f) == 1 ? E_SHM_OK : E_SHM_SYSTEM;
+}
+
+shm_internal int snap_put(FILE* f, const char* key, const void* value, uint32_t size, 
+                          uint32_t max_size, uint32_t raw_size, uint64_t expire) {
+  struct repl_op op;
+
+  memset(&op, 0, sizeof(op));
+  op.key_size = (uint32_t)strlen(key) + 1;
+  op.val_size = size;
+  op.max_size = max_size;
+  op.raw_size = raw_size;
+  op.expire = expire;
+  op.checksum = snap_checksum(&op, key, (const char*)value);
+  if (fwrite(&op, sizeof(op), 1, f) != 1 || 
+      fwrite(key, op.key_size, 1, f) != 1 ||
+      fwrite(value, 1, size, f) != size)
+    return E_SHM_SYSTEM;
+  return E_SHM_OK;
+}
+
+/* the end op, a snapshot cut short has none */
+shm_internal int snap_end(FILE* f) {
+  struct repl_op end;
+
+  memset(&end, 0, sizeof(end));
+  return fwrite(&end, sizeof(end), 1, f) == 1 && fflush(f) == 0 ? E_SHM_OK : E_SHM_SYSTEM;
+}
+
+/*
+ * load a snapshot into st, and tell the end of the log it was taken at
+ */
+shm_internal int snap_load(struct hamster_store* st, FILE* f, uint64_t* pos, uint64_t* lsn) {
+  int ec = E_SHM_OK;
+  uint32_t cap = 0;
+  char* buf = NULL, *grown = NULL;
+  struct snap_header hdr;
+  struct repl_op op;
+  struct h_value_t val;
+  struct hamster_batch* b = NULL;
+
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic)) != 0)
+    return E_SHM_DATA_CORRUPTED;
+
+  if (E_SHM_OK != (ec = hamster_batch_new(&b)))
+    return ec;
+
+  for (;;) {
+    if (fread(&op, sizeof(op), 1, f) != 1) {
+      ec = E_SHM_DATA_CORRUPTED;
+      break;
+    }
+    if (op.key_size == 0)
+      break;
+
+    if (op.val_size > op.max_size || op.key_size > UINT32_MAX / 2 || op.val_size > UINT32_MAX / 2) {
+      ec = E_SHM_DATA_CORRUPTED;
+      break;
+    }
+
+    if (op.key_size + op.val_size > cap) {
+      if (NULL == (grown = (char*)realloc(buf, op.key_size + op.val_size))) {
+        ec = E_SHM_SYSTEM;
+        break;
+      }
+      buf = grown;
+      cap = op.key_size + op.val_size;
+    }
+
+    if (fread(buf, 1, op.key_size + op.val_size, f) != op.key_size + op.val_size ||
+        buf[op.key_size - 1] != '\0' ||
+        op.checksum != snap_checksum(&op, buf, buf + op.key_size)) {
+      ec = E_SHM_DATA_CORRUPTED;
+      break;
+    }
+
+    // written a batch at a time, each shard gets one allocation for it
+    val.ptr = buf + op.key_size;
+    val.size = op.val_size;
+    val.max_size = op.max_size;
+    if (E_SHM_OK != (ec = batch_add(b, buf, &val, 0, op.expire, op.raw_size)) ||
+        (b->size >= SHM_LOAD_BATCH && E_SHM_OK != (ec = hamster_store_write(st, b))))
+      break;
+    if (b->size >= SHM_LOAD_BATCH)
+      hamster_batch_clear(b);
+  }
+
+  if (ec == E_SHM_OK)
+    ec = hamster_store_write(st, b);
+  hamster_batch_free(b);
+  free(buf);
+  *pos = hdr.pos;
+  *lsn = hdr.lsn;
+  return ec;
+}
+
+/*
+ * copy the record at at out and move at to the next one. the owner might
+ * write it meanwhile, a copy failing its checksum is taken up to 3 more
+ * times before the record counts as bad. a torn next could link the chain
+ * into a cycle, a chain has no more records than 16 bytes units
+ */
+shm_internal int reader_step(struct hamster_reader* r, struct shmseg_chain* c, 
+                             struct shmseg_ptr* at, uint64_t* steps) {
+  int found = READ_BAD, tries = 0;
+  uint32_t total = 0, flags = 0;
+  uint64_t version = 0;
+  bool settled = false;
+  char* buf = NULL;
+  struct shm_data_header h;
+  struct shm_data_header* hdr = NULL;
+  struct shm_data_header* live = NULL;
+
+  if (at->base.shm_key == -1 || ++*steps > c->size / 16 || !shmseg_valid(c, at, hdr_size))
+    return READ_END;
+
+  for (tries = 0; tries < 4 && found == READ_BAD; ++tries) {
+    live = (struct shm_data_header*)shmseg_ptr_ptr(c, at);
+    memcpy(&h, live, hdr_size);
+    if (h.total_size < hdr_size || !shmseg_valid(c, at, h.total_size)) {
+      hdr = &h;
+      continue;
+    }
+
+    if (h.total_size > r->cap) {
+      if (NULL == (buf = (char*)realloc(r->buf, h.total_size)))
+        return READ_END;
+      r->buf = buf;
+      r->cap = h.total_size;
+    }
+    total = h.total_size;
+    // an unsealed record, or a counter an add is left on, is taken as a
+    // seqlock: no update began before the copy, and none ended or is going
+    // on after it
+    flags = __atomic_load_n(&live->flags, __ATOMIC_ACQUIRE);
+    version = __atomic_load_n(&live->version, __ATOMIC_ACQUIRE);
+    memcpy(r->buf, live, total);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    settled = !(flags & HDR_F_DIRTY) && 
+              !(__atomic_load_n(&live->flags, __ATOMIC_RELAXED) & HDR_F_DIRTY) &&
+              version == __atomic_load_n(&live->version, __ATOMIC_RELAXED);
+    hdr = (struct shm_data_header*)r->buf;
+
+    if (hdr->flags & HDR_F_QUARANTINE)
+      break;
+    if (hdr->flags & HDR_F_FREE)
+      found = READ_FREE;
+    else if (hdr->total_size != total || hdr->data_size > total - hdr_size ||
+             NULL == memchr(hdr + 1, 0, hdr->data_size) ||
+             hdr_key_size(hdr) + hdr->pad_size > hdr->data_size ||
+             ((hdr->flags & (HDR_F_UNSEALED | HDR_F_ADDING)) ? !settled 
+                                                            : hdr->checksum != data_checksum(hdr)))
+      found = READ_BAD;
+    else if (hdr->expire != 0 && hdr->expire <= r->now)
+      found = READ_FREE;
+    else
+      found = READ_LIVE;
+  }
+
+  shmseg_ptr_reset(at);
+  *(struct shmseg_ptr_base*)at = hdr->next;
+  return found;
+}
+
+/*
+ * gather the value of the live record reader_step copied last, if it is
+ * chunked, E_SHM_EMPTY is returned for a chunk, which has no key of its own
+ */
+shm_internal int reader_gather(struct hamster_reader* r, struct shmseg_chain* c) {
+  struct shm_data_header* hdr = (struct shm_data_header*)r->buf;
+  struct chunk_table* table = NULL;
+  char* buf = NULL;
+  struct iovec iov;
+  struct iov_cursor cur;
+
+  if (hdr->flags & HDR_F_CHUNK)
+    return E_SHM_EMPTY;
+  if (!(hdr->flags & HDR_F_CHUNKED))
+    return E_SHM_OK;
+  if (NULL == (table = hdr_chunks(hdr)))
+    return E_SHM_DATA_CORRUPTED;
+
+  if (table->size > r->val_cap) {
+    if (NULL == (buf = (char*)realloc(r->val, table->size)))
+      return E_SHM_SYSTEM;
+    r->val = buf;
+    r->val_cap = table->size;
+  }
+
+  iov.iov_base = r->val;
+  iov.iov_len = table->size;
+  iov_init(&cur, &iov, 1);
+  return chunk_read(c, hdr, 0, &cur, table->size);
+}
+
+#ifdef UNITTEST
+shm_internal void unittest_shmseg_sim_crash(struct shmseg_chain* c);
+shm_internal void unittest_hamster_store_sim_crash(struct hamster_store* st) {
+  uint32_t i = 0;
+  hamster_store_scrub_stop(st);
+  seal_join(st);
+  store_unregister(st);
+  for (i = 0; i < st->shard_count; ++i) {
+    shard_free(&st->shards[i]);
+    unittest_shmseg_sim_crash(&st->shards[i].segs);
+  }
+  shm_notify_detach(st->notify, false);
+  shm_replog_detach(st->replog, false);
+  store_free(st);
+}
+
+shm_internal void unittest_hamster_sim_crash() {
+  if (g_default != NULL)
+    unittest_hamster_store_sim_crash(g_default);
+  g_default = NULL;
+}
+
+/* leave key half rewritten in place, as if we crash in data_update */
+shm_internal void unittest_hamster_store_tear(struct hamster_store* st, const char* key) {
+  struct shard_t* sh = shard_of(st, key);
+  struct data_t* d = NULL;
+
+  pthread_rwlock_wrlock(&sh->lock);
+  if (E_SHM_OK == data_lookup(sh, key, &d)) {
+    data_hdr(sh, d)->flags |= HDR_F_DIRTY;
+    ((char*)d->value.ptr)[0] ^= 0xff;
+  }
+  pthread_rwlock_unlock(&sh->lock);
+}
+
+/* add to counter key, as if we crash in counter_add before the checksum is patched */
+shm_internal void unittest_hamster_store_tear_add(struct hamster_store* st, const char* key, int64_t delta) {
+  struct shard_t* sh = shard_of(st, key);
+  struct data_t* d = NULL;
+
+  pthread_rwlock_wrlock(&sh->lock);
+  if (E_SHM_OK == data_lookup(sh, key, &d)) {
+    __atomic_fetch_add(&data_hdr(sh, d)->flags, HDR_ADDING_ONE, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add((int64_t*)d->value.ptr, delta, __ATOMIC_SEQ_CST);
+  }
+  pthread_rwlock_unlock(&sh->lock);
+}
+
+/* flip a byte of the i-th chunk of key, as a bit rot its checksum catches */
+shm_internal void unittest_hamster_store_rot_chunk(struct hamster_store* st, const char* key, uint32_t i) {
+  struct shard_t* sh = shard_of(st, key);
+  struct data_t* d = NULL;
+  struct chunk_table* table = NULL;
+  struct shmseg_ptr sptr = { { -1, 0 }, NULL };
+
+  pthread_rwlock_wrlock(&sh->lock);
+  if (E_SHM_OK == data_lookup(sh, key, &d) && 
+      NULL != (table = hdr_chunks(data_hdr(sh, d))) && i < table->count) {
+    sptr.base = table->chunks[i];
+    ((char*)hdr_value((struct shm_data_header*)shmseg_ptr_ptr(&sh->segs, &sptr)))[0] ^= 0xff;
+  }
+  pthread_rwlock_unlock(&sh->lock);
+}
+
+/*
+ * write key as data_new does up to the commit of its record, and die there
+ * with the chain lock held. run it in a child, see owner_dead
+ */
+shm_internal void unittest_hamster_store_set_kill(struct hamster_store* st, const char* key, struct h_value_t* val) {
+  struct shard_t* sh = shard_of(st, key);
+  struct data_t* d = NULL;
+  uint32_t key_size = strlen(key) + 1, total_size = hdr_size + key_size + val->max_size;
+
+  pthread_rwlock_wrlock(&sh->lock);
+  if (E_SHM_OK == data_place(sh, &total_size, &d) && !(data_hdr(sh, d)->flags & HDR_F_FREE)) {
+    data_fill(sh, d, key, key_size, val, 0, 0, 0);
+    data_add(sh, d);
+  }
+  kill(getpid(), SIGKILL);
+}
+
+/* index of the shard of key in st */
+shm_internal uint32_t unittest_hamster_store_shard(struct hamster_store* st, const char* key) {
+  return (uint32_t)(shard_of(st, key) - st->shards);
+}
+
+/*
+ * write b as hamster_store_write does up to the link of every shard, or up
+ * to the index if linked, and die there. run it in a child, see the batch
+ * tests
+ */
+shm_internal void unittest_hamster_store_write_kill(struct hamster_store* st, struct hamster_batch* b, bool linked) {
+  uint32_t i = 0, *shard_of_op = (uint32_t*)malloc(b->count * sizeof(uint32_t));
+  uint64_t shards = batch_route(st, b, shard_of_op);
+  struct batch_resv* rs = (struct batch_resv*)calloc(st->shard_count, sizeof(struct batch_resv));
+
+  for (i = 0; i < st->shard_count; ++i) {
+    if (shards & ((uint64_t)1 << i))
+      pthread_rwlock_wrlock(&st->shards[i].lock);
+  }
+  if (E_SHM_OK == batch_prepare(st, b, shard_of_op, shards, now_ms(), rs) && linked) {
+    for (i = 0; i < st->shard_count; ++i) {
+      if (rs[i].ds != NULL)
+        batch_link(&st->shards[i], &rs[i]);
+    }
+  }
+  kill(getpid(), SIGKILL);
+}
+
+/* filters of st are rebuilt with bits per key from now on, not those set */
+shm_internal void unittest_hamster_store_filter_bits(struct hamster_store* st, uint32_t bits) {
+  uint32_t i = 0;
+  for (i = 0; i < st->shard_count; ++i) {
+    pthread_rwlock_wrlock(&st->shards[i].lock);
+    st->shards[i].filter_bits = bits;
+    pthread_rwlock_unlock(&st->shards[i].lock);
+  }
+}
+
+/* roll the commit marker back over the tail, as if we crash before commit */
+shm_internal void unittest_hamster_uncommit_tail(const char* key) {
+  struct shard_t* sh = shard_of(g_default, key);
+  struct shmseg_ptr sptr = sh->tail->base_sptr;
+  shmseg_commit(&sh->segs, &sptr, 0);
 }
 #endif
 
 #undef hdr_size
+#undef compress_cap
+#undef data_at
+#undef data_handle
 
@@ -3,18 +3,244 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-struct h_value_t;
+struct hamster_store;
+struct hamster_watch;
+struct hamster_batch;
+struct hamster_follower;
+struct hamster_reader;
+
+/*
+ * a value. hamster_value_new makes one on the heap, it may as well live on
+ * the stack of the caller, with no allocation per call
+ */
+struct h_value_t {
+  /* pointer to value */
+  void* ptr;
+  /* size of this value */
+  uint32_t size;
+  /* max size of this value */
+  uint32_t max_size; 
+};
+
+/* flags of hamster_options.segment_flags */
+#define HAMSTER_SEG_PREFAULT  0x1  /* fault new segments in when they are created */
+#define HAMSTER_SEG_MLOCK     0x2  /* lock new segments in memory, best effort */
+#define HAMSTER_SEG_PRECREATE 0x4  /* create the next segment ahead on a background thread */
+
+/* numa policies of hamster_options.numa_policy, see hamster_open */
+#define HAMSTER_NUMA_NONE       0
+#define HAMSTER_NUMA_BIND       1
+#define HAMSTER_NUMA_INTERLEAVE 2
+#define HAMSTER_NUMA_PER_NODE   3
+
+/* indexes of hamster_options.index, see hamster_open */
+#define HAMSTER_INDEX_RB_TREE 0
+#define HAMSTER_INDEX_ART     1
+
+/*
+ * options of hamster_open, zero-fill it to take the defaults
+ */
+struct hamster_options {
+  key_t    key;           /* first shm key, 0 picks one by the store name */
+  uint32_t shards;        /* number of shards, 0 for 1 */
+  size_t   segment_min;   /* bytes of the first segment, 0 for SHM_SIZE_IN_PAGES pages */
+  size_t   segment_max;   /* cap of segment growth, 0 for SHM_SEG_MAX_PAGES pages */
+  uint32_t segment_flags; /* HAMSTER_SEG_*, keeps segment roll-over off the write path */
+  uint64_t capacity;      /* see hamster_set_capacity */
+  uint32_t compress_min;  /* see hamster_set_compression */
+  uint32_t numa_policy;   /* HAMSTER_NUMA_* */
+  uint32_t numa_node;     /* node of HAMSTER_NUMA_BIND */
+  uint32_t filter_bits;   /* see hamster_set_filter */
+  size_t   replog_size;   /* bytes of the replication log, 0 for none, see hamster_follow */
+  uint32_t seal_ms;       /* see hamster_set_sealing */
+  uint32_t index;         /* HAMSTER_INDEX_*, of the keys in process memory */
+  uint64_t budget_soft;   /* see hamster_set_budget */
+  uint64_t budget_hard;
+  uint32_t chunk_min;     /* see hamster_set_chunking */
+};
+
+struct hamster_stat {
+  uint64_t hits;         /* hamster_get found the key */
+  uint64_t misses;       /* hamster_get did not */
+  double   hit_ratio;    /* hits / (hits + misses) */
+  uint64_t evictions;    /* keys evicted to stay within capacity */
+  uint64_t expirations;  /* keys reclaimed by hamster_expire */
+  uint64_t bytes;        /* shm bytes of all segments */
+  uint64_t capacity;     /* byte cap, 0 for unbounded */
+  uint64_t quarantined;  /* records failing their checksum, see hamster_scrub */
+  uint64_t scrubbed;     /* bytes verified by the scrubber */
+  uint64_t sealed;       /* checksums of combined updates, see hamster_set_sealing */
+  uint64_t unsealed;     /* records waiting for theirs */
+  uint64_t filter_skips;            /* lookups of missing keys the filter answered */
+  uint64_t filter_false_positives;  /* lookups of missing keys it let through */
+  double   filter_fp_rate;          /* false positives / missing keys looked up */
+  uint64_t index_bytes;  /* process memory for record descriptors and the index */
+  uint64_t replog_lag_bytes;    /* log bytes the last follower to report has not applied */
+  uint64_t replog_lag_records;  /* log records it has not applied */
+};
+
+/*
+ * how far a follower is behind its log, see hamster_follower_lag
+ */
+struct hamster_lag {
+  uint64_t bytes;    /* bytes of the log not applied yet */
+  uint64_t records;  /* records of the log not applied yet */
+};
+
+/*
+ * a record as hamster_reader_next finds it, key and value point into the
+ * reader and are good until its next call
+ */
+struct hamster_record {
+  const char* key;
+  const void* value;
+  uint32_t    size;      /* bytes of value */
+  uint32_t    max_size;  /* bytes the record has room for */
+  uint32_t    raw_size;  /* size before compression, 0 if value is stored raw */
+  uint32_t    shard;
+  uint64_t    expire;    /* deadline in CLOCK_MONOTONIC ms, 0 for never */
+  uint64_t    version;
+};
+
+/*
+ * what the records of a shard take up, see hamster_reader_occupancy
+ */
+struct hamster_occupancy {
+  uint32_t segments;
+  uint64_t bytes;        /* shm bytes of the segments */
+  uint64_t used;         /* bytes up to the end of the last record of each */
+  uint64_t records;      /* records in the chain, live or not */
+  uint64_t live;         /* records of live keys */
+  uint64_t live_bytes;   /* bytes they take, headers and slack included */
+  uint64_t value_bytes;  /* bytes of their values, as stored */
+  uint64_t free;         /* records free or expired, waiting to be reused */
+  uint64_t free_bytes;
+  uint64_t bad;          /* records quarantined or failing their checksum */
+};
+
+/*
+ * a segment of a shard, see hamster_reader_segment
+ */
+struct hamster_segment {
+  key_t    shm_key;
+  size_t   size;       /* bytes of the segment */
+  uint32_t used;       /* bytes up to the end of the last record */
+  uint32_t committed;  /* bytes up to the commit marker */
+};
+
+/*
+ * a change of a store, see hamster_watch_next
+ */
+struct hamster_change {
+  uint64_t seq;       /* number of the change, from 1 on */
+  uint32_t hash;      /* hash of the key */
+  uint32_t key_size;  /* length of the key */
+  char     key[48];   /* the key, its first 47 bytes if it is longer */
+};
+
+/*
+ * called for a record the scrubber finds corrupted, key is NULL if it can not
+ * be read. the record is quarantined already. it runs with the scrubber
+ * blocked, and must not start or stop it
+ */
+typedef void (*hamster_corrupt_fn)(struct hamster_store* store, const char* key, void* ctx);
+
+/*
+ * called after a write grew the store beyond its soft budget, with used the
+ * bytes of its segments. it runs with no lock held, and might expire, delete
+ * or evict keys of the store to make room
+ */
+typedef void (*hamster_budget_fn)(struct hamster_store* store, uint64_t used, void* ctx);
+
+/* levels of hamster_budget.level */
+#define HAMSTER_BUDGET_OK   0  /* within the soft budget */
+#define HAMSTER_BUDGET_SOFT 1  /* beyond the soft budget */
+#define HAMSTER_BUDGET_HARD 2  /* a write was refused at the hard budget, and none took room since */
+
+/*
+ * shm usage of a store against its budgets, see hamster_budget
+ */
+struct hamster_budget {
+  uint64_t used;      /* bytes of all segments */
+  uint64_t soft;      /* 0 for none */
+  uint64_t hard;      /* 0 for none */
+  uint64_t rejected;  /* writes refused with E_SHM_BUDGET_EXCEEDED */
+  uint32_t level;     /* HAMSTER_BUDGET_* */
+};
+
+/*
+ * open a store, a process might open several independent stores, each with
+ * its own shm keys, segment sizes, index and policies. shard i of the store
+ * uses the keys from key + i * SHM_KEY_RANGE on, but the last key of shard 0
+ * holds the change ring (see hamster_watch_open) and the one before it the
+ * replication log (see hamster_follow), and a key derived from name
+ * leaves room for SHM_SHARDS_MAX shards. the key ranges of stores open in one
+ * process must not overlap, E_SHM_INIT_ONLY_ONCE is returned otherwise.
+ * the shm of a store is tagged with a hash of its name, a store of another
+ * name which picked the same keys is not opened, E_SHM_NAME_MISMATCH is
+ * returned instead. nor is a store written by a build with another layout
+ * of records in shm, E_SHM_FORMAT_MISMATCH is returned: it has to be dumped
+ * by that build and loaded again, or removed. a store left by a crash is
+ * recovered, E_SHM_DATA_CORRUPTED still opens it with the damaged records
+ * quarantined (see hamster_scrub), only if the link to the next record is
+ * damaged too the rest of the chain is cut off.
+ * new records are linked under a robust lock in shm, so a process killed in
+ * the middle of a set does not leave it locked: the next one to open the
+ * store undoes that set, which never returned, instead of waiting.
+ *
+ * numa placement of the segments (it needs libnuma at build time, and is
+ * ignored otherwise): HAMSTER_NUMA_BIND places them on numa_node,
+ * HAMSTER_NUMA_INTERLEAVE spreads them over all nodes. HAMSTER_NUMA_PER_NODE
+ * keeps one shard per node in place of the shards option, each a full
+ * replica on its node: a set goes to every replica, and lookups only to the
+ * one of the node the caller runs on. it suits read-mostly data: a write
+ * locks every replica, in the same order for all writers, and checks the
+ * hard budget of each and reserves the memory and segments it takes there
+ * before any is written, so it goes to all replicas or none. a capacity is
+ * refused, replicas would evict different keys. only a write failing on a
+ * broken segment chain after the first replica leaves the earlier ones
+ * updated and returns E_SHM_REPLICA_PARTIAL, the key should be written again.
+ *
+ * keys are indexed in a red-black tree by default. HAMSTER_INDEX_ART takes
+ * an adaptive radix tree instead: a lookup costs the length of the key and
+ * not log n compares of it, which pays for keys with long shared prefixes,
+ * and it mostly takes less memory per key, see index_bytes of hamster_stat
+ */
+int hamster_open(const char* name, const struct hamster_options* opts, 
+                 struct hamster_store** store);
+
+/*
+ * release all resources of a store, its shm is deleted
+ */
+void hamster_close(struct hamster_store* store);
 
 /*
  * initialise data, call after shmseg_init
+ *
+ * the functions below without a store work on a default store, which
+ * hamster_init opens on SHM_KEY. as with hamster_open, the default store
+ * is open after E_SHM_DATA_CORRUPTED, with the damaged records quarantined,
+ * and a later hamster_init gets E_SHM_INIT_ONLY_ONCE until hamster_shutdown
  */
 int hamster_init();
 
+/*
+ * initialise a store of several shards, keys are hashed to the shards and
+ * each shard has its own index, segment chain (keys from
+ * SHM_KEY + i * SHM_KEY_RANGE) and lock, so writers of different shards run
+ * in parallel. a store must be reopened with the same number of shards,
+ * otherwise E_SHM_SHARDS_MISMATCH is returned. hamster_init() is the
+ * one-shard case
+ */
+int hamster_init_sharded(uint32_t shards);
+
 /*
  * release all resources
  */
@@ -55,16 +281,401 @@ void hamster_value_free(struct h_value_t* val);
  */
 int hamster_set(const char* key, struct h_value_t* val);
 
+/*
+ * set value to key like hamster_set, and the key expires ttl_ms milliseconds
+ * later, ttl_ms of 0 means never. hamster_set clears the ttl of a key
+ */
+int hamster_set_ttl(const char* key, struct h_value_t* val, uint32_t ttl_ms);
+
 /*
  * get value by key
+ * an expired key is reported as E_SHM_KEY_NOT_FOUND right away, even before
+ * it is reclaimed by hamster_expire. val points into shm, so a compressed
+ * value is reported as E_SHM_VAL_COMPRESSED, and a chunked one, which is not
+ * in one piece, as E_SHM_VAL_CHUNKED, read them by hamster_get_copy
  */
 int hamster_get(const char* key, struct h_value_t* val);
 
+/*
+ * copy value of key into buf of *size bytes, decompressing or gathering it
+ * if needed. *size is set to the size of value, and
+ * E_SHM_VAL_BUFFER_TOO_SMALL is returned if it does not fit, a *size of 0
+ * just asks for the size
+ */
+int hamster_get_copy(const char* key, void* buf, uint32_t* size);
+
+/*
+ * set the iovcnt buffers of iov, one after the other, as the value of key,
+ * like writev. a value of at least the chunking size (see
+ * hamster_set_chunking) goes into its chunks straight from the buffers,
+ * without being put together first, and replaces the record of key as a
+ * whole, others are put together and set like hamster_set_ttl
+ */
+int hamster_setv(const char* key, const struct iovec* iov, int iovcnt, uint32_t ttl_ms);
+
+/*
+ * copy the value of key from byte off on into the iovcnt buffers of iov, like
+ * preadv: as many bytes as they hold or the value has left, *size is set to
+ * the bytes copied. a value is read in pieces by calls with growing off,
+ * each call is consistent on its own. only the chunks in the range are read,
+ * and their checksums checked on the way, a bad one fails the call with
+ * E_SHM_DATA_CORRUPTED. compressed values get E_SHM_VAL_COMPRESSED
+ */
+int hamster_getv(const char* key, uint32_t off, const struct iovec* iov, int iovcnt, 
+                 uint32_t* size);
+
+/*
+ * get value by key like hamster_get, and its version for hamster_cas.
+ * every write of a key gives it a new version, greater than any the shard
+ * gave before
+ */
+int hamster_get_version(const char* key, struct h_value_t* val, uint64_t* version);
+
+/*
+ * set value to key like hamster_set, only if its version is still *version,
+ * 0 for a key which does not exist (or expired). otherwise
+ * E_SHM_VERSION_MISMATCH is returned. *version is set to the version of key
+ * after the call either way
+ */
+int hamster_cas(const char* key, struct h_value_t* val, uint64_t* version);
+
+/*
+ * add delta to the 64 bits integer value of key, in host byte order, and get
+ * the sum in *value (if not NULL). a missing or expired key is created with
+ * delta, without ttl. a value of another size gets E_SHM_VAL_NOT_COUNTER.
+ * counters created here are updated in place with atomic instructions, and
+ * their checksum is patched instead of computed again, so increments of a
+ * shard run in parallel
+ */
+int hamster_add(const char* key, int64_t delta, int64_t* value);
+int hamster_incr(const char* key, int64_t* value);
+
+/*
+ * a batch stages sets, which hamster_write then applies all together: the
+ * new records of a shard are written to a single reservation and linked into
+ * its chain by a single store, so readers, and recovery after a crash, see
+ * either all of them or none. keys and values are copied into the batch.
+ * values are stored raw, in new records rather than over the old ones
+ */
+int hamster_batch_new(struct hamster_batch** b);
+void hamster_batch_free(struct hamster_batch* b);
+
+/*
+ * empty b for reuse, it keeps its buffers
+ */
+void hamster_batch_clear(struct hamster_batch* b);
+uint32_t hamster_batch_count(struct hamster_batch* b);
+
+/*
+ * stage a set of key, a later set of the same key in b wins
+ */
+int hamster_batch_set(struct hamster_batch* b, const char* key, struct h_value_t* val);
+int hamster_batch_set_ttl(struct hamster_batch* b, const char* key, 
+                          struct h_value_t* val, uint32_t ttl_ms);
+
+/*
+ * apply b, it is left staged. the shards b writes to are locked together, and
+ * checked before any is written: E_SHM_CAPACITY_EXCEEDED is returned if a
+ * shard would grow beyond its capacity (a batch does not evict), and
+ * E_SHM_DATA_CORRUPTED if a key is quarantined. every shard reserves its
+ * records before any is linked, so an error leaves none of b visible. a
+ * crash is survived atomically within each shard, not across shards
+ */
+int hamster_write(struct hamster_batch* b);
+
+/*
+ * reclaim expired keys, their space is reused by later insertions.
+ * call it periodically, expired keys are counted by hamster_count until they
+ * are reclaimed. return number of keys reclaimed
+ */
+size_t hamster_expire();
+
+/*
+ * bound the shm segments of the store to about bytes (split evenly among
+ * shards), 0 for unbounded. once the cap is hit, new keys take over the space
+ * of old ones chosen by CLOCK: a hamster_get only sets a reference bit in shm,
+ * and the clock hand evicts the first key not referenced since it passed by.
+ * E_SHM_CAPACITY_EXCEEDED is returned if no key big enough can be evicted.
+ * segments already beyond the cap are kept
+ */
+int hamster_set_capacity(uint64_t bytes);
+
+/*
+ * bound the shm of the store by byte budgets (split evenly among shards like
+ * the capacity), 0 for none. a write which needs a shard to grow beyond
+ * soft reclaims the expired keys of the shard first, to reuse their space,
+ * and calls fn once it has grown anyway. a write which needs a shard to grow
+ * beyond hard fails with E_SHM_BUDGET_EXCEEDED, without evicting and before
+ * anything is written. it takes over where the capacity does not evict any
+ * more. E_SHM_INVALID_PARAMS is returned if soft is beyond hard
+ */
+int hamster_set_budget(uint64_t soft, uint64_t hard, hamster_budget_fn fn, void* ctx);
+
+/*
+ * get the shm usage against the budgets without taking a lock, for a load
+ * balancer to shed writes before the hard budget refuses them
+ */
+int hamster_budget(struct hamster_budget* b);
+
+/*
+ * get hit/miss, eviction and expiry counters and the shm usage
+ */
+int hamster_stat(struct hamster_stat* st);
+
 /*
  * get cache count
  */
 size_t hamster_count();
 
+/*
+ * get number of shards
+ */
+uint32_t hamster_shard_count();
+
+/*
+ * compress values of at least min_size bytes set from now on, 0 (the default)
+ * turns it off. a value is only stored compressed if it saves 1/8 of its
+ * size, and its record keeps room for max_size - size bytes of growth on top
+ * of the compressed size. a later hamster_set of a value which does not
+ * compress as well gets a new record then, rather than updating in place
+ */
+void hamster_set_compression(uint32_t min_size);
+
+/*
+ * store values of at least min_size bytes set from now on in chunks, 0 (the
+ * default) turns it off. a chunk is a record of SHM_CHUNK_SIZE bytes with a
+ * checksum of its own, and the record of the key only holds the table of its
+ * chunks. a multi-megabyte value then takes records of one size out of the
+ * segments and the free lists, rather than a segment of its own size, and no
+ * write or read of it copies or checksums it in one piece. chunked values are
+ * neither compressed nor updated in place, a set writes new chunks and frees
+ * the old ones once the new table is in. they are read by hamster_get_copy
+ * and hamster_getv, dumps and snapshots hold them in one piece
+ */
+void hamster_set_chunking(uint32_t min_size);
+
+/*
+ * keep a bloom filter of bits_per_key bits per key in front of the index of
+ * each shard, 0 (the default) turns it off. a lookup of a missing key then
+ * mostly ends after one cache line of the filter instead of a walk down the
+ * tree. the filter lives in process memory, it is built from the index here
+ * and on open, and rebuilt as keys come and go. 10 bits give about 1% false
+ * positives, see hamster_stat
+ */
+int hamster_set_filter(uint32_t bits_per_key);
+
+/*
+ * verify the checksums of about max_bytes of records, going on from where the
+ * last call stopped and starting over after the last record. a bad record is
+ * quarantined: it is dropped from the index, its space is never reused and
+ * recovery skips it, but it stays in the chain, so the records behind it are
+ * kept. fn is called for it, if not NULL. return bytes verified
+ */
+size_t hamster_scrub(size_t max_bytes, hamster_corrupt_fn fn, void* ctx);
+
+/*
+ * start a thread to scrub the store over and over in the background, at the
+ * lowest priority and at most bytes_per_sec. E_SHM_INIT_ONLY_ONCE is returned
+ * if it runs already
+ */
+int hamster_scrub_start(uint64_t bytes_per_sec, hamster_corrupt_fn fn, void* ctx);
+
+/*
+ * stop the scrubber thread, hamster_shutdown stops it too
+ */
+void hamster_scrub_stop();
+
+/*
+ * write-combining, for keys rewritten faster than their checksums are worth
+ * computing: an update in place only copies the value and notes its record
+ * in a bitmap, and a thread seals the checksums of the noted records every
+ * interval_ms, once for all the updates in between. 0 (the default) turns it
+ * off and seals what is pending, new records are always sealed at once.
+ *
+ * recovery trusts an unsealed record whose last update completed and seals
+ * it, so the last value of a key survives a crash of the writer. such a
+ * record is not verified, damage to it goes unnoticed, and the scrubber
+ * skips it until it is sealed. a record torn by a crash in the middle of an
+ * update fails its checksum and is quarantined, as without write-combining.
+ * hamster_detach seals before it lets go of the shm
+ */
+int hamster_set_sealing(uint32_t interval_ms);
+
+/*
+ * seal the pending records now, return how many
+ */
+size_t hamster_seal();
+
+/*
+ * watch the changes of a store, from this process or any other one. the
+ * store is given as to hamster_open: by key if not 0, by name otherwise
+ * (SHM_KEY for the default store). a hamster_set records the key in a ring
+ * of the last SHM_NOTIFY_RING changes in shm, and wakes the watchers blocked
+ * on a futex next to it. expiry and eviction are not reported.
+ * E_SHM_EMPTY is returned if the store has not been opened yet
+ */
+int hamster_watch_open(const char* name, key_t key, struct hamster_watch** w);
+void hamster_watch_close(struct hamster_watch* w);
+
+/*
+ * seq of the last change, 0 if none
+ */
+uint64_t hamster_watch_seq(struct hamster_watch* w);
+
+/*
+ * block until there is a change after seq, timeout_ms at most, without
+ * polling. E_SHM_TIMEOUT is returned if there is none
+ */
+int hamster_watch_wait(struct hamster_watch* w, uint64_t seq, uint32_t timeout_ms);
+
+/*
+ * get the change after seq. E_SHM_EMPTY is returned if there is none yet, and
+ * E_SHM_CHANGES_LOST if the watcher fell behind by more than the ring holds,
+ * go on from hamster_watch_seq after a full reread then
+ */
+int hamster_watch_next(struct hamster_watch* w, uint64_t seq, struct hamster_change* c);
+
+/*
+ * write a snapshot of the store to path: every live key, and where its
+ * replication log was when the snapshot started. shards are read locked
+ * one at a time, the others are written meanwhile. the file is replaced as
+ * a whole, once the snapshot is complete
+ */
+int hamster_snapshot(const char* path);
+
+/*
+ * follow a store opened with replog_size, from this process or another one,
+ * to keep a hot standby. the store is given as to hamster_watch_open, and
+ * E_SHM_EMPTY is returned if it keeps no log. every set, cas, add and batch
+ * of that store appends the value it leaves to a ring in shm, in the order
+ * of the writes of each key, and a follower applies them to store, which is
+ * a store of its own. to take over, close the follower and go on with store,
+ * it is live and indexed already, there is nothing to recover. expiry works
+ * by the same deadlines on both sides, evictions are not logged
+ */
+int hamster_follow(const char* name, key_t key, struct hamster_store* store, 
+                   struct hamster_follower** f);
+void hamster_follower_close(struct hamster_follower* f);
+
+/*
+ * apply the records logged since the last poll, max at most (0 for all of
+ * them), and set *applied to how many. a batch is applied as a batch. a
+ * follower starts at the beginning of the log, E_SHM_CHANGES_LOST is
+ * returned once it falls behind by more than the ring holds, catch up with
+ * hamster_follower_restore then
+ */
+int hamster_follower_poll(struct hamster_follower* f, uint32_t max, uint32_t* applied);
+
+/*
+ * block until there is a record to apply, timeout_ms at most.
+ * E_SHM_TIMEOUT is returned if there is none
+ */
+int hamster_follower_wait(struct hamster_follower* f, uint32_t timeout_ms);
+
+/*
+ * load a snapshot of the followed store (see hamster_snapshot) into the
+ * store of the follower, and go on from where the log was when it was
+ * taken. the records logged since are applied again by the next polls
+ */
+int hamster_follower_restore(struct hamster_follower* f, const char* path);
+
+/*
+ * how far the follower is behind the log. the followed store reports the
+ * lag of the follower to poll last in hamster_stat
+ */
+int hamster_follower_lag(struct hamster_follower* f, struct hamster_lag* lag);
+
+/*
+ * attach the shm of a store read only, to look at it while another process
+ * owns it, or after that process is gone. the store is given as to
+ * hamster_watch_open, and E_SHM_EMPTY is returned if there is none, or
+ * E_SHM_NAME_MISMATCH if it is the store of another name. the reader takes
+ * no lock, every record is copied out and checked against its checksum
+ * first, so a record being rewritten meanwhile might be skipped, or found
+ * twice if it is moved
+ */
+int hamster_reader_open(const char* name, key_t key, struct hamster_reader** r);
+void hamster_reader_close(struct hamster_reader* r);
+uint32_t hamster_reader_shards(struct hamster_reader* r);
+
+/*
+ * the next live record, shard by shard in the order of the segments.
+ * E_SHM_EMPTY is returned past the last one
+ */
+int hamster_reader_next(struct hamster_reader* r, struct hamster_record* rec);
+
+/*
+ * walk the records of shard, and tell what they take up
+ */
+int hamster_reader_occupancy(struct hamster_reader* r, uint32_t shard, 
+                             struct hamster_occupancy* o);
+
+/*
+ * the i-th segment of shard, E_SHM_EMPTY is returned past the last one
+ */
+int hamster_reader_segment(struct hamster_reader* r, uint32_t shard, uint32_t i, 
+                           struct hamster_segment* seg);
+
+/*
+ * write the records hamster_reader_next has not returned yet to fd, in the
+ * format of hamster_snapshot. one record is held in memory at a time
+ */
+int hamster_reader_dump(struct hamster_reader* r, int fd);
+
+/*
+ * load a dump or a snapshot from fd into store, SHM_LOAD_BATCH bytes of
+ * records at a time, each written as a batch. compressed values are loaded
+ * as they are
+ */
+int hamster_store_load(struct hamster_store* store, int fd);
+
+/*
+ * close the store but keep its shm, a later hamster_open finds the records
+ * as after a crash, with nothing to recover
+ */
+void hamster_detach(struct hamster_store* store);
+
+/*
+ * the same as the functions above, on the given store
+ */
+int hamster_store_set(struct hamster_store* store, const char* key, struct h_value_t* val);
+int hamster_store_set_ttl(struct hamster_store* store, const char* key, 
+                          struct h_value_t* val, uint32_t ttl_ms);
+int hamster_store_get(struct hamster_store* store, const char* key, struct h_value_t* val);
+int hamster_store_get_copy(struct hamster_store* store, const char* key, 
+                           void* buf, uint32_t* size);
+int hamster_store_get_version(struct hamster_store* store, const char* key, 
+                              struct h_value_t* val, uint64_t* version);
+int hamster_store_setv(struct hamster_store* store, const char* key, 
+                       const struct iovec* iov, int iovcnt, uint32_t ttl_ms);
+int hamster_store_getv(struct hamster_store* store, const char* key, uint32_t off, 
+                       const struct iovec* iov, int iovcnt, uint32_t* size);
+int hamster_store_cas(struct hamster_store* store, const char* key, 
+                      struct h_value_t* val, uint64_t* version);
+int hamster_store_add(struct hamster_store* store, const char* key, int64_t delta, int64_t* value);
+int hamster_store_incr(struct hamster_store* store, const char* key, int64_t* value);
+int hamster_store_write(struct hamster_store* store, struct hamster_batch* b);
+size_t hamster_store_expire(struct hamster_store* store);
+int hamster_store_set_capacity(struct hamster_store* store, uint64_t bytes);
+int hamster_store_set_budget(struct hamster_store* store, uint64_t soft, uint64_t hard, 
+                             hamster_budget_fn fn, void* ctx);
+int hamster_store_budget(struct hamster_store* store, struct hamster_budget* b);
+void hamster_store_set_compression(struct hamster_store* store, uint32_t min_size);
+void hamster_store_set_chunking(struct hamster_store* store, uint32_t min_size);
+int hamster_store_set_filter(struct hamster_store* store, uint32_t bits_per_key);
+int hamster_store_stat(struct hamster_store* store, struct hamster_stat* st);
+size_t hamster_store_count(struct hamster_store* store);
+uint32_t hamster_store_shard_count(struct hamster_store* store);
+const char* hamster_store_name(struct hamster_store* store);
+size_t hamster_store_scrub(struct hamster_store* store, size_t max_bytes, 
+                           hamster_corrupt_fn fn, void* ctx);
+int hamster_store_scrub_start(struct hamster_store* store, uint64_t bytes_per_sec, 
+                              hamster_corrupt_fn fn, void* ctx);
+void hamster_store_scrub_stop(struct hamster_store* store);
+int hamster_store_set_sealing(struct hamster_store* store, uint32_t interval_ms);
+size_t hamster_store_seal(struct hamster_store* store);
+int hamster_store_snapshot(struct hamster_store* store, const char* path);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,327 @@
+#ifndef LIBHAMSTER_HPP
+#define LIBHAMSTER_HPP
+
+/*
+ * typed c++ api over hamster.h, c++17. nothing here allocates on the way to
+ * the store: values go in as a view of the bytes of the caller in an
+ * h_value_t on the stack, keys are copied onto the stack to get their
+ * terminating 0 (longer keys than key_inline fall back to a std::string).
+ * errors are the E_SHM_* codes of the c api, as return values
+ */
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <iterator>
+#include <type_traits>
+#include <string_view>
+#if __cplusplus > 201703L && __has_include(<span>)
+#include <span>
+#endif
+
+extern "C" {
+#include "hamster.h"
+#include "shm_error.h"
+}
+
+namespace hamster {
+
+/* keys up to this length are made c strings on the stack */
+constexpr size_t key_inline = 255;
+
+/*
+ * a value as bytes, from a pointer and a size or from any contiguous range
+ * of trivially copyable elements: std::string, std::string_view,
+ * std::vector, std::array, std::span. it refers to them, copies nothing
+ */
+class bytes {
+ public:
+  bytes(const void* data, size_t size) : data_(data), size_(size) {}
+
+  /* a string literal goes without its terminating 0 */
+  template <size_t N>
+  bytes(const char (&s)[N]) : data_(s), size_(N - 1) {}
+
+  template <class Range,
+            class = std::enable_if_t<!std::is_same<Range, bytes>::value>,
+            class = decltype(std::data(std::declval<const Range&>())),
+            class = decltype(std::size(std::declval<const Range&>()))>
+  bytes(const Range& r)
+      : data_(std::data(r)), size_(std::size(r) * sizeof(*std::data(r))) {
+    static_assert(std::is_trivially_copyable<
+                    std::remove_reference_t<decltype(*std::data(r))>>::value,
+                  "elements of a value must be trivially copyable");
+  }
+
+  const void* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const void* data_;
+  size_t      size_;
+};
+
+/*
+ * the layout of T is the layout of its record: its bytes as they are in
+ * memory, in a record of exactly sizeof(T) bytes. pointers would not mean
+ * anything to another process
+ */
+template <class T>
+struct layout {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "a typed value is stored as its bytes, it must be trivially copyable");
+  static_assert(!std::is_pointer<T>::value,
+                "a pointer does not point anywhere in another process");
+  static_assert(sizeof(T) <= UINT32_MAX / 2, "a record holds 2GB at most");
+  static constexpr uint32_t size = sizeof(T);
+};
+
+/*
+ * a value in shm, as hamster_get leaves it: it is good until the key is
+ * written again. a typed view loads the T out of it, values are not aligned
+ * in a record
+ */
+template <class T = void>
+class view {
+ public:
+  view() : ptr_(NULL) {}
+  explicit view(const void* ptr) : ptr_(ptr) {}
+
+  T load() const {
+    T v;
+    std::memcpy(&v, ptr_, layout<T>::size);
+    return v;
+  }
+
+  const void* data() const { return ptr_; }
+  static constexpr uint32_t size() { return layout<T>::size; }
+
+ private:
+  const void* ptr_;
+};
+
+template <>
+class view<void> {
+ public:
+  view() : ptr_(NULL), size_(0) {}
+  view(const void* ptr, uint32_t size) : ptr_(ptr), size_(size) {}
+
+  const void* data() const { return ptr_; }
+  uint32_t size() const { return size_; }
+  std::string_view str() const { return std::string_view((const char*)ptr_, size_); }
+
+ private:
+  const void* ptr_;
+  uint32_t    size_;
+};
+
+namespace detail {
+
+/* key as a c string, on the stack if it is short */
+class c_key {
+ public:
+  explicit c_key(std::string_view key) : ok_(key.find('\0') == std::string_view::npos) {
+    if (key.size() <= key_inline) {
+      std::memcpy(buf_, key.data(), key.size());
+      buf_[key.size()] = '\0';
+      str_ = buf_;
+    } else {
+      long_.assign(key.data(), key.size());
+      str_ = long_.c_str();
+    }
+  }
+
+  c_key(const c_key&) = delete;
+  c_key& operator=(const c_key&) = delete;
+
+  /* a key with a 0 in it would be cut short by the c api */
+  bool ok() const { return ok_; }
+  const char* c_str() const { return str_; }
+
+ private:
+  bool        ok_;
+  const char* str_;
+  char        buf_[key_inline + 1];
+  std::string long_;
+};
+
+inline h_value_t value_of(bytes v) {
+  h_value_t val;
+  val.ptr = const_cast<void*>(v.data());
+  val.size = (uint32_t)v.size();
+  val.max_size = (uint32_t)v.size();
+  return val;
+}
+
+} // namespace detail
+
+class batch;
+
+/*
+ * an open store, closed as the handle goes. move only
+ */
+class store {
+ public:
+  store() : st_(NULL) {}
+  ~store() { close(); }
+
+  store(store&& o) noexcept : st_(std::exchange(o.st_, nullptr)) {}
+  store& operator=(store&& o) noexcept {
+    if (this != &o) {
+      close();
+      st_ = std::exchange(o.st_, nullptr);
+    }
+    return *this;
+  }
+  store(const store&) = delete;
+  store& operator=(const store&) = delete;
+
+  /* see hamster_open, a store open already is closed first */
+  int open(const char* name, const hamster_options* opts = NULL) {
+    close();
+    return hamster_open(name, opts, &st_);
+  }
+
+  void close() {
+    hamster_close(st_);
+    st_ = NULL;
+  }
+
+  /* close it but keep its shm, see hamster_detach */
+  void detach() {
+    hamster_detach(st_);
+    st_ = NULL;
+  }
+
+  hamster_store* get() const { return st_; }
+  explicit operator bool() const { return st_ != NULL; }
+
+  int set(std::string_view key, bytes value, uint32_t ttl_ms = 0) {
+    detail::c_key k(key);
+    h_value_t val = detail::value_of(value);
+    if (!k.ok() || value.size() > UINT32_MAX / 2)
+      return E_SHM_INVALID_PARAMS;
+    return hamster_store_set_ttl(st_, k.c_str(), &val, ttl_ms);
+  }
+
+  /*
+   * set value in a record of its own size, a later set of the same key with
+   * another T gets E_SHM_VAL_UPDATE_EXCEED_MAX_SIZE if it is bigger
+   */
+  template <class T>
+  int set_as(std::string_view key, const T& value, uint32_t ttl_ms = 0) {
+    return set(key, bytes(&value, layout<T>::size), ttl_ms);
+  }
+
+  /* see hamster_get */
+  int get(std::string_view key, view<>* value) const {
+    detail::c_key k(key);
+    h_value_t val = { NULL, 0, 0 };
+    int ec = E_SHM_OK;
+    if (!k.ok())
+      return E_SHM_INVALID_PARAMS;
+    if (E_SHM_OK == (ec = hamster_store_get(st_, k.c_str(), &val)))
+      *value = view<>(val.ptr, val.size);
+    return ec;
+  }
+
+  /* E_SHM_VAL_SIZE_INVALID is returned if the value is not a T */
+  template <class T>
+  int get_as(std::string_view key, view<T>* value) const {
+    view<> raw;
+    int ec = E_SHM_OK;
+    if (E_SHM_OK != (ec = get(key, &raw)))
+      return ec;
+    if (raw.size() != layout<T>::size)
+      return E_SHM_VAL_SIZE_INVALID;
+    *value = view<T>(raw.data());
+    return E_SHM_OK;
+  }
+
+  /* see hamster_get_copy, it decompresses */
+  int get_copy(std::string_view key, void* buf, uint32_t* size) const {
+    detail::c_key k(key);
+    if (!k.ok())
+      return E_SHM_INVALID_PARAMS;
+    return hamster_store_get_copy(st_, k.c_str(), buf, size);
+  }
+
+  template <class T>
+  int get_copy_as(std::string_view key, T* value) const {
+    uint32_t size = layout<T>::size;
+    int ec = get_copy(key, value, &size);
+    if (ec == E_SHM_VAL_BUFFER_TOO_SMALL || (ec == E_SHM_OK && size != layout<T>::size))
+      return E_SHM_VAL_SIZE_INVALID;
+    return ec;
+  }
+
+  int add(std::string_view key, int64_t delta, int64_t* value = NULL) {
+    detail::c_key k(key);
+    if (!k.ok())
+      return E_SHM_INVALID_PARAMS;
+    return hamster_store_add(st_, k.c_str(), delta, value);
+  }
+
+  int write(batch& b);
+  size_t count() const { return hamster_store_count(st_); }
+
+ private:
+  hamster_store* st_;
+};
+
+/*
+ * a batch of sets, see hamster_batch_new. keys and values are copied into
+ * its buffers, which it keeps across clear
+ */
+class batch {
+ public:
+  batch() : b_(NULL) {}
+  ~batch() { hamster_batch_free(b_); }
+
+  batch(batch&& o) noexcept : b_(std::exchange(o.b_, nullptr)) {}
+  batch& operator=(batch&& o) noexcept {
+    if (this != &o) {
+      hamster_batch_free(b_);
+      b_ = std::exchange(o.b_, nullptr);
+    }
+    return *this;
+  }
+  batch(const batch&) = delete;
+  batch& operator=(const batch&) = delete;
+
+  int set(std::string_view key, bytes value, uint32_t ttl_ms = 0) {
+    detail::c_key k(key);
+    h_value_t val = detail::value_of(value);
+    int ec = E_SHM_OK;
+    if (!k.ok() || value.size() > UINT32_MAX / 2)
+      return E_SHM_INVALID_PARAMS;
+    if (b_ == NULL && E_SHM_OK != (ec = hamster_batch_new(&b_)))
+      return ec;
+    return hamster_batch_set_ttl(b_, k.c_str(), &val, ttl_ms);
+  }
+
+  template <class T>
+  int set_as(std::string_view key, const T& value, uint32_t ttl_ms = 0) {
+    return set(key, bytes(&value, layout<T>::size), ttl_ms);
+  }
+
+  void clear() {
+    if (b_ != NULL)
+      hamster_batch_clear(b_);
+  }
+
+  uint32_t count() const { return b_ != NULL ? hamster_batch_count(b_) : 0; }
+
+ private:
+  friend class store;
+  hamster_batch* b_;
+};
+
+inline int store::write(batch& b) {
+  return b.b_ != NULL ? hamster_store_write(st_, b.b_) : E_SHM_OK;
+}
+
+} // namespace hamster
+
+#endif // LIBHAMSTER_HPP
@@ -0,0 +1,612 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "shm_error.h"
+#include "shm_config.h"
+#include "shm_art.h"
+
+#define ART_NODE4   0
+#define ART_NODE16  1
+#define ART_NODE48  2
+#define ART_NODE256 3
+
+/* keys of node4 and node16 are sorted, a byte of node48 maps to slot + 1 */
+struct art_node4 {
+  struct art_node n;
+  uint8_t         keys[4];
+  void*           children[4];
+};
+
+struct art_node16 {
+  struct art_node n;
+  uint8_t         keys[16];
+  void*           children[16];
+};
+
+struct art_node48 {
+  struct art_node n;
+  uint8_t         index[256];
+  void*           children[48];
+};
+
+struct art_node256 {
+  struct art_node n;
+  void*           children[256];
+};
+
+/* a child is a node, or a leaf: the data itself, tagged by its lowest bit */
+#define is_leaf(p) ((uintptr_t)(p) & 1)
+#define leaf_of(data) ((void*)((uintptr_t)(data) | 1))
+#define leaf_data(p) ((void*)((uintptr_t)(p) & ~(uintptr_t)1))
+#define leaf_key(t, p) ((const uint8_t*)(t)->key(leaf_data(p)))
+
+#define art_min(a, b) ((a) < (b) ? (a) : (b))
+
+shm_internal struct art_node* art_node_new(struct art_tree* t, uint8_t type);
+shm_internal void   art_node_free(struct art_tree* t, struct art_node* n);
+shm_internal void   art_node_copy_header(struct art_node* to, struct art_node* from);
+shm_internal void** art_node_find(struct art_node* n, uint8_t c);
+shm_internal void*  art_node_minimum(void* n);
+shm_internal int    art_node_add(struct art_tree* t, void** ref, struct art_node* n, 
+                                 uint8_t c, void* child);
+shm_internal void   art_node_remove(struct art_tree* t, void** ref, struct art_node* n, 
+                                    uint8_t c, void** slot);
+shm_internal uint32_t art_prefix_check(struct art_node* n, const uint8_t* key, 
+                                       size_t len, size_t depth);
+shm_internal uint32_t art_prefix_mismatch(struct art_tree* t, struct art_node* n, 
+                                          const uint8_t* key, size_t len, size_t depth);
+shm_internal void   art_foreach_nodes(void* n, void (*fn)(void* data, void* ctx), void* ctx);
+shm_internal void   art_release_leaf(void* data, void* ctx);
+shm_internal void   art_free_nodes(void* n, art_release_fn release);
+
+struct art_tree* art_new(art_key_fn key, art_release_fn release) {
+  struct art_tree* t = NULL;
+
+  if (NULL == key)
+    return NULL;
+
+  if (NULL != (t = (struct art_tree*)calloc(1, sizeof(struct art_tree)))) {
+    t->key = key;
+    t->release = release;
+    shm_pool_init(&t->nodes[ART_NODE4], sizeof(struct art_node4));
+    shm_pool_init(&t->nodes[ART_NODE16], sizeof(struct art_node16));
+    shm_pool_init(&t->nodes[ART_NODE48], sizeof(struct art_node48));
+    shm_pool_init(&t->nodes[ART_NODE256], sizeof(struct art_node256));
+  }
+  return t;
+}
+
+void art_free(struct art_tree* t) {
+  int i = 0;
+
+  if (t->release != NULL && t->root != NULL)
+    art_free_nodes(t->root, t->release);
+  for (i = 0; i < 4; ++i)
+    shm_pool_destroy(&t->nodes[i]);
+  free(t);
+}
+
+int art_add(struct art_tree* t, void* data) {
+  int ec = E_SHM_OK;
+  const uint8_t* key = (const uint8_t*)t->key(data);
+  const uint8_t* l = NULL;
+  size_t len = strlen((const char*)key) + 1, depth = 0;
+  uint32_t i = 0, diff = 0;
+  void** ref = &t->root;
+  void** child = NULL;
+  struct art_node* n = NULL;
+  struct art_node* nn = NULL;
+
+  for (;;) {
+    if (*ref == NULL) {
+      *ref = leaf_of(data);
+      break;
+    }
+
+    if (is_leaf(*ref)) {
+      // split the leaf where the keys part
+      l = leaf_key(t, *ref);
+      if (0 == strcmp((const char*)l, (const char*)key))
+        return E_SHM_SAME_KEY_EXIST;
+      if (NULL == (nn = art_node_new(t, ART_NODE4)))
+        return E_SHM_SYSTEM;
+      for (i = 0; l[depth + i] == key[depth + i]; ++i)
+        ;
+      nn->prefix_len = i;
+      memcpy(nn->prefix, key + depth, art_min(i, ART_PREFIX));
+      art_node_add(t, ref, nn, l[depth + i], *ref);
+      art_node_add(t, ref, nn, key[depth + i], leaf_of(data));
+      *ref = nn;
+      break;
+    }
+
+    n = (struct art_node*)*ref;
+    if (n->prefix_len > 0) {
+      diff = art_prefix_mismatch(t, n, key, len, depth);
+      if (diff < n->prefix_len) {
+        // split the path where the key leaves it
+        if (NULL == (nn = art_node_new(t, ART_NODE4)))
+          return E_SHM_SYSTEM;
+        nn->prefix_len = diff;
+        memcpy(nn->prefix, n->prefix, art_min(diff, ART_PREFIX));
+        if (n->prefix_len <= ART_PREFIX) {
+          art_node_add(t, ref, nn, n->prefix[diff], n);
+          n->prefix_len -= diff + 1;
+          memmove(n->prefix, n->prefix + diff + 1, art_min(n->prefix_len, ART_PREFIX));
+        } else {
+          // the bytes past those kept are the ones of any leaf below
+          l = leaf_key(t, art_node_minimum(n));
+          n->prefix_len -= diff + 1;
+          art_node_add(t, ref, nn, l[depth + diff], n);
+          memcpy(n->prefix, l + depth + diff + 1, art_min(n->prefix_len, ART_PREFIX));
+        }
+        art_node_add(t, ref, nn, key[depth + diff], leaf_of(data));
+        *ref = nn;
+        break;
+      }
+      depth += n->prefix_len;
+    }
+
+    if (NULL == (child = art_node_find(n, key[depth]))) {
+      if (E_SHM_OK != (ec = art_node_add(t, ref, n, key[depth], leaf_of(data))))
+        return ec;
+      break;
+    }
+    ref = child;
+    ++depth;
+  }
+
+  ++t->count;
+  return E_SHM_OK;
+}
+
+int art_reserve(struct art_tree* t) {
+  int ec = E_SHM_OK;
+  uint32_t i = 0;
+
+  for (i = 0; i < 4 && ec == E_SHM_OK; ++i)
+    ec = shm_pool_reserve(&t->nodes[i], 1);
+  return ec;
+}
+
+int art_query(struct art_tree* t, void** data) {
+  const uint8_t* key = (const uint8_t*)t->key(*data);
+  size_t len = strlen((const char*)key) + 1, depth = 0;
+  void* n = t->root;
+  void** child = NULL;
+  struct art_node* node = NULL;
+
+  while (n != NULL) {
+    // the path only picks the leaf, the key is compared on it once
+    if (is_leaf(n)) {
+      if (0 != strcmp((const char*)leaf_key(t, n), (const char*)key))
+        return E_SHM_KEY_NOT_FOUND;
+      *data = leaf_data(n);
+      return E_SHM_OK;
+    }
+
+    node = (struct art_node*)n;
+    if (node->prefix_len > 0) {
+      if (art_prefix_check(node, key, len, depth) != art_min(node->prefix_len, ART_PREFIX))
+        return E_SHM_KEY_NOT_FOUND;
+      depth += node->prefix_len;
+    }
+    if (depth >= len || NULL == (child = art_node_find(node, key[depth])))
+      return E_SHM_KEY_NOT_FOUND;
+    n = *child;
+    ++depth;
+  }
+  return E_SHM_KEY_NOT_FOUND;
+}
+
+int art_del(struct art_tree* t, void** data) {
+  const uint8_t* key = (const uint8_t*)t->key(*data);
+  size_t len = strlen((const char*)key) + 1, depth = 0;
+  void** ref = &t->root;
+  void** child = NULL;
+  struct art_node* n = NULL;
+
+  if (*ref != NULL && is_leaf(*ref)) {
+    if (0 != strcmp((const char*)leaf_key(t, *ref), (const char*)key))
+      return E_SHM_KEY_NOT_FOUND;
+    *data = leaf_data(*ref);
+    *ref = NULL;
+    --t->count;
+    return E_SHM_OK;
+  }
+
+  while (*ref != NULL) {
+    n = (struct art_node*)*ref;
+    if (n->prefix_len > 0) {
+      if (art_prefix_check(n, key, len, depth) != art_min(n->prefix_len, ART_PREFIX))
+        return E_SHM_KEY_NOT_FOUND;
+      depth += n->prefix_len;
+    }
+    if (depth >= len || NULL == (child = art_node_find(n, key[depth])))
+      return E_SHM_KEY_NOT_FOUND;
+
+    if (is_leaf(*child)) {
+      if (0 != strcmp((const char*)leaf_key(t, *child), (const char*)key))
+        return E_SHM_KEY_NOT_FOUND;
+      *data = leaf_data(*child);
+      art_node_remove(t, ref, n, key[depth], child);
+      --t->count;
+      return E_SHM_OK;
+    }
+    ref = child;
+    ++depth;
+  }
+  return E_SHM_KEY_NOT_FOUND;
+}
+
+void art_foreach(struct art_tree* t, void (*fn)(void* data, void* ctx), void* ctx) {
+  if (t->root != NULL)
+    art_foreach_nodes(t->root, fn, ctx);
+}
+
+size_t art_bytes(const struct art_tree* t) {
+  size_t bytes = 0;
+  int i = 0;
+
+  for (i = 0; i < 4; ++i)
+    bytes += shm_pool_bytes(&t->nodes[i]);
+  return bytes;
+}
+
+shm_internal struct art_node* art_node_new(struct art_tree* t, uint8_t type) {
+  struct art_node* n = (struct art_node*)shm_pool_ptr(&t->nodes[type],
+                                                      shm_pool_alloc(&t->nodes[type]));
+  if (n != NULL)
+    n->type = type;
+  return n;
+}
+
+shm_internal void art_node_free(struct art_tree* t, struct art_node* n) {
+  shm_pool_free(&t->nodes[n->type], shm_pool_handle(&t->nodes[n->type], n));
+}
+
+shm_internal void art_node_copy_header(struct art_node* to, struct art_node* from) {
+  to->count = from->count;
+  to->prefix_len = from->prefix_len;
+  memcpy(to->prefix, from->prefix, art_min(from->prefix_len, ART_PREFIX));
+}
+
+/*
+ * the slot of the child of n for byte c, NULL if none. node16 compares c to
+ * all its keys at once where sse2 is there
+ */
+shm_internal void** art_node_find(struct art_node* n, uint8_t c) {
+  uint32_t i = 0;
+  struct art_node4* n4 = NULL;
+  struct art_node16* n16 = NULL;
+  struct art_node48* n48 = NULL;
+  struct art_node256* n256 = NULL;
+#ifdef __SSE2__
+  uint32_t mask = 0;
+#endif
+
+  switch (n->type) {
+  case ART_NODE4:
+    n4 = (struct art_node4*)n;
+    for (i = 0; i < n->count; ++i)
+      if (n4->keys[i] == c)
+        return &n4->children[i];
+    break;
+  case ART_NODE16:
+    n16 = (struct art_node16*)n;
+#ifdef __SSE2__
+    mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8((char)c),
+                                                      _mm_loadu_si128((__m128i*)n16->keys)));
+    mask &= (1u << n->count) - 1;
+    if (mask != 0)
+      return &n16->children[__builtin_ctz(mask)];
+#else
+    for (i = 0; i < n->count; ++i)
+      if (n16->keys[i] == c)
+        return &n16->children[i];
+#endif
+    break;
+  case ART_NODE48:
+    n48 = (struct art_node48*)n;
+    if (n48->index[c] != 0)
+      return &n48->children[n48->index[c] - 1];
+    break;
+  case ART_NODE256:
+    n256 = (struct art_node256*)n;
+    if (n256->children[c] != NULL)
+      return &n256->children[c];
+    break;
+  }
+  return NULL;
+}
+
+/* the leaf of the smallest key below n */
+shm_internal void* art_node_minimum(void* n) {
+  uint32_t i = 0;
+  struct art_node48* n48 = NULL;
+  struct art_node256* n256 = NULL;
+
+  while (!is_leaf(n)) {
+    switch (((struct art_node*)n)->type) {
+    case ART_NODE4:
+      n = ((struct art_node4*)n)->children[0];
+      break;
+    case ART_NODE16:
+      n = ((struct art_node16*)n)->children[0];
+      break;
+    case ART_NODE48:
+      n48 = (struct art_node48*)n;
+      for (i = 0; n48->index[i] == 0; ++i)
+        ;
+      n = n48->children[n48->index[i] - 1];
+      break;
+    case ART_NODE256:
+      n256 = (struct art_node256*)n;
+      for (i = 0; n256->children[i] == NULL; ++i)
+        ;
+      n = n256->children[i];
+      break;
+    }
+  }
+  return n;
+}
+
+/*
+ * add child to n for byte c, which it has none for. a full node is replaced
+ * at ref by one of the next size, nothing changes if that fails
+ */
+shm_internal int art_node_add(struct art_tree* t, void** ref, struct art_node* n, uint8_t c, void* child) {
+  uint32_t i = 0, pos = 0;
+  struct art_node4* n4 = NULL;
+  struct art_node16* n16 = NULL;
+  struct art_node48* n48 = NULL;
+  struct art_node256* n256 = NULL;
+  struct art_node* nn = NULL;
+#ifdef __SSE2__
+  uint32_t mask = 0;
+  __m128i bias;
+#endif
+
+  switch (n->type) {
+  case ART_NODE4:
+    n4 = (struct art_node4*)n;
+    if (n->count < 4) {
+      for (pos = 0; pos < n->count && n4->keys[pos] < c; ++pos)
+        ;
+      memmove(n4->keys + pos + 1, n4->keys + pos, n->count - pos);
+      memmove(n4->children + pos + 1, n4->children + pos, (n->count - pos) * sizeof(void*));
+      n4->keys[pos] = c;
+      n4->children[pos] = child;
+      ++n->count;
+      return E_SHM_OK;
+    }
+    if (NULL == (nn = art_node_new(t, ART_NODE16)))
+      return E_SHM_SYSTEM;
+    n16 = (struct art_node16*)nn;
+    art_node_copy_header(nn, n);
+    memcpy(n16->keys, n4->keys, sizeof(n4->keys));
+    memcpy(n16->children, n4->children, sizeof(n4->children));
+    break;
+
+  case ART_NODE16:
+    n16 = (struct art_node16*)n;
+    if (n->count < 16) {
+#ifdef __SSE2__
+      // the first key greater than c, compared signed with the sign bit flipped
+      bias = _mm_set1_epi8((char)0x80);
+      mask = (uint32_t)_mm_movemask_epi8(
+          _mm_cmplt_epi8(_mm_xor_si128(_mm_set1_epi8((char)c), bias),
+                         _mm_xor_si128(_mm_loadu_si128((__m128i*)n16->keys), bias)));
+      mask &= (1u << n->count) - 1;
+      pos = mask != 0 ? (uint32_t)__builtin_ctz(mask) : n->count;
+#else
+      for (pos = 0; pos < n->count && n16->keys[pos] < c; ++pos)
+        ;
+#endif
+      memmove(n16->keys + pos + 1, n16->keys + pos, n->count - pos);
+      memmove(n16->children + pos + 1, n16->children + pos, (n->count - pos) * sizeof(void*));
+      n16->keys[pos] = c;
+      n16->children[pos] = child;
+      ++n->count;
+      return E_SHM_OK;
+    }
+    if (NULL == (nn = art_node_new(t, ART_NODE48)))
+      return E_SHM_SYSTEM;
+    n48 = (struct art_node48*)nn;
+    art_node_copy_header(nn, n);
+    for (i = 0; i < 16; ++i) {
+      n48->index[n16->keys[i]] = i + 1;
+      n48->children[i] = n16->children[i];
+    }
+    break;
+
+  case ART_NODE48:
+    n48 = (struct art_node48*)n;
+    if (n->count < 48) {
+      for (pos = 0; n48->children[pos] != NULL; ++pos)
+        ;
+      n48->children[pos] = child;
+      n48->index[c] = pos + 1;
+      ++n->count;
+      return E_SHM_OK;
+    }
+    if (NULL == (nn = art_node_new(t, ART_NODE256)))
+      return E_SHM_SYSTEM;
+    n256 = (struct art_node256*)nn;
+    art_node_copy_header(nn, n);
+    for (i = 0; i < 256; ++i)
+      if (n48->index[i] != 0)
+        n256->children[i] = n48->children[n48->index[i] - 1];
+    break;
+
+  case ART_NODE256:
+    n256 = (struct art_node256*)n;
+    n256->children[c] = child;
+    ++n->count;
+    return E_SHM_OK;
+  }
+
+  *ref = nn;
+  art_node_free(t, n);
+  return art_node_add(t, ref, nn, c, child);
+}
+
+/*
+ * drop the child of n at slot, for byte c. a node left with few children is
+ * replaced at ref by one of the size below, if it can be had, a node4 left
+ * with one child by the child itself, its path put in front of the child's
+ */
+shm_internal void art_node_remove(struct art_tree* t, void** ref, struct art_node* n, uint8_t c, void** slot) {
+  uint32_t i = 0, pos = 0, sub = 0;
+  struct art_node4* n4 = NULL;
+  struct art_node16* n16 = NULL;
+  struct art_node48* n48 = NULL;
+  struct art_node256* n256 = NULL;
+  struct art_node* nn = NULL;
+  struct art_node* child = NULL;
+
+  switch (n->type) {
+  case ART_NODE4:
+    n4 = (struct art_node4*)n;
+    pos = slot - n4->children;
+    memmove(n4->keys + pos, n4->keys + pos + 1, n->count - pos - 1);
+    memmove(n4->children + pos, n4->children + pos + 1, (n->count - pos - 1) * sizeof(void*));
+    if (--n->count > 1)
+      return;
+    if (!is_leaf(n4->children[0])) {
+      child = (struct art_node*)n4->children[0];
+      pos = n->prefix_len;
+      if (pos < ART_PREFIX)
+        n->prefix[pos++] = n4->keys[0];
+      if (pos < ART_PREFIX) {
+        sub = art_min(child->prefix_len, ART_PREFIX - pos);
+        memcpy(n->prefix + pos, child->prefix, sub);
+        pos += sub;
+      }
+      memcpy(child->prefix, n->prefix, art_min(pos, ART_PREFIX));
+      child->prefix_len += n->prefix_len + 1;
+    }
+    *ref = n4->children[0];
+    art_node_free(t, n);
+    return;
+
+  case ART_NODE16:
+    n16 = (struct art_node16*)n;
+    pos = slot - n16->children;
+    memmove(n16->keys + pos, n16->keys + pos + 1, n->count - pos - 1);
+    memmove(n16->children + pos, n16->children + pos + 1, (n->count - pos - 1) * sizeof(void*));
+    if (--n->count > 3 || NULL == (nn = art_node_new(t, ART_NODE4)))
+      return;
+    n4 = (struct art_node4*)nn;
+    art_node_copy_header(nn, n);
+    memcpy(n4->keys, n16->keys, n->count);
+    memcpy(n4->children, n16->children, n->count * sizeof(void*));
+    break;
+
+  case ART_NODE48:
+    n48 = (struct art_node48*)n;
+    n48->children[n48->index[c] - 1] = NULL;
+    n48->index[c] = 0;
+    if (--n->count > 12 || NULL == (nn = art_node_new(t, ART_NODE16)))
+      return;
+    n16 = (struct art_node16*)nn;
+    art_node_copy_header(nn, n);
+    for (i = 0, pos = 0; i < 256; ++i) {
+      if (n48->index[i] != 0) {
+        n16->keys[pos] = (uint8_t)i;
+        n16->children[pos++] = n48->children[n48->index[i] - 1];
+      }
+    }
+    break;
+
+  case ART_NODE256:
+    n256 = (struct art_node256*)n;
+    n256->children[c] = NULL;
+    if (--n->count > 37 || NULL == (nn = art_node_new(t, ART_NODE48)))
+      return;
+    n48 = (struct art_node48*)nn;
+    art_node_copy_header(nn, n);
+    for (i = 0, pos = 0; i < 256; ++i) {
+      if (n256->children[i] != NULL) {
+        n48->index[i] = pos + 1;
+        n48->children[pos++] = n256->children[i];
+      }
+    }
+    break;
+  }
+
+  *ref = nn;
+  art_node_free(t, n);
+}
+
+/* bytes of the path of n kept in it which key matches from depth on */
+shm_internal uint32_t art_prefix_check(struct art_node* n, const uint8_t* key, size_t len, size_t depth) {
+  uint32_t i = 0, max = art_min(art_min(n->prefix_len, ART_PREFIX), len - depth);
+
+  for (i = 0; i < max && n->prefix[i] == key[depth + i]; ++i)
+    ;
+  return i;
+}
+
+/* bytes of the whole path of n which key matches from depth on */
+shm_internal uint32_t art_prefix_mismatch(struct art_tree* t, struct art_node* n, const uint8_t* key,
+                                      size_t len, size_t depth) {
+  uint32_t i = art_prefix_check(n, key, len, depth), max = 0;
+  const uint8_t* l = NULL;
+
+  if (i == ART_PREFIX && n->prefix_len > ART_PREFIX) {
+    l = leaf_key(t, art_node_minimum(n));
+    max = art_min(n->prefix_len, len - depth);
+    for (; i < max && l[depth + i] == key[depth + i]; ++i)
+      ;
+  }
+  return i;
+}
+
+shm_internal void art_foreach_nodes(void* n, void (*fn)(void* data, void* ctx), void* ctx) {
+  uint32_t i = 0;
+  struct art_node* node = (struct art_node*)n;
+  struct art_node48* n48 = NULL;
+  struct art_node256* n256 = NULL;
+
+  if (is_leaf(n)) {
+    fn(leaf_data(n), ctx);
+    return;
+  }
+
+  switch (node->type) {
+  case ART_NODE4:
+    for (i = 0; i < node->count; ++i)
+      art_foreach_nodes(((struct art_node4*)n)->children[i], fn, ctx);
+    break;
+  case ART_NODE16:
+    for (i = 0; i < node->count; ++i)
+      art_foreach_nodes(((struct art_node16*)n)->children[i], fn, ctx);
+    break;
+  case ART_NODE48:
+    n48 = (struct art_node48*)n;
+    for (i = 0; i < 256; ++i)
+      if (n48->index[i] != 0)
+        art_foreach_nodes(n48->children[n48->index[i] - 1], fn, ctx);
+    break;
+  case ART_NODE256:
+    n256 = (struct art_node256*)n;
+    for (i = 0; i < 256; ++i)
+      if (n256->children[i] != NULL)
+        art_foreach_nodes(n256->children[i], fn, ctx);
+    break;
+  }
+}
+
+shm_internal void art_release_leaf(void* data, void* ctx) {
+  (*(art_release_fn*)ctx)(data);
+}
+
+/* the nodes themselves go with the pools */
+shm_internal void art_free_nodes(void* n, art_release_fn release) {
+  art_foreach_nodes(n, art_release_leaf, &release);
+}
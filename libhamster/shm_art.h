@@ -0,0 +1,88 @@
+#ifndef SHM_ART_H
+#define SHM_ART_H
+
+/*
+ * an adaptive radix tree over the 0 terminated string keys of its data, an
+ * index with the interface of shm_rb_tree. a lookup walks one byte of the
+ * key per level, and a level takes each prefix byte once, where a binary
+ * tree compares the whole shared prefix again at every level. inner nodes
+ * grow and shrink between 4, 16, 48 and 256 children, a path of single
+ * children is kept in the node below it, and the data is stored in place
+ * of a leaf, so small fanouts cost little memory. the terminating 0 is the
+ * last byte of every key, no key ends in the middle of a path then, and
+ * keys come out of art_foreach in strcmp order
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "shm_pool.h"
+
+/* the key of data, it must not change as long as data is in the tree */
+typedef const char* (*art_key_fn)(void* data);
+typedef void (*art_release_fn)(void* data);
+
+/* bytes of a compressed path kept in its node, longer ones are checked on a leaf */
+#define ART_PREFIX 10
+
+struct art_node {
+  uint8_t  type;        /* ART_NODE* */
+  uint8_t  pad;
+  uint16_t count;       /* children */
+  uint32_t prefix_len;  /* bytes of the compressed path */
+  uint8_t  prefix[ART_PREFIX];
+};
+
+struct art_tree {
+  void*           root;  /* a node, a leaf or NULL */
+  size_t          count;
+  art_key_fn      key;
+  art_release_fn  release;
+  struct shm_pool nodes[4];  /* nodes of each size come from here */
+};
+
+/*
+ * create a new tree with key and release callback provided
+ */
+struct art_tree* art_new(art_key_fn key, art_release_fn release);
+
+/*
+ * free all resources, if release callback is provided, it will be call on each
+ * element of the tree
+ */
+void art_free(struct art_tree* t);
+
+/*
+ * add a new data, E_SHM_SAME_KEY_EXIST is returned if its key is in already
+ */
+int art_add(struct art_tree* t, void* data);
+
+/*
+ * make sure the next art_add does not run out of memory, it takes one node
+ * at most
+ */
+int art_reserve(struct art_tree* t);
+
+/*
+ * find the data of the key of *data and override *data with it, see
+ * rb_tree_query
+ */
+int art_query(struct art_tree* t, void** data);
+
+/*
+ * remove the data of the key of *data and override *data with it, release
+ * callback is not called, the removed data belongs to caller
+ */
+int art_del(struct art_tree* t, void** data);
+
+/*
+ * call fn on each data in order of keys, fn must not change the tree
+ */
+void art_foreach(struct art_tree* t, void (*fn)(void* data, void* ctx), void* ctx);
+
+/*
+ * bytes of the nodes of t
+ */
+size_t art_bytes(const struct art_tree* t);
+
+#endif // SHM_ART_H
@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "shm_config.h"
+#include "shm_bloom.h"
+
+#define BLOCK_BITS 512
+#define BLOCK_WORDS (BLOCK_BITS / 64)
+
+struct shm_bloom_block {
+  uint64_t w[BLOCK_WORDS];
+} __attribute__((aligned(64)));
+
+struct shm_bloom {
+  uint32_t                nblocks;
+  uint32_t                k;       /* bits set per key */
+  struct shm_bloom_block* blocks;
+};
+
+shm_internal uint64_t bloom_mix(uint64_t hash);
+shm_internal struct shm_bloom_block* bloom_block(const struct shm_bloom* b, uint64_t hash);
+
+struct shm_bloom* shm_bloom_new(uint32_t keys, uint32_t bits_per_key) {
+  struct shm_bloom* b = NULL;
+  uint64_t bits = (uint64_t)(keys > 0 ? keys : 1) * (bits_per_key > 0 ? bits_per_key : 1);
+  void* blocks = NULL;
+
+  // the block count is a uint32
+  if ((bits + BLOCK_BITS - 1) / BLOCK_BITS > UINT32_MAX)
+    return NULL;
+  if (NULL == (b = (struct shm_bloom*)calloc(1, sizeof(struct shm_bloom))))
+    return NULL;
+
+  // ln2 * bits per key probes is optimal for a plain bloom filter, blocking
+  // costs a little of it but the number stays about right
+  b->k = (uint32_t)(bits_per_key * 0.69 + 0.5);
+  b->k = b->k < 1 ? 1 : b->k > 16 ? 16 : b->k;
+  b->nblocks = (uint32_t)((bits + BLOCK_BITS - 1) / BLOCK_BITS);
+
+  if (0 != posix_memalign(&blocks, sizeof(struct shm_bloom_block),
+                          b->nblocks * sizeof(struct shm_bloom_block))) {
+    free(b);
+    return NULL;
+  }
+
+  memset(blocks, 0, b->nblocks * sizeof(struct shm_bloom_block));
+  b->blocks = (struct shm_bloom_block*)blocks;
+  return b;
+}
+
+void shm_bloom_free(struct shm_bloom* b) {
+  if (b == NULL)
+    return;
+
+  free(b->blocks);
+  free(b);
+}
+
+/*
+ * the high half of the mixed hash picks the block, the low half drives the
+ * probes in it by double hashing
+ */
+void shm_bloom_add(struct shm_bloom* b, uint64_t hash) {
+  struct shm_bloom_block* blk = bloom_block(b, hash = bloom_mix(hash));
+  uint32_t h = (uint32_t)hash, delta = (h >> 17) | (h << 15);
+  uint32_t i = 0, bit = 0;
+
+  for (i = 0; i < b->k; ++i, h += delta) {
+    bit = h % BLOCK_BITS;
+    blk->w[bit / 64] |= (uint64_t)1 << (bit % 64);
+  }
+}
+
+int shm_bloom_maybe(const struct shm_bloom* b, uint64_t hash) {
+  const struct shm_bloom_block* blk = bloom_block(b, hash = bloom_mix(hash));
+  uint32_t h = (uint32_t)hash, delta = (h >> 17) | (h << 15);
+  uint32_t i = 0, bit = 0;
+
+  for (i = 0; i < b->k; ++i, h += delta) {
+    bit = h % BLOCK_BITS;
+    if (0 == (blk->w[bit / 64] & ((uint64_t)1 << (bit % 64))))
+      return 0;
+  }
+  return 1;
+}
+
+/* murmur3 finalizer, the low bits of hashes like FNV-1a hardly vary */
+shm_internal uint64_t bloom_mix(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+shm_internal struct shm_bloom_block* bloom_block(const struct shm_bloom* b, uint64_t hash) {
+  // multiply and shift maps the hash onto nblocks without a division
+  return &b->blocks[((hash >> 32) * b->nblocks) >> 32];
+}
+
+#undef BLOCK_BITS
+#undef BLOCK_WORDS
@@ -0,0 +1,32 @@
+#ifndef SHM_BLOOM_H
+#define SHM_BLOOM_H
+
+#include <stdint.h>
+
+/*
+ * a blocked bloom filter: every key sets its bits in one cache line, so a
+ * lookup touches a single line whatever the number of probes. it lives in
+ * the memory of one process, and only answers "maybe" or "surely not".
+ */
+
+struct shm_bloom;
+
+/*
+ * make a filter for keys keys with bits_per_key bits each,
+ * NULL is returned if out of memory
+ */
+struct shm_bloom* shm_bloom_new(uint32_t keys, uint32_t bits_per_key);
+
+void shm_bloom_free(struct shm_bloom* b);
+
+/*
+ * add a key by its 64 bits hash, any hash of the key does, it is mixed again
+ */
+void shm_bloom_add(struct shm_bloom* b, uint64_t hash);
+
+/*
+ * 0 if the key was never added, 1 if it might have been
+ */
+int shm_bloom_maybe(const struct shm_bloom* b, uint64_t hash);
+
+#endif // SHM_BLOOM_H
@@ -1,18 +1,94 @@
 #ifndef SHM_CONFIG_H
 #define SHM_CONFIG_H
 
+/*
+ * pages of the first segment of a chain, later segments grow geometrically
+ * up to SHM_SEG_MAX_PAGES pages, see shmseg_init
+ */
 #ifndef SHM_SIZE_IN_PAGES
 #define SHM_SIZE_IN_PAGES 1
 #endif /* SHM_SIZE_IN_PAGES */
 
+#ifndef SHM_SEG_MAX_PAGES
+#define SHM_SEG_MAX_PAGES 4096
+#endif /* SHM_SEG_MAX_PAGES */
+
 #ifndef SHM_KEY
 #define SHM_KEY 0xdeadbeef
 #endif /* SHM_KEY */
 
+/*
+ * number of shm keys reserved for one segment chain, the i-th shard of a
+ * store uses the keys from SHM_KEY + i * SHM_KEY_RANGE on
+ */
+#ifndef SHM_KEY_RANGE
+#define SHM_KEY_RANGE 1024
+#endif /* SHM_KEY_RANGE */
+
+#ifndef SHM_SHARDS_MAX
+#define SHM_SHARDS_MAX 64
+#endif /* SHM_SHARDS_MAX */
+
 #ifndef SHM_KEY_RETRY
 #define SHM_KEY_RETRY 10
 #endif /* SHM_KEY_RETRY */
 
+/*
+ * recovery trusts records below the commit marker of their segment and only
+ * checksums the uncommitted tail, set to 1 to checksum every record instead
+ */
+#ifndef SHM_RECOVERY_VERIFY_ALL
+#define SHM_RECOVERY_VERIFY_ALL 0
+#endif /* SHM_RECOVERY_VERIFY_ALL */
+
+/*
+ * granularity of the ttl timer wheel in milliseconds
+ */
+#ifndef SHM_TTL_TICK_MS
+#define SHM_TTL_TICK_MS 10
+#endif /* SHM_TTL_TICK_MS */
+
+/*
+ * entries of the change ring of a store, a watcher falling behind by more
+ * changes loses them, see hamster_watch_next
+ */
+#ifndef SHM_NOTIFY_RING
+#define SHM_NOTIFY_RING 1024
+#endif /* SHM_NOTIFY_RING */
+
+/*
+ * keys a shard filter is sized for at least, it is rebuilt for twice the
+ * keys of the shard once they outgrow it, see hamster_set_filter
+ */
+#ifndef SHM_FILTER_MIN_KEYS
+#define SHM_FILTER_MIN_KEYS 1024
+#endif /* SHM_FILTER_MIN_KEYS */
+
+/*
+ * bytes of a chunk of the descriptor pools, a power of 2 and a multiple of
+ * the page size. pages of a chunk are only backed once used, see shm_pool.h
+ */
+#ifndef SHM_POOL_CHUNK
+#define SHM_POOL_CHUNK (1 << 20)
+#endif /* SHM_POOL_CHUNK */
+
+/*
+ * bytes of a chunk record of a chunked value, header and key included, so
+ * the chunks of every key fall into the same free list, see
+ * hamster_set_chunking
+ */
+#ifndef SHM_CHUNK_SIZE
+#define SHM_CHUNK_SIZE (16 * 1024)
+#endif /* SHM_CHUNK_SIZE */
+
+/*
+ * bytes of keys and values a snapshot or a dump is loaded in at a time,
+ * each one is written as a batch, see hamster_store_load
+ */
+#ifndef SHM_LOAD_BATCH
+#define SHM_LOAD_BATCH (1 << 20)
+#endif /* SHM_LOAD_BATCH */
+
 #if defined(PAGESIZE)
 #define SHM_PAGESIZE PAGESIZE
 #elif defined(PAGE_SIZE)
@@ -23,7 +99,7 @@
 
 #if defined(SHM_PAGESIZE)
 #define shm_pagesize __shm_pagesize()
-static long __shm_pagesize() {
+static inline long __shm_pagesize() {
   static long s_page_size = 0;
   return s_page_size > 0 
       ? s_page_size 
@@ -36,8 +36,12 @@ static unsigned int crc32_table[] = {
 };
 
 unsigned int shm_crc32(char* bytes, size_t bytes_count) {
+  return shm_crc32_update(0, bytes, bytes_count);
+}
+
+unsigned int shm_crc32_update(unsigned int crc, char* bytes, size_t bytes_count) {
   unsigned int* t = crc32_table; 
-  unsigned int reg = 0xffffffff;
+  unsigned int reg = crc ^ 0xffffffff;
 
   while (bytes_count-- > 0)
     reg = t[(reg ^ *bytes++) & 0xff] ^ (reg >> 8);
@@ -12,5 +12,11 @@
  */
 unsigned int shm_crc32(char* bytes, size_t bytes_count);
 
+/*
+ * go on with the checksum crc of the bytes before, shm_crc32 is the same as
+ * shm_crc32_update(0, bytes, bytes_count)
+ */
+unsigned int shm_crc32_update(unsigned int crc, char* bytes, size_t bytes_count);
+
 #endif // SHM_CRC32_H
 
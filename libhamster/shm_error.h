@@ -16,6 +16,20 @@ enum {
   E_SHM_KEY_ZERO_LENGTH,
   E_SHM_INIT_ONLY_ONCE,
   E_SHM_INVALID_PARAMS,
+  E_SHM_SHARDS_MISMATCH,
+  E_SHM_CAPACITY_EXCEEDED,
+  E_SHM_VAL_COMPRESSED,
+  E_SHM_VAL_BUFFER_TOO_SMALL,
+  E_SHM_TIMEOUT,
+  E_SHM_CHANGES_LOST,
+  E_SHM_VERSION_MISMATCH,
+  E_SHM_VAL_NOT_COUNTER,
+  E_SHM_OWNER_DEAD,
+  E_SHM_BUDGET_EXCEEDED,
+  E_SHM_VAL_CHUNKED,
+  E_SHM_NAME_MISMATCH,
+  E_SHM_REPLICA_PARTIAL,
+  E_SHM_FORMAT_MISMATCH,
 };
 
 #endif /* SHM_ERROR_H */
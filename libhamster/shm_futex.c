@@ -0,0 +1,50 @@
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shm_error.h"
+#include "shm_config.h"
+#include "shm_futex.h"
+
+shm_internal long futex_call(uint32_t* addr, int op, uint32_t val, struct timespec* timeout);
+shm_internal uint64_t futex_now_ns();
+
+void shm_futex_wake(struct shm_futex* f) {
+  __atomic_add_fetch(&f->word, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&f->waiters, __ATOMIC_SEQ_CST) > 0)
+    futex_call(&f->word, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+int shm_futex_wait(struct shm_futex* f, const uint64_t* head, uint64_t pos, uint32_t timeout_ms) {
+  uint32_t word = 0;
+  uint64_t deadline = futex_now_ns() + (uint64_t)timeout_ms * 1000000, now = 0;
+  struct timespec left;
+
+  for (;;) {
+    word = __atomic_load_n(&f->word, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(head, __ATOMIC_SEQ_CST) > pos)
+      return E_SHM_OK;
+
+    if ((now = futex_now_ns()) >= deadline)
+      return E_SHM_TIMEOUT;
+
+    left.tv_sec  = (deadline - now) / 1000000000;
+    left.tv_nsec = (deadline - now) % 1000000000;
+    __atomic_add_fetch(&f->waiters, 1, __ATOMIC_SEQ_CST);
+    futex_call(&f->word, FUTEX_WAIT, word, &left);
+    __atomic_sub_fetch(&f->waiters, 1, __ATOMIC_SEQ_CST);
+  }
+}
+
+/* shared futex, the word is in shm of several processes */
+shm_internal long futex_call(uint32_t* addr, int op, uint32_t val, struct timespec* timeout) {
+  return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+shm_internal uint64_t futex_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
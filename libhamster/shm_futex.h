@@ -0,0 +1,32 @@
+#ifndef SHM_FUTEX_H
+#define SHM_FUTEX_H
+
+#include <stdint.h>
+
+/*
+ * a futex in shm, which threads of the processes attaching it block on
+ * until a position in shm, head, moves past theirs. head is moved before
+ * shm_futex_wake bumps the word, so a waiter which saw the word unchanged
+ * and head not past its position yet can not miss the wake. a waiter
+ * killed while blocked leaves waiters too high, which only costs the
+ * writers a needless wake
+ */
+
+struct shm_futex {
+  uint32_t word;     /* bumped after every move of head */
+  uint32_t waiters;  /* threads blocked on word */
+};
+
+/*
+ * wake the waiters of f after head moved, the syscall is only made if
+ * somebody waits
+ */
+void shm_futex_wake(struct shm_futex* f);
+
+/*
+ * wait up to timeout_ms for head to move past pos, E_SHM_TIMEOUT is
+ * returned if it does not
+ */
+int shm_futex_wait(struct shm_futex* f, const uint64_t* head, uint64_t pos, uint32_t timeout_ms);
+
+#endif // SHM_FUTEX_H
@@ -0,0 +1,41 @@
+#include <errno.h>
+
+#include "shm_lock.h"
+#include "shm_error.h"
+
+int shm_lock_init(struct shm_lock* l) {
+  int ec = E_SHM_OK;
+  pthread_mutexattr_t attr;
+
+  if (0 != pthread_mutexattr_init(&attr))
+    return E_SHM_SYSTEM;
+
+  // robust: a holder which dies is taken off by the kernel, see its robust list
+  if (0 != pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) ||
+      0 != pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST) ||
+      0 != pthread_mutex_init(&l->mutex, &attr))
+    ec = E_SHM_SYSTEM;
+
+  pthread_mutexattr_destroy(&attr);
+  return ec;
+}
+
+int shm_lock_acquire(struct shm_lock* l) {
+  switch (pthread_mutex_lock(&l->mutex)) {
+  case 0:
+    return E_SHM_OK;
+  case EOWNERDEAD:
+    return E_SHM_OWNER_DEAD;
+  default:
+    // ENOTRECOVERABLE, the one to repair it gave up
+    return E_SHM_SYSTEM;
+  }
+}
+
+void shm_lock_consistent(struct shm_lock* l) {
+  pthread_mutex_consistent(&l->mutex);
+}
+
+void shm_lock_release(struct shm_lock* l) {
+  pthread_mutex_unlock(&l->mutex);
+}
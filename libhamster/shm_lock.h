@@ -0,0 +1,37 @@
+#ifndef SHM_LOCK_H
+#define SHM_LOCK_H
+
+#include <pthread.h>
+
+/*
+ * a mutex in shm, shared by the processes attaching it, which survives its
+ * holder dying. a holder killed with the lock held does not leave it locked
+ * for good: the kernel hands it to the next one to lock it, which gets
+ * E_SHM_OWNER_DEAD, repairs whatever the dead holder left half done, and
+ * calls shm_lock_consistent before it releases it. a lock released without
+ * that can not be locked any more
+ */
+
+struct shm_lock {
+  pthread_mutex_t mutex;
+};
+
+/*
+ * set up a lock in zero-filled shm, nobody else may use it meanwhile
+ */
+int shm_lock_init(struct shm_lock* l);
+
+/*
+ * lock l, E_SHM_OWNER_DEAD is returned with the lock held if its last
+ * holder died holding it
+ */
+int shm_lock_acquire(struct shm_lock* l);
+
+/*
+ * mark l repaired after E_SHM_OWNER_DEAD, it is still held
+ */
+void shm_lock_consistent(struct shm_lock* l);
+
+void shm_lock_release(struct shm_lock* l);
+
+#endif // SHM_LOCK_H
@@ -0,0 +1,159 @@
+#include <string.h>
+
+#include "shm_config.h"
+#include "shm_lz.h"
+
+#define LZ_HASH_BITS  12
+#define LZ_MIN_MATCH  4
+#define LZ_MAX_OFFSET 0xffff
+
+shm_internal uint32_t lz_read32(const char* p);
+shm_internal uint32_t lz_hash(uint32_t v);
+shm_internal bool     lz_put_len(char** op, char* oend, uint32_t len);
+shm_internal bool     lz_get_len(const char** ip, const char* iend, uint32_t* len);
+shm_internal bool     lz_emit(char** op, char* oend, const char* lit, 
+                              uint32_t lit_len, uint32_t offset, uint32_t match_len);
+
+uint32_t shm_lz_compress(const char* src, uint32_t src_size, 
+                         char* dst, uint32_t dst_cap) {
+  uint32_t table[1 << LZ_HASH_BITS];
+  uint32_t ip = 0, anchor = 0, cand = 0, len = 0, h = 0, v = 0;
+  char *op = dst, *oend = dst + dst_cap;
+
+  memset(table, 0, sizeof(table));
+  while (ip + LZ_MIN_MATCH <= src_size) {
+    v = lz_read32(src + ip);
+    h = lz_hash(v);
+    cand = table[h];
+    table[h] = ip;
+
+    if (cand >= ip || ip - cand > LZ_MAX_OFFSET || lz_read32(src + cand) != v) {
+      ++ip;
+      continue;
+    }
+
+    len = LZ_MIN_MATCH;
+    while (ip + len < src_size && src[cand + len] == src[ip + len])
+      ++len;
+
+    if (!lz_emit(&op, oend, src + anchor, ip - anchor, ip - cand, len))
+      return 0;
+
+    ip += len;
+    anchor = ip;
+  }
+
+  if (!lz_emit(&op, oend, src + anchor, src_size - anchor, 0, 0))
+    return 0;
+  return op - dst;
+}
+
+int shm_lz_decompress(const char* src, uint32_t src_size, 
+                      char* dst, uint32_t dst_cap) {
+  const char *ip = src, *iend = src + src_size;
+  char *op = dst, *oend = dst + dst_cap;
+  const char* match = NULL;
+  uint32_t len = 0, offset = 0;
+  uint8_t token = 0;
+
+  while (ip < iend) {
+    token = (uint8_t)*ip++;
+
+    // literals
+    len = token >> 4;
+    if (len == 15 && !lz_get_len(&ip, iend, &len))
+      return -1;
+    if (len > (uint32_t)(iend - ip) || len > (uint32_t)(oend - op))
+      return -1;
+    memcpy(op, ip, len);
+    ip += len;
+    op += len;
+
+    if (ip == iend)
+      break;
+
+    // match
+    if (iend - ip < 2)
+      return -1;
+    offset = (uint8_t)ip[0] | ((uint8_t)ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (uint32_t)(op - dst))
+      return -1;
+
+    len = token & 15;
+    if (len == 15 && !lz_get_len(&ip, iend, &len))
+      return -1;
+    len += LZ_MIN_MATCH;
+    if (len > (uint32_t)(oend - op))
+      return -1;
+
+    // byte by byte, the match may overlap what it is producing
+    match = op - offset;
+    while (len-- > 0)
+      *op++ = *match++;
+  }
+  return op - dst;
+}
+
+shm_internal uint32_t lz_read32(const char* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+shm_internal uint32_t lz_hash(uint32_t v) {
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+shm_internal bool lz_put_len(char** op, char* oend, uint32_t len) {
+  for (; len >= 255; len -= 255) {
+    if (*op >= oend) return false;
+    *(*op)++ = (char)255;
+  }
+  if (*op >= oend) return false;
+  *(*op)++ = (char)len;
+  return true;
+}
+
+shm_internal bool lz_get_len(const char** ip, const char* iend, uint32_t* len) {
+  uint8_t b = 0;
+  do {
+    if (*ip >= iend) return false;
+    b = (uint8_t)*(*ip)++;
+    *len += b;
+  } while (b == 255);
+  return true;
+}
+
+/* match_len of 0 ends the stream after the literals */
+shm_internal bool lz_emit(char** op, char* oend, const char* lit, 
+                          uint32_t lit_len, uint32_t offset, uint32_t match_len) {
+  char* token = *op;
+  uint32_t ml = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+
+  if (*op >= oend) return false;
+  ++(*op);
+  *token = (char)(((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15));
+
+  if (lit_len >= 15 && !lz_put_len(op, oend, lit_len - 15))
+    return false;
+  if (lit_len > (uint32_t)(oend - *op))
+    return false;
+  memcpy(*op, lit, lit_len);
+  *op += lit_len;
+
+  if (match_len == 0)
+    return true;
+
+  if (oend - *op < 2)
+    return false;
+  *(*op)++ = (char)(offset & 0xff);
+  *(*op)++ = (char)(offset >> 8);
+  if (ml >= 15 && !lz_put_len(op, oend, ml - 15))
+    return false;
+  return true;
+}
+
+#undef LZ_HASH_BITS
+#undef LZ_MIN_MATCH
+#undef LZ_MAX_OFFSET
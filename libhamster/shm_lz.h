@@ -0,0 +1,32 @@
+#ifndef SHM_LZ_H
+#define SHM_LZ_H
+
+#include <stdint.h>
+
+/*
+ * a small byte oriented LZ77 codec in the spirit of LZ4, fast to compress
+ * and even faster to decompress, for values stored in shm.
+ *
+ * the stream is a list of sequences:
+ *   token | [literal length bytes] | literals | offset | [match length bytes]
+ * the high nibble of token is the literal length, the low nibble is the match
+ * length minus 4, a nibble of 15 is followed by bytes which are added to it
+ * until a byte other than 255. offset is 2 bytes little endian. the last
+ * sequence stops after its literals.
+ */
+
+/*
+ * compress src into dst, return compressed size, or 0 if it does not fit in
+ * dst_cap bytes, pass dst_cap < src_size to only accept a real gain
+ */
+uint32_t shm_lz_compress(const char* src, uint32_t src_size, 
+                         char* dst, uint32_t dst_cap);
+
+/*
+ * decompress src into dst, return decompressed size, or -1 if src is
+ * malformed or does not fit in dst_cap bytes
+ */
+int shm_lz_decompress(const char* src, uint32_t src_size, 
+                      char* dst, uint32_t dst_cap);
+
+#endif // SHM_LZ_H
@@ -0,0 +1,116 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/shm.h>
+
+#include "shm_error.h"
+#include "shm_config.h"
+#include "shm_futex.h"
+#include "shm_notify.h"
+
+/*
+ * head is taken before an entry is written and futex is woken after, see
+ * shm_futex for the waiters
+ */
+struct notify_header {
+  struct shm_futex futex;
+  uint64_t head;     /* seq of the last change */
+} __attribute__((aligned(64)));
+
+struct shm_notify {
+  int                   shm_id;
+  struct notify_header* hdr;
+  struct shm_change*    ring;
+};
+
+#define notify_size \
+  (sizeof(struct notify_header) + SHM_NOTIFY_RING * sizeof(struct shm_change))
+
+
+int shm_notify_attach(key_t key, int create, struct shm_notify** n) {
+  int shm_id = -1;
+  void* base_ptr = NULL;
+
+  // a new segment is zero-filled, which is an empty ring
+  if ((shm_id = shmget(key, notify_size, create ? 0600 | IPC_CREAT : 0600)) < 0)
+    return errno == EINVAL ? E_SHM_SAME_KEY_EXIST 
+         : errno == ENOENT ? E_SHM_EMPTY : E_SHM_SYSTEM;
+
+  if ((void*)-1 == (base_ptr = shmat(shm_id, 0, 0)))
+    return E_SHM_SYSTEM;
+
+  if (NULL == (*n = (struct shm_notify*)calloc(1, sizeof(struct shm_notify)))) {
+    shmdt(base_ptr);
+    return E_SHM_SYSTEM;
+  }
+
+  (*n)->shm_id = shm_id;
+  (*n)->hdr = (struct notify_header*)base_ptr;
+  (*n)->ring = (struct shm_change*)((*n)->hdr + 1);
+  return E_SHM_OK;
+}
+
+void shm_notify_detach(struct shm_notify* n, int remove) {
+  if (n == NULL)
+    return;
+
+  shmdt(n->hdr);
+  if (remove)
+    shmctl(n->shm_id, IPC_RMID, NULL);
+  free(n);
+}
+
+uint64_t shm_notify_publish(struct shm_notify* n, const char* key, uint32_t hash) {
+  struct notify_header* h = n->hdr;
+  uint64_t seq = __atomic_add_fetch(&h->head, 1, __ATOMIC_SEQ_CST);
+  struct shm_change* c = &n->ring[(seq - 1) % SHM_NOTIFY_RING];
+  size_t key_size = strlen(key);
+  size_t copy = key_size < SHM_NOTIFY_KEY_SIZE ? key_size : SHM_NOTIFY_KEY_SIZE - 1;
+
+  // readers tell a half written entry by its seq
+  __atomic_store_n(&c->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  c->hash = hash;
+  c->key_size = (uint32_t)key_size;
+  memcpy(c->key, key, copy);
+  c->key[copy] = '\0';
+  __atomic_store_n(&c->seq, seq, __ATOMIC_RELEASE);
+
+  shm_futex_wake(&h->futex);
+  return seq;
+}
+
+uint64_t shm_notify_seq(struct shm_notify* n) {
+  return __atomic_load_n(&n->hdr->head, __ATOMIC_ACQUIRE);
+}
+
+int shm_notify_wait(struct shm_notify* n, uint64_t seq, uint32_t timeout_ms) {
+  return shm_futex_wait(&n->hdr->futex, &n->hdr->head, seq, timeout_ms);
+}
+
+int shm_notify_read(struct shm_notify* n, uint64_t seq, struct shm_change* c) {
+  uint64_t head = __atomic_load_n(&n->hdr->head, __ATOMIC_ACQUIRE);
+  struct shm_change* e = &n->ring[(seq - 1) % SHM_NOTIFY_RING];
+  uint64_t s = 0;
+
+  if (seq == 0 || seq > head)
+    return E_SHM_EMPTY;
+
+  if (head - seq >= SHM_NOTIFY_RING)
+    return E_SHM_CHANGES_LOST;
+
+  // seqlock: the entry is good if its seq is the same before and after
+  if ((s = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE)) != seq)
+    return s > seq ? E_SHM_CHANGES_LOST : E_SHM_EMPTY;
+
+  memcpy(c, e, sizeof(struct shm_change));
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq)
+    return E_SHM_CHANGES_LOST;
+
+  c->seq = seq;
+  c->key[SHM_NOTIFY_KEY_SIZE - 1] = '\0';
+  return E_SHM_OK;
+}
+
+#undef notify_size
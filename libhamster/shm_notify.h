@@ -0,0 +1,60 @@
+#ifndef SHM_NOTIFY_H
+#define SHM_NOTIFY_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * change notifications in shm: a ring of the last SHM_NOTIFY_RING changes
+ * and a futex word bumped after each of them. every process attaching the
+ * same key sees the same ring, and might block on the futex until the next
+ * change. writers only make the wake syscall if somebody waits
+ */
+
+#define SHM_NOTIFY_KEY_SIZE 48
+
+/* an entry of the ring */
+struct shm_change {
+  uint64_t seq;       /* number of the change, from 1 on, 0 while written */
+  uint32_t hash;      /* hash of the key */
+  uint32_t key_size;  /* length of the key */
+  char     key[SHM_NOTIFY_KEY_SIZE];  /* the key, truncated if too long */
+};
+
+struct shm_notify;
+
+/*
+ * attach the ring on key, create it if it does not exist yet and create,
+ * E_SHM_EMPTY is returned otherwise. E_SHM_SAME_KEY_EXIST is returned if
+ * key holds a smaller segment
+ */
+int shm_notify_attach(key_t key, int create, struct shm_notify** n);
+
+/*
+ * detach the ring, and delete it if remove
+ */
+void shm_notify_detach(struct shm_notify* n, int remove);
+
+/*
+ * record a change of key and wake the waiters, return its seq
+ */
+uint64_t shm_notify_publish(struct shm_notify* n, const char* key, uint32_t hash);
+
+/*
+ * seq of the last change, 0 if none
+ */
+uint64_t shm_notify_seq(struct shm_notify* n);
+
+/*
+ * block until there is a change after seq, for timeout_ms at most.
+ * E_SHM_TIMEOUT is returned if there is none
+ */
+int shm_notify_wait(struct shm_notify* n, uint64_t seq, uint32_t timeout_ms);
+
+/*
+ * read change seq. E_SHM_EMPTY is returned if it is not written yet, and
+ * E_SHM_CHANGES_LOST if the ring has overwritten it already
+ */
+int shm_notify_read(struct shm_notify* n, uint64_t seq, struct shm_change* c);
+
+#endif // SHM_NOTIFY_H
@@ -0,0 +1,100 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+
+#include "shm_config.h"
+#include "shm_numa.h"
+
+#ifdef HAVE_LIBNUMA
+
+#include <sched.h>
+#include <numa.h>
+#include <numaif.h>
+
+shm_internal pthread_once_t g_numa_once = PTHREAD_ONCE_INIT;
+shm_internal int  g_numa_nodes = 1;
+shm_internal int  g_numa_cpus;
+shm_internal int* g_numa_cpu_node;  /* node of each cpu */
+
+shm_internal void numa_setup();
+
+int shm_numa_nodes() {
+  pthread_once(&g_numa_once, numa_setup);
+  return g_numa_nodes;
+}
+
+int shm_numa_node() {
+  int cpu = 0;
+
+  pthread_once(&g_numa_once, numa_setup);
+  if (g_numa_nodes == 1 || (cpu = sched_getcpu()) < 0 || cpu >= g_numa_cpus)
+    return 0;
+  return g_numa_cpu_node[cpu];
+}
+
+int shm_numa_bind(void* addr, size_t len, int node) {
+  unsigned long mask[16] = { 0 };
+  size_t bits = sizeof(mask) * 8;
+
+  if (numa_available() < 0 || node < 0 || (size_t)node >= bits)
+    return -1;
+
+  mask[node / (sizeof(unsigned long) * 8)] = 1UL << (node % (sizeof(unsigned long) * 8));
+  return mbind(addr, len, MPOL_BIND, mask, bits, 0) == 0 ? 0 : -1;
+}
+
+int shm_numa_interleave(void* addr, size_t len) {
+  unsigned long mask[16] = { 0 };
+  size_t bits = sizeof(mask) * 8;
+  int node = 0;
+
+  if (numa_available() < 0)
+    return -1;
+
+  shm_numa_nodes();
+
+  for (node = 0; node < g_numa_nodes && (size_t)node < bits; ++node)
+    mask[node / (sizeof(unsigned long) * 8)] |= 1UL << (node % (sizeof(unsigned long) * 8));
+  return mbind(addr, len, MPOL_INTERLEAVE, mask, bits, 0) == 0 ? 0 : -1;
+}
+
+/* cache the cpu to node map, numa_node_of_cpu is too slow for each lookup */
+shm_internal void numa_setup() {
+  int cpu = 0;
+
+  if (numa_available() < 0)
+    return;
+
+  g_numa_nodes = numa_max_node() + 1;
+  g_numa_cpus = numa_num_configured_cpus();
+  if (g_numa_nodes <= 1 || g_numa_cpus <= 0 ||
+      NULL == (g_numa_cpu_node = (int*)calloc(g_numa_cpus, sizeof(int)))) {
+    g_numa_nodes = 1;
+    return;
+  }
+
+  for (cpu = 0; cpu < g_numa_cpus; ++cpu) {
+    g_numa_cpu_node[cpu] = numa_node_of_cpu(cpu);
+    if (g_numa_cpu_node[cpu] < 0)
+      g_numa_cpu_node[cpu] = 0;
+  }
+}
+
+#else /* HAVE_LIBNUMA */
+
+int shm_numa_nodes() {
+  return 1;
+}
+
+int shm_numa_node() {
+  return 0;
+}
+
+int shm_numa_bind(void* addr, size_t len, int node) {
+  return -1;
+}
+
+int shm_numa_interleave(void* addr, size_t len) {
+  return -1;
+}
+
+#endif /* HAVE_LIBNUMA */
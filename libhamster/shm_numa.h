@@ -0,0 +1,29 @@
+#ifndef SHM_NUMA_H
+#define SHM_NUMA_H
+
+#include <stdlib.h>
+
+/*
+ * numa placement of shm segments, on top of libnuma if the build finds it
+ * (HAVE_LIBNUMA). without it, or on a kernel without numa, the host is one
+ * node and the placement calls do nothing but fail
+ */
+
+/*
+ * number of numa nodes, 1 at least
+ */
+int shm_numa_nodes();
+
+/*
+ * node of the cpu the calling thread runs on
+ */
+int shm_numa_node();
+
+/*
+ * place the pages of [addr, addr + len) on node, or interleave them over
+ * all nodes, call before they are touched. return 0 on success, -1 otherwise
+ */
+int shm_numa_bind(void* addr, size_t len, int node);
+int shm_numa_interleave(void* addr, size_t len);
+
+#endif // SHM_NUMA_H
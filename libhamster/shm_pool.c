@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "shm_error.h"
+#include "shm_config.h"
+#include "shm_pool.h"
+
+/*
+ * layout of a chunk
+ * +--------------+--------+--------+-----+--------+
+ * | chunk header | slot 0 | slot 1 | ... | unused |
+ * +--------------+--------+--------+-----+--------+
+ * slot i of chunk c has handle c * per_chunk + i + 1
+ */
+struct chunk_header {
+  uint32_t index;  /* in chunks */
+} __attribute__((aligned(16)));
+
+#define chunk_of(ptr) \
+  ((struct chunk_header*)((uintptr_t)(ptr) & ~(uintptr_t)(SHM_POOL_CHUNK - 1)))
+
+shm_internal int pool_grow(struct shm_pool* p);
+
+void shm_pool_init(struct shm_pool* p, uint32_t size) {
+  memset(p, 0, sizeof(struct shm_pool));
+  // a free slot holds the handle of the next one, and slots stay aligned
+  p->size = ((size < sizeof(uint32_t) ? sizeof(uint32_t) : size) + 7) & ~7u;
+  p->per_chunk = (SHM_POOL_CHUNK - sizeof(struct chunk_header)) / p->size;
+}
+
+void shm_pool_destroy(struct shm_pool* p) {
+  uint32_t i = 0;
+
+  for (i = 0; i < p->nchunks; ++i)
+    munmap(p->chunks[i], SHM_POOL_CHUNK);
+  free(p->chunks);
+  shm_pool_init(p, p->size);
+}
+
+uint32_t shm_pool_alloc(struct shm_pool* p) {
+  uint32_t h = 0;
+  void* ptr = NULL;
+
+  if (p->free != 0) {
+    h = p->free;
+    ptr = shm_pool_ptr(p, h);
+    memcpy(&p->free, ptr, sizeof(uint32_t));
+  } else {
+    if (p->top == p->nchunks * p->per_chunk && E_SHM_OK != pool_grow(p))
+      return 0;
+    h = ++p->top;
+    ptr = shm_pool_ptr(p, h);
+  }
+
+  memset(ptr, 0, p->size);
+  ++p->used;
+  return h;
+}
+
+int shm_pool_reserve(struct shm_pool* p, uint32_t n) {
+  int ec = E_SHM_OK;
+
+  // the free slots, and those not handed out of the chunks yet
+  while (p->nchunks * p->per_chunk - p->used < n)
+    if (E_SHM_OK != (ec = pool_grow(p)))
+      return ec;
+  return E_SHM_OK;
+}
+
+void shm_pool_free(struct shm_pool* p, uint32_t h) {
+  if (h == 0)
+    return;
+
+  memcpy(shm_pool_ptr(p, h), &p->free, sizeof(uint32_t));
+  p->free = h;
+  --p->used;
+}
+
+void* shm_pool_ptr(const struct shm_pool* p, uint32_t h) {
+  if (h == 0)
+    return NULL;
+
+  --h;
+  return p->chunks[h / p->per_chunk] + sizeof(struct chunk_header) + 
+         (size_t)(h % p->per_chunk) * p->size;
+}
+
+uint32_t shm_pool_handle(const struct shm_pool* p, const void* ptr) {
+  struct chunk_header* c = chunk_of(ptr);
+  return c->index * p->per_chunk + 
+         (uint32_t)(((const char*)ptr - (const char*)(c + 1)) / p->size) + 1;
+}
+
+size_t shm_pool_bytes(const struct shm_pool* p) {
+  return (size_t)p->nchunks * SHM_POOL_CHUNK;
+}
+
+shm_internal int pool_grow(struct shm_pool* p) {
+  char* chunk = NULL;
+  char** chunks = NULL;
+  uint32_t cap = 0;
+  size_t head = 0;
+
+  if (p->nchunks == p->cap) {
+    cap = p->cap > 0 ? p->cap * 2 : 16;
+    if (NULL == (chunks = (char**)realloc(p->chunks, cap * sizeof(char*))))
+      return E_SHM_SYSTEM;
+    p->chunks = chunks;
+    p->cap = cap;
+  }
+
+  // aligned on its size, so a slot finds its chunk by masking. mapped rather
+  // than malloced, the pages are only backed once slots are handed out of them
+  chunk = (char*)mmap(NULL, 2 * SHM_POOL_CHUNK, PROT_READ | PROT_WRITE, 
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (chunk == MAP_FAILED)
+    return E_SHM_SYSTEM;
+
+  head = (SHM_POOL_CHUNK - (uintptr_t)chunk % SHM_POOL_CHUNK) % SHM_POOL_CHUNK;
+  if (head > 0)
+    munmap(chunk, head);
+  munmap(chunk + head + SHM_POOL_CHUNK, SHM_POOL_CHUNK - head);
+  chunk += head;
+
+  ((struct chunk_header*)chunk)->index = p->nchunks;
+  p->chunks[p->nchunks++] = chunk;
+  return E_SHM_OK;
+}
+
+#undef chunk_of
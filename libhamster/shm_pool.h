@@ -0,0 +1,66 @@
+#ifndef SHM_POOL_H
+#define SHM_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * a pool of fixed size slots in process memory, for the descriptors there is
+ * one of per key. slots are carved from SHM_POOL_CHUNK byte chunks aligned
+ * on their size, so they cost no allocator header, never move, and map to a
+ * 32 bits handle and back in O(1). handle 0 is never used, it stands for
+ * none. free slots are chained by handle
+ */
+
+struct shm_pool {
+  uint32_t size;       /* bytes of a slot */
+  uint32_t per_chunk;  /* slots of a chunk */
+  char**   chunks;
+  uint32_t nchunks;
+  uint32_t cap;        /* room of chunks */
+  uint32_t top;        /* slots handed out of the chunks so far */
+  uint32_t free;       /* first free slot, 0 for none */
+  uint32_t used;       /* slots in use */
+};
+
+/*
+ * set up an empty pool of size byte slots, it allocates on first use
+ */
+void shm_pool_init(struct shm_pool* p, uint32_t size);
+
+/*
+ * free every chunk, handles and pointers of the pool are gone after it
+ */
+void shm_pool_destroy(struct shm_pool* p);
+
+/*
+ * take a zeroed slot, 0 is returned if out of memory
+ */
+uint32_t shm_pool_alloc(struct shm_pool* p);
+
+/*
+ * make sure the next n shm_pool_alloc do not run out of memory
+ */
+int shm_pool_reserve(struct shm_pool* p, uint32_t n);
+
+/*
+ * give slot h back
+ */
+void shm_pool_free(struct shm_pool* p, uint32_t h);
+
+/*
+ * the slot of handle h, NULL for 0
+ */
+void* shm_pool_ptr(const struct shm_pool* p, uint32_t h);
+
+/*
+ * the handle of a slot of p
+ */
+uint32_t shm_pool_handle(const struct shm_pool* p, const void* ptr);
+
+/*
+ * bytes of the chunks of p
+ */
+size_t shm_pool_bytes(const struct shm_pool* p);
+
+#endif // SHM_POOL_H
@@ -12,9 +12,9 @@
 shm_internal bool do_add_fixup = true;
 #endif
 
-shm_internal struct rb_node* node_new(struct rb_node* p, struct rb_node* nil, 
-                                      rb_color c, void* data) {
-  struct rb_node* n = (struct rb_node*)calloc(1, sizeof(struct rb_node));
+shm_internal struct rb_node* node_new(struct rb_tree* t, struct rb_node* p, 
+                                      struct rb_node* nil, rb_color c, void* data) {
+  struct rb_node* n = (struct rb_node*)shm_pool_ptr(&t->nodes, shm_pool_alloc(&t->nodes));
   if (NULL != n) {
     n->p = p;
     n->l = n->r = nil;
@@ -33,12 +33,22 @@ shm_internal void free_nodes(struct rb_tree* t,
                              struct rb_node* n,
                              release_fn release);
 
+shm_internal void foreach_nodes(struct rb_tree* t,
+                                struct rb_node* n,
+                                void (*fn)(void* data, void* ctx),
+                                void* ctx);
+
 /** rotation **/
 shm_internal void rb_tree_left_rotate(struct rb_tree* t, struct rb_node* n);
 shm_internal void rb_tree_right_rotate(struct rb_tree* t, struct rb_node* y);
 
 /** fixup **/
 shm_internal void rb_tree_fixup(struct rb_tree* t, struct rb_node* new_node);
+shm_internal void rb_tree_del_fixup(struct rb_tree* t, struct rb_node* x);
+
+/** deletion helpers **/
+shm_internal void rb_tree_transplant(struct rb_tree* t, struct rb_node* u, struct rb_node* v);
+shm_internal struct rb_node* rb_tree_minimum(struct rb_tree* t, struct rb_node* n);
 
 struct rb_tree* rb_tree_new(less_fn less, release_fn release) {
   struct rb_tree* t = NULL;
@@ -47,17 +57,22 @@ struct rb_tree* rb_tree_new(less_fn less, release_fn release) {
     return NULL;
 
   if (NULL != (t =  (struct rb_tree*)calloc(1, sizeof(struct rb_tree)))) {
-    t->nil = node_new(NULL, NULL, black, NULL);
+    shm_pool_init(&t->nodes, sizeof(struct rb_node));
     t->less = less;
     t->release = release;
+    if (NULL == (t->nil = node_new(t, NULL, NULL, black, NULL))) {
+      free(t);
+      return NULL;
+    }
   }
 
   return t;
 }
 
 void rb_tree_free(struct rb_tree* t) {
-  free_nodes(t, t->root, t->release);
-  free(t->nil);
+  if (t->release != NULL)
+    free_nodes(t, t->root, t->release);
+  shm_pool_destroy(&t->nodes);
   free(t);
 }
 
@@ -68,7 +83,7 @@ int rb_tree_add(struct rb_tree* t, void* data) {
   if (found != nil(t))
     return E_SHM_SAME_KEY_EXIST;
 
-  new_node = node_new(parent, nil(t), red, data);
+  new_node = node_new(t, parent, nil(t), red, data);
   if (NULL == new_node)
     return E_SHM_SYSTEM;
 
@@ -89,6 +104,10 @@ int rb_tree_add(struct rb_tree* t, void* data) {
   return 0;
 }
 
+int rb_tree_reserve(struct rb_tree* t) {
+  return shm_pool_reserve(&t->nodes, 1);
+}
+
 int rb_tree_query(struct rb_tree* t, void** data) {
   struct rb_node *found = NULL, *parent = NULL;
   rb_tree_query_internal(t, *data, &found, &parent);
@@ -99,6 +118,52 @@ int rb_tree_query(struct rb_tree* t, void** data) {
   return E_SHM_OK;
 }
 
+int rb_tree_del(struct rb_tree* t, void** data) {
+  struct rb_node *z = NULL, *parent = NULL, *x = NULL, *y = NULL;
+  rb_color y_color;
+
+  rb_tree_query_internal(t, *data, &z, &parent);
+  if (z == nil(t))
+    return E_SHM_KEY_NOT_FOUND;
+
+  y = z;
+  y_color = y->c;
+  if (z->l == nil(t)) {
+    x = z->r;
+    rb_tree_transplant(t, z, z->r);
+  } else if (z->r == nil(t)) {
+    x = z->l;
+    rb_tree_transplant(t, z, z->l);
+  } else {
+    y = rb_tree_minimum(t, z->r);
+    y_color = y->c;
+    x = y->r;
+    if (y->p == z) {
+      x->p = y;
+    } else {
+      rb_tree_transplant(t, y, y->r);
+      y->r = z->r;
+      y->r->p = y;
+    }
+    rb_tree_transplant(t, z, y);
+    y->l = z->l;
+    y->l->p = y;
+    y->c = z->c;
+  }
+
+  if (y_color == black)
+    rb_tree_del_fixup(t, x);
+
+  // an empty tree has a NULL root, see rb_tree_query_internal
+  if (t->root == nil(t))
+    t->root = NULL;
+
+  *data = z->data;
+  shm_pool_free(&t->nodes, shm_pool_handle(&t->nodes, z));
+  --(t->count);
+  return E_SHM_OK;
+}
+
 shm_internal void rb_tree_query_internal(struct rb_tree* t, 
                                          void* data, 
                                          struct rb_node** n, 
@@ -128,6 +193,21 @@ shm_internal void rb_tree_query_internal(struct rb_tree* t,
   *p = parent;
 }
 
+void rb_tree_foreach(struct rb_tree* t, void (*fn)(void* data, void* ctx), void* ctx) {
+  foreach_nodes(t, t->root, fn, ctx);
+}
+
+shm_internal void foreach_nodes(struct rb_tree* t, 
+                                struct rb_node* n,
+                                void (*fn)(void* data, void* ctx),
+                                void* ctx) {
+  if (n == NULL || n == nil(t)) return;
+
+  foreach_nodes(t, n->l, fn, ctx);
+  fn(n->data, ctx);
+  foreach_nodes(t, n->r, fn, ctx);
+}
+
 shm_internal void free_nodes(struct rb_tree* t, 
                              struct rb_node* n,
                              release_fn release) {
@@ -135,10 +215,7 @@ shm_internal void free_nodes(struct rb_tree* t,
 
   free_nodes(t, n->l, release);
   free_nodes(t, n->r, release);
-
-  if (release != NULL)
-    release(n->data);
-  free(n);
+  release(n->data);
 }
 
 /*
@@ -247,5 +324,91 @@ shm_internal void rb_tree_fixup(struct rb_tree* t, struct rb_node* z)
   t->root->c = black;
 }
 
+/*
+ * x carries an extra black after its parent was removed, push it up until it
+ * hits a red node or the root. x might be nil, whose p is set by transplant
+ */
+shm_internal void rb_tree_del_fixup(struct rb_tree* t, struct rb_node* x)
+{
+  struct rb_node* w = NULL;
+
+  while (x != t->root && x->c == black) {
+    if (x == x->p->l) {
+      w = x->p->r;
+      if (w->c == red) {
+        /** case 1 **/
+        w->c = black;
+        x->p->c = red;
+        rb_tree_left_rotate(t, x->p);
+        w = x->p->r;
+      }
+      if (w->l->c == black && w->r->c == black) {
+        /** case 2 **/
+        w->c = red;
+        x = x->p;
+      } else {
+        if (w->r->c == black) {
+          /** case 3 **/
+          w->l->c = black;
+          w->c = red;
+          rb_tree_right_rotate(t, w);
+          w = x->p->r;
+        }
+        /** case 4 **/
+        w->c = x->p->c;
+        x->p->c = black;
+        w->r->c = black;
+        rb_tree_left_rotate(t, x->p);
+        x = t->root;
+      }
+    } else {
+      w = x->p->l;
+      if (w->c == red) {
+        /** case 1 **/
+        w->c = black;
+        x->p->c = red;
+        rb_tree_right_rotate(t, x->p);
+        w = x->p->l;
+      }
+      if (w->r->c == black && w->l->c == black) {
+        /** case 2 **/
+        w->c = red;
+        x = x->p;
+      } else {
+        if (w->l->c == black) {
+          /** case 3 **/
+          w->r->c = black;
+          w->c = red;
+          rb_tree_left_rotate(t, w);
+          w = x->p->l;
+        }
+        /** case 4 **/
+        w->c = x->p->c;
+        x->p->c = black;
+        w->l->c = black;
+        rb_tree_right_rotate(t, x->p);
+        x = t->root;
+      }
+    }
+  }
+  x->c = black;
+}
+
+shm_internal void rb_tree_transplant(struct rb_tree* t, struct rb_node* u, struct rb_node* v) {
+  if (u->p == nil(t))
+    t->root = v;
+  else if (u == u->p->l)
+    u->p->l = v;
+  else
+    u->p->r = v;
+  v->p = u->p;
+}
+
+shm_internal struct rb_node* rb_tree_minimum(struct rb_tree* t, struct rb_node* n) {
+  while (n->l != nil(t))
+    n = n->l;
+  return n;
+}
+
 #undef nil
 
@@ -10,6 +10,8 @@
  * nil helps a lot in boundary checking
  */
 
+#include "shm_pool.h"
+
 typedef int (*less_fn)(void* left, void* right);
 typedef void (*release_fn)(void* data);
 
@@ -32,6 +34,7 @@ struct rb_tree {
   size_t          count;
   less_fn         less;
   release_fn      release;
+  struct shm_pool nodes;  /* every node, nil included, comes from here */
 };
 
 /*
@@ -50,6 +53,11 @@ void rb_tree_free(struct rb_tree* t);
  */
 int rb_tree_add(struct rb_tree* t, void* data);
 
+/*
+ * make sure the next rb_tree_add does not run out of memory
+ */
+int rb_tree_reserve(struct rb_tree* t);
+
 /*
  * this api is not seen to be straght forward to be use:
  * 1. data is a pptr which will be use in less function for node searching,
@@ -64,5 +72,17 @@ int rb_tree_add(struct rb_tree* t, void* data);
  */
 int rb_tree_query(struct rb_tree* t, void** data);
 
+/*
+ * remove a data, data works the same way as in rb_tree_query: it is searched
+ * by its 'key' element, and overrided with the removed data ptr on success.
+ * release callback is not called, the removed data belongs to caller
+ */
+int rb_tree_del(struct rb_tree* t, void** data);
+
+/*
+ * call fn on each data in order, fn must not change the tree
+ */
+void rb_tree_foreach(struct rb_tree* t, void (*fn)(void* data, void* ctx), void* ctx);
+
 #endif // SHM_RB_TREE_H
 
@@ -0,0 +1,219 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/shm.h>
+
+#include "shm_error.h"
+#include "shm_config.h"
+#include "shm_futex.h"
+#include "shm_replog.h"
+
+/*
+ * reserve is moved past a record before it is written and head after, a
+ * reader copies a record below head and checks reserve has not moved on by
+ * more than the ring since, or the bytes it copied might be overwritten.
+ * futex is woken after head moved, see shm_futex for the waiters
+ */
+struct replog_header {
+  struct shm_futex futex;
+  uint64_t size;       /* bytes of the ring */
+  uint64_t reserve;    /* end of the records being written */
+  uint64_t head;       /* end of the records written */
+  uint64_t lsn;        /* lsn of the last record */
+  uint64_t acked;      /* end of the records a follower applied */
+  uint64_t acked_lsn;
+} __attribute__((aligned(64)));
+
+/* a record in the ring, 8 bytes aligned, its payload follows */
+struct replog_rec {
+  uint32_t size;  /* bytes of the payload */
+  uint32_t pad;
+  uint64_t lsn;
+};
+
+struct shm_replog {
+  int                   shm_id;
+  struct replog_header* hdr;
+  char*                 ring;
+  pthread_mutex_t       lock;  /* appends of the owner */
+};
+
+#define rec_total(size) ((sizeof(struct replog_rec) + (size) + 7) & ~(uint64_t)7)
+
+shm_internal void replog_copy_in(struct shm_replog* l, uint64_t pos, const void* src, size_t n);
+shm_internal void replog_copy_out(struct shm_replog* l, uint64_t pos, void* dst, size_t n);
+
+int shm_replog_attach(key_t key, size_t size, struct shm_replog** l) {
+  int shm_id = -1;
+  void* base_ptr = NULL;
+  struct replog_header* h = NULL;
+
+  size = (size + 7) & ~(size_t)7;
+  if (size > 0) {
+    // a new segment is zero-filled, which is an empty ring
+    if ((shm_id = shmget(key, sizeof(struct replog_header) + size, 0600 | IPC_CREAT)) < 0)
+      return errno == EINVAL ? E_SHM_SAME_KEY_EXIST : E_SHM_SYSTEM;
+  } else if ((shm_id = shmget(key, 0, 0600)) < 0) {
+    return errno == ENOENT ? E_SHM_EMPTY : E_SHM_SYSTEM;
+  }
+
+  if ((void*)-1 == (base_ptr = shmat(shm_id, 0, 0)))
+    return E_SHM_SYSTEM;
+
+  h = (struct replog_header*)base_ptr;
+  if (size > 0) {
+    // positions are in units of the first size, a crash leaves a record
+    // which is reserved but never written
+    if (h->size == 0)
+      h->size = size;
+    __atomic_store_n(&h->reserve, h->head, __ATOMIC_SEQ_CST);
+  } else if (__atomic_load_n(&h->size, __ATOMIC_ACQUIRE) == 0) {
+    shmdt(base_ptr);
+    return E_SHM_EMPTY;
+  }
+
+  if (NULL == (*l = (struct shm_replog*)calloc(1, sizeof(struct shm_replog)))) {
+    shmdt(base_ptr);
+    return E_SHM_SYSTEM;
+  }
+
+  (*l)->shm_id = shm_id;
+  (*l)->hdr = h;
+  (*l)->ring = (char*)(h + 1);
+  pthread_mutex_init(&(*l)->lock, NULL);
+  return E_SHM_OK;
+}
+
+void shm_replog_detach(struct shm_replog* l, int remove) {
+  if (l == NULL)
+    return;
+
+  shmdt(l->hdr);
+  if (remove)
+    shmctl(l->shm_id, IPC_RMID, NULL);
+  pthread_mutex_destroy(&l->lock);
+  free(l);
+}
+
+uint64_t shm_replog_append(struct shm_replog* l, const struct iovec* iov, int n) {
+  struct replog_header* h = l->hdr;
+  struct replog_rec rec;
+  uint64_t pos = 0, total = 0, lsn = 0;
+  size_t size = 0;
+  int i = 0;
+
+  for (i = 0; i < n; ++i)
+    size += iov[i].iov_len;
+  total = rec_total(size);
+
+  pthread_mutex_lock(&l->lock);
+  pos = h->head;
+  lsn = h->lsn + 1;
+  __atomic_store_n(&h->reserve, pos + total, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  if (total <= h->size) {
+    rec.size = (uint32_t)size;
+    rec.pad = 0;
+    rec.lsn = lsn;
+    replog_copy_in(l, pos, &rec, sizeof(rec));
+    pos += sizeof(rec);
+    for (i = 0; i < n; ++i) {
+      replog_copy_in(l, pos, iov[i].iov_base, iov[i].iov_len);
+      pos += iov[i].iov_len;
+    }
+  }
+  __atomic_store_n(&h->lsn, lsn, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->head, h->reserve, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&l->lock);
+
+  shm_futex_wake(&h->futex);
+  return lsn;
+}
+
+uint64_t shm_replog_head(struct shm_replog* l, uint64_t* lsn) {
+  uint64_t head = 0;
+
+  // lsn is stored before head, read them the other way round
+  do {
+    head = __atomic_load_n(&l->hdr->head, __ATOMIC_ACQUIRE);
+    if (lsn != NULL)
+      *lsn = __atomic_load_n(&l->hdr->lsn, __ATOMIC_ACQUIRE);
+  } while (head != __atomic_load_n(&l->hdr->head, __ATOMIC_ACQUIRE));
+  return head;
+}
+
+int shm_replog_read(struct shm_replog* l, uint64_t* pos, void* buf, uint32_t* size, uint64_t* lsn) {
+  struct replog_header* h = l->hdr;
+  uint64_t head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+  struct replog_rec rec;
+  bool fits = false;
+
+  if (*pos >= head)
+    return E_SHM_EMPTY;
+
+  if (head - *pos > h->size)
+    return E_SHM_CHANGES_LOST;
+
+  replog_copy_out(l, *pos, &rec, sizeof(rec));
+  if ((fits = rec.size <= *size && rec_total(rec.size) <= head - *pos))
+    replog_copy_out(l, *pos + sizeof(rec), buf, rec.size);
+
+  // the copy is good if the ring did not move over it meanwhile
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&h->reserve, __ATOMIC_RELAXED) - *pos > h->size)
+    return E_SHM_CHANGES_LOST;
+
+  if (rec_total(rec.size) > head - *pos)
+    return E_SHM_DATA_CORRUPTED;
+
+  *size = rec.size;
+  if (!fits)
+    return E_SHM_VAL_BUFFER_TOO_SMALL;
+
+  if (lsn != NULL)
+    *lsn = rec.lsn;
+  *pos += rec_total(rec.size);
+  return E_SHM_OK;
+}
+
+int shm_replog_wait(struct shm_replog* l, uint64_t pos, uint32_t timeout_ms) {
+  return shm_futex_wait(&l->hdr->futex, &l->hdr->head, pos, timeout_ms);
+}
+
+void shm_replog_ack(struct shm_replog* l, uint64_t pos, uint64_t lsn) {
+  __atomic_store_n(&l->hdr->acked_lsn, lsn, __ATOMIC_RELAXED);
+  __atomic_store_n(&l->hdr->acked, pos, __ATOMIC_RELEASE);
+}
+
+uint64_t shm_replog_acked(struct shm_replog* l, uint64_t* lsn) {
+  uint64_t acked = __atomic_load_n(&l->hdr->acked, __ATOMIC_ACQUIRE);
+  if (lsn != NULL)
+    *lsn = __atomic_load_n(&l->hdr->acked_lsn, __ATOMIC_RELAXED);
+  return acked;
+}
+
+/* n bytes at pos, wrapping around the end of the ring */
+shm_internal void replog_copy_in(struct shm_replog* l, uint64_t pos, const void* src, size_t n) {
+  size_t off = (size_t)(pos % l->hdr->size), first = l->hdr->size - off;
+
+  if (n <= first) {
+    memcpy(l->ring + off, src, n);
+  } else {
+    memcpy(l->ring + off, src, first);
+    memcpy(l->ring, (const char*)src + first, n - first);
+  }
+}
+
+shm_internal void replog_copy_out(struct shm_replog* l, uint64_t pos, void* dst, size_t n) {
+  size_t off = (size_t)(pos % l->hdr->size), first = l->hdr->size - off;
+
+  if (n <= first) {
+    memcpy(dst, l->ring + off, n);
+  } else {
+    memcpy(dst, l->ring + off, first);
+    memcpy((char*)dst + first, l->ring, n - first);
+  }
+}
+
+#undef rec_total
@@ -0,0 +1,64 @@
+#ifndef SHM_REPLOG_H
+#define SHM_REPLOG_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <sys/types.h>
+
+/*
+ * replication log in shm: a byte ring the owner of a store appends a record
+ * to for every write, and followers in any process read from. positions are
+ * byte offsets since the ring was created and never wrap, a record at pos
+ * is readable until the ring has moved on by its size past it. records are
+ * numbered by lsn from 1 on, the owner appends them one at a time
+ */
+
+struct shm_replog;
+
+/*
+ * attach the ring on key. the owner passes the size of the ring and
+ * creates it if it does not exist yet, E_SHM_SAME_KEY_EXIST is returned if
+ * key holds a smaller segment. a follower passes 0, and gets E_SHM_EMPTY if
+ * there is no ring on key
+ */
+int shm_replog_attach(key_t key, size_t size, struct shm_replog** l);
+
+/*
+ * detach the ring, and delete it if remove
+ */
+void shm_replog_detach(struct shm_replog* l, int remove);
+
+/*
+ * append one record made of the n parts of iov and wake the waiters, return
+ * its lsn. a record bigger than the ring can not be read by anybody, the
+ * ring is moved on by its size instead, so every follower has to catch up
+ */
+uint64_t shm_replog_append(struct shm_replog* l, const struct iovec* iov, int n);
+
+/*
+ * end of the last record, and its lsn if lsn is not NULL
+ */
+uint64_t shm_replog_head(struct shm_replog* l, uint64_t* lsn);
+
+/*
+ * read the record at *pos into buf of *size bytes, and move *pos past it.
+ * E_SHM_EMPTY is returned if it is not written yet, E_SHM_CHANGES_LOST if
+ * the ring has overwritten it already, and E_SHM_VAL_BUFFER_TOO_SMALL with
+ * *size set to the size needed
+ */
+int shm_replog_read(struct shm_replog* l, uint64_t* pos, void* buf, uint32_t* size, uint64_t* lsn);
+
+/*
+ * block until the ring ends after pos, for timeout_ms at most.
+ * E_SHM_TIMEOUT is returned if it does not
+ */
+int shm_replog_wait(struct shm_replog* l, uint64_t pos, uint32_t timeout_ms);
+
+/*
+ * a follower tells how far it got, the last one to do it is what
+ * shm_replog_acked reports
+ */
+void shm_replog_ack(struct shm_replog* l, uint64_t pos, uint64_t lsn);
+uint64_t shm_replog_acked(struct shm_replog* l, uint64_t* lsn);
+
+#endif // SHM_REPLOG_H
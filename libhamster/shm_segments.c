@@ -1,11 +1,19 @@
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/shm.h>
+#include <sys/mman.h>
 
+#include "shm_lock.h"
+#include "shm_numa.h"
 #include "shm_error.h"
 #include "shm_config.h"
 #include "shm_segments.h"
 
+#define seg_round(size) ((((size) + 15) >> 4) << 4) /* round size to 16 */
+/* free space of the current segment which starts the next one ahead */
+#define seg_low_water(s) ((s)->seg_size / 4)
+
 struct seg_t {
   key_t   shm_key;    /* shm key */
   int     shm_id;     /* shm_id after successfully attach to shm with shm_key */
@@ -15,143 +23,419 @@ struct seg_t {
 };
 
 /* 
- * a 16 bytes header for each shm segment 
+ * a header for each shm segment, aligned to 16 bytes
  * why 16 bytes ? beacuse the size of key_t is undetermined under different 
- * system, some might define it as int, and some might define it as long
+ * system, some might define it as int, and some might define it as long.
+ * the lock and the allocation it guards are used in the entry segment of a
+ * chain only, see shmseg_lock
  */
 struct seg_header {
   uint32_t off;          /* offset of used part */
   key_t    next_shm_key; /* next shm segment */
+  uint32_t commit_off;   /* records below this offset are committed */
+  uint32_t epoch;        /* chain epoch of the last commit in this segment */
+  struct shm_lock        lock;   /* of the chain */
+  struct shmseg_ptr_base alloc;  /* what the holder of lock got, -1 for nothing yet */
+  struct shmseg_ptr_base link;   /* where it links that, -1 for nowhere */
+  struct shmseg_ptr_base first;  /* the first record of the chain, -1 for none yet */
+  uint64_t owner;        /* see shmseg_claim, 0 for none yet */
+  uint32_t format;       /* SEG_FORMAT of the build which created it */
 } __attribute__((aligned(16)));
 
-shm_internal key_t  g_entry_key; 
-shm_internal key_t  g_last_key;
-shm_internal struct seg_t* g_seg_head;
-shm_internal struct seg_t* g_seg_cur;
-shm_internal struct seg_t* g_seg_tail;
+/*
+ * tag and version of the layout of segments and the records in them, bumped
+ * whenever either changes. a chain of another one is not opened
+ */
+#define SEG_FORMAT 0x48530002
+
+/*
+ * the next segment, created by a background thread before the current one
+ * fills up. only the owner of the chain starts and joins the thread, the
+ * join hands seg over
+ */
+/* how seg_new treats a segment that is on the key already */
+#define SEG_ATTACH  0  /* linked in the chain, attached as it is or NULL */
+#define SEG_OPEN    1  /* the entry segment, attached as it is or created */
+#define SEG_FRESH   2  /* beyond the chain tail, reused only if big enough */
+
+struct seg_spare {
+  pthread_t     thread;
+  bool          running;  /* started and not joined yet */
+  bool          done;     /* set by the thread once seg is final */
+  key_t         key;
+  size_t        size;
+  uint32_t      flags;
+  int           node;
+  struct seg_t* seg;      /* NULL if not created (yet) */
+};
 
 shm_internal struct seg_header* seg_hdr(struct seg_t* s);
-shm_internal struct seg_t*      seg_new(key_t key, size_t size_hint, bool attach_only);
+shm_internal struct seg_t*      seg_new(key_t key, size_t shm_size, int mode);
+shm_internal struct seg_t*      seg_attach(key_t key);
+shm_internal void               seg_prepare(struct seg_t* s, uint32_t flags, int node);
+shm_internal void               seg_place(struct seg_t* s, uint32_t flags, int node);
+shm_internal void               seg_free(struct seg_t* s, bool remove);
+shm_internal struct seg_t*      seg_find(struct shmseg_chain* c, key_t key);
+shm_internal size_t             seg_size_for(struct shmseg_chain* c, size_t size_hint);
+shm_internal size_t             seg_regular_size(struct shmseg_chain* c);
+shm_internal size_t             seg_page_round(size_t size);
 
 shm_internal uint32_t seg_off(struct seg_t* s);
 shm_internal void     seg_consume(struct seg_t* s, uint32_t off);
 shm_internal size_t   seg_available_size(struct seg_t* s);
 shm_internal key_t    seg_next_shm_key(struct seg_t* s);
 shm_internal bool     seg_empty(struct seg_t* s);
-shm_internal int      seg_add(struct seg_t* s);
-
-int shmseg_init(key_t entry_key) {
+shm_internal int      seg_add(struct shmseg_chain* c, struct seg_t* s);
+shm_internal void     seg_check_epoch(struct shmseg_chain* c, struct seg_t* s);
+shm_internal void     seg_repair(struct shmseg_chain* c);
+shm_internal bool     seg_key_after(struct shmseg_chain* c, key_t key, key_t than);
+shm_internal struct seg_t* seg_create(struct shmseg_chain* c, uint32_t actual_size);
+shm_internal struct seg_t* room_take(struct shmseg_chain* c, size_t size);
+
+/** segments created ahead **/
+shm_internal void*         spare_main(void* arg);
+shm_internal void          spare_start(struct shmseg_chain* c);
+shm_internal struct seg_t* spare_take(struct shmseg_chain* c, size_t size);
+shm_internal void          spare_stop(struct shmseg_chain* c, bool remove);
+
+int shmseg_init(struct shmseg_chain* c, key_t entry_key, uint32_t key_range, 
+                size_t seg_min, size_t seg_max) {
   int ec = E_SHM_OK;
   struct seg_t *s = NULL, *next = NULL;
   key_t next_shm_key = -1;
 
-  g_entry_key = entry_key;
-  g_last_key = g_entry_key;
-  if ((s = seg_new(entry_key, 0, false)) == NULL)
+  if (key_range == 0)
+    return E_SHM_INVALID_PARAMS;
+
+  memset(c, 0, sizeof(struct shmseg_chain));
+  c->entry_key = entry_key;
+  c->last_key = entry_key;
+  c->key_range = key_range;
+  c->seg_min = seg_page_round(seg_min > 0 ? seg_min : shm_pagesize * SHM_SIZE_IN_PAGES);
+  c->seg_max = seg_page_round(seg_max > 0 ? seg_max : shm_pagesize * SHM_SEG_MAX_PAGES);
+  if (c->seg_max < c->seg_min)
+    c->seg_max = c->seg_min;
+  if ((s = seg_new(entry_key, seg_size_for(c, 0), SEG_OPEN)) == NULL)
     return E_SHM_CREAT_SEGINFO_FAILED;
+  if (seg_hdr(s)->format != SEG_FORMAT) {
+    seg_free(s, false);
+    return E_SHM_FORMAT_MISMATCH;
+  }
 
-  ec = seg_add(s);
+  ec = seg_add(c, s);
   if (E_SHM_OK != ec)
     return ec;
 
-  g_seg_cur = s;
+  seg_check_epoch(c, s);
+
+  c->cur = s;
   next_shm_key = seg_next_shm_key(s);
   while (-1 != next_shm_key) {
-    if ((next = seg_new(next_shm_key, 0, true)) == NULL) {
+    if ((next = seg_new(next_shm_key, 0, SEG_ATTACH)) == NULL) {
       seg_hdr(s)->next_shm_key = -1;
       break;
     }
 
     s = next;
-    ec = seg_add(s);
+    ec = seg_add(c, s);
     if (E_SHM_OK != ec)
       return ec;
+    if (seg_hdr(s)->format != SEG_FORMAT)
+      return E_SHM_FORMAT_MISMATCH;
 
     if (!seg_empty(s))
-      g_seg_cur = s;
+      c->cur = s;
+
+    seg_check_epoch(c, s);
 
-    g_last_key = next_shm_key;
+    // segments of large values and spares are not chained in key order
+    if (seg_key_after(c, next_shm_key, c->last_key))
+      c->last_key = next_shm_key;
     next_shm_key = seg_next_shm_key(s);
   }
 
   return E_SHM_OK;
 }
 
-void shmseg_shutdown() {
-  struct seg_t* s = g_seg_head;
+void shmseg_shutdown(struct shmseg_chain* c) {
+  struct seg_t* s = NULL;
+
+  spare_stop(c, true);
+  room_take(c, SIZE_MAX);
+  s = c->head;
   while (s != NULL) {
     if (0 != shmdt(s->base_ptr) ||
         0 != shmctl(s->shm_id, IPC_RMID, NULL)) {
       abort();
     }
-    g_seg_head = s->next;
+    c->head = s->next;
     free(s);
-    s = g_seg_head;
+    s = c->head;
   }
 }
 
+void shmseg_detach(struct shmseg_chain* c) {
+  struct seg_t* s = NULL;
+
+  // an unlinked spare is reused by key when the chain grows next time
+  spare_stop(c, false);
+  room_take(c, SIZE_MAX);
+  s = c->head;
+  while (s != NULL) {
+    c->head = s->next;
+    seg_free(s, false);
+    s = c->head;
+  }
+
+  memset(c, 0, sizeof(struct shmseg_chain));
+}
+
 // TODO: thread-safe
-int shmseg_get(uint32_t* size, struct shmseg_ptr* sptr) {
-  int i = 1;
+int shmseg_get(struct shmseg_chain* c, uint32_t* size, struct shmseg_ptr* sptr) {
   int ec = E_SHM_OK;
-  uint32_t actual_size = ((*size + 15) >> 4) << 4; // round size to 16
-  key_t next_shm_key = -1;
+  uint32_t actual_size = seg_round(*size);
   struct seg_t* s = NULL;
+  struct seg_t* target = c->cur;
+  bool large = false;
   
-  // 2. from g_seg_cur, check if there's enough space for this alloc
+  // 2. from the current segment, check if there's enough space for this alloc
   //    if it does: adjust id/off and return 
   //    if it doesn't: alloc a new segment and return the id/off of next seg
-  if (seg_available_size(g_seg_cur) < actual_size) {
-    for (i = 1; s == NULL && i <= SHM_KEY_RETRY; ++i) {
-      next_shm_key = g_last_key + i;    
-      if (next_shm_key != -1) {
-        s = seg_new(next_shm_key,
-                    actual_size + sizeof(struct seg_header),
-                    false);
-      }
-    }
+  if (seg_available_size(c->cur) < actual_size) {
+    large = actual_size + sizeof(struct seg_header) > seg_regular_size(c) / 2;
+    // a large value gets a segment of its own size, the spare is kept
+    if (NULL == (s = room_take(c, actual_size + sizeof(struct seg_header))) &&
+        NULL == (s = spare_take(c, large ? 0 : actual_size + sizeof(struct seg_header))))
+      s = seg_create(c, actual_size);
 
     if (s == NULL)
       return E_SHM_CREAT_SEGINFO_FAILED;
 
-    ec = seg_add(s);
+    ec = seg_add(c, s);
     if (E_SHM_OK != ec)
       return ec;
 
-    g_last_key = next_shm_key;
-    g_seg_cur = s;
+    if (seg_key_after(c, s->shm_key, c->last_key))
+      c->last_key = s->shm_key;
+    target = s;
+    // a segment of a large value is full already, keep filling the current
+    if (!large)
+      c->cur = s;
   }
 
-  sptr->base.shm_key = g_seg_cur->shm_key;
-  sptr->base.off = seg_off(g_seg_cur);
-  sptr->cache_ptr = g_seg_cur->base_ptr + sptr->base.off;
-
-  seg_consume(g_seg_cur, actual_size);
+  sptr->base.shm_key = target->shm_key;
+  sptr->base.off = seg_off(target);
+  sptr->cache_ptr = target->base_ptr + sptr->base.off;
+
+  // noted before it is taken, the holder of the lock might die any time.
+  // the first record might not fit into the entry segment, it is noted too
+  seg_hdr(c->head)->alloc = sptr->base;
+  if (seg_hdr(c->head)->first.shm_key == -1)
+    seg_hdr(c->head)->first = sptr->base;
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  seg_consume(target, actual_size);
   *size = actual_size;
+
+  if ((c->flags & SHMSEG_F_PRECREATE) && 
+      seg_available_size(c->cur) < seg_low_water(c->cur))
+    spare_start(c);
+  return E_SHM_OK;
+}
+
+void shmseg_unget(struct shmseg_chain* c) {
+  struct seg_header* h = seg_hdr(c->head);
+  struct seg_t* s = NULL;
+
+  if (h->alloc.shm_key == -1)
+    return;
+
+  if ((s = seg_find(c, h->alloc.shm_key)) != NULL)
+    seg_hdr(s)->off = h->alloc.off;
+
+  if (h->first.shm_key == h->alloc.shm_key && h->first.off == h->alloc.off)
+    h->first.shm_key = -1;
+  h->alloc.shm_key = -1;
+}
+
+void shmseg_set_flags(struct shmseg_chain* c, uint32_t flags, int node) {
+  struct seg_t* s = NULL;
+
+  if (!(flags & SHMSEG_F_PRECREATE))
+    spare_stop(c, true);
+  else if (c->spare == NULL)
+    c->spare = (struct seg_spare*)calloc(1, sizeof(struct seg_spare));
+  c->flags = flags;
+  c->node = node;
+
+  for (s = c->head; s != NULL; s = s->next)
+    seg_place(s, flags, node);
+}
+
+size_t shmseg_grow_size(struct shmseg_chain* c, uint32_t size) {
+  uint32_t actual_size = seg_round(size);
+  if (seg_available_size(c->cur) >= actual_size)
+    return 0;
+  return seg_size_for(c, actual_size + sizeof(struct seg_header));
+}
+
+int shmseg_room(struct shmseg_chain* c, uint32_t size) {
+  uint32_t actual_size = seg_round(size);
+
+  if (seg_available_size(c->cur) >= actual_size ||
+      (c->room != NULL && c->room->seg_size >= actual_size + sizeof(struct seg_header)))
+    return E_SHM_OK;
+
+  room_take(c, SIZE_MAX);
+  if (NULL == (c->room = seg_create(c, actual_size)))
+    return E_SHM_CREAT_SEGINFO_FAILED;
   return E_SHM_OK;
 }
 
 // TODO: thread-safe
-int shmseg_first_ptr(struct shmseg_ptr* sptr) {
-  if (!seg_empty(g_seg_head)) {
-    sptr->base.shm_key = g_seg_head->shm_key;
+int shmseg_commit(struct shmseg_chain* c, struct shmseg_ptr* sptr, uint32_t size) {
+  struct seg_t* s = seg_find(c, sptr->base.shm_key);
+  struct seg_header* h = NULL;
+
+  if (s == NULL)
+    return E_SHM_PTR_INVALID;
+
+  h = seg_hdr(s);
+  if (sptr->base.off + size > h->off)
+    return E_SHM_PTR_INVALID;
+
+  /* every write of the record and its link must land before the marker */
+  __sync_synchronize();
+  h->epoch = ++c->epoch;
+  h->commit_off = sptr->base.off + size;
+  return E_SHM_OK;
+}
+
+int shmseg_lock(struct shmseg_chain* c, const struct shmseg_ptr_base* link) {
+  struct seg_header* h = seg_hdr(c->head);
+  int ec = shm_lock_acquire(&h->lock);
+
+  if (ec == E_SHM_OWNER_DEAD) {
+    seg_repair(c);
+    shm_lock_consistent(&h->lock);
+  } else if (ec != E_SHM_OK) {
+    return ec;
+  }
+
+  h->alloc.shm_key = -1;
+  h->alloc.off = 0;
+  if (link != NULL) {
+    h->link = *link;
+  } else {
+    h->link.shm_key = -1;
+    h->link.off = 0;
+  }
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  return ec;
+}
+
+void shmseg_unlock(struct shmseg_chain* c) {
+  shm_lock_release(&seg_hdr(c->head)->lock);
+}
+
+int shmseg_attach(struct shmseg_chain* c, key_t entry_key, uint32_t key_range) {
+  struct seg_t* s = NULL;
+  key_t key = entry_key;
+  uint32_t n = 0;
+
+  if (key_range == 0)
+    return E_SHM_INVALID_PARAMS;
+
+  memset(c, 0, sizeof(struct shmseg_chain));
+  c->entry_key = entry_key;
+  c->last_key = entry_key;
+  c->key_range = key_range;
+
+  // the owner might link a segment any time, the chain ends where it did
+  // when it was read, and a key range can not hold a longer one
+  while (key != -1 && n++ < key_range && (s = seg_attach(key)) != NULL) {
+    c->size += s->seg_size;
+    if (c->head == NULL)
+      c->head = c->cur = s;
+    else
+      c->tail->next = s;
+    c->tail = s;
+    key = seg_next_shm_key(s);
+  }
+
+  if (c->head != NULL && seg_hdr(c->head)->format != SEG_FORMAT) {
+    shmseg_detach(c);
+    return E_SHM_FORMAT_MISMATCH;
+  }
+  return c->head != NULL ? E_SHM_OK : E_SHM_EMPTY;
+}
+
+int shmseg_claim(struct shmseg_chain* c, uint64_t owner) {
+  struct seg_header* h = seg_hdr(c->head);
+
+  if (h->owner == 0)
+    h->owner = owner;
+  return h->owner == owner ? E_SHM_OK : E_SHM_NAME_MISMATCH;
+}
+
+uint64_t shmseg_owner(struct shmseg_chain* c) {
+  return c->head != NULL ? seg_hdr(c->head)->owner : 0;
+}
+
+int shmseg_info(struct shmseg_chain* c, uint32_t i, struct shmseg_info* info) {
+  struct seg_t* s = c->head;
+
+  for (; s != NULL && i > 0; --i)
+    s = s->next;
+
+  if (s == NULL)
+    return E_SHM_EMPTY;
+
+  info->shm_key = s->shm_key;
+  info->size = s->seg_size;
+  info->used = seg_hdr(s)->off;
+  info->committed = seg_hdr(s)->commit_off;
+  return E_SHM_OK;
+}
+
+bool shmseg_committed(struct shmseg_chain* c, struct shmseg_ptr* sptr) {
+  struct seg_t* s = seg_find(c, sptr->base.shm_key);
+  return s != NULL && sptr->base.off < seg_hdr(s)->commit_off;
+}
+
+bool shmseg_valid(struct shmseg_chain* c, struct shmseg_ptr* sptr, uint32_t size) {
+  struct seg_t* s = seg_find(c, sptr->base.shm_key);
+  return s != NULL && 
+         sptr->base.off >= sizeof(struct seg_header) &&
+         (uint64_t)sptr->base.off + size <= seg_hdr(s)->off &&
+         (uint64_t)sptr->base.off + size <= s->seg_size;
+}
+
+// TODO: thread-safe
+int shmseg_first_ptr(struct shmseg_chain* c, struct shmseg_ptr* sptr) {
+  struct seg_header* h = seg_hdr(c->head);
+
+  if (h->first.shm_key != -1) {
+    sptr->base = h->first;
+    sptr->cache_ptr = NULL;
+    return NULL != shmseg_ptr_ptr(c, sptr) ? E_SHM_OK : E_SHM_EMPTY;
+  }
+  if (!seg_empty(c->head)) {
+    sptr->base.shm_key = c->head->shm_key;
     sptr->base.off = sizeof(struct seg_header);
-    sptr->cache_ptr = shmseg_ptr_ptr(sptr);
+    sptr->cache_ptr = shmseg_ptr_ptr(c, sptr);
     return E_SHM_OK;
   }
   return E_SHM_EMPTY;
 }
 
 // TODO: thread-safe
-void* shmseg_ptr_ptr(struct shmseg_ptr* sptr) {
-  struct seg_t* s = g_seg_head;
+void* shmseg_ptr_ptr(struct shmseg_chain* c, struct shmseg_ptr* sptr) {
+  struct seg_t* s = NULL;
   if (sptr->cache_ptr == NULL) {
-    for (; s != NULL; s = s->next) {
-      if (s->shm_key == sptr->base.shm_key) {
-        sptr->cache_ptr = sptr->base.off < s->seg_size 
-          ? s->base_ptr + sptr->base.off 
-          : NULL;
-      }
+    if ((s = seg_find(c, sptr->base.shm_key)) != NULL) {
+      sptr->cache_ptr = sptr->base.off < s->seg_size 
+        ? s->base_ptr + sptr->base.off 
+        : NULL;
     }
   }
   return sptr->cache_ptr;
@@ -186,25 +470,103 @@ shm_internal struct seg_header* seg_hdr(struct seg_t* s) {
   return (struct seg_header*)s->base_ptr;
 }
 
+shm_internal struct seg_t* seg_find(struct shmseg_chain* c, key_t key) {
+  struct seg_t* s = c->head;
+  for (; s != NULL; s = s->next) {
+    if (s->shm_key == key)
+      return s;
+  }
+  return NULL;
+}
+
+shm_internal size_t seg_size_for(struct shmseg_chain* c, size_t size_hint) {
+  size_t shm_size = seg_regular_size(c);
+  return size_hint > shm_size / 2 ? seg_page_round(size_hint) : shm_size;
+}
+
+/* size of the next segment, as big as the chain so far */
+shm_internal size_t seg_regular_size(struct shmseg_chain* c) {
+  size_t shm_size = c->size;
+  if (shm_size < c->seg_min)
+    shm_size = c->seg_min;
+  if (shm_size > c->seg_max)
+    shm_size = c->seg_max;
+  return seg_page_round(shm_size);
+}
+
+shm_internal size_t seg_page_round(size_t size) {
+  return ((size + shm_pagesize - 1) / shm_pagesize) * shm_pagesize;
+}
+
+/*
+ * segments are filled in chain order, so the epochs along the chain never
+ * go backwards. a segment whose epoch does regress carries a stale commit
+ * marker, drop it so every record in that segment gets validated. the
+ * segment of a large value sits before the current one is full, so it might
+ * look stale too, which only costs a checksum pass over it
+ */
+shm_internal void seg_check_epoch(struct shmseg_chain* c, struct seg_t* s) {
+  struct seg_header* h = seg_hdr(s);
+  if (h->epoch == 0)
+    return;
+
+  if (h->epoch < c->epoch)
+    h->commit_off = sizeof(struct seg_header);
+  else
+    c->epoch = h->epoch;
+}
+
+/*
+ * undo what the holder of the chain lock died in the middle of, unless it
+ * got as far as its commit: the bytes it took are given back, and the link
+ * to them is reset, so the chain ends where it did before. a segment it
+ * created but did not link is not found, and reused by key later
+ */
+shm_internal void seg_repair(struct shmseg_chain* c) {
+  struct seg_header* h = seg_hdr(c->head);
+  struct seg_t *s = NULL, *t = NULL;
+  struct shmseg_ptr_base* link = NULL;
+
+  if (h->alloc.shm_key == -1 || (s = seg_find(c, h->alloc.shm_key)) == NULL ||
+      h->alloc.off < seg_hdr(s)->commit_off || h->alloc.off > seg_hdr(s)->off)
+    return;
+
+  if (h->link.shm_key != -1 && (t = seg_find(c, h->link.shm_key)) != NULL &&
+      h->link.off + sizeof(struct shmseg_ptr_base) <= seg_hdr(t)->off) {
+    link = (struct shmseg_ptr_base*)((char*)t->base_ptr + h->link.off);
+    link->shm_key = -1;
+    link->off = 0;
+  }
+
+  seg_hdr(s)->off = h->alloc.off;
+  if (h->first.shm_key == h->alloc.shm_key && h->first.off == h->alloc.off)
+    h->first.shm_key = -1;
+  h->alloc.shm_key = -1;
+}
+
 /* TODO: thread-safe */
-shm_internal struct seg_t* seg_new(key_t key, size_t size_hint, bool attach_only) {
+shm_internal struct seg_t* seg_new(key_t key, size_t shm_size, int mode) {
   int    shm_id = -1;
-  long   shm_size = 0;
   struct seg_t* s = NULL;
   void*  base_ptr = NULL;
   struct shmid_ds buf;
   struct seg_header* h = NULL;
   char   zero_header[sizeof(struct seg_header)] = { 0 };
 
-  if ((shm_id = shmget(key, 0, 0600)) < 0) {
-    if (attach_only)
-      return NULL;
+  // a key beyond the chain might be left by a crash, not linked yet, it is
+  // reused unless too small. a segment of the chain keeps the size it has,
+  // whatever the size asked for now
+  if ((shm_id = shmget(key, 0, 0600)) >= 0 && mode == SEG_FRESH &&
+      (shmctl(shm_id, IPC_STAT, &buf) < 0 || buf.shm_segsz < shm_size)) {
+    shmctl(shm_id, IPC_RMID, NULL);
+    shm_id = -1;
+  }
 
-    shm_size = shm_pagesize * SHM_SIZE_IN_PAGES;
-    if (shm_size < size_hint) 
-      shm_size = ((size_hint + shm_pagesize - 1) / shm_pagesize) * shm_pagesize;
+  if (shm_id < 0) {
+    if (mode == SEG_ATTACH)
+      return NULL;
 
-    if ((shm_id = shmget(key, shm_size, 0600 | IPC_CREAT)) < 0)
+    if ((shm_id = shmget(key, shm_size, 0600 | IPC_CREAT | IPC_EXCL)) < 0)
       return NULL;
   }
 
@@ -226,44 +588,241 @@ shm_internal struct seg_t* seg_new(key_t key, size_t size_hint, bool attach_only
 
   /* read header */
   h = seg_hdr(s);
+  // a key beyond the chain left by another build is not linked, its content
+  // is of no use
+  if (mode == SEG_FRESH && h->format != SEG_FORMAT)
+    memset(h, 0, sizeof(struct seg_header));
   if (0 == memcmp(h, zero_header, sizeof(struct seg_header))) {
     /* header is empty */
     h->off = sizeof(struct seg_header);
     h->next_shm_key = -1;
+    h->commit_off = sizeof(struct seg_header);
+    h->epoch = 0;
+    h->alloc.shm_key = -1;
+    h->link.shm_key = -1;
+    h->first.shm_key = -1;
+    h->format = SEG_FORMAT;
+    if (E_SHM_OK != shm_lock_init(&h->lock)) {
+      seg_free(s, false);
+      return NULL;
+    }
+  }
+
+  return s;
+}
+
+/* attach an existing segment read only, its header is left as it is */
+shm_internal struct seg_t* seg_attach(key_t key) {
+  int shm_id = -1;
+  void* base_ptr = NULL;
+  struct shmid_ds buf;
+  struct seg_t* s = NULL;
+
+  if ((shm_id = shmget(key, 0, 0600)) < 0 || shmctl(shm_id, IPC_STAT, &buf) < 0 ||
+      buf.shm_segsz < sizeof(struct seg_header))
+    return NULL;
+
+  if ((void*)-1 == (base_ptr = shmat(shm_id, 0, SHM_RDONLY)))
+    return NULL;
+
+  if ((s = malloc(sizeof(struct seg_t))) == NULL) {
+    shmdt(base_ptr);
+    return NULL;
   }
 
+  s->shm_key  = key;
+  s->shm_id   = shm_id;
+  s->seg_size = buf.shm_segsz;
+  s->base_ptr = base_ptr;
+  s->next     = NULL;
   return s;
 }
 
+/*
+ * fault the pages of a new segment in now rather than on the hot path of
+ * the writes, mlock does that as part of locking them
+ */
+shm_internal void seg_prepare(struct seg_t* s, uint32_t flags, int node) {
+  size_t off = 0;
+  volatile char* p = (volatile char*)s->base_ptr;
+
+  seg_place(s, flags, node);
+
+  if ((flags & SHMSEG_F_MLOCK) && 0 == mlock(s->base_ptr, s->seg_size))
+    return;
+
+  if (!(flags & (SHMSEG_F_PREFAULT | SHMSEG_F_MLOCK)))
+    return;
+
+#ifdef MADV_POPULATE_WRITE
+  if (0 == madvise(s->base_ptr, s->seg_size, MADV_POPULATE_WRITE))
+    return;
+#endif
+  // the header page is in use already
+  for (off = shm_pagesize; off < s->seg_size; off += shm_pagesize)
+    p[off] = p[off];
+}
+
+/* numa policy of the pages not faulted in yet */
+shm_internal void seg_place(struct seg_t* s, uint32_t flags, int node) {
+  if (flags & SHMSEG_F_NUMA_BIND)
+    shm_numa_bind(s->base_ptr, s->seg_size, node);
+  else if (flags & SHMSEG_F_NUMA_INTERLEAVE)
+    shm_numa_interleave(s->base_ptr, s->seg_size);
+}
+
+shm_internal void seg_free(struct seg_t* s, bool remove) {
+  shmdt(s->base_ptr);
+  if (remove)
+    shmctl(s->shm_id, IPC_RMID, NULL);
+  free(s);
+}
+
 /* TODO: thread-safe */
-shm_internal int seg_add(struct seg_t* s) {
-  if (g_seg_head == NULL) {
-    g_seg_head = g_seg_tail = s;
+shm_internal int seg_add(struct shmseg_chain* c, struct seg_t* s) {
+  c->size += s->seg_size;
+  if (c->head == NULL) {
+    c->head = c->tail = s;
   } else {
-    g_seg_tail->next = s;
-    seg_hdr(g_seg_tail)->next_shm_key = s->shm_key;
-    g_seg_tail = s;
+    c->tail->next = s;
+    seg_hdr(c->tail)->next_shm_key = s->shm_key;
+    c->tail = s;
   }
 
   return E_SHM_OK;
 }
 
-/* unittest call only */
-shm_internal void unittest_shmseg_sim_crash() {
-  struct seg_t* s = g_seg_head;
-  while (s != NULL) {
-    shmdt(s->base_ptr);
-    g_seg_head = s->next;
-    free(s);
-    s = g_seg_head;
+/* if key comes later than `than` in the key range of c */
+shm_internal bool seg_key_after(struct shmseg_chain* c, key_t key, key_t than) {
+  return (uint32_t)(key - c->entry_key) > (uint32_t)(than - c->entry_key);
+}
+
+shm_internal void* spare_main(void* arg) {
+  struct seg_spare* sp = (struct seg_spare*)arg;
+  if (NULL != (sp->seg = seg_new(sp->key, sp->size, SEG_FRESH)))
+    seg_prepare(sp->seg, sp->flags, sp->node);
+  __atomic_store_n(&sp->done, true, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/*
+ * create the segment the chain grows by next on a background thread, it
+ * takes the next key and the size of a regular segment as of now
+ */
+shm_internal void spare_start(struct shmseg_chain* c) {
+  struct seg_spare* sp = c->spare;
+  key_t key = c->last_key + 1;
+
+  if (sp == NULL || sp->running || sp->seg != NULL)
+    return;
+
+  if (key == -1)
+    ++key;
+  if ((uint32_t)(key - c->entry_key) >= c->key_range)
+    return;
+
+  sp->key = key;
+  sp->size = seg_regular_size(c);
+  sp->flags = c->flags;
+  sp->node = c->node;
+  sp->done = false;
+  sp->running = (0 == pthread_create(&sp->thread, NULL, spare_main, sp));
+}
+
+/*
+ * take the spare if it is done and big enough for size. a spare still
+ * being created is not waited for, the chain probes past its key
+ */
+shm_internal struct seg_t* spare_take(struct shmseg_chain* c, size_t size) {
+  struct seg_spare* sp = c->spare;
+  struct seg_t* s = NULL;
+
+  if (sp == NULL)
+    return NULL;
+
+  if (sp->running) {
+    if (!__atomic_load_n(&sp->done, __ATOMIC_ACQUIRE))
+      return NULL;
+    pthread_join(sp->thread, NULL);
+    sp->running = false;
+  }
+
+  if (sp->seg != NULL && size > 0 && sp->seg->seg_size >= size) {
+    s = sp->seg;
+    sp->seg = NULL;
   }
+  return s;
+}
+
+/*
+ * create the segment shmseg_get needs for actual_size bytes, on the first key
+ * after the last one that can be had, NULL if none can
+ */
+shm_internal struct seg_t* seg_create(struct shmseg_chain* c, uint32_t actual_size) {
+  int i = 1;
+  key_t next_shm_key = -1;
+  struct seg_t* s = NULL;
+
+  for (i = 1; s == NULL && i <= SHM_KEY_RETRY; ++i) {
+    next_shm_key = c->last_key + i;    
+    if ((uint32_t)(next_shm_key - c->entry_key) >= c->key_range)
+      break;
+
+    // the key of a spare still being created is left to it
+    if (next_shm_key != -1 && 
+        (c->spare == NULL || next_shm_key != c->spare->key ||
+         (!c->spare->running && c->spare->seg == NULL))) {
+      s = seg_new(next_shm_key,
+                  seg_size_for(c, actual_size + sizeof(struct seg_header)),
+                  SEG_FRESH);
+      if (s != NULL)
+        seg_prepare(s, c->flags, c->node);
+    }
+  }
+  return s;
+}
+
+/*
+ * take the segment of shmseg_room if it is big enough for size, it is
+ * removed otherwise, so its key is free again
+ */
+shm_internal struct seg_t* room_take(struct shmseg_chain* c, size_t size) {
+  struct seg_t* s = c->room;
+
+  c->room = NULL;
+  if (s != NULL && s->seg_size < size) {
+    seg_free(s, true);
+    s = NULL;
+  }
+  return s;
+}
+
+shm_internal void spare_stop(struct shmseg_chain* c, bool remove) {
+  struct seg_spare* sp = c->spare;
+
+  if (sp == NULL)
+    return;
+
+  if (sp->running)
+    pthread_join(sp->thread, NULL);
+  if (sp->seg != NULL)
+    seg_free(sp->seg, remove);
+  free(sp);
+  c->spare = NULL;
+}
+
+/* unittest call only */
+shm_internal void unittest_shmseg_sim_crash(struct shmseg_chain* c) {
+  shmseg_detach(c);
+}
 
-  g_seg_head = g_seg_cur = g_seg_tail = NULL;
-  g_entry_key = g_last_key = 0;
+shm_internal bool unittest_shmseg_spare_done(struct shmseg_chain* c) {
+  return c->spare != NULL && 
+    (!c->spare->running || __atomic_load_n(&c->spare->done, __ATOMIC_ACQUIRE));
 }
 
-shm_internal struct seg_t* unittest_seg_head() {
-  return g_seg_head;
+shm_internal struct seg_t* unittest_seg_head(struct shmseg_chain* c) {
+  return c->head;
 }
 
 shm_internal struct seg_t* unittest_seg_next(struct seg_t* s) {
@@ -8,7 +8,7 @@
  * share memory segments management:
  * 1. manage segment allocation and reload from a crash
  * 2. ensure enough size for client, but do not care or manage the content
- * 3. TODO: check if a ptr is within valid range
+ * 3. check if a ptr is within valid range, see shmseg_valid
  */
 
 struct shmseg_ptr_base {
@@ -21,32 +21,175 @@ struct shmseg_ptr {
   void*                  cache_ptr;
 };
 
+struct seg_t;
+struct seg_spare;
+
+/* flags of a chain, see shmseg_set_flags */
+#define SHMSEG_F_PREFAULT  0x1
+#define SHMSEG_F_MLOCK     0x2
+#define SHMSEG_F_PRECREATE 0x4
+#define SHMSEG_F_NUMA_BIND       0x8
+#define SHMSEG_F_NUMA_INTERLEAVE 0x10
+
+/*
+ * a chain of segments, every shm key it creates stays within
+ * [entry_key, entry_key + key_range), so several chains can live side by side
+ */
+struct shmseg_chain {
+  key_t          entry_key;
+  key_t          last_key;
+  uint32_t       key_range;
+  uint32_t       epoch;
+  size_t         size;      /* bytes of all segments */
+  size_t         seg_min;   /* bytes of the first segment */
+  size_t         seg_max;   /* cap of the geometric growth */
+  uint32_t       flags;     /* SHMSEG_F_* */
+  int            node;      /* numa node of SHMSEG_F_NUMA_BIND */
+  struct seg_spare* spare;  /* next segment created ahead */
+  struct seg_t*  room;      /* created by shmseg_room for the next shmseg_get */
+  struct seg_t*  head;
+  struct seg_t*  cur;
+  struct seg_t*  tail;
+};
+
 /*
  * initialise the shmseg, if client is safely shutdown last time, all shm 
  * should be delete, if they remain attachable means client was suffering a
- * crash and try to recovery, in that case, we reattach all shm 
+ * crash and try to recovery, in that case, we reattach all shm.
+ *
+ * segments grow geometrically: a new one is as big as the whole chain so
+ * far, within [seg_min, seg_max] (rounded up to pages, 0 for
+ * SHM_SIZE_IN_PAGES and SHM_SEG_MAX_PAGES pages), so the number of segments
+ * stays logarithmic in the data size. a record which takes more than half of
+ * the next segment gets a segment of its own instead, and the current
+ * segment keeps being filled.
+ * a chain left by a build with another layout of segments or records is
+ * not touched, E_SHM_FORMAT_MISMATCH is returned
  */
-int shmseg_init(key_t entry_key);
+int shmseg_init(struct shmseg_chain* c, key_t entry_key, uint32_t key_range, 
+                size_t seg_min, size_t seg_max);
 
 /*
  * shutdown, delete all shm
  */
-void shmseg_shutdown();
+void shmseg_shutdown(struct shmseg_chain* c);
+
+/*
+ * detach all shm but keep them, a later shmseg_init reattaches them
+ */
+void shmseg_detach(struct shmseg_chain* c);
+
+/*
+ * attach the segments of a chain read only, to look at a chain another
+ * process might own and write meanwhile. nothing of the shm is changed,
+ * shmseg_detach is the way to let it go, and only the functions reading a
+ * chain work on it. E_SHM_EMPTY is returned if there is no chain on entry_key,
+ * E_SHM_FORMAT_MISMATCH if it has another layout, see shmseg_init
+ */
+int shmseg_attach(struct shmseg_chain* c, key_t entry_key, uint32_t key_range);
+
+/*
+ * tag the chain with owner, which must not be 0, as the chain of whoever
+ * picked its keys by it. a chain tagged with another owner already is left
+ * alone, E_SHM_NAME_MISMATCH is returned
+ */
+int shmseg_claim(struct shmseg_chain* c, uint64_t owner);
+
+/*
+ * the owner the chain is tagged with, 0 for none
+ */
+uint64_t shmseg_owner(struct shmseg_chain* c);
+
+/* a segment as shmseg_info tells it */
+struct shmseg_info {
+  key_t    shm_key;
+  size_t   size;       /* bytes of the segment */
+  uint32_t used;       /* bytes up to the end of the last record */
+  uint32_t committed;  /* bytes up to the commit marker */
+};
+
+/*
+ * the i-th segment of the chain, E_SHM_EMPTY is returned past the last
+ */
+int shmseg_info(struct shmseg_chain* c, uint32_t i, struct shmseg_info* info);
+
+/*
+ * how new segments are set up, it applies to segments created from now on:
+ * SHMSEG_F_PREFAULT faults all their pages in when they are created, instead
+ * of one by one on the writes to them. SHMSEG_F_MLOCK locks them in memory
+ * (best effort, it is subject to RLIMIT_MEMLOCK), which faults them in too.
+ * SHMSEG_F_PRECREATE creates the next segment on a background thread once
+ * the current one is 3/4 full, so shmseg_get only has to link it.
+ * SHMSEG_F_NUMA_BIND places the pages on node, SHMSEG_F_NUMA_INTERLEAVE
+ * spreads them over all nodes, this applies to the untouched pages of the
+ * segments attached already as well
+ */
+void shmseg_set_flags(struct shmseg_chain* c, uint32_t flags, int node);
 
 /*
  * ensure size bytes are available, allocate new shm if necessary
  */
-int shmseg_get(uint32_t* size, struct shmseg_ptr* sptr); 
+int shmseg_get(struct shmseg_chain* c, uint32_t* size, struct shmseg_ptr* sptr);
+
+/*
+ * give back what the last shmseg_get under the chain lock returned, before
+ * anything links to it
+ */
+void shmseg_unget(struct shmseg_chain* c);
+
+/*
+ * bytes of the segment shmseg_get would create for size bytes, 0 if the
+ * current segment still has room for them
+ */
+size_t shmseg_grow_size(struct shmseg_chain* c, uint32_t size);
+
+/*
+ * make sure the next shmseg_get of size bytes does not fail for a segment:
+ * the one it would create is created now, and taken by it
+ */
+int shmseg_room(struct shmseg_chain* c, uint32_t size);
+
+/*
+ * commit protocol:
+ * a record becomes committed once shmseg_commit is called on it, after it is
+ * completely written and linked into the record chain. each segment keeps a
+ * commit marker (offset + chain epoch) in its header, so after a crash
+ * everything below the marker can be trusted as is and only the uncommitted
+ * tail needs to be validated
+ */
+int shmseg_commit(struct shmseg_chain* c, struct shmseg_ptr* sptr, uint32_t size);
+
+/*
+ * lock the chain against the other processes which share it, around one
+ * shmseg_get, the link to what it returns and its shmseg_commit. link is
+ * where that link is going to be stored in the chain, NULL if the record is
+ * reached by its place. if the last holder died before its commit, the lock
+ * undoes its shmseg_get and resets its link before it is held, and
+ * E_SHM_OWNER_DEAD is returned instead of E_SHM_OK
+ */
+int shmseg_lock(struct shmseg_chain* c, const struct shmseg_ptr_base* link);
+
+void shmseg_unlock(struct shmseg_chain* c);
+
+/*
+ * check if the record at sptr is covered by the commit marker of its segment
+ */
+int shmseg_committed(struct shmseg_chain* c, struct shmseg_ptr* sptr);
+
+/*
+ * check if [sptr, sptr + size) lies within the used part of its segment
+ */
+int shmseg_valid(struct shmseg_chain* c, struct shmseg_ptr* sptr, uint32_t size);
 
 /*
  * get the first shmseg_ptr of shm chain
  */
-int shmseg_first_ptr(struct shmseg_ptr* sptr);
+int shmseg_first_ptr(struct shmseg_chain* c, struct shmseg_ptr* sptr);
 
 /*
  * get ptr of shmseg_ptr
  */
-void* shmseg_ptr_ptr(struct shmseg_ptr* sptr);
+void* shmseg_ptr_ptr(struct shmseg_chain* c, struct shmseg_ptr* sptr);
 
 /*
  * reset the content of shmseg_ptr
@@ -0,0 +1,161 @@
+#include <string.h>
+
+#include "shm_config.h"
+#include "shm_timer_wheel.h"
+
+#define TW_MASK  (TW_SLOTS - 1)
+#define TW_SPAN  ((uint64_t)1 << (TW_BITS * TW_LEVELS))
+
+shm_internal void tw_place(struct timer_wheel* tw, struct timer_node* n);
+shm_internal void tw_remove(struct timer_wheel* tw, struct timer_node* n);
+shm_internal bool tw_skip_idle(struct timer_wheel* tw, uint64_t now);
+shm_internal int  tw_cascade(struct timer_wheel* tw, int level);
+
+struct timer_wheel* timer_wheel_new(uint64_t now) {
+  int l = 0, i = 0;
+  struct timer_wheel* tw = NULL;
+
+  if (NULL == (tw = (struct timer_wheel*)calloc(1, sizeof(struct timer_wheel))))
+    return NULL;
+
+  tw->cur = now + 1;
+  for (l = 0; l < TW_LEVELS; ++l) {
+    for (i = 0; i < TW_SLOTS; ++i)
+      tw->slots[l][i].prev = tw->slots[l][i].next = &tw->slots[l][i];
+  }
+  return tw;
+}
+
+void timer_wheel_free(struct timer_wheel* tw) {
+  free(tw);
+}
+
+void timer_wheel_add(struct timer_wheel* tw, struct timer_node* n) {
+  tw_place(tw, n);
+  ++(tw->count);
+}
+
+void timer_wheel_del(struct timer_wheel* tw, struct timer_node* n) {
+  if (n->next != NULL) {
+    tw_remove(tw, n);
+    --(tw->count);
+  }
+}
+
+size_t timer_wheel_advance(struct timer_wheel* tw, uint64_t now, 
+                           expire_fn fn, void* ctx) {
+  size_t expired = 0;
+  int idx = 0, l = 0;
+  struct timer_node *head = NULL, *n = NULL;
+
+  while (tw->cur <= now) {
+    if (!tw_skip_idle(tw, now))
+      break;
+
+    idx = tw->cur & TW_MASK;
+    for (l = 1; l < TW_LEVELS && idx == 0; ++l)
+      idx = tw_cascade(tw, l);
+
+    head = &tw->slots[0][tw->cur & TW_MASK];
+    while (head->next != head) {
+      n = head->next;
+      tw_remove(tw, n);
+      if (n->expire > tw->cur) {
+        // parked at the far end of the wheel, not due yet
+        tw_place(tw, n);
+        continue;
+      }
+
+      --(tw->count);
+      ++expired;
+      fn(n, ctx);
+    }
+    ++(tw->cur);
+  }
+  return expired;
+}
+
+/*
+ * level is chosen by distance to the current tick and index by the deadline
+ * bits of that level. deadlines beyond the wheel span are parked in the
+ * furthest slot and placed again when they come down to level 0
+ */
+shm_internal void tw_place(struct timer_wheel* tw, struct timer_node* n) {
+  int l = 0;
+  uint64_t expire = n->expire, delta = 0;
+  struct timer_node* head = NULL;
+
+  if (expire < tw->cur)
+    expire = tw->cur;
+
+  delta = expire - tw->cur;
+  if (delta >= TW_SPAN) {
+    expire = tw->cur + TW_SPAN - 1;
+    delta = TW_SPAN - 1;
+  }
+
+  while (delta >= ((uint64_t)1 << (TW_BITS * (l + 1))))
+    ++l;
+
+  head = &tw->slots[l][(expire >> (TW_BITS * l)) & TW_MASK];
+  n->prev = head->prev;
+  n->next = head;
+  head->prev->next = n;
+  head->prev = n;
+  n->level = l;
+  ++(tw->level_count[l]);
+}
+
+shm_internal void tw_remove(struct timer_wheel* tw, struct timer_node* n) {
+  n->prev->next = n->next;
+  n->next->prev = n->prev;
+  n->prev = n->next = NULL;
+  --(tw->level_count[n->level]);
+}
+
+/*
+ * while levels below l are empty, nothing can happen before the next slot of
+ * level l comes round, jump to it. return false if nothing is due up to now
+ */
+shm_internal bool tw_skip_idle(struct timer_wheel* tw, uint64_t now) {
+  int l = 0;
+  uint64_t step = 0, next = 0;
+
+  while (l < TW_LEVELS && tw->level_count[l] == 0)
+    ++l;
+
+  if (l == TW_LEVELS) {
+    tw->cur = now + 1;
+    return false;
+  }
+
+  if (l > 0) {
+    step = (uint64_t)1 << (TW_BITS * l);
+    next = (tw->cur + step - 1) & ~(step - 1);
+    if (next > now) {
+      tw->cur = now + 1;
+      return false;
+    }
+    tw->cur = next;
+  }
+  return true;
+}
+
+/*
+ * move all timers of the current slot of level down to lower levels, return
+ * the slot index, so the caller knows whether the level above is due as well
+ */
+shm_internal int tw_cascade(struct timer_wheel* tw, int level) {
+  int idx = (tw->cur >> (TW_BITS * level)) & TW_MASK;
+  struct timer_node *head = &tw->slots[level][idx], *n = NULL;
+
+  while (head->next != head) {
+    n = head->next;
+    tw_remove(tw, n);
+    tw_place(tw, n);
+  }
+  return idx;
+}
+
+#undef TW_MASK
+#undef TW_SPAN
@@ -0,0 +1,68 @@
+#ifndef SHM_TIMER_WHEEL_H
+#define SHM_TIMER_WHEEL_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * hierarchical timing wheel, see "Hashed and Hierarchical Timing Wheels"
+ * (Varghese & Lauck) and the pre-hrtimer linux timer for the design:
+ *
+ * TW_LEVELS levels of TW_SLOTS slots, level l covers deadlines up to
+ * TW_SLOTS^(l+1) ticks ahead. a timer is placed in one slot, and moves down
+ * one level each time the slot of its upper level comes round (cascade), so
+ * add/del are O(1) and each expiry costs O(TW_LEVELS) at most. idle ticks
+ * are skipped level by level, so a long gap between advances is cheap too.
+ *
+ * the wheel lives in process memory, nodes are embedded by the client.
+ */
+
+#define TW_BITS   6
+#define TW_SLOTS  (1 << TW_BITS)
+#define TW_LEVELS 5
+
+struct timer_node {
+  struct timer_node* prev;
+  struct timer_node* next;
+  uint64_t           expire;  /* deadline in ticks */
+  int                level;   /* level it is placed in */
+  void*              data;
+};
+
+struct timer_wheel {
+  uint64_t          cur;      /* next tick to be processed */
+  size_t            count;
+  size_t            level_count[TW_LEVELS];
+  struct timer_node slots[TW_LEVELS][TW_SLOTS];
+};
+
+typedef void (*expire_fn)(struct timer_node* n, void* ctx);
+
+/*
+ * create a wheel, ticks up to now are considered processed
+ */
+struct timer_wheel* timer_wheel_new(uint64_t now);
+
+/*
+ * free the wheel, nodes are owned by client and left untouched
+ */
+void timer_wheel_free(struct timer_wheel* tw);
+
+/*
+ * schedule n at n->expire, a deadline already passed fires on next advance
+ */
+void timer_wheel_add(struct timer_wheel* tw, struct timer_node* n);
+
+/*
+ * unschedule n, it is fine if n is not scheduled
+ */
+void timer_wheel_del(struct timer_wheel* tw, struct timer_node* n);
+
+/*
+ * process all ticks up to now, fn is called on each expired node after it is
+ * unscheduled, fn may reschedule or free the node. return number of expired
+ */
+size_t timer_wheel_advance(struct timer_wheel* tw, uint64_t now, 
+                           expire_fn fn, void* ctx);
+
+#endif // SHM_TIMER_WHEEL_H
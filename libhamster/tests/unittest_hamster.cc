@@ -11,6 +11,7 @@ extern "C" {
 #include "hamster.h"
 #include "shm_error.h"
 #include "shm_config.h"
+#include "shm_lock.h"
 #include "shm_segments.h"
 }
 
@@ -18,25 +19,29 @@ using namespace std;
 
 //////////////////////////////////////////////////////////////////////
 // structs introduce from libhamster
-struct h_value_t {
-  /* pointer to value */
-  void* ptr;
-  /* size of this value */
-  uint32_t size;
-  /* max size of this value */
-  uint32_t max_size; 
-};
-
 struct shm_data_header {
   int checksum;
+  uint32_t flags;
+  struct shmseg_ptr_base next;
+  uint64_t version;
   uint32_t total_size;
   uint32_t data_size;
-  struct shmseg_ptr_base next;
+  uint64_t expire;
+  uint32_t raw_size;
+  uint32_t pad_size;
 };
 
 struct seg_header {
   uint32_t off;          /* offset of used part */
   key_t    next_shm_key; /* next shm segment */
+  uint32_t commit_off;   /* records below this offset are committed */
+  uint32_t epoch;        /* chain epoch of the last commit in this segment */
+  struct shm_lock        lock;
+  struct shmseg_ptr_base alloc;
+  struct shmseg_ptr_base link;
+  struct shmseg_ptr_base first;
+  uint64_t owner;
+  uint32_t format;
 } __attribute__((aligned(16)));
 //////////////////////////////////////////////////////////////////////
 
@@ -196,6 +201,8 @@ TEST_F(hamster_test, huge_data) {
 /// crash recovery
 /// crash recovery with data corruption
 extern "C" void unittest_hamster_sim_crash();
+extern "C" void unittest_hamster_uncommit_tail(const char* key);
+extern "C" int g_recovery_verify_all;
 TEST_F(hamster_test, crash_recovery) {
   unittest_hamster_sim_crash();
   ASSERT_EQ(E_SHM_OK, hamster_init()); 
@@ -218,36 +225,81 @@ TEST_F(hamster_test, crash_recovery_with_data_corruption) {
   base_ptr = (char*)base_ptr + sizeof(seg_header) + sizeof(shm_data_header);
   memset(base_ptr, 0xff, 32);
 
+  // committed records are only checksumed on demand
+  g_recovery_verify_all = true;
   int ec = hamster_init();
+  g_recovery_verify_all = false;
   ASSERT_EQ(E_SHM_DATA_CORRUPTED, ec); 
   f_t1[0].Check();
   f_t1[1].Check();
 
-  ASSERT_EQ((size_t)2, hamster_count());
-
+  // only the bad record is quarantined, the ones behind it are kept
   h_value_t get_val;
   ASSERT_EQ(E_SHM_KEY_NOT_FOUND, hamster_get(f_t2[0].key.c_str(), &get_val));
-  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, hamster_get(f_t2[1].key.c_str(), &get_val));
-  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, hamster_get(f_t3.key.c_str(), &get_val));
+  f_t2[1].Check();
+  f_t3.Check();
+  ASSERT_EQ((size_t)4, hamster_count());
+
+  struct hamster_stat st;
+  ASSERT_EQ(E_SHM_OK, hamster_stat(&st));
+  ASSERT_EQ((uint64_t)1, st.quarantined);
 
   f_new_kv.Set();
   f_new_kv.Check();
   f_new_kv.Update();
   f_new_kv.Check();
 
-  ASSERT_EQ((size_t)3, hamster_count());
+  ASSERT_EQ((size_t)5, hamster_count());
 }
 
 TEST_F(hamster_test, recovery_after_corruption_happend) {
   unittest_hamster_sim_crash();
+  // the quarantined record is skipped, without being reported again
   ASSERT_EQ(E_SHM_OK, hamster_init()); 
   f_t1[0].Check();
   f_t1[1].Check();
   h_value_t get_val;
   ASSERT_EQ(E_SHM_KEY_NOT_FOUND, hamster_get(f_t2[0].key.c_str(), &get_val));
-  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, hamster_get(f_t2[1].key.c_str(), &get_val));
-  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, hamster_get(f_t3.key.c_str(), &get_val));
+  f_t2[1].Check();
+  f_t3.Check();
   f_new_kv.Check();
-  ASSERT_EQ((size_t)3, hamster_count());
+  ASSERT_EQ((size_t)5, hamster_count());
 }
 
+TEST_F(hamster_test, index_pools) {
+  // descriptors and tree nodes come from chunked pools
+  struct hamster_stat st;
+  ASSERT_EQ(E_SHM_OK, hamster_stat(&st));
+  ASSERT_GT(st.index_bytes, (uint64_t)0);
+  ASSERT_EQ((uint64_t)0, st.index_bytes % SHM_POOL_CHUNK);
+}
+
+
+TEST_F(hamster_test, crash_before_commit) {
+  KeyValue kv;
+  kv.Generate("uncommitted_key", 256);
+  kv.Set();
+  kv.Check();
+
+  // the record is linked, but the crash comes before its commit marker
+  h_value_t get_val;
+  ASSERT_EQ(E_SHM_OK, hamster_get(kv.key.c_str(), &get_val));
+  memset(get_val.ptr, 0xff, get_val.size);
+  unittest_hamster_uncommit_tail(kv.key.c_str());
+
+  unittest_hamster_sim_crash();
+  ASSERT_EQ(E_SHM_DATA_CORRUPTED, hamster_init());
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, hamster_get(kv.key.c_str(), &get_val));
+  f_t1[0].Check();
+  f_t1[1].Check();
+  f_new_kv.Check();
+  ASSERT_EQ((size_t)5, hamster_count());
+
+  // the bad record is quarantined, the store stays writable
+  kv.Set();
+  kv.Check();
+  unittest_hamster_sim_crash();
+  ASSERT_EQ(E_SHM_OK, hamster_init());
+  kv.Check();
+  ASSERT_EQ((size_t)6, hamster_count());
+}
@@ -0,0 +1,265 @@
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hamster.h"
+#include "shm_error.h"
+#include "shm_config.h"
+}
+
+#define KEYS 100
+
+static int set(hamster_store* st, const std::string& key, const std::string& v) {
+  h_value_t* val = hamster_value_new((void*)v.data(), v.size(), v.size());
+  int ec = hamster_store_set(st, key.c_str(), val);
+  hamster_value_free(val);
+  return ec;
+}
+
+static int stage(hamster_batch* b, const std::string& key, const std::string& v, 
+                 uint32_t ttl_ms = 0) {
+  h_value_t* val = hamster_value_new((void*)v.data(), v.size(), v.size());
+  int ec = hamster_batch_set_ttl(b, key.c_str(), val, ttl_ms);
+  hamster_value_free(val);
+  return ec;
+}
+
+static std::string get(hamster_store* st, const std::string& key) {
+  h_value_t* val = hamster_value_empty();
+  std::string v;
+  if (E_SHM_OK == hamster_store_get(st, key.c_str(), val))
+    v.assign((char*)hamster_value_ptr(val), hamster_value_size(val));
+  hamster_value_free(val);
+  return v;
+}
+
+static std::string make_key(int i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "key%04d", i);
+  return buf;
+}
+
+static std::string make_value(int i, int gen) {
+  return std::string(20 + i % 50, 'a' + (i + gen) % 26);
+}
+
+extern "C" void unittest_hamster_store_sim_crash(struct hamster_store* st);
+extern "C" uint32_t unittest_hamster_store_shard(struct hamster_store* st, const char* key);
+extern "C" void unittest_hamster_store_write_kill(struct hamster_store* st, struct hamster_batch* b, 
+                                                  bool linked);
+
+class hamster_batch_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
+  }
+
+  virtual void SetUp() {
+    ASSERT_EQ(E_SHM_OK, open());
+    ASSERT_EQ(E_SHM_OK, hamster_batch_new(&b_));
+  }
+
+  virtual void TearDown() {
+    hamster_batch_free(b_);
+    hamster_close(st_);
+  }
+
+  int open() {
+    struct hamster_options opts = {};
+    opts.shards = 4;
+    return hamster_open("batch", &opts, &st_);
+  }
+
+  void reopen() {
+    unittest_hamster_store_sim_crash(st_);
+    ASSERT_EQ(E_SHM_OK, open());
+  }
+
+  // write b_ in a child, killed before any shard is linked, or before any
+  // is indexed if linked
+  void write_killed(bool linked) {
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+      unittest_hamster_store_write_kill(st_, b_, linked);
+    int status = 0;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFSIGNALED(status));
+  }
+
+  hamster_store* st_;
+  hamster_batch* b_;
+};
+
+TEST_F(hamster_batch_test, write) {
+  // the first write of an empty store is a batch
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, stage(b_, make_key(i), make_value(i, 0)));
+  ASSERT_EQ((uint32_t)KEYS, hamster_batch_count(b_));
+  ASSERT_EQ(E_SHM_OK, hamster_store_write(st_, b_));
+  ASSERT_EQ((size_t)KEYS, hamster_store_count(st_));
+
+  // replace half of them, a later set of a key in the batch wins
+  hamster_batch_clear(b_);
+  ASSERT_EQ((uint32_t)0, hamster_batch_count(b_));
+  for (int i = 0; i < KEYS; i += 2)
+    ASSERT_EQ(E_SHM_OK, stage(b_, make_key(i), "stale"));
+  for (int i = 0; i < KEYS; i += 2)
+    ASSERT_EQ(E_SHM_OK, stage(b_, make_key(i), make_value(i, 1)));
+  ASSERT_EQ(E_SHM_OK, hamster_store_write(st_, b_));
+  ASSERT_EQ((size_t)KEYS, hamster_store_count(st_));
+
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(make_value(i, i % 2 == 0 ? 1 : 0), get(st_, make_key(i)));
+
+  // as recovery finds them
+  reopen();
+  ASSERT_EQ((size_t)KEYS, hamster_store_count(st_));
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(make_value(i, i % 2 == 0 ? 1 : 0), get(st_, make_key(i)));
+
+  // plain sets go on from there
+  ASSERT_EQ(E_SHM_OK, set(st_, make_key(0), "plain"));
+  ASSERT_EQ("plain", get(st_, make_key(0)));
+}
+
+TEST_F(hamster_batch_test, invalid) {
+  h_value_t* val = hamster_value_new((void*)"v", 1, 1);
+  ASSERT_EQ(E_SHM_KEY_ZERO_LENGTH, hamster_batch_set(b_, "", val));
+  ASSERT_EQ(E_SHM_INVALID_PARAMS, hamster_batch_set(b_, NULL, val));
+  ASSERT_EQ(E_SHM_INVALID_PARAMS, hamster_batch_set(NULL, "k", val));
+  hamster_value_free(val);
+  ASSERT_EQ((uint32_t)0, hamster_batch_count(b_));
+  ASSERT_EQ(E_SHM_OK, hamster_store_write(st_, b_));
+  ASSERT_EQ(E_SHM_INVALID_PARAMS, hamster_store_write(st_, NULL));
+}
+
+TEST_F(hamster_batch_test, ttl) {
+  ASSERT_EQ(E_SHM_OK, stage(b_, "short", "v", 1));
+  ASSERT_EQ(E_SHM_OK, stage(b_, "long", "v"));
+  ASSERT_EQ(E_SHM_OK, hamster_store_write(st_, b_));
+  usleep(20000);
+  ASSERT_EQ("", get(st_, "short"));
+  ASSERT_EQ("v", get(st_, "long"));
+  ASSERT_EQ((size_t)1, hamster_store_expire(st_));
+}
+
+TEST_F(hamster_batch_test, capacity) {
+  // a batch fails as a whole, before any shard is written
+  ASSERT_EQ(E_SHM_OK, hamster_store_set_capacity(st_, 4 * 4096));
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, stage(b_, make_key(i), std::string(1000, 'x')));
+  ASSERT_EQ(E_SHM_CAPACITY_EXCEEDED, hamster_store_write(st_, b_));
+  ASSERT_EQ((size_t)0, hamster_store_count(st_));
+}
+
+TEST_F(hamster_batch_test, crash_before_link) {
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st_, make_key(i), make_value(i, 0)));
+
+  // every record is written, none is linked yet
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, stage(b_, make_key(i), make_value(i, 1)));
+  stage(b_, "new", "v");
+  write_killed(false);
+
+  reopen();
+  ASSERT_EQ((size_t)KEYS, hamster_store_count(st_));
+  ASSERT_EQ("", get(st_, "new"));
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(make_value(i, 0), get(st_, make_key(i)));
+}
+
+TEST_F(hamster_batch_test, crash_before_drop) {
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st_, make_key(i), make_value(i, 0)));
+
+  // linked and committed, the records replaced are still alive in shm
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, stage(b_, make_key(i), make_value(i, 1)));
+  stage(b_, "new", "v");
+  write_killed(true);
+
+  // recovery keeps the later version of each key, and reuses the other
+  reopen();
+  ASSERT_EQ((size_t)KEYS + 1, hamster_store_count(st_));
+  ASSERT_EQ("v", get(st_, "new"));
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(make_value(i, 1), get(st_, make_key(i)));
+
+  reopen();
+  ASSERT_EQ((size_t)KEYS + 1, hamster_store_count(st_));
+  ASSERT_EQ(make_value(7, 1), get(st_, make_key(7)));
+}
+
+TEST_F(hamster_batch_test, shard_fails) {
+  hamster_close(st_);
+  struct hamster_options opts = {};
+  opts.shards = 4;
+  opts.segment_max = 4096;
+  ASSERT_EQ(E_SHM_OK, hamster_open("full", &opts, &st_));
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st_, make_key(i), make_value(i, 0)));
+
+  // values of a segment each, until the last shard has no key left for one
+  std::string big(3000, 'x'), full;
+  for (int i = 0; full.empty(); ++i) {
+    ASSERT_LT(i, 4 * SHM_KEY_RANGE);
+    std::string key = "big" + std::to_string(i);
+    if (unittest_hamster_store_shard(st_, key.c_str()) != 3)
+      continue;
+    int ec = set(st_, key, big);
+    if (ec == E_SHM_CREAT_SEGINFO_FAILED)
+      full = key;
+    else
+      ASSERT_EQ(E_SHM_OK, ec);
+  }
+  size_t count = hamster_store_count(st_);
+
+  // the other shards are reserved and written already, none is linked
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, stage(b_, make_key(i), make_value(i, 1)));
+  stage(b_, full, big);
+  ASSERT_EQ(E_SHM_CREAT_SEGINFO_FAILED, hamster_store_write(st_, b_));
+
+  ASSERT_EQ(count, hamster_store_count(st_));
+  ASSERT_EQ("", get(st_, full));
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(make_value(i, 0), get(st_, make_key(i)));
+
+  // what they reserved is taken again, by the keys of the other shards
+  hamster_batch_clear(b_);
+  int written = 0;
+  for (int i = 0; i < KEYS; ++i) {
+    if (unittest_hamster_store_shard(st_, make_key(i).c_str()) != 3) {
+      ASSERT_EQ(E_SHM_OK, stage(b_, make_key(i), make_value(i, 1)));
+      ++written;
+    }
+  }
+  ASSERT_LT(0, written);
+  ASSERT_EQ(E_SHM_OK, hamster_store_write(st_, b_));
+  unittest_hamster_store_sim_crash(st_);
+  ASSERT_EQ(E_SHM_OK, hamster_open("full", &opts, &st_));
+  ASSERT_EQ(count, hamster_store_count(st_));
+  ASSERT_EQ("", get(st_, full));
+  for (int i = 0; i < KEYS; ++i) {
+    bool last = unittest_hamster_store_shard(st_, make_key(i).c_str()) == 3;
+    ASSERT_EQ(make_value(i, last ? 0 : 1), get(st_, make_key(i)));
+  }
+}
+
+TEST_F(hamster_batch_test, default_store) {
+  ASSERT_EQ(E_SHM_OK, hamster_init());
+  ASSERT_EQ(E_SHM_OK, stage(b_, "a", "1"));
+  ASSERT_EQ(E_SHM_OK, stage(b_, "b", "2"));
+  ASSERT_EQ(E_SHM_OK, hamster_write(b_));
+  ASSERT_EQ((size_t)2, hamster_count());
+  hamster_shutdown();
+}
@@ -0,0 +1,170 @@
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hamster.h"
+#include "shm_error.h"
+#include "shm_config.h"
+}
+
+#define VALUE_SIZE 200
+
+static int set(hamster_store* st, const std::string& key, uint32_t ttl_ms = 0) {
+  std::string v(VALUE_SIZE, key[0]);
+  h_value_t* val = hamster_value_new(&v[0], v.size(), v.size());
+  int ec = hamster_store_set_ttl(st, key.c_str(), val, ttl_ms);
+  hamster_value_free(val);
+  return ec;
+}
+
+static std::string make_key(const char* prefix, int i) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%s%05d", prefix, i);
+  return buf;
+}
+
+static void on_budget(hamster_store* st, uint64_t used, void* ctx) {
+  struct hamster_budget b;
+  hamster_store_budget(st, &b);
+  ASSERT_EQ(used, b.used);
+  ASSERT_LT(b.soft, used);
+  ++*(int*)ctx;
+}
+
+class hamster_budget_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
+    page_ = shm_pagesize * SHM_SIZE_IN_PAGES;
+  }
+
+  virtual void SetUp() {
+    struct hamster_options opts = {};
+    hits_ = 0;
+    ASSERT_EQ(E_SHM_OK, hamster_open("budget", &opts, &st_));
+  }
+
+  virtual void TearDown() {
+    hamster_close(st_);
+  }
+
+  static size_t page_;
+  hamster_store* st_;
+  int hits_;
+};
+
+size_t hamster_budget_test::page_;
+
+TEST_F(hamster_budget_test, hard) {
+  // segments double, the chain of 8 pages can not grow any more
+  ASSERT_EQ(E_SHM_OK, hamster_store_set_budget(st_, 2 * page_, 8 * page_, on_budget, &hits_));
+
+  int n = 0, ec = E_SHM_OK;
+  while (E_SHM_OK == (ec = set(st_, make_key("k", n))))
+    ++n;
+  ASSERT_EQ(E_SHM_BUDGET_EXCEEDED, ec);
+  ASSERT_EQ(E_SHM_BUDGET_EXCEEDED, set(st_, make_key("k", n)));
+  ASSERT_EQ(2, hits_);
+
+  struct hamster_budget b;
+  ASSERT_EQ(E_SHM_OK, hamster_store_budget(st_, &b));
+  ASSERT_EQ(8 * page_, b.used);
+  ASSERT_EQ(2 * page_, b.soft);
+  ASSERT_EQ(8 * page_, b.hard);
+  ASSERT_EQ(2u, b.rejected);
+  ASSERT_EQ((uint32_t)HAMSTER_BUDGET_HARD, b.level);
+
+  // the keys written are kept, and rewritten in place
+  ASSERT_EQ((size_t)n, hamster_store_count(st_));
+  ASSERT_EQ(E_SHM_OK, set(st_, make_key("k", 0)));
+
+  // a batch is refused before any of it is written
+  hamster_batch* batch = NULL;
+  std::string v(VALUE_SIZE, 'b');
+  h_value_t val = { &v[0], VALUE_SIZE, VALUE_SIZE };
+  ASSERT_EQ(E_SHM_OK, hamster_batch_new(&batch));
+  for (int i = 0; i < 100; ++i)
+    ASSERT_EQ(E_SHM_OK, hamster_batch_set(batch, make_key("b", i).c_str(), &val));
+  ASSERT_EQ(E_SHM_BUDGET_EXCEEDED, hamster_store_write(st_, batch));
+  ASSERT_EQ((size_t)n, hamster_store_count(st_));
+  hamster_batch_free(batch);
+
+  // a bigger budget takes writes again
+  ASSERT_EQ(E_SHM_OK, hamster_store_set_budget(st_, 2 * page_, 16 * page_, NULL, NULL));
+  ASSERT_EQ(E_SHM_OK, hamster_store_budget(st_, &b));
+  ASSERT_EQ((uint32_t)HAMSTER_BUDGET_SOFT, b.level);
+  ASSERT_EQ(E_SHM_OK, set(st_, make_key("k", n)));
+  ASSERT_EQ(E_SHM_OK, hamster_store_set_budget(st_, 0, 0, NULL, NULL));
+  ASSERT_EQ(E_SHM_OK, hamster_store_budget(st_, &b));
+  ASSERT_EQ((uint32_t)HAMSTER_BUDGET_OK, b.level);
+}
+
+TEST_F(hamster_budget_test, hard_level_ends) {
+  ASSERT_EQ(E_SHM_OK, hamster_store_set_budget(st_, 2 * page_, 8 * page_, NULL, NULL));
+
+  int n = 0;
+  while (E_SHM_OK == set(st_, make_key("t", n), 300))
+    ++n;
+  struct hamster_budget b;
+  ASSERT_EQ(E_SHM_OK, hamster_store_budget(st_, &b));
+  ASSERT_EQ((uint32_t)HAMSTER_BUDGET_HARD, b.level);
+
+  // the space of the expired keys is free again
+  usleep(400000);
+  ASSERT_LT(0u, hamster_store_expire(st_));
+  ASSERT_EQ(E_SHM_OK, hamster_store_budget(st_, &b));
+  ASSERT_EQ((uint32_t)HAMSTER_BUDGET_SOFT, b.level);
+  ASSERT_EQ(E_SHM_OK, set(st_, make_key("k", 0)));
+
+  // and refused once it is taken up
+  int m = 1;
+  while (E_SHM_OK == set(st_, make_key("k", m)))
+    ++m;
+  ASSERT_EQ(E_SHM_OK, hamster_store_budget(st_, &b));
+  ASSERT_EQ((uint32_t)HAMSTER_BUDGET_HARD, b.level);
+  ASSERT_EQ(n, m);
+}
+
+TEST_F(hamster_budget_test, soft_reclaims_expired) {
+  ASSERT_EQ(E_SHM_OK, hamster_store_set_budget(st_, 4 * page_, 0, on_budget, &hits_));
+
+  // fill the soft budget with keys about to expire
+  int n = 0;
+  struct hamster_budget b;
+  do {
+    ASSERT_EQ(E_SHM_OK, set(st_, make_key("t", n++), 1));
+    ASSERT_EQ(E_SHM_OK, hamster_store_budget(st_, &b));
+  } while (b.used < 4 * page_);
+  ASSERT_EQ(0, hits_);
+  usleep(20000);
+
+  // the chain is half full, the space of the expired keys is reused before
+  // it grows beyond soft
+  for (int i = 0; i < n * 3 / 2; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st_, make_key("k", i)));
+  ASSERT_EQ(E_SHM_OK, hamster_store_budget(st_, &b));
+  ASSERT_EQ(4 * page_, b.used);
+  ASSERT_EQ((uint32_t)HAMSTER_BUDGET_OK, b.level);
+  ASSERT_EQ(0, hits_);
+
+  struct hamster_stat stat;
+  ASSERT_EQ(E_SHM_OK, hamster_store_stat(st_, &stat));
+  ASSERT_LT(0u, stat.expirations);
+}
+
+TEST_F(hamster_budget_test, params) {
+  ASSERT_EQ(E_SHM_INVALID_PARAMS, hamster_store_set_budget(st_, 2 * page_, page_, NULL, NULL));
+  ASSERT_EQ(E_SHM_INVALID_PARAMS, hamster_store_set_budget(NULL, 0, 0, NULL, NULL));
+  ASSERT_EQ(E_SHM_OK, hamster_store_set_budget(st_, 2 * page_, 0, NULL, NULL));
+
+  struct hamster_budget b;
+  ASSERT_EQ(E_SHM_INVALID_PARAMS, hamster_store_budget(NULL, &b));
+  ASSERT_EQ(E_SHM_OK, hamster_store_budget(st_, &b));
+  ASSERT_EQ(page_, b.used);
+  ASSERT_EQ((uint32_t)HAMSTER_BUDGET_OK, b.level);
+}
@@ -0,0 +1,117 @@
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hamster.h"
+#include "shm_error.h"
+#include "shm_config.h"
+}
+
+#define HOT_KEYS 4
+#define COLD_KEYS 512
+#define VALUE_SIZE 200
+
+static std::string make_key(const char* prefix, int i) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%s%04d", prefix, i);
+  return buf;
+}
+
+static int set(const std::string& key, uint32_t size = VALUE_SIZE) {
+  std::string v(size, key[0]);
+  h_value_t* val = hamster_value_new(&v[0], size, size);
+  int ec = hamster_set(key.c_str(), val);
+  hamster_value_free(val);
+  return ec;
+}
+
+static int get(const std::string& key) {
+  h_value_t* val = hamster_value_empty();
+  int ec = hamster_get(key.c_str(), val);
+  if (ec == E_SHM_OK && *(char*)hamster_value_ptr(val) != key[0])
+    ec = E_SHM_DATA_CORRUPTED;
+  hamster_value_free(val);
+  return ec;
+}
+
+class hamster_cache_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
+    capacity_ = shm_pagesize * SHM_SIZE_IN_PAGES * 4;
+  }
+
+  static void TearDownTestCase() {
+    hamster_shutdown();
+  }
+
+  static uint64_t capacity_;
+};
+
+uint64_t hamster_cache_test::capacity_;
+
+TEST_F(hamster_cache_test, init) {
+  ASSERT_EQ(E_SHM_OK, hamster_init());
+  ASSERT_EQ(E_SHM_OK, hamster_set_capacity(capacity_));
+
+  struct hamster_stat st;
+  ASSERT_EQ(E_SHM_OK, hamster_stat(&st));
+  ASSERT_EQ(capacity_, st.capacity);
+  ASSERT_EQ((uint64_t)0, st.evictions);
+}
+
+TEST_F(hamster_cache_test, hot_keys_survive) {
+  for (int i = 0; i < HOT_KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(make_key("hot", i)));
+
+  for (int i = 0; i < COLD_KEYS; ++i) {
+    ASSERT_EQ(E_SHM_OK, set(make_key("cold", i)));
+    for (int k = 0; k < HOT_KEYS; ++k)
+      ASSERT_EQ(E_SHM_OK, get(make_key("hot", k)));
+  }
+
+  struct hamster_stat st;
+  ASSERT_EQ(E_SHM_OK, hamster_stat(&st));
+  ASSERT_LE(st.bytes, capacity_);
+  ASSERT_GT(st.evictions, (uint64_t)0);
+  ASSERT_EQ(st.evictions + hamster_count(), (uint64_t)(HOT_KEYS + COLD_KEYS));
+
+  // the newest keys are there, the oldest cold ones are gone
+  ASSERT_EQ(E_SHM_OK, get(make_key("cold", COLD_KEYS - 1)));
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, get(make_key("cold", 0)));
+}
+
+TEST_F(hamster_cache_test, hit_ratio) {
+  struct hamster_stat st;
+  ASSERT_EQ(E_SHM_OK, hamster_stat(&st));
+  ASSERT_EQ((uint64_t)HOT_KEYS * COLD_KEYS + 1, st.hits);
+  ASSERT_EQ((uint64_t)1, st.misses);
+  ASSERT_DOUBLE_EQ((double)st.hits / (st.hits + st.misses), st.hit_ratio);
+}
+
+TEST_F(hamster_cache_test, capacity_exceeded) {
+  // no key is big enough to make room for it, and it can not grow
+  ASSERT_EQ(E_SHM_CAPACITY_EXCEEDED, set("huge", shm_pagesize * 2));
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, get("huge"));
+
+  // unbounded again
+  ASSERT_EQ(E_SHM_OK, hamster_set_capacity(0));
+  ASSERT_EQ(E_SHM_OK, set("huge", shm_pagesize * 2));
+  ASSERT_EQ(E_SHM_OK, get("huge"));
+}
+
+extern "C" void unittest_hamster_sim_crash();
+TEST_F(hamster_cache_test, crash_recovery) {
+  size_t count = hamster_count();
+  unittest_hamster_sim_crash();
+  ASSERT_EQ(E_SHM_OK, hamster_init());
+  ASSERT_EQ(count, hamster_count());
+  for (int k = 0; k < HOT_KEYS; ++k)
+    ASSERT_EQ(E_SHM_OK, get(make_key("hot", k)));
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, get(make_key("cold", 0)));
+}
@@ -0,0 +1,232 @@
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hamster.h"
+#include "shm_error.h"
+#include "shm_config.h"
+}
+
+#define CHUNK_MIN 4096
+
+static int set(hamster_store* st, const std::string& key, const std::string& v) {
+  h_value_t* val = hamster_value_new((void*)v.data(), v.size(), v.size());
+  int ec = hamster_store_set(st, key.c_str(), val);
+  hamster_value_free(val);
+  return ec;
+}
+
+static std::string get_copy(hamster_store* st, const std::string& key) {
+  std::string v(1 << 20, 0);
+  uint32_t size = v.size();
+  if (E_SHM_OK != hamster_store_get_copy(st, key.c_str(), &v[0], &size))
+    return "";
+  v.resize(size);
+  return v;
+}
+
+static std::string make_value(size_t size, int seed) {
+  std::string v(size, 0);
+  for (size_t i = 0; i < size; ++i)
+    v[i] = (char)((i * 131 + seed) % 251);
+  return v;
+}
+
+static uint64_t used(hamster_store* st) {
+  struct hamster_budget b;
+  hamster_store_budget(st, &b);
+  return b.used;
+}
+
+extern "C" void unittest_hamster_store_sim_crash(struct hamster_store* st);
+extern "C" void unittest_hamster_store_rot_chunk(struct hamster_store* st, const char* key, uint32_t i);
+
+class hamster_chunks_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
+  }
+
+  virtual void SetUp() {
+    copy_ = NULL;
+    ASSERT_EQ(E_SHM_OK, open());
+    hamster_store_set_chunking(st_, CHUNK_MIN);
+  }
+
+  virtual void TearDown() {
+    hamster_close(copy_);
+    hamster_close(st_);
+  }
+
+  int open() {
+    struct hamster_options opts = {};
+    opts.shards = 2;
+    return hamster_open("chunks", &opts, &st_);
+  }
+
+  hamster_store* st_;
+  hamster_store* copy_;
+};
+
+TEST_F(hamster_chunks_test, set_get) {
+  std::string v = make_value(100000, 1);
+  ASSERT_EQ(E_SHM_OK, set(st_, "big", v));
+  ASSERT_EQ(E_SHM_OK, set(st_, "small", "not chunked"));
+
+  // a chunked value is not in one piece to point to
+  h_value_t* val = hamster_value_empty();
+  ASSERT_EQ(E_SHM_VAL_CHUNKED, hamster_store_get(st_, "big", val));
+  ASSERT_EQ(E_SHM_OK, hamster_store_get(st_, "small", val));
+  hamster_value_free(val);
+
+  ASSERT_EQ(v, get_copy(st_, "big"));
+  ASSERT_EQ("not chunked", get_copy(st_, "small"));
+  char buf[16];
+  uint32_t size = sizeof(buf);
+  ASSERT_EQ(E_SHM_VAL_BUFFER_TOO_SMALL, hamster_store_get_copy(st_, "big", buf, &size));
+  ASSERT_EQ((size_t)2, hamster_store_count(st_));
+}
+
+TEST_F(hamster_chunks_test, setv_getv) {
+  std::string a = make_value(30000, 2), b = make_value(1, 3), c = make_value(50000, 4);
+  struct iovec in[3] = {
+    { &a[0], a.size() }, { &b[0], b.size() }, { &c[0], c.size() }
+  };
+  ASSERT_EQ(E_SHM_OK, hamster_store_setv(st_, "v", in, 3, 0));
+  std::string v = a + b + c;
+  ASSERT_EQ(v, get_copy(st_, "v"));
+
+  // a range across chunk borders into two buffers
+  std::string x(10000, 0), y(7000, 0);
+  struct iovec out[2] = { { &x[0], x.size() }, { &y[0], y.size() } };
+  uint32_t size = 0;
+  ASSERT_EQ(E_SHM_OK, hamster_store_getv(st_, "v", 12345, out, 2, &size));
+  ASSERT_EQ(17000u, size);
+  ASSERT_EQ(v.substr(12345, 17000), x + y);
+
+  // the tail and past the end
+  ASSERT_EQ(E_SHM_OK, hamster_store_getv(st_, "v", v.size() - 100, out, 2, &size));
+  ASSERT_EQ(100u, size);
+  ASSERT_EQ(v.substr(v.size() - 100), x.substr(0, 100));
+  ASSERT_EQ(E_SHM_OK, hamster_store_getv(st_, "v", v.size() + 1, out, 2, &size));
+  ASSERT_EQ(0u, size);
+
+  // small values are put together and read the same way
+  struct iovec parts[2] = { { (void*)"hello ", 6 }, { (void*)"world", 5 } };
+  ASSERT_EQ(E_SHM_OK, hamster_store_setv(st_, "s", parts, 2, 0));
+  ASSERT_EQ(E_SHM_OK, hamster_store_getv(st_, "s", 6, out, 2, &size));
+  ASSERT_EQ("world", x.substr(0, size));
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, hamster_store_getv(st_, "none", 0, out, 2, &size));
+  ASSERT_EQ(E_SHM_INVALID_PARAMS, hamster_store_getv(st_, "s", 0, out, -1, &size));
+}
+
+TEST_F(hamster_chunks_test, replace) {
+  // old chunks are freed once the new ones are in and taken by the next set
+  ASSERT_EQ(E_SHM_OK, set(st_, "k", make_value(200000, 0)));
+  ASSERT_EQ(E_SHM_OK, set(st_, "k", make_value(200000, 1)));
+  uint64_t before = used(st_);
+  for (int i = 2; i < 20; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st_, "k", make_value(200000, i)));
+  ASSERT_EQ(before, used(st_));
+  ASSERT_EQ(make_value(200000, 19), get_copy(st_, "k"));
+
+  // a plain value over a chunked one and back
+  ASSERT_EQ(E_SHM_OK, set(st_, "k", "plain"));
+  ASSERT_EQ("plain", get_copy(st_, "k"));
+  ASSERT_EQ(E_SHM_OK, set(st_, "k", make_value(50000, 7)));
+  ASSERT_EQ(make_value(50000, 7), get_copy(st_, "k"));
+
+  // an expired one frees its chunks too
+  std::string e = make_value(50000, 8);
+  struct iovec in = { &e[0], e.size() };
+  ASSERT_EQ(E_SHM_OK, hamster_store_setv(st_, "e", &in, 1, 1));
+  usleep(20000);
+  hamster_store_expire(st_);
+  ASSERT_EQ("", get_copy(st_, "e"));
+  ASSERT_EQ((size_t)1, hamster_store_count(st_));
+}
+
+TEST_F(hamster_chunks_test, corrupted) {
+  std::string v = make_value(100000, 5);
+  ASSERT_EQ(E_SHM_OK, set(st_, "k", v));
+  unittest_hamster_store_rot_chunk(st_, "k", 3);
+
+  // the ranges away from the bad chunk still read
+  std::string x(1000, 0);
+  struct iovec out = { &x[0], x.size() };
+  uint32_t size = 0;
+  ASSERT_EQ(E_SHM_OK, hamster_store_getv(st_, "k", 0, &out, 1, &size));
+  ASSERT_EQ(v.substr(0, 1000), x);
+  ASSERT_EQ(E_SHM_DATA_CORRUPTED, hamster_store_getv(st_, "k", v.size() / 2, &out, 1, &size));
+  char* buf = (char*)malloc(v.size());
+  size = v.size();
+  ASSERT_EQ(E_SHM_DATA_CORRUPTED, hamster_store_get_copy(st_, "k", buf, &size));
+  free(buf);
+}
+
+TEST_F(hamster_chunks_test, recover) {
+  for (int i = 0; i < 10; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st_, "k" + std::to_string(i), make_value(40000 + i, i)));
+  ASSERT_EQ(E_SHM_OK, set(st_, "k3", make_value(60000, 99)));
+  uint64_t before = used(st_);
+
+  unittest_hamster_store_sim_crash(st_);
+  ASSERT_EQ(E_SHM_OK, open());
+  hamster_store_set_chunking(st_, CHUNK_MIN);
+  ASSERT_EQ((size_t)10, hamster_store_count(st_));
+  for (int i = 0; i < 10; ++i) {
+    if (i == 3)
+      ASSERT_EQ(make_value(60000, 99), get_copy(st_, "k3"));
+    else
+      ASSERT_EQ(make_value(40000 + i, i), get_copy(st_, "k" + std::to_string(i)));
+  }
+
+  // the chunks of replaced values are free again
+  for (int i = 0; i < 10; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st_, "k" + std::to_string(i), make_value(40000, i + 1)));
+  ASSERT_LE(used(st_), before + 40000);
+  ASSERT_EQ(make_value(40000, 10), get_copy(st_, "k9"));
+}
+
+TEST_F(hamster_chunks_test, dump_load) {
+  std::string v = make_value(300000, 8);
+  ASSERT_EQ(E_SHM_OK, set(st_, "big", v));
+  ASSERT_EQ(E_SHM_OK, set(st_, "small", "s"));
+
+  FILE* f = tmpfile();
+  ASSERT_TRUE(NULL != f);
+  hamster_reader* r = NULL;
+  ASSERT_EQ(E_SHM_OK, hamster_reader_open("chunks", 0, &r));
+  hamster_record rec;
+  int n = 0;
+  while (E_SHM_OK == hamster_reader_next(r, &rec)) {
+    if (std::string("big") == rec.key) {
+      ASSERT_EQ(v, std::string((const char*)rec.value, rec.size));
+    }
+    ++n;
+  }
+  ASSERT_EQ(2, n);
+  hamster_reader_close(r);
+
+  ASSERT_EQ(E_SHM_OK, hamster_reader_open("chunks", 0, &r));
+  ASSERT_EQ(E_SHM_OK, hamster_reader_dump(r, fileno(f)));
+  hamster_reader_close(r);
+
+  // loaded in one piece into a store without chunking
+  struct hamster_options opts = {};
+  ASSERT_EQ(E_SHM_OK, hamster_open("chunks_copy", &opts, &copy_));
+  rewind(f);
+  ASSERT_EQ(E_SHM_OK, hamster_store_load(copy_, fileno(f)));
+  fclose(f);
+  ASSERT_EQ((size_t)2, hamster_store_count(copy_));
+  h_value_t* val = hamster_value_empty();
+  ASSERT_EQ(E_SHM_OK, hamster_store_get(copy_, "big", val));
+  ASSERT_EQ(v, std::string((char*)hamster_value_ptr(val), hamster_value_size(val)));
+  hamster_value_free(val);
+}
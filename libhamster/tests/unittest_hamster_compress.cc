@@ -0,0 +1,175 @@
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hamster.h"
+#include "shm_error.h"
+#include "shm_config.h"
+}
+
+#define COMPRESS_MIN 256
+#define KEYS 64
+
+static std::string make_blob(int i, int fields) {
+  std::string s = "{";
+  char buf[64];
+  for (int f = 0; f < fields; ++f) {
+    snprintf(buf, sizeof(buf), "\"field%d\":\"value of record %d\",", f, i);
+    s += buf;
+  }
+  return s + "}";
+}
+
+static std::string make_key(int i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "blob%04d", i);
+  return buf;
+}
+
+static int set(const std::string& key, const std::string& v, uint32_t max_size = 0) {
+  h_value_t* val = hamster_value_new((void*)v.data(), v.size(), 
+                                     max_size ? max_size : v.size());
+  int ec = hamster_set(key.c_str(), val);
+  hamster_value_free(val);
+  return ec;
+}
+
+static void check(const std::string& key, const std::string& v) {
+  std::string buf(v.size(), '\0');
+  uint32_t size = buf.size();
+  ASSERT_EQ(E_SHM_OK, hamster_get_copy(key.c_str(), &buf[0], &size));
+  ASSERT_EQ(v.size(), size);
+  ASSERT_EQ(v, buf);
+}
+
+class hamster_compress_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
+  }
+
+  static void TearDownTestCase() {
+    hamster_set_compression(0);
+    hamster_shutdown();
+  }
+};
+
+TEST_F(hamster_compress_test, init) {
+  ASSERT_EQ(E_SHM_OK, hamster_init());
+  hamster_set_compression(COMPRESS_MIN);
+}
+
+TEST_F(hamster_compress_test, small_value_raw) {
+  std::string v(COMPRESS_MIN - 1, 's');
+  ASSERT_EQ(E_SHM_OK, set("small", v));
+
+  // stored raw, so still readable in place
+  h_value_t* val = hamster_value_empty();
+  ASSERT_EQ(E_SHM_OK, hamster_get("small", val));
+  ASSERT_EQ(v.size(), hamster_value_size(val));
+  ASSERT_EQ(v, std::string((char*)hamster_value_ptr(val), hamster_value_size(val)));
+  hamster_value_free(val);
+  check("small", v);
+}
+
+TEST_F(hamster_compress_test, get_copy) {
+  std::string v = make_blob(0, 40);
+  ASSERT_EQ(E_SHM_OK, set("big", v));
+
+  h_value_t* val = hamster_value_empty();
+  ASSERT_EQ(E_SHM_VAL_COMPRESSED, hamster_get("big", val));
+  hamster_value_free(val);
+
+  // ask for the size first
+  uint32_t size = 0;
+  ASSERT_EQ(E_SHM_VAL_BUFFER_TOO_SMALL, hamster_get_copy("big", NULL, &size));
+  ASSERT_EQ(v.size(), size);
+
+  check("big", v);
+
+  uint32_t miss = 16;
+  char buf[16];
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, hamster_get_copy("nope", buf, &miss));
+}
+
+TEST_F(hamster_compress_test, incompressible) {
+  std::string v(1024, '\0');
+  srand(1);
+  for (size_t i = 0; i < v.size(); ++i)
+    v[i] = (char)rand();
+  ASSERT_EQ(E_SHM_OK, set("noise", v));
+
+  h_value_t* val = hamster_value_empty();
+  ASSERT_EQ(E_SHM_OK, hamster_get("noise", val));
+  hamster_value_free(val);
+  check("noise", v);
+}
+
+TEST_F(hamster_compress_test, update) {
+  std::string v = make_blob(1, 40);
+  ASSERT_EQ(E_SHM_OK, set("upd", v, v.size() + 64));
+  check("upd", v);
+
+  // same size, compresses about as well
+  std::string v2 = make_blob(2, 40);
+  ASSERT_EQ(E_SHM_OK, set("upd", v2));
+  check("upd", v2);
+
+  // small enough to be stored raw in the compressed record
+  std::string v3(64, 'r');
+  ASSERT_EQ(E_SHM_OK, set("upd", v3));
+  h_value_t* val = hamster_value_empty();
+  ASSERT_EQ(E_SHM_OK, hamster_get("upd", val));
+  hamster_value_free(val);
+  check("upd", v3);
+
+  // the record only has room for the compressed size, a new one is taken
+  std::string noise(v.size(), '\0');
+  for (size_t i = 0; i < noise.size(); ++i)
+    noise[i] = (char)rand();
+  ASSERT_EQ(E_SHM_OK, set("upd", noise));
+  check("upd", noise);
+
+  // and a compressed value back over the raw one
+  ASSERT_EQ(E_SHM_OK, set("upd", v));
+  check("upd", v);
+
+  // a raw value beyond the max_size of its raw record still fails
+  std::string raw(100, 'x');
+  ASSERT_EQ(E_SHM_OK, set("raw", raw));
+  ASSERT_EQ(E_SHM_VAL_UPDATE_EXCEED_MAX_SIZE, set("raw", noise));
+  check("raw", raw);
+}
+
+TEST_F(hamster_compress_test, saves_space) {
+  struct hamster_stat before, after;
+  size_t raw = 0;
+
+  ASSERT_EQ(E_SHM_OK, hamster_stat(&before));
+  for (int i = 0; i < KEYS; ++i) {
+    std::string v = make_blob(i, 100);
+    raw += v.size();
+    ASSERT_EQ(E_SHM_OK, set(make_key(i), v));
+  }
+  ASSERT_EQ(E_SHM_OK, hamster_stat(&after));
+  ASSERT_LT(after.bytes - before.bytes, raw / 2);
+
+  for (int i = 0; i < KEYS; ++i)
+    check(make_key(i), make_blob(i, 100));
+}
+
+extern "C" void unittest_hamster_sim_crash();
+TEST_F(hamster_compress_test, recovery) {
+  unittest_hamster_sim_crash();
+  ASSERT_EQ(E_SHM_OK, hamster_init());
+
+  check("big", make_blob(0, 40));
+  check("small", std::string(COMPRESS_MIN - 1, 's'));
+  for (int i = 0; i < KEYS; ++i)
+    check(make_key(i), make_blob(i, 100));
+}
@@ -0,0 +1,236 @@
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hamster.h"
+#include "shm_error.h"
+#include "shm_config.h"
+}
+
+#define THREADS 4
+#define INCRS   20000
+
+static int set(hamster_store* st, const std::string& key, const std::string& v) {
+  h_value_t* val = hamster_value_new((void*)v.data(), v.size(), v.size());
+  int ec = hamster_store_set(st, key.c_str(), val);
+  hamster_value_free(val);
+  return ec;
+}
+
+static std::string get(hamster_store* st, const std::string& key) {
+  h_value_t* val = hamster_value_empty();
+  std::string v;
+  if (E_SHM_OK == hamster_store_get(st, key.c_str(), val))
+    v.assign((char*)hamster_value_ptr(val), hamster_value_size(val));
+  hamster_value_free(val);
+  return v;
+}
+
+static void on_corrupt(hamster_store* st, const char* key, void* ctx) {
+  ++*(int*)ctx;
+}
+
+extern "C" void unittest_hamster_store_sim_crash(struct hamster_store* st);
+extern "C" int g_recovery_verify_all;
+extern "C" void unittest_hamster_store_tear_add(struct hamster_store* st, const char* key, int64_t delta);
+
+class hamster_counter_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
+  }
+
+  virtual void SetUp() {
+    ASSERT_EQ(E_SHM_OK, hamster_open("counter", NULL, &st_));
+  }
+
+  virtual void TearDown() {
+    hamster_close(st_);
+  }
+
+  /* the checksums must still match after the in-place updates */
+  void Verify() {
+    int corrupted = 0;
+    hamster_store_scrub(st_, 1 << 30, on_corrupt, &corrupted);
+    ASSERT_EQ(0, corrupted);
+  }
+
+  hamster_store* st_;
+};
+
+TEST_F(hamster_counter_test, add) {
+  int64_t n = 0;
+
+  ASSERT_EQ(E_SHM_OK, hamster_store_add(st_, "c", 5, &n));
+  ASSERT_EQ(5, n);
+  ASSERT_EQ(E_SHM_OK, hamster_store_incr(st_, "c", &n));
+  ASSERT_EQ(6, n);
+  ASSERT_EQ(E_SHM_OK, hamster_store_add(st_, "c", -10, &n));
+  ASSERT_EQ(-4, n);
+  ASSERT_EQ(E_SHM_OK, hamster_store_add(st_, "c", INT64_MAX / 3, NULL));
+
+  // the value is an aligned int64 in shm
+  h_value_t* val = hamster_value_empty();
+  ASSERT_EQ(E_SHM_OK, hamster_store_get(st_, "c", val));
+  ASSERT_EQ((uint32_t)sizeof(int64_t), hamster_value_size(val));
+  ASSERT_EQ((uintptr_t)0, (uintptr_t)hamster_value_ptr(val) % sizeof(int64_t));
+  ASSERT_EQ(-4 + INT64_MAX / 3, *(int64_t*)hamster_value_ptr(val));
+  hamster_value_free(val);
+
+  // keys of every length mod 8
+  for (int i = 1; i <= 8; ++i) {
+    std::string key(i, 'k');
+    for (int j = 0; j < 100; ++j)
+      ASSERT_EQ(E_SHM_OK, hamster_store_add(st_, key.c_str(), j * 0x10001, &n));
+    ASSERT_EQ(4950 * 0x10001, n);
+  }
+  Verify();
+}
+
+TEST_F(hamster_counter_test, not_counter) {
+  int64_t n = 0;
+
+  ASSERT_EQ(E_SHM_OK, set(st_, "s", "abc"));
+  ASSERT_EQ(E_SHM_VAL_NOT_COUNTER, hamster_store_add(st_, "s", 1, &n));
+  ASSERT_EQ("abc", get(st_, "s"));
+
+  // a counter set by hamster_set is likely unaligned, it still counts
+  n = 40;
+  ASSERT_EQ(E_SHM_OK, set(st_, "u", std::string((char*)&n, sizeof(n))));
+  ASSERT_EQ(E_SHM_OK, hamster_store_add(st_, "u", 2, &n));
+  ASSERT_EQ(42, n);
+  ASSERT_EQ(E_SHM_OK, hamster_store_incr(st_, "u", &n));
+  ASSERT_EQ(43, n);
+  Verify();
+}
+
+struct incr_args {
+  hamster_store* st;
+  int id;
+};
+
+static void* incr_main(void* arg) {
+  incr_args* a = (incr_args*)arg;
+  char own[32];
+  snprintf(own, sizeof(own), "own%d", a->id);
+  for (int i = 0; i < INCRS; ++i) {
+    if (E_SHM_OK != hamster_store_incr(a->st, "shared", NULL) ||
+        E_SHM_OK != hamster_store_add(a->st, own, 2, NULL))
+      return (void*)1;
+  }
+  return NULL;
+}
+
+TEST_F(hamster_counter_test, threads) {
+  pthread_t threads[THREADS];
+  incr_args args[THREADS];
+  int64_t n = 0;
+
+  for (int i = 0; i < THREADS; ++i) {
+    args[i].st = st_;
+    args[i].id = i;
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, incr_main, &args[i]));
+  }
+  for (int i = 0; i < THREADS; ++i) {
+    void* ret = NULL;
+    pthread_join(threads[i], &ret);
+    ASSERT_EQ(NULL, ret);
+  }
+
+  ASSERT_EQ(E_SHM_OK, hamster_store_add(st_, "shared", 0, &n));
+  ASSERT_EQ((int64_t)THREADS * INCRS, n);
+  for (int i = 0; i < THREADS; ++i) {
+    char own[32];
+    snprintf(own, sizeof(own), "own%d", i);
+    ASSERT_EQ(E_SHM_OK, hamster_store_add(st_, own, 0, &n));
+    ASSERT_EQ((int64_t)2 * INCRS, n);
+  }
+  Verify();
+}
+
+TEST_F(hamster_counter_test, torn_add) {
+  int64_t n = 0;
+  ASSERT_EQ(E_SHM_OK, hamster_store_add(st_, "c", 5, &n));
+
+  // an add dies before it patches the checksum, the scrubber leaves it be
+  unittest_hamster_store_tear_add(st_, "c", 3);
+  Verify();
+
+  // and so does a reader
+  hamster_reader* r = NULL;
+  hamster_record rec;
+  ASSERT_EQ(E_SHM_OK, hamster_reader_open("counter", 0, &r));
+  ASSERT_EQ(E_SHM_OK, hamster_reader_next(r, &rec));
+  ASSERT_STREQ("c", rec.key);
+  ASSERT_EQ(8, *(const int64_t*)rec.value);
+  ASSERT_EQ(E_SHM_EMPTY, hamster_reader_next(r, &rec));
+  hamster_reader_close(r);
+
+  // recovery computes the checksum again
+  unittest_hamster_store_sim_crash(st_);
+  ASSERT_EQ(E_SHM_OK, hamster_open("counter", NULL, &st_));
+  Verify();
+  unittest_hamster_store_sim_crash(st_);
+  g_recovery_verify_all = true;
+  ASSERT_EQ(E_SHM_OK, hamster_open("counter", NULL, &st_));
+  g_recovery_verify_all = false;
+  ASSERT_EQ(E_SHM_OK, hamster_store_add(st_, "c", 1, &n));
+  ASSERT_EQ(9, n);
+  Verify();
+}
+
+TEST_F(hamster_counter_test, cas) {
+  uint64_t v = 0, v1 = 0;
+  h_value_t* val = hamster_value_new((void*)"one", 3, 8);
+  h_value_t* val2 = hamster_value_new((void*)"two", 3, 8);
+  h_value_t* got = hamster_value_empty();
+
+  // 0 creates a key only
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, hamster_store_get_version(st_, "k", got, &v));
+  v = 0;
+  ASSERT_EQ(E_SHM_OK, hamster_store_cas(st_, "k", val, &v));
+  ASSERT_GT(v, (uint64_t)0);
+  v1 = 0;
+  ASSERT_EQ(E_SHM_VERSION_MISMATCH, hamster_store_cas(st_, "k", val2, &v1));
+  ASSERT_EQ(v, v1);
+
+  ASSERT_EQ(E_SHM_OK, hamster_store_get_version(st_, "k", got, &v1));
+  ASSERT_EQ(v, v1);
+
+  // a write in between makes a stale version fail
+  ASSERT_EQ(E_SHM_OK, set(st_, "k", "mid"));
+  ASSERT_EQ(E_SHM_VERSION_MISMATCH, hamster_store_cas(st_, "k", val2, &v1));
+  ASSERT_GT(v1, v);
+  ASSERT_EQ("mid", get(st_, "k"));
+  ASSERT_EQ(E_SHM_OK, hamster_store_cas(st_, "k", val2, &v1));
+  ASSERT_EQ("two", get(st_, "k"));
+
+  // counters take versions as well
+  ASSERT_EQ(E_SHM_OK, hamster_store_incr(st_, "c", NULL));
+  ASSERT_EQ(E_SHM_OK, hamster_store_get_version(st_, "c", got, &v));
+  ASSERT_EQ(E_SHM_OK, hamster_store_incr(st_, "c", NULL));
+  ASSERT_EQ(E_SHM_OK, hamster_store_get_version(st_, "c", got, &v1));
+  ASSERT_GT(v1, v);
+
+  // versions keep growing over a crash
+  ASSERT_EQ(E_SHM_OK, hamster_store_get_version(st_, "k", got, &v));
+  unittest_hamster_store_sim_crash(st_);
+  g_recovery_verify_all = true;
+  ASSERT_EQ(E_SHM_OK, hamster_open("counter", NULL, &st_));
+  g_recovery_verify_all = false;
+  ASSERT_EQ(E_SHM_OK, set(st_, "k2", "new"));
+  ASSERT_EQ(E_SHM_OK, hamster_store_get_version(st_, "k2", got, &v1));
+  ASSERT_GT(v1, v);
+  ASSERT_EQ(E_SHM_OK, hamster_store_add(st_, "c", 0, (int64_t*)&v));
+  ASSERT_EQ((uint64_t)2, v);
+
+  hamster_value_free(val);
+  hamster_value_free(val2);
+  hamster_value_free(got);
+}
@@ -0,0 +1,193 @@
+#include <new>
+#include <array>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "gtest/gtest.h"
+
+#include "hamster.hpp"
+
+// allocations of this thread, to see the hot path does without
+static thread_local size_t g_allocs = 0;
+
+void* operator new(size_t size) {
+  ++g_allocs;
+  if (void* p = malloc(size))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+struct point {
+  int32_t x;
+  int32_t y;
+  double  weight;
+};
+
+class hamster_cpp_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
+  }
+
+  virtual void SetUp() {
+    struct hamster_options opts = {};
+    opts.shards = 2;
+    ASSERT_EQ(E_SHM_OK, st_.open("cpp", &opts));
+  }
+
+  hamster::store st_;
+};
+
+TEST_F(hamster_cpp_test, bytes) {
+  std::string s("string");
+  std::vector<int32_t> v = { 1, 2, 3 };
+  std::array<char, 5> a = { { 'a', 'r', 'r', 'a', 'y' } };
+
+  ASSERT_EQ(E_SHM_OK, st_.set("s", s));
+  ASSERT_EQ(E_SHM_OK, st_.set(std::string_view("sv-and-more", 2), std::string_view("view")));
+  ASSERT_EQ(E_SHM_OK, st_.set("v", v));
+  ASSERT_EQ(E_SHM_OK, st_.set("a", a));
+  ASSERT_EQ(E_SHM_OK, st_.set("lit", "literal"));
+  ASSERT_EQ(E_SHM_OK, st_.set("raw", hamster::bytes("raw bytes", 3)));
+
+  hamster::view<> val;
+  ASSERT_EQ(E_SHM_OK, st_.get("s", &val));
+  ASSERT_EQ("string", val.str());
+  ASSERT_EQ(E_SHM_OK, st_.get("sv", &val));
+  ASSERT_EQ("view", val.str());
+  ASSERT_EQ(E_SHM_OK, st_.get("v", &val));
+  ASSERT_EQ(3 * sizeof(int32_t), val.size());
+  ASSERT_EQ(0, memcmp(v.data(), val.data(), val.size()));
+  ASSERT_EQ(E_SHM_OK, st_.get("a", &val));
+  ASSERT_EQ("array", val.str());
+  ASSERT_EQ(E_SHM_OK, st_.get("lit", &val));
+  ASSERT_EQ("literal", val.str());
+  ASSERT_EQ(E_SHM_OK, st_.get("raw", &val));
+  ASSERT_EQ("raw", val.str());
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, st_.get("none", &val));
+
+  // the c api would cut such a key short
+  ASSERT_EQ(E_SHM_INVALID_PARAMS, st_.set(std::string_view("a\0b", 3), s));
+}
+
+TEST_F(hamster_cpp_test, typed) {
+  point p = { 3, -4, 0.5 };
+  ASSERT_EQ(E_SHM_OK, st_.set_as("p", p));
+  static_assert(hamster::view<point>::size() == sizeof(point), "");
+
+  hamster::view<point> view;
+  ASSERT_EQ(E_SHM_OK, st_.get_as("p", &view));
+  point q = view.load();
+  ASSERT_EQ(3, q.x);
+  ASSERT_EQ(-4, q.y);
+  ASSERT_EQ(0.5, q.weight);
+
+  point c = {};
+  ASSERT_EQ(E_SHM_OK, st_.get_copy_as("p", &c));
+  ASSERT_EQ(-4, c.y);
+
+  // a record of another size is not a point
+  hamster::view<int64_t> wrong;
+  ASSERT_EQ(E_SHM_VAL_SIZE_INVALID, st_.get_as("p", &wrong));
+  int64_t n = 0;
+  ASSERT_EQ(E_SHM_VAL_SIZE_INVALID, st_.get_copy_as("p", &n));
+
+  // counters are typed values too
+  ASSERT_EQ(E_SHM_OK, st_.add("n", 5, NULL));
+  ASSERT_EQ(E_SHM_OK, st_.add("n", 2, &n));
+  ASSERT_EQ(7, n);
+  ASSERT_EQ(E_SHM_OK, st_.get_as("n", &wrong));
+  ASSERT_EQ(7, wrong.load());
+}
+
+TEST_F(hamster_cpp_test, no_allocation) {
+  point p = { 1, 2, 3.0 };
+  std::string key("a-key-of-some-length"), value(100, 'v');
+  hamster::view<> val;
+  hamster::view<point> typed;
+  int ec[4];
+
+  // the records exist, the calls below only write them over
+  ASSERT_EQ(E_SHM_OK, st_.set(key, value));
+  ASSERT_EQ(E_SHM_OK, st_.set_as("point", p));
+
+  g_allocs = 0;
+  for (int i = 0; i < 1000; ++i) {
+    ec[0] = st_.set(key, value);
+    ec[1] = st_.get(key, &val);
+    ec[2] = st_.set_as("point", p);
+    ec[3] = st_.get_as("point", &typed);
+  }
+  size_t allocs = g_allocs;
+
+  ASSERT_EQ(0u, allocs);
+  for (int i = 0; i < 4; ++i)
+    ASSERT_EQ(E_SHM_OK, ec[i]);
+}
+
+TEST_F(hamster_cpp_test, long_key) {
+  std::string key(1000, 'k');
+  ASSERT_EQ(E_SHM_OK, st_.set(key, "long"));
+  hamster::view<> val;
+  ASSERT_EQ(E_SHM_OK, st_.get(key, &val));
+  ASSERT_EQ("long", val.str());
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, st_.get(key.substr(0, 999), &val));
+}
+
+TEST_F(hamster_cpp_test, batch) {
+  hamster::batch b;
+  ASSERT_EQ(0u, b.count());
+  ASSERT_EQ(E_SHM_OK, st_.write(b));
+
+  point p = { 7, 8, 9.0 };
+  ASSERT_EQ(E_SHM_OK, b.set("x", "1"));
+  ASSERT_EQ(E_SHM_OK, b.set_as("p", p));
+  ASSERT_EQ(2u, b.count());
+  ASSERT_EQ(E_SHM_OK, st_.write(b));
+  ASSERT_EQ((size_t)2, st_.count());
+
+  hamster::view<point> view;
+  ASSERT_EQ(E_SHM_OK, st_.get_as("p", &view));
+  ASSERT_EQ(8, view.load().y);
+
+  b.clear();
+  ASSERT_EQ(0u, b.count());
+}
+
+TEST_F(hamster_cpp_test, handle) {
+  // a handle closes its store as it goes, moves hand it over
+  hamster::store other;
+  ASSERT_TRUE(NULL == other.get());
+  ASSERT_EQ(E_SHM_OK, other.open("cpp_other"));
+  ASSERT_EQ(E_SHM_OK, other.set("k", "v"));
+
+  hamster::store moved(std::move(other));
+  ASSERT_TRUE(NULL == other.get());
+  ASSERT_TRUE(NULL != moved.get());
+  ASSERT_EQ((size_t)1, moved.count());
+
+  // detached, the shm stays for the next one to open it
+  moved.detach();
+  ASSERT_TRUE(NULL == moved.get());
+  {
+    hamster::store again;
+    ASSERT_EQ(E_SHM_OK, again.open("cpp_other"));
+    ASSERT_EQ((size_t)1, again.count());
+  }
+
+  // and a closed store starts empty
+  hamster::store last;
+  ASSERT_EQ(E_SHM_OK, last.open("cpp_other"));
+  ASSERT_EQ((size_t)0, last.count());
+}
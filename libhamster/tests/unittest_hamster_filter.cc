@@ -0,0 +1,149 @@
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hamster.h"
+#include "shm_error.h"
+#include "shm_config.h"
+}
+
+#define KEYS 2000
+
+static int set(hamster_store* st, const std::string& key, const std::string& v) {
+  h_value_t* val = hamster_value_new((void*)v.data(), v.size(), v.size());
+  int ec = hamster_store_set(st, key.c_str(), val);
+  hamster_value_free(val);
+  return ec;
+}
+
+static int get(hamster_store* st, const std::string& key) {
+  h_value_t* val = hamster_value_empty();
+  int ec = hamster_store_get(st, key.c_str(), val);
+  hamster_value_free(val);
+  return ec;
+}
+
+static std::string make_key(int i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "key%05d", i);
+  return buf;
+}
+
+extern "C" void unittest_hamster_store_sim_crash(struct hamster_store* st);
+
+class hamster_filter_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
+  }
+
+  virtual void SetUp() {
+    struct hamster_options opts = {};
+    opts.shards = 2;
+    opts.filter_bits = 10;
+    ASSERT_EQ(E_SHM_OK, hamster_open("filter", &opts, &st_));
+  }
+
+  virtual void TearDown() {
+    hamster_close(st_);
+  }
+
+  hamster_store* st_;
+};
+
+TEST_F(hamster_filter_test, misses) {
+  // grows past SHM_FILTER_MIN_KEYS, which rebuilds the filter on the way
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st_, make_key(i), "v"));
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, get(st_, make_key(i)));
+  for (int i = KEYS; i < 11 * KEYS; ++i)
+    ASSERT_EQ(E_SHM_KEY_NOT_FOUND, get(st_, make_key(i)));
+
+  struct hamster_stat stat;
+  ASSERT_EQ(E_SHM_OK, hamster_store_stat(st_, &stat));
+  ASSERT_EQ((uint64_t)KEYS, stat.hits);
+  ASSERT_EQ((uint64_t)10 * KEYS, stat.misses);
+  ASSERT_EQ(stat.misses, stat.filter_skips + stat.filter_false_positives);
+  ASSERT_GT(stat.filter_skips, (uint64_t)0);
+  ASSERT_LT(stat.filter_fp_rate, 0.05);
+}
+
+TEST_F(hamster_filter_test, expired_and_reused) {
+  // dropped keys stay in the filter until a rebuild, they are plain misses
+  ASSERT_EQ(E_SHM_OK, set(st_, "a", "v"));
+  h_value_t* val = hamster_value_new((void*)"v", 1, 1);
+  ASSERT_EQ(E_SHM_OK, hamster_store_set_ttl(st_, "b", val, 1));
+  usleep(20000);
+  hamster_store_expire(st_);
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, get(st_, "b"));
+
+  // the expired record is reused for a new key, which must be found
+  ASSERT_EQ(E_SHM_OK, hamster_store_set(st_, "c", val));
+  ASSERT_EQ(E_SHM_OK, get(st_, "c"));
+  ASSERT_EQ(E_SHM_OK, get(st_, "a"));
+  hamster_value_free(val);
+}
+
+TEST_F(hamster_filter_test, switch_and_recover) {
+  for (int i = 0; i < 100; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st_, make_key(i), "v"));
+
+  // off, lookups go to the index only
+  ASSERT_EQ(E_SHM_OK, hamster_store_set_filter(st_, 0));
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, get(st_, make_key(100)));
+  struct hamster_stat stat;
+  ASSERT_EQ(E_SHM_OK, hamster_store_stat(st_, &stat));
+  ASSERT_EQ((uint64_t)0, stat.filter_skips + stat.filter_false_positives);
+
+  // on again, built from the index
+  ASSERT_EQ(E_SHM_OK, hamster_store_set_filter(st_, 8));
+  for (int i = 0; i < 100; ++i)
+    ASSERT_EQ(E_SHM_OK, get(st_, make_key(i)));
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, get(st_, make_key(100)));
+  ASSERT_EQ(E_SHM_OK, hamster_store_stat(st_, &stat));
+  ASSERT_EQ((uint64_t)1, stat.filter_skips + stat.filter_false_positives);
+
+  // recovery builds it from the recovered index
+  unittest_hamster_store_sim_crash(st_);
+  struct hamster_options opts = {};
+  opts.shards = 2;
+  opts.filter_bits = 10;
+  ASSERT_EQ(E_SHM_OK, hamster_open("filter", &opts, &st_));
+  for (int i = 0; i < 100; ++i)
+    ASSERT_EQ(E_SHM_OK, get(st_, make_key(i)));
+}
+
+extern "C" void unittest_hamster_store_filter_bits(struct hamster_store* st, uint32_t bits);
+TEST_F(hamster_filter_test, rebuild_fails) {
+  // the filter can not be rebuilt once full, a filter of as many bits per key
+  // does not fit, the writes still succeed, and their keys are found and
+  // expire
+  const int n = 3 * SHM_FILTER_MIN_KEYS;
+  unittest_hamster_store_filter_bits(st_, UINT32_MAX);
+  h_value_t* val = hamster_value_new((void*)"v", 1, 1);
+  for (int i = 0; i < n; ++i)
+    ASSERT_EQ(E_SHM_OK, hamster_store_set_ttl(st_, make_key(i).c_str(), val, 
+                                              i < n / 2 ? 0 : 1));
+  hamster_value_free(val);
+  for (int i = 0; i < n / 2; ++i)
+    ASSERT_EQ(E_SHM_OK, get(st_, make_key(i)));
+
+  usleep(20000);
+  ASSERT_EQ((size_t)n / 2, hamster_store_expire(st_));
+  ASSERT_EQ((size_t)n / 2, hamster_store_count(st_));
+
+  // nor does it fail recovery, the shards go without a filter then
+  unittest_hamster_store_sim_crash(st_);
+  struct hamster_options opts = {};
+  opts.shards = 2;
+  opts.filter_bits = UINT32_MAX;
+  ASSERT_EQ(E_SHM_OK, hamster_open("filter", &opts, &st_));
+  for (int i = 0; i < n / 2; ++i)
+    ASSERT_EQ(E_SHM_OK, get(st_, make_key(i)));
+}
@@ -0,0 +1,153 @@
+#include <string>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hamster.h"
+#include "shm_error.h"
+#include "shm_config.h"
+}
+
+static int set(hamster_store* st, const std::string& key, const std::string& v) {
+  h_value_t* val = hamster_value_new((void*)v.data(), v.size(), v.size());
+  int ec = hamster_store_set(st, key.c_str(), val);
+  hamster_value_free(val);
+  return ec;
+}
+
+static uint64_t now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+class hamster_notify_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
+  }
+
+  virtual void SetUp() {
+    ASSERT_EQ(E_SHM_OK, hamster_open("notify", NULL, &st_));
+    ASSERT_EQ(E_SHM_OK, hamster_watch_open("notify", 0, &w_));
+  }
+
+  virtual void TearDown() {
+    hamster_watch_close(w_);
+    hamster_close(st_);
+  }
+
+  hamster_store* st_;
+  hamster_watch* w_;
+};
+
+TEST_F(hamster_notify_test, changes) {
+  hamster_change c;
+  std::string long_key(60, 'k');
+
+  ASSERT_EQ((uint64_t)0, hamster_watch_seq(w_));
+  ASSERT_EQ(E_SHM_EMPTY, hamster_watch_next(w_, 0, &c));
+
+  ASSERT_EQ(E_SHM_OK, set(st_, "k1", "v1"));
+  ASSERT_EQ(E_SHM_OK, set(st_, "k2", "v2"));
+  ASSERT_EQ(E_SHM_OK, set(st_, "k1", "v3"));
+  ASSERT_EQ(E_SHM_OK, set(st_, long_key, "v4"));
+  ASSERT_EQ((uint64_t)4, hamster_watch_seq(w_));
+
+  ASSERT_EQ(E_SHM_OK, hamster_watch_next(w_, 0, &c));
+  ASSERT_EQ((uint64_t)1, c.seq);
+  ASSERT_STREQ("k1", c.key);
+  ASSERT_EQ(E_SHM_OK, hamster_watch_next(w_, 1, &c));
+  ASSERT_STREQ("k2", c.key);
+  ASSERT_EQ(E_SHM_OK, hamster_watch_next(w_, 2, &c));
+  ASSERT_STREQ("k1", c.key);
+
+  // a long key is truncated, its size and hash still tell it
+  ASSERT_EQ(E_SHM_OK, hamster_watch_next(w_, 3, &c));
+  ASSERT_EQ((uint64_t)4, c.seq);
+  ASSERT_EQ((uint32_t)long_key.size(), c.key_size);
+  ASSERT_EQ(long_key.substr(0, sizeof(c.key) - 1), c.key);
+  ASSERT_EQ(E_SHM_EMPTY, hamster_watch_next(w_, 4, &c));
+
+  // a failed set is no change
+  h_value_t* val = hamster_value_new((void*)"01234567890123456789", 20, 20);
+  ASSERT_EQ(E_SHM_VAL_UPDATE_EXCEED_MAX_SIZE, hamster_store_set(st_, "k2", val));
+  hamster_value_free(val);
+  ASSERT_EQ((uint64_t)4, hamster_watch_seq(w_));
+}
+
+TEST_F(hamster_notify_test, lost) {
+  hamster_change c;
+  char key[32];
+
+  for (int i = 0; i < SHM_NOTIFY_RING + 10; ++i) {
+    snprintf(key, sizeof(key), "key%d", i % 100);
+    ASSERT_EQ(E_SHM_OK, set(st_, key, "v"));
+  }
+
+  uint64_t seq = hamster_watch_seq(w_);
+  ASSERT_EQ((uint64_t)SHM_NOTIFY_RING + 10, seq);
+  ASSERT_EQ(E_SHM_CHANGES_LOST, hamster_watch_next(w_, 0, &c));
+  ASSERT_EQ(E_SHM_CHANGES_LOST, hamster_watch_next(w_, 9, &c));
+  ASSERT_EQ(E_SHM_OK, hamster_watch_next(w_, 10, &c));
+  ASSERT_EQ(E_SHM_OK, hamster_watch_next(w_, seq - 1, &c));
+  ASSERT_EQ(seq, c.seq);
+}
+
+TEST_F(hamster_notify_test, wait_timeout) {
+  uint64_t start = now_ms();
+  ASSERT_EQ(E_SHM_TIMEOUT, hamster_watch_wait(w_, 0, 50));
+  ASSERT_GE(now_ms() - start, (uint64_t)50);
+
+  ASSERT_EQ(E_SHM_OK, set(st_, "k", "v"));
+  ASSERT_EQ(E_SHM_OK, hamster_watch_wait(w_, 0, 0));
+  ASSERT_EQ(E_SHM_TIMEOUT, hamster_watch_wait(w_, 1, 0));
+}
+
+TEST_F(hamster_notify_test, wait_other_process) {
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+
+  if (pid == 0) {
+    // the watcher of another process only attaches the ring
+    hamster_watch* w = NULL;
+    hamster_change c;
+    if (E_SHM_OK != hamster_watch_open("notify", 0, &w) ||
+        E_SHM_OK != hamster_watch_wait(w, 0, 5000) ||
+        E_SHM_OK != hamster_watch_next(w, 0, &c))
+      _exit(1);
+    _exit(std::string("ping") == c.key ? 0 : 2);
+  }
+
+  usleep(50000);
+  ASSERT_EQ(E_SHM_OK, set(st_, "ping", "v"));
+
+  int status = 0;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(0, WEXITSTATUS(status));
+}
+
+TEST_F(hamster_notify_test, watch_before_open) {
+  hamster_watch* w = NULL;
+  hamster_store* st = NULL;
+  hamster_change c;
+
+  // the ring is created by the store, a watcher does not leave one behind
+  ASSERT_EQ(E_SHM_EMPTY, hamster_watch_open("notify2", 0, &w));
+  ASSERT_TRUE(NULL == w);
+  ASSERT_EQ(E_SHM_OK, hamster_open("notify2", NULL, &st));
+  ASSERT_EQ(E_SHM_OK, hamster_watch_open("notify2", 0, &w));
+  ASSERT_EQ(E_SHM_OK, set(st, "k", "v"));
+  ASSERT_EQ(E_SHM_OK, hamster_watch_next(w, 0, &c));
+  ASSERT_STREQ("k", c.key);
+
+  hamster_close(st);
+  hamster_watch_close(w);
+}
@@ -0,0 +1,204 @@
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hamster.h"
+#include "shm_error.h"
+#include "shm_config.h"
+}
+
+#define KEYS 1000
+
+static int set(hamster_store* st, const std::string& key, const std::string& v,
+               uint32_t ttl_ms = 0) {
+  h_value_t* val = hamster_value_new((void*)v.data(), v.size(), v.size());
+  int ec = hamster_store_set_ttl(st, key.c_str(), val, ttl_ms);
+  hamster_value_free(val);
+  return ec;
+}
+
+static std::string get(hamster_store* st, const std::string& key) {
+  h_value_t* val = hamster_value_empty();
+  std::string v;
+  if (E_SHM_OK == hamster_store_get(st, key.c_str(), val))
+    v.assign((char*)hamster_value_ptr(val), hamster_value_size(val));
+  hamster_value_free(val);
+  return v;
+}
+
+static std::string make_key(int i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "key%05d", i);
+  return buf;
+}
+
+static std::string make_value(int i, size_t size = 0) {
+  return std::string(size > 0 ? size : 20 + i % 50, 'a' + i % 26);
+}
+
+class hamster_reader_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
+  }
+
+  virtual void SetUp() {
+    struct hamster_options opts = {};
+    opts.shards = 4;
+    copy_ = NULL;
+    ASSERT_EQ(E_SHM_OK, hamster_open("reader", &opts, &st_));
+    ASSERT_TRUE(NULL != (f_ = tmpfile()));
+  }
+
+  virtual void TearDown() {
+    fclose(f_);
+    hamster_close(copy_);
+    hamster_close(st_);
+  }
+
+  int open_copy(uint32_t shards = 0) {
+    struct hamster_options opts = {};
+    opts.shards = shards;
+    hamster_close(copy_);
+    copy_ = NULL;
+    return hamster_open("reader_copy", &opts, &copy_);
+  }
+
+  hamster_store* st_;
+  hamster_store* copy_;
+  FILE* f_;
+};
+
+TEST_F(hamster_reader_test, next) {
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st_, make_key(i), make_value(i)));
+
+  hamster_reader* r = NULL;
+  ASSERT_EQ(E_SHM_OK, hamster_reader_open("reader", 0, &r));
+  ASSERT_EQ(4u, hamster_reader_shards(r));
+
+  // every key once, as the owner has it
+  hamster_record rec;
+  std::string seen(KEYS, 0);
+  int n = 0;
+  while (E_SHM_OK == hamster_reader_next(r, &rec)) {
+    int i = atoi(rec.key + 3);
+    ASSERT_EQ(make_value(i), std::string((const char*)rec.value, rec.size));
+    ASSERT_EQ(0, seen[i]++);
+    ASSERT_LT(rec.shard, 4u);
+    ++n;
+  }
+  ASSERT_EQ(KEYS, n);
+  ASSERT_EQ(E_SHM_EMPTY, hamster_reader_next(r, &rec));
+  hamster_reader_close(r);
+
+  ASSERT_EQ(E_SHM_EMPTY, hamster_reader_open("no_such_store", 0, &r));
+  ASSERT_EQ(E_SHM_INVALID_PARAMS, hamster_reader_open(NULL, 0, &r));
+}
+
+TEST_F(hamster_reader_test, dump_load) {
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st_, make_key(i), make_value(i), i % 2 ? 0 : 60000));
+  hamster_store_set_compression(st_, 64);
+  ASSERT_EQ(E_SHM_OK, set(st_, "compressed", std::string(4096, 'z')));
+  ASSERT_EQ(E_SHM_OK, set(st_, "expired", "v", 1));
+  usleep(20000);
+
+  hamster_reader* r = NULL;
+  ASSERT_EQ(E_SHM_OK, hamster_reader_open("reader", 0, &r));
+  ASSERT_EQ(E_SHM_OK, hamster_reader_dump(r, fileno(f_)));
+  hamster_reader_close(r);
+
+  // into a store of another shard count, the deadlines carry over
+  ASSERT_EQ(E_SHM_OK, open_copy(3));
+  rewind(f_);
+  ASSERT_EQ(E_SHM_OK, hamster_store_load(copy_, fileno(f_)));
+  ASSERT_EQ((size_t)KEYS + 1, hamster_store_count(copy_));
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(make_value(i), get(copy_, make_key(i)));
+  char buf[4096];
+  uint32_t size = sizeof(buf);
+  ASSERT_EQ(E_SHM_OK, hamster_store_get_copy(copy_, "compressed", buf, &size));
+  ASSERT_EQ(std::string(4096, 'z'), std::string(buf, size));
+  ASSERT_EQ("", get(copy_, "expired"));
+
+  // a dump cut short is not loaded past the cut
+  ASSERT_EQ(0, ftruncate(fileno(f_), 100));
+  ASSERT_EQ(E_SHM_OK, open_copy());
+  rewind(f_);
+  ASSERT_EQ(E_SHM_DATA_CORRUPTED, hamster_store_load(copy_, fileno(f_)));
+}
+
+TEST_F(hamster_reader_test, load_batches) {
+  // several times SHM_LOAD_BATCH, in bounded batches
+  int keys = 3 * SHM_LOAD_BATCH / 1000;
+  for (int i = 0; i < keys; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st_, make_key(i), make_value(i, 1000)));
+
+  hamster_reader* r = NULL;
+  ASSERT_EQ(E_SHM_OK, hamster_reader_open("reader", 0, &r));
+  ASSERT_EQ(E_SHM_OK, hamster_reader_dump(r, fileno(f_)));
+  hamster_reader_close(r);
+
+  ASSERT_EQ(E_SHM_OK, open_copy());
+  rewind(f_);
+  ASSERT_EQ(E_SHM_OK, hamster_store_load(copy_, fileno(f_)));
+  ASSERT_EQ((size_t)keys, hamster_store_count(copy_));
+  ASSERT_EQ(make_value(keys - 1, 1000), get(copy_, make_key(keys - 1)));
+}
+
+TEST_F(hamster_reader_test, occupancy) {
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st_, make_key(i), make_value(i), i < 100 ? 1 : 0));
+  usleep(20000);
+  ASSERT_EQ((size_t)100, hamster_store_expire(st_));
+
+  hamster_reader* r = NULL;
+  ASSERT_EQ(E_SHM_OK, hamster_reader_open("reader", 0, &r));
+
+  struct hamster_occupancy o;
+  uint64_t live = 0, free = 0;
+  for (uint32_t shard = 0; shard < hamster_reader_shards(r); ++shard) {
+    ASSERT_EQ(E_SHM_OK, hamster_reader_occupancy(r, shard, &o));
+    ASSERT_LE(1u, o.segments);
+    ASSERT_LE(o.used, o.bytes);
+    ASSERT_LE(o.live_bytes + o.free_bytes, o.used);
+    ASSERT_LE(o.value_bytes, o.live_bytes);
+    ASSERT_EQ(o.records, o.live + o.free + o.bad);
+    ASSERT_EQ(0u, o.bad);
+    live += o.live;
+    free += o.free;
+  }
+  ASSERT_EQ((uint64_t)KEYS - 100, live);
+  ASSERT_EQ(100u, free);
+  ASSERT_EQ(E_SHM_INVALID_PARAMS, hamster_reader_occupancy(r, 4, &o));
+
+  // the first segment of a shard is on its first key
+  struct hamster_segment seg;
+  ASSERT_EQ(E_SHM_OK, hamster_reader_segment(r, 0, 0, &seg));
+  ASSERT_LE(seg.committed, seg.used);
+  ASSERT_LE((size_t)seg.used, seg.size);
+  uint32_t n = 0;
+  while (E_SHM_OK == hamster_reader_segment(r, 0, n, &seg))
+    ++n;
+  ASSERT_EQ(E_SHM_EMPTY, hamster_reader_segment(r, 0, n, &seg));
+  hamster_reader_close(r);
+}
+
+TEST_F(hamster_reader_test, detach) {
+  ASSERT_EQ(E_SHM_OK, open_copy());
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(copy_, make_key(i), make_value(i)));
+  hamster_detach(copy_);
+  copy_ = NULL;
+
+  // the records stay for the next one to open the store
+  ASSERT_EQ(E_SHM_OK, open_copy());
+  ASSERT_EQ((size_t)KEYS, hamster_store_count(copy_));
+  ASSERT_EQ(make_value(7), get(copy_, make_key(7)));
+}
@@ -0,0 +1,280 @@
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hamster.h"
+#include "shm_error.h"
+#include "shm_config.h"
+}
+
+#define KEYS 200
+#define SNAPSHOT "/tmp/unittest_hamster_replog.snap"
+
+static int set(hamster_store* st, const std::string& key, const std::string& v,
+               uint32_t ttl_ms = 0) {
+  h_value_t* val = hamster_value_new((void*)v.data(), v.size(), v.size());
+  int ec = hamster_store_set_ttl(st, key.c_str(), val, ttl_ms);
+  hamster_value_free(val);
+  return ec;
+}
+
+static std::string get(hamster_store* st, const std::string& key) {
+  char buf[4096];
+  uint32_t size = sizeof(buf);
+  if (E_SHM_OK != hamster_store_get_copy(st, key.c_str(), buf, &size))
+    return "";
+  return std::string(buf, size);
+}
+
+static std::string make_key(int i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "key%04d", i);
+  return buf;
+}
+
+static std::string make_value(int i, int gen) {
+  return std::string(20 + i % 300, 'a' + (i + gen) % 26);
+}
+
+class hamster_replog_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
+  }
+
+  virtual void SetUp() {
+    ASSERT_EQ(E_SHM_OK, open_leader(1 << 20));
+    ASSERT_EQ(E_SHM_OK, hamster_open("follower", NULL, &follower_));
+    ASSERT_EQ(E_SHM_OK, hamster_follow("leader", 0, follower_, &f_));
+  }
+
+  virtual void TearDown() {
+    hamster_follower_close(f_);
+    hamster_close(follower_);
+    hamster_close(leader_);
+    unlink(SNAPSHOT);
+  }
+
+  int open_leader(size_t replog_size) {
+    struct hamster_options opts = {};
+    opts.shards = 4;
+    opts.compress_min = 128;
+    opts.replog_size = replog_size;
+    return hamster_open("leader", &opts, &leader_);
+  }
+
+  void expect_same() {
+    ASSERT_EQ(hamster_store_count(leader_), hamster_store_count(follower_));
+    for (int i = 0; i < KEYS; ++i)
+      ASSERT_EQ(get(leader_, make_key(i)), get(follower_, make_key(i)));
+  }
+
+  hamster_store* leader_;
+  hamster_store* follower_;
+  hamster_follower* f_;
+};
+
+TEST_F(hamster_replog_test, follow) {
+  uint32_t applied = 0;
+  hamster_lag lag;
+
+  ASSERT_EQ(E_SHM_OK, hamster_follower_poll(f_, 0, &applied));
+  ASSERT_EQ((uint32_t)0, applied);
+
+  // sets, compressed or not, and updates of them
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(leader_, make_key(i), make_value(i, 0)));
+  for (int i = 0; i < KEYS; i += 3)
+    ASSERT_EQ(E_SHM_OK, set(leader_, make_key(i), make_value(i, 1)));
+
+  ASSERT_EQ(E_SHM_OK, hamster_follower_lag(f_, &lag));
+  ASSERT_EQ((uint64_t)(KEYS + (KEYS + 2) / 3), lag.records);
+  ASSERT_GT(lag.bytes, (uint64_t)0);
+
+  // a poll might stop short
+  ASSERT_EQ(E_SHM_OK, hamster_follower_poll(f_, 10, &applied));
+  ASSERT_EQ((uint32_t)10, applied);
+  ASSERT_EQ(E_SHM_OK, hamster_follower_poll(f_, 0, &applied));
+  ASSERT_EQ(lag.records - 10, (uint64_t)applied);
+  ASSERT_EQ(E_SHM_OK, hamster_follower_lag(f_, &lag));
+  ASSERT_EQ((uint64_t)0, lag.records);
+  ASSERT_EQ((uint64_t)0, lag.bytes);
+  expect_same();
+
+  // counters are logged by their sums, cas and batches as well
+  int64_t n = 0;
+  for (int i = 0; i < 10; ++i)
+    ASSERT_EQ(E_SHM_OK, hamster_store_add(leader_, "counter", 5, &n));
+
+  uint64_t version = 0;
+  h_value_t* val = hamster_value_new((void*)"cas", 3, 3);
+  ASSERT_EQ(E_SHM_OK, hamster_store_cas(leader_, "cas", val, &version));
+  hamster_value_free(val);
+
+  hamster_batch* b = NULL;
+  ASSERT_EQ(E_SHM_OK, hamster_batch_new(&b));
+  for (int i = 0; i < KEYS; i += 2) {
+    std::string v = make_value(i, 2);
+    val = hamster_value_new((void*)v.data(), v.size(), v.size());
+    ASSERT_EQ(E_SHM_OK, hamster_batch_set(b, make_key(i).c_str(), val));
+    hamster_value_free(val);
+  }
+  ASSERT_EQ(E_SHM_OK, hamster_store_write(leader_, b));
+  hamster_batch_free(b);
+
+  struct hamster_stat stat;
+  ASSERT_EQ(E_SHM_OK, hamster_store_stat(leader_, &stat));
+  ASSERT_EQ((uint64_t)12, stat.replog_lag_records);
+
+  ASSERT_EQ(E_SHM_OK, hamster_follower_poll(f_, 0, &applied));
+  ASSERT_EQ((uint32_t)12, applied);
+  ASSERT_EQ(E_SHM_OK, hamster_store_stat(leader_, &stat));
+  ASSERT_EQ((uint64_t)0, stat.replog_lag_records);
+  ASSERT_EQ((uint64_t)0, stat.replog_lag_bytes);
+  expect_same();
+  ASSERT_EQ(E_SHM_OK, hamster_store_add(follower_, "counter", 0, &n));
+  ASSERT_EQ(50, n);
+  ASSERT_EQ("cas", get(follower_, "cas"));
+
+  // taking over is closing the follower
+  hamster_follower_close(f_);
+  f_ = NULL;
+  ASSERT_EQ(E_SHM_OK, set(follower_, make_key(0), "promoted"));
+  ASSERT_EQ("promoted", get(follower_, make_key(0)));
+}
+
+TEST_F(hamster_replog_test, ttl) {
+  uint32_t applied = 0;
+
+  // deadlines are logged, not ttls
+  ASSERT_EQ(E_SHM_OK, set(leader_, "short", "v", 20));
+  ASSERT_EQ(E_SHM_OK, set(leader_, "long", "v"));
+  usleep(30000);
+  ASSERT_EQ(E_SHM_OK, hamster_follower_poll(f_, 0, &applied));
+  ASSERT_EQ((uint32_t)2, applied);
+  ASSERT_EQ("", get(follower_, "short"));
+  ASSERT_EQ("v", get(follower_, "long"));
+}
+
+TEST_F(hamster_replog_test, wait) {
+  ASSERT_EQ(E_SHM_TIMEOUT, hamster_follower_wait(f_, 10));
+  ASSERT_EQ(E_SHM_OK, set(leader_, "k", "v"));
+  ASSERT_EQ(E_SHM_OK, hamster_follower_wait(f_, 10));
+  ASSERT_EQ(E_SHM_OK, hamster_follower_poll(f_, 0, NULL));
+  ASSERT_EQ(E_SHM_TIMEOUT, hamster_follower_wait(f_, 10));
+}
+
+TEST_F(hamster_replog_test, no_log) {
+  hamster_follower* f = NULL;
+  ASSERT_EQ(E_SHM_EMPTY, hamster_follow("follower", 0, leader_, &f));
+  ASSERT_EQ(E_SHM_INVALID_PARAMS, hamster_follow(NULL, 0, leader_, &f));
+  ASSERT_EQ(E_SHM_INVALID_PARAMS, hamster_follow("leader", 0, NULL, &f));
+}
+
+TEST_F(hamster_replog_test, restore) {
+  uint32_t applied = 0;
+
+  // the ring holds a few records only
+  hamster_follower_close(f_);
+  hamster_close(leader_);
+  ASSERT_EQ(E_SHM_OK, open_leader(4096));
+  ASSERT_EQ(E_SHM_OK, hamster_follow("leader", 0, follower_, &f_));
+
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(leader_, make_key(i), make_value(i, 0)));
+  ASSERT_EQ(E_SHM_CHANGES_LOST, hamster_follower_poll(f_, 0, &applied));
+  ASSERT_EQ((uint32_t)0, applied);
+
+  // the writes after the snapshot come from the log
+  ASSERT_EQ(E_SHM_OK, hamster_store_snapshot(leader_, SNAPSHOT));
+  for (int i = 0; i < 5; ++i)
+    ASSERT_EQ(E_SHM_OK, set(leader_, make_key(i), make_value(i, 1)));
+  ASSERT_EQ(E_SHM_OK, hamster_follower_restore(f_, SNAPSHOT));
+
+  hamster_lag lag;
+  ASSERT_EQ(E_SHM_OK, hamster_follower_lag(f_, &lag));
+  ASSERT_EQ((uint64_t)5, lag.records);
+  ASSERT_EQ(E_SHM_OK, hamster_follower_poll(f_, 0, &applied));
+  ASSERT_EQ((uint32_t)5, applied);
+  expect_same();
+
+  // a record too big for the ring is never shipped
+  std::string big(8192, 0);
+  for (size_t i = 0; i < big.size(); ++i)
+    big[i] = (char)rand();
+  ASSERT_EQ(E_SHM_OK, set(leader_, "big", big));
+  ASSERT_EQ(E_SHM_CHANGES_LOST, hamster_follower_poll(f_, 0, &applied));
+}
+
+TEST_F(hamster_replog_test, bad_snapshot) {
+  ASSERT_EQ(E_SHM_SYSTEM, hamster_follower_restore(f_, SNAPSHOT));
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(leader_, make_key(i), make_value(i, 0)));
+  ASSERT_EQ(E_SHM_OK, hamster_store_snapshot(leader_, SNAPSHOT));
+
+  // cut short
+  FILE* fp = fopen(SNAPSHOT, "r+");
+  ASSERT_TRUE(fp != NULL);
+  fseek(fp, 0, SEEK_END);
+  ASSERT_EQ(0, ftruncate(fileno(fp), ftell(fp) - 1));
+  fclose(fp);
+  ASSERT_EQ(E_SHM_DATA_CORRUPTED, hamster_follower_restore(f_, SNAPSHOT));
+
+  // a flipped byte
+  ASSERT_EQ(E_SHM_OK, hamster_store_snapshot(leader_, SNAPSHOT));
+  fp = fopen(SNAPSHOT, "r+");
+  fseek(fp, 100, SEEK_SET);
+  int c = fgetc(fp);
+  fseek(fp, 100, SEEK_SET);
+  fputc(c ^ 0x1, fp);
+  fclose(fp);
+  ASSERT_EQ(E_SHM_DATA_CORRUPTED, hamster_follower_restore(f_, SNAPSHOT));
+}
+
+TEST_F(hamster_replog_test, process) {
+  // a follower in a process of its own, until it sees key "done"
+  hamster_follower_close(f_);
+  f_ = NULL;
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if (pid == 0) {
+    hamster_store* standby = NULL;
+    hamster_follower* f = NULL;
+    if (E_SHM_OK != hamster_open("standby", NULL, &standby) ||
+        E_SHM_OK != hamster_follow("leader", 0, standby, &f))
+      _exit(1);
+    while (get(standby, "done").empty()) {
+      hamster_follower_wait(f, 100);
+      if (E_SHM_OK != hamster_follower_poll(f, 0, NULL))
+        _exit(2);
+    }
+    for (int i = 0; i < KEYS; ++i) {
+      if (get(standby, make_key(i)) != make_value(i, 1))
+        _exit(3);
+    }
+    hamster_follower_close(f);
+    hamster_close(standby);
+    _exit(0);
+  }
+
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(leader_, make_key(i), make_value(i, 0)));
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(leader_, make_key(i), make_value(i, 1)));
+  ASSERT_EQ(E_SHM_OK, set(leader_, "done", "1"));
+
+  int status = 0;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(0, WEXITSTATUS(status));
+
+  struct hamster_stat stat;
+  ASSERT_EQ(E_SHM_OK, hamster_store_stat(leader_, &stat));
+  ASSERT_EQ((uint64_t)0, stat.replog_lag_records);
+}
@@ -0,0 +1,197 @@
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hamster.h"
+#include "shm_error.h"
+#include "shm_config.h"
+}
+
+#define KEYS 64
+
+static int set(hamster_store* st, const std::string& key, const std::string& v) {
+  h_value_t* val = hamster_value_new((void*)v.data(), v.size(), v.size());
+  int ec = hamster_store_set(st, key.c_str(), val);
+  hamster_value_free(val);
+  return ec;
+}
+
+static std::string get(hamster_store* st, const std::string& key) {
+  h_value_t* val = hamster_value_empty();
+  std::string v;
+  if (E_SHM_OK == hamster_store_get(st, key.c_str(), val))
+    v.assign((char*)hamster_value_ptr(val), hamster_value_size(val));
+  hamster_value_free(val);
+  return v;
+}
+
+static std::string make_key(int i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "key%04d", i);
+  return buf;
+}
+
+static std::string make_value(int i) {
+  return std::string(100 + i, 'a' + i % 26);
+}
+
+/* flip a byte of the value in shm, behind the back of the store */
+static void corrupt(hamster_store* st, const std::string& key) {
+  h_value_t* val = hamster_value_empty();
+  ASSERT_EQ(E_SHM_OK, hamster_store_get(st, key.c_str(), val));
+  ((char*)hamster_value_ptr(val))[1] ^= 0xff;
+  hamster_value_free(val);
+}
+
+struct corrupted {
+  std::vector<std::string> keys;
+};
+
+static void on_corrupt(hamster_store* st, const char* key, void* ctx) {
+  ((corrupted*)ctx)->keys.push_back(key != NULL ? key : "");
+}
+
+extern "C" void unittest_hamster_store_sim_crash(struct hamster_store* st);
+extern "C" int g_recovery_verify_all;
+
+class hamster_scrub_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
+  }
+
+  virtual void SetUp() {
+    ASSERT_EQ(E_SHM_OK, hamster_open("scrub", NULL, &st_));
+    for (int i = 0; i < KEYS; ++i)
+      ASSERT_EQ(E_SHM_OK, set(st_, make_key(i), make_value(i)));
+  }
+
+  virtual void TearDown() {
+    hamster_close(st_);
+  }
+
+  hamster_store* st_;
+};
+
+TEST_F(hamster_scrub_test, clean) {
+  corrupted c;
+
+  // a step ends at the last record, a big one is a full pass
+  size_t total = hamster_store_scrub(st_, 1024 * 1024, on_corrupt, &c);
+  ASSERT_TRUE(c.keys.empty());
+  ASSERT_EQ(total, hamster_store_scrub(st_, 1024 * 1024, on_corrupt, &c));
+  total *= 2;
+
+  struct hamster_stat stat;
+  ASSERT_EQ(E_SHM_OK, hamster_store_stat(st_, &stat));
+  ASSERT_EQ((uint64_t)0, stat.quarantined);
+  ASSERT_EQ(stat.scrubbed, (uint64_t)total);
+  ASSERT_GT(total, (size_t)KEYS * 100);
+}
+
+TEST_F(hamster_scrub_test, quarantine) {
+  corrupted c;
+
+  corrupt(st_, make_key(3));
+  corrupt(st_, make_key(40));
+  for (int i = 0; i < 100 && c.keys.size() < 2; ++i)
+    hamster_store_scrub(st_, 4096, on_corrupt, &c);
+
+  ASSERT_EQ((size_t)2, c.keys.size());
+  ASSERT_EQ(make_key(3), c.keys[0]);
+  ASSERT_EQ(make_key(40), c.keys[1]);
+
+  // only the bad records are lost
+  ASSERT_EQ("", get(st_, make_key(3)));
+  ASSERT_EQ("", get(st_, make_key(40)));
+  ASSERT_EQ((size_t)KEYS - 2, hamster_store_count(st_));
+  for (int i = 0; i < KEYS; ++i) {
+    if (i != 3 && i != 40) {
+      ASSERT_EQ(make_value(i), get(st_, make_key(i)));
+    }
+  }
+
+  struct hamster_stat stat;
+  ASSERT_EQ(E_SHM_OK, hamster_store_stat(st_, &stat));
+  ASSERT_EQ((uint64_t)2, stat.quarantined);
+
+  // the key can be set again, in a new record
+  ASSERT_EQ(E_SHM_OK, set(st_, make_key(3), "again"));
+  ASSERT_EQ("again", get(st_, make_key(3)));
+
+  // recovery skips the quarantined records, and does not report them again
+  unittest_hamster_store_sim_crash(st_);
+  ASSERT_EQ(E_SHM_OK, hamster_open("scrub", NULL, &st_));
+  ASSERT_EQ((size_t)KEYS - 1, hamster_store_count(st_));
+  ASSERT_EQ("again", get(st_, make_key(3)));
+  ASSERT_EQ("", get(st_, make_key(40)));
+  ASSERT_EQ(make_value(41), get(st_, make_key(41)));
+}
+
+TEST_F(hamster_scrub_test, recovery_quarantine) {
+  // recovery quarantines a bad record instead of cutting the chain there
+  corrupt(st_, make_key(10));
+  unittest_hamster_store_sim_crash(st_);
+
+  // committed records are only checksumed on demand
+  g_recovery_verify_all = true;
+  int ec = hamster_open("scrub", NULL, &st_);
+  g_recovery_verify_all = false;
+  ASSERT_EQ(E_SHM_DATA_CORRUPTED, ec);
+  ASSERT_EQ((size_t)KEYS - 1, hamster_store_count(st_));
+  ASSERT_EQ("", get(st_, make_key(10)));
+  for (int i = 11; i < KEYS; ++i)
+    ASSERT_EQ(make_value(i), get(st_, make_key(i)));
+}
+
+TEST_F(hamster_scrub_test, thread) {
+  corrupted c;
+
+  ASSERT_EQ(E_SHM_OK, hamster_store_scrub_start(st_, 1024 * 1024, on_corrupt, &c));
+  ASSERT_EQ(E_SHM_INIT_ONLY_ONCE, hamster_store_scrub_start(st_, 1024, NULL, NULL));
+
+  struct hamster_stat stat;
+  for (int i = 0; i < 200; ++i) {
+    ASSERT_EQ(E_SHM_OK, hamster_store_stat(st_, &stat));
+    if (stat.scrubbed > 0)
+      break;
+    usleep(10000);
+  }
+  ASSERT_GT(stat.scrubbed, (uint64_t)0);
+
+  // the callback runs on the scrubber thread, stop it before looking
+  corrupt(st_, make_key(7));
+  for (int i = 0; i < 200; ++i) {
+    ASSERT_EQ(E_SHM_OK, hamster_store_stat(st_, &stat));
+    if (stat.quarantined > 0)
+      break;
+    usleep(10000);
+  }
+  hamster_store_scrub_stop(st_);
+  ASSERT_EQ((size_t)1, c.keys.size());
+  ASSERT_EQ(make_key(7), c.keys[0]);
+  ASSERT_EQ("", get(st_, make_key(7)));
+
+  // stopped, it can start again
+  ASSERT_EQ(E_SHM_OK, hamster_store_scrub_start(st_, 1024, NULL, NULL));
+}
+
+TEST_F(hamster_scrub_test, rate_limit) {
+  uint64_t rate = 16 * 1024;
+  struct hamster_stat stat;
+
+  ASSERT_EQ(E_SHM_OK, hamster_store_scrub_start(st_, rate, NULL, NULL));
+  usleep(500000);
+  hamster_store_scrub_stop(st_);
+
+  // half a second at the rate, plus the first step and the record ending it
+  ASSERT_EQ(E_SHM_OK, hamster_store_stat(st_, &stat));
+  ASSERT_GT(stat.scrubbed, (uint64_t)0);
+  ASSERT_LE(stat.scrubbed, rate / 2 + rate / 10 + 1024);
+}
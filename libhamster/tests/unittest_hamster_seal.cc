@@ -0,0 +1,169 @@
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hamster.h"
+#include "shm_error.h"
+#include "shm_config.h"
+}
+
+#define KEYS 64
+
+static int set(hamster_store* st, const std::string& key, const std::string& v) {
+  h_value_t* val = hamster_value_new((void*)v.data(), v.size(), 200);
+  int ec = hamster_store_set(st, key.c_str(), val);
+  hamster_value_free(val);
+  return ec;
+}
+
+static std::string get(hamster_store* st, const std::string& key) {
+  h_value_t* val = hamster_value_empty();
+  std::string v;
+  if (E_SHM_OK == hamster_store_get(st, key.c_str(), val))
+    v.assign((char*)hamster_value_ptr(val), hamster_value_size(val));
+  hamster_value_free(val);
+  return v;
+}
+
+static std::string make_key(int i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "key%04d", i);
+  return buf;
+}
+
+static std::string make_value(int i, int round) {
+  return std::string(50 + i, 'a' + (i + round) % 26);
+}
+
+static uint64_t unsealed(hamster_store* st) {
+  struct hamster_stat stat;
+  hamster_store_stat(st, &stat);
+  return stat.unsealed;
+}
+
+extern "C" void unittest_hamster_store_sim_crash(struct hamster_store* st);
+extern "C" void unittest_hamster_store_tear(struct hamster_store* st, const char* key);
+
+class hamster_seal_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
+  }
+
+  virtual void SetUp() {
+    ASSERT_EQ(E_SHM_OK, open());
+    for (int i = 0; i < KEYS; ++i)
+      ASSERT_EQ(E_SHM_OK, set(st_, make_key(i), make_value(i, 0)));
+  }
+
+  virtual void TearDown() {
+    hamster_close(st_);
+  }
+
+  int open(uint32_t seal_ms = 0) {
+    struct hamster_options opts = {};
+    opts.shards = 2;
+    opts.seal_ms = seal_ms;
+    return hamster_open("seal", &opts, &st_);
+  }
+
+  void update(int rounds) {
+    for (int round = 1; round <= rounds; ++round)
+      for (int i = 0; i < KEYS; ++i)
+        ASSERT_EQ(E_SHM_OK, set(st_, make_key(i), make_value(i, round)));
+  }
+
+  hamster_store* st_;
+};
+
+TEST_F(hamster_seal_test, seal) {
+  // long enough for the thread to stay out of the way
+  ASSERT_EQ(E_SHM_OK, hamster_store_set_sealing(st_, 60000));
+  update(10);
+  ASSERT_EQ((uint64_t)KEYS, unsealed(st_));
+  ASSERT_EQ(make_value(7, 10), get(st_, make_key(7)));
+
+  // the scrubber leaves them alone meanwhile
+  ASSERT_LT(0u, hamster_store_scrub(st_, 1 << 20, NULL, NULL));
+  struct hamster_stat stat;
+  hamster_store_stat(st_, &stat);
+  ASSERT_EQ(0u, stat.quarantined);
+
+  // once per record, however many times it was written
+  ASSERT_EQ((size_t)KEYS, hamster_store_seal(st_));
+  ASSERT_EQ(0u, unsealed(st_));
+  ASSERT_EQ(0u, hamster_store_seal(st_));
+  hamster_store_stat(st_, &stat);
+  ASSERT_EQ((uint64_t)KEYS, stat.sealed);
+
+  // and their checksums hold
+  ASSERT_EQ(E_SHM_OK, hamster_store_set_sealing(st_, 0));
+  ASSERT_LT(0u, hamster_store_scrub(st_, 1 << 20, NULL, NULL));
+  hamster_store_stat(st_, &stat);
+  ASSERT_EQ(0u, stat.quarantined);
+
+  // off, updates are sealed at once
+  update(1);
+  ASSERT_EQ(0u, unsealed(st_));
+}
+
+TEST_F(hamster_seal_test, thread) {
+  ASSERT_EQ(E_SHM_OK, hamster_store_set_sealing(st_, 10));
+  update(3);
+
+  for (int i = 0; i < 100 && unsealed(st_) > 0; ++i)
+    usleep(10000);
+  ASSERT_EQ(0u, unsealed(st_));
+
+  struct hamster_stat stat;
+  hamster_store_stat(st_, &stat);
+  ASSERT_LE((uint64_t)KEYS, stat.sealed);
+}
+
+TEST_F(hamster_seal_test, recovery) {
+  ASSERT_EQ(E_SHM_OK, hamster_store_set_sealing(st_, 60000));
+  update(5);
+  ASSERT_EQ((uint64_t)KEYS, unsealed(st_));
+
+  // the last values survive, sealed as they are recovered
+  unittest_hamster_store_sim_crash(st_);
+  ASSERT_EQ(E_SHM_OK, open());
+  ASSERT_EQ((size_t)KEYS, hamster_store_count(st_));
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(make_value(i, 5), get(st_, make_key(i)));
+
+  hamster_store_scrub(st_, 1 << 20, NULL, NULL);
+  struct hamster_stat stat;
+  hamster_store_stat(st_, &stat);
+  ASSERT_EQ(0u, stat.quarantined);
+}
+
+TEST_F(hamster_seal_test, torn) {
+  ASSERT_EQ(E_SHM_OK, hamster_store_set_sealing(st_, 60000));
+  update(2);
+  unittest_hamster_store_tear(st_, make_key(3).c_str());
+
+  // a record torn in the middle of an update can not be trusted
+  unittest_hamster_store_sim_crash(st_);
+  ASSERT_EQ(E_SHM_DATA_CORRUPTED, open());
+  ASSERT_EQ((size_t)KEYS - 1, hamster_store_count(st_));
+  ASSERT_EQ("", get(st_, make_key(3)));
+  ASSERT_EQ(make_value(4, 2), get(st_, make_key(4)));
+}
+
+TEST_F(hamster_seal_test, detach) {
+  ASSERT_EQ(E_SHM_OK, hamster_store_set_sealing(st_, 60000));
+  update(1);
+  hamster_detach(st_);
+
+  ASSERT_EQ(E_SHM_OK, open(60000));
+  ASSERT_EQ(make_value(9, 1), get(st_, make_key(9)));
+  ASSERT_EQ(0u, unsealed(st_));
+  update(1);
+  ASSERT_EQ((uint64_t)KEYS, unsealed(st_));
+}
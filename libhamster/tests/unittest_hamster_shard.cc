@@ -0,0 +1,109 @@
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/shm.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hamster.h"
+#include "shm_error.h"
+#include "shm_config.h"
+}
+
+#define SHARDS 4
+#define WRITERS 4
+#define KEYS_PER_WRITER 512
+
+struct writer_arg {
+  int id;
+  int ec;
+};
+
+static std::string make_key(int writer, int i) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "writer%d:key%d", writer, i);
+  return buf;
+}
+
+static void* writer(void* p) {
+  writer_arg* arg = (writer_arg*)p;
+  arg->ec = E_SHM_OK;
+  for (int i = 0; i < KEYS_PER_WRITER && arg->ec == E_SHM_OK; ++i) {
+    std::string key = make_key(arg->id, i);
+    int64_t v = (int64_t)arg->id << 32 | i;
+    h_value_t* val = hamster_value_new(&v, sizeof(v), sizeof(v));
+    arg->ec = hamster_set(key.c_str(), val);
+    hamster_value_free(val);
+  }
+  return NULL;
+}
+
+static void check_all() {
+  h_value_t* val = hamster_value_empty();
+  for (int w = 0; w < WRITERS; ++w) {
+    for (int i = 0; i < KEYS_PER_WRITER; ++i) {
+      ASSERT_EQ(E_SHM_OK, hamster_get(make_key(w, i).c_str(), val));
+      ASSERT_EQ(sizeof(int64_t), hamster_value_size(val));
+      ASSERT_EQ((int64_t)w << 32 | i, *(int64_t*)hamster_value_ptr(val));
+    }
+  }
+  hamster_value_free(val);
+}
+
+class hamster_shard_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
+  }
+
+  static void TearDownTestCase() {
+    hamster_shutdown();
+  }
+};
+
+TEST_F(hamster_shard_test, init) {
+  ASSERT_EQ(E_SHM_INVALID_PARAMS, hamster_init_sharded(0));
+  ASSERT_EQ(E_SHM_INVALID_PARAMS, hamster_init_sharded(SHM_SHARDS_MAX + 1));
+  ASSERT_EQ(E_SHM_OK, hamster_init_sharded(SHARDS));
+  ASSERT_EQ((uint32_t)SHARDS, hamster_shard_count());
+
+  // every shard has its own chain
+  for (int i = 0; i < SHARDS; ++i)
+    ASSERT_NE(-1, shmget(SHM_KEY + i * SHM_KEY_RANGE, 0, 0600));
+}
+
+TEST_F(hamster_shard_test, parallel_writers) {
+  pthread_t threads[WRITERS];
+  writer_arg args[WRITERS];
+
+  for (int i = 0; i < WRITERS; ++i) {
+    args[i].id = i;
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, writer, &args[i]));
+  }
+  for (int i = 0; i < WRITERS; ++i) {
+    ASSERT_EQ(0, pthread_join(threads[i], NULL));
+    ASSERT_EQ(E_SHM_OK, args[i].ec);
+  }
+
+  ASSERT_EQ((size_t)WRITERS * KEYS_PER_WRITER, hamster_count());
+  check_all();
+}
+
+extern "C" void unittest_hamster_sim_crash();
+TEST_F(hamster_shard_test, crash_recovery) {
+  unittest_hamster_sim_crash();
+  ASSERT_EQ(E_SHM_OK, hamster_init_sharded(SHARDS));
+  ASSERT_EQ((size_t)WRITERS * KEYS_PER_WRITER, hamster_count());
+  check_all();
+}
+
+TEST_F(hamster_shard_test, shards_mismatch) {
+  unittest_hamster_sim_crash();
+  ASSERT_EQ(E_SHM_SHARDS_MISMATCH, hamster_init_sharded(SHARDS - 1));
+  ASSERT_EQ(E_SHM_SHARDS_MISMATCH, hamster_init_sharded(SHARDS + 1));
+  ASSERT_EQ(E_SHM_OK, hamster_init_sharded(SHARDS));
+  check_all();
+}
@@ -0,0 +1,315 @@
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hamster.h"
+#include "shm_error.h"
+#include "shm_config.h"
+#include "shm_numa.h"
+}
+
+#define KEYS 100
+#define HOT_SEGMENT_SIZE (64 * 1024)
+
+static int set(hamster_store* st, const std::string& key, const std::string& v) {
+  h_value_t* val = hamster_value_new((void*)v.data(), v.size(), v.size());
+  int ec = hamster_store_set(st, key.c_str(), val);
+  hamster_value_free(val);
+  return ec;
+}
+
+static std::string get(hamster_store* st, const std::string& key) {
+  h_value_t* val = hamster_value_empty();
+  std::string v;
+  if (E_SHM_OK == hamster_store_get(st, key.c_str(), val))
+    v.assign((char*)hamster_value_ptr(val), hamster_value_size(val));
+  hamster_value_free(val);
+  return v;
+}
+
+static std::string make_key(int i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "key%04d", i);
+  return buf;
+}
+
+class hamster_store_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
+  }
+
+  static void TearDownTestCase() {
+    hamster_close(hot_);
+    hamster_close(cold_);
+    hamster_shutdown();
+  }
+
+  static hamster_store* hot_;
+  static hamster_store* cold_;
+};
+
+hamster_store* hamster_store_test::hot_;
+hamster_store* hamster_store_test::cold_;
+
+TEST_F(hamster_store_test, open) {
+  hamster_options opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.segment_min = HOT_SEGMENT_SIZE;
+  opts.shards = 2;
+  ASSERT_EQ(E_SHM_OK, hamster_open("hot", &opts, &hot_));
+  ASSERT_EQ(E_SHM_OK, hamster_open("cold", NULL, &cold_));
+  ASSERT_EQ(E_SHM_OK, hamster_init());
+
+  ASSERT_STREQ("hot", hamster_store_name(hot_));
+  ASSERT_EQ((uint32_t)2, hamster_store_shard_count(hot_));
+  ASSERT_EQ((uint32_t)1, hamster_store_shard_count(cold_));
+
+  // the segment size is per store
+  struct hamster_stat st;
+  ASSERT_EQ(E_SHM_OK, hamster_store_stat(hot_, &st));
+  ASSERT_EQ((uint64_t)2 * HOT_SEGMENT_SIZE, st.bytes);
+  ASSERT_EQ(E_SHM_OK, hamster_store_stat(cold_, &st));
+  ASSERT_EQ((uint64_t)shm_pagesize * SHM_SIZE_IN_PAGES, st.bytes);
+}
+
+TEST_F(hamster_store_test, overlap) {
+  hamster_store* st = NULL;
+  ASSERT_EQ(E_SHM_INIT_ONLY_ONCE, hamster_open("hot", NULL, &st));
+  ASSERT_EQ(E_SHM_INIT_ONLY_ONCE, hamster_init());
+
+  hamster_options opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.key = SHM_KEY + SHM_KEY_RANGE / 2;
+  ASSERT_EQ(E_SHM_INIT_ONLY_ONCE, hamster_open("other", &opts, &st));
+  ASSERT_EQ(E_SHM_INVALID_PARAMS, hamster_open(NULL, NULL, &st));
+}
+
+TEST_F(hamster_store_test, independent) {
+  for (int i = 0; i < KEYS; ++i) {
+    ASSERT_EQ(E_SHM_OK, set(hot_, make_key(i), "hot" + make_key(i)));
+    ASSERT_EQ(E_SHM_OK, set(cold_, make_key(i), "cold" + make_key(i)));
+  }
+  ASSERT_EQ(E_SHM_OK, set(cold_, "cold_only", "x"));
+
+  ASSERT_EQ((size_t)KEYS, hamster_store_count(hot_));
+  ASSERT_EQ((size_t)KEYS + 1, hamster_store_count(cold_));
+  ASSERT_EQ((size_t)0, hamster_count());
+
+  for (int i = 0; i < KEYS; ++i) {
+    ASSERT_EQ("hot" + make_key(i), get(hot_, make_key(i)));
+    ASSERT_EQ("cold" + make_key(i), get(cold_, make_key(i)));
+  }
+  ASSERT_EQ("", get(hot_, "cold_only"));
+}
+
+extern "C" void unittest_hamster_store_sim_crash(hamster_store* st);
+TEST_F(hamster_store_test, crash_recovery) {
+  unittest_hamster_store_sim_crash(hot_);
+  hot_ = NULL;
+
+  // reopened by name, the options must keep the shard count
+  hamster_options opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.shards = 1;
+  ASSERT_EQ(E_SHM_SHARDS_MISMATCH, hamster_open("hot", &opts, &hot_));
+  opts.shards = 2;
+  ASSERT_EQ(E_SHM_OK, hamster_open("hot", &opts, &hot_));
+
+  ASSERT_EQ((size_t)KEYS, hamster_store_count(hot_));
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ("hot" + make_key(i), get(hot_, make_key(i)));
+}
+
+TEST_F(hamster_store_test, close) {
+  hamster_options opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.key = SHM_KEY + SHM_SHARDS_MAX * SHM_KEY_RANGE;
+
+  hamster_store* st = NULL;
+  ASSERT_EQ(E_SHM_OK, hamster_open("tmp", &opts, &st));
+  ASSERT_NE(-1, shmget(opts.key, 0, 0600));
+  hamster_close(st);
+  ASSERT_EQ(-1, shmget(opts.key, 0, 0600));
+
+  // other stores are not affected
+  ASSERT_EQ("cold" + make_key(0), get(cold_, make_key(0)));
+}
+
+TEST_F(hamster_store_test, name_mismatch) {
+  hamster_options opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.key = SHM_KEY + 2 * SHM_SHARDS_MAX * SHM_KEY_RANGE;
+
+  hamster_store* st = NULL;
+  ASSERT_EQ(E_SHM_OK, hamster_open("mine", &opts, &st));
+  ASSERT_EQ(E_SHM_OK, set(st, "k", "v"));
+  hamster_detach(st);
+
+  // a store of another name on the same keys neither opens nor reads it
+  ASSERT_EQ(E_SHM_NAME_MISMATCH, hamster_open("theirs", &opts, &st));
+  hamster_reader* r = NULL;
+  ASSERT_EQ(E_SHM_NAME_MISMATCH, hamster_reader_open("theirs", opts.key, &r));
+
+  // and leaves it as it was
+  ASSERT_EQ(E_SHM_OK, hamster_reader_open("mine", opts.key, &r));
+  hamster_reader_close(r);
+  ASSERT_EQ(E_SHM_OK, hamster_open("mine", &opts, &st));
+  ASSERT_EQ((size_t)1, hamster_store_count(st));
+  ASSERT_EQ("v", get(st, "k"));
+  hamster_close(st);
+}
+
+TEST_F(hamster_store_test, reopen_larger_segment) {
+  hamster_options opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.key = SHM_KEY + 3 * SHM_SHARDS_MAX * SHM_KEY_RANGE;
+
+  hamster_store* st = NULL;
+  ASSERT_EQ(E_SHM_OK, hamster_open("grown", &opts, &st));
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st, make_key(i), "grown" + make_key(i)));
+  hamster_detach(st);
+
+  // a bigger first segment applies to segments still to come only
+  opts.segment_min = 4 * shm_pagesize * SHM_SIZE_IN_PAGES;
+  ASSERT_EQ(E_SHM_OK, hamster_open("grown", &opts, &st));
+  ASSERT_EQ((size_t)KEYS, hamster_store_count(st));
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ("grown" + make_key(i), get(st, make_key(i)));
+  hamster_close(st);
+}
+
+TEST_F(hamster_store_test, segment_flags) {
+  hamster_options opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.segment_flags = HAMSTER_SEG_PREFAULT | HAMSTER_SEG_PRECREATE;
+
+  hamster_store* st = NULL;
+  ASSERT_EQ(E_SHM_OK, hamster_open("warm", &opts, &st));
+  for (int i = 0; i < 10 * KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st, make_key(i), "warm" + make_key(i)));
+
+  // a segment created ahead but not linked yet does not get in the way
+  unittest_hamster_store_sim_crash(st);
+  ASSERT_EQ(E_SHM_OK, hamster_open("warm", &opts, &st));
+  for (int i = 10 * KEYS; i < 20 * KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st, make_key(i), "warm" + make_key(i)));
+
+  ASSERT_EQ((size_t)20 * KEYS, hamster_store_count(st));
+  for (int i = 0; i < 20 * KEYS; ++i)
+    ASSERT_EQ("warm" + make_key(i), get(st, make_key(i)));
+  hamster_close(st);
+}
+
+TEST_F(hamster_store_test, numa) {
+  int policies[] = { HAMSTER_NUMA_BIND, HAMSTER_NUMA_INTERLEAVE, HAMSTER_NUMA_PER_NODE };
+  for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); ++p) {
+    hamster_options opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.numa_policy = policies[p];
+    opts.shards = 4;
+
+    hamster_store* st = NULL;
+    if (policies[p] == HAMSTER_NUMA_PER_NODE) {
+      opts.capacity = 1 << 20;
+      ASSERT_EQ(E_SHM_INVALID_PARAMS, hamster_open("numa", &opts, &st));
+      opts.capacity = 0;
+    }
+    ASSERT_EQ(E_SHM_OK, hamster_open("numa", &opts, &st));
+    for (int i = 0; i < KEYS; ++i)
+      ASSERT_EQ(E_SHM_OK, set(st, make_key(i), "numa" + make_key(i)));
+    ASSERT_EQ((size_t)KEYS, hamster_store_count(st));
+    for (int i = 0; i < KEYS; ++i)
+      ASSERT_EQ("numa" + make_key(i), get(st, make_key(i)));
+
+    // one full replica per node, which would not evict the same keys
+    if (policies[p] == HAMSTER_NUMA_PER_NODE) {
+      ASSERT_EQ((uint32_t)shm_numa_nodes(), hamster_store_shard_count(st));
+      struct hamster_stat stat;
+      ASSERT_EQ(E_SHM_OK, hamster_store_stat(st, &stat));
+      ASSERT_EQ((uint64_t)KEYS, stat.hits);
+      ASSERT_EQ(E_SHM_INVALID_PARAMS, hamster_store_set_capacity(st, 1 << 20));
+
+      // nothing is written beyond the hard budget of a replica
+      ASSERT_EQ(E_SHM_OK, hamster_store_set_budget(st, 0, 1, NULL, NULL));
+      std::string big(shm_pagesize * SHM_SIZE_IN_PAGES, 'b');
+      ASSERT_EQ(E_SHM_BUDGET_EXCEEDED, set(st, "big", big));
+      ASSERT_EQ("", get(st, "big"));
+      ASSERT_EQ((size_t)KEYS, hamster_store_count(st));
+      ASSERT_EQ(E_SHM_OK, set(st, make_key(0), "numa"));
+    }
+    hamster_close(st);
+  }
+}
+
+TEST_F(hamster_store_test, art_index) {
+  hamster_options opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.index = HAMSTER_INDEX_ART;
+  opts.shards = 2;
+
+  // keys with a long shared prefix, written over and recovered
+  hamster_store* st = NULL;
+  ASSERT_EQ(E_SHM_OK, hamster_open("art", &opts, &st));
+  for (int i = 0; i < 10 * KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st, "svc:region:tenant:" + make_key(i), "art" + make_key(i)));
+  for (int i = 0; i < 10 * KEYS; i += 2)
+    ASSERT_EQ(E_SHM_OK, set(st, "svc:region:tenant:" + make_key(i), "new" + make_key(i)));
+  ASSERT_EQ("", get(st, "svc:region:tenant:"));
+
+  unittest_hamster_store_sim_crash(st);
+  ASSERT_EQ(E_SHM_OK, hamster_open("art", &opts, &st));
+  ASSERT_EQ((size_t)10 * KEYS, hamster_store_count(st));
+  for (int i = 0; i < 10 * KEYS; ++i)
+    ASSERT_EQ((i % 2 ? "art" : "new") + make_key(i), 
+              get(st, "svc:region:tenant:" + make_key(i)));
+
+  struct hamster_stat stat;
+  ASSERT_EQ(E_SHM_OK, hamster_store_stat(st, &stat));
+  ASSERT_LT(0u, stat.index_bytes);
+  hamster_close(st);
+}
+
+extern "C" void unittest_hamster_store_set_kill(struct hamster_store* st, const char* key, 
+                                                struct h_value_t* val);
+TEST_F(hamster_store_test, owner_dead) {
+  hamster_options opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.shards = 1;
+
+  hamster_store* st = NULL;
+  ASSERT_EQ(E_SHM_OK, hamster_open("dead", &opts, &st));
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ(E_SHM_OK, set(st, make_key(i), "dead" + make_key(i)));
+  hamster_detach(st);
+
+  // another process takes the store over, and is killed in the middle of a
+  // write, its record linked but not committed
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (E_SHM_OK == hamster_open("dead", &opts, &st))
+      unittest_hamster_store_set_kill(st, "lost", hamster_value_new((void*)"lost", 4, 4));
+    _exit(1);
+  }
+  int status = 0;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFSIGNALED(status));
+
+  // the write it left half done is undone, nothing is reported corrupted
+  ASSERT_EQ(E_SHM_OK, hamster_open("dead", &opts, &st));
+  ASSERT_EQ((size_t)KEYS, hamster_store_count(st));
+  ASSERT_EQ("", get(st, "lost"));
+  for (int i = 0; i < KEYS; ++i)
+    ASSERT_EQ("dead" + make_key(i), get(st, make_key(i)));
+  ASSERT_EQ(E_SHM_OK, set(st, "lost", "found"));
+  ASSERT_EQ("found", get(st, "lost"));
+  hamster_close(st);
+}
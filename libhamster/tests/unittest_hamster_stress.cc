@@ -0,0 +1,367 @@
+#include <string>
+#include <vector>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hamster.h"
+#include "shm_crc32.h"
+#include "shm_error.h"
+#include "shm_config.h"
+}
+
+/*
+ * stress and scalability of a store: writer and reader threads of the
+ * process owning the store for a while at several thread counts, then a
+ * writer process killed at random points and the store recovered by
+ * another. the environment scales it up:
+ *   HAMSTER_STRESS_MS     run time of each thread count, 300 by default
+ *   HAMSTER_STRESS_MAX    max threads of either kind, 4 by default
+ *   HAMSTER_STRESS_CRASHES  kill and recover rounds, 5 by default
+ */
+
+#define SHARDS 4
+#define KEYS_PER_WRITER 256
+#define MAX_WRITERS 64
+#define VALUE_MAX 512
+
+static int env_int(const char* name, int def) {
+  const char* v = getenv(name);
+  return v != NULL && atoi(v) > 0 ? atoi(v) : def;
+}
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+extern "C" void unittest_hamster_store_sim_crash(struct hamster_store* st);
+
+static int open_store(hamster_store** st) {
+  struct hamster_options opts = {};
+  opts.shards = SHARDS;
+  return hamster_open("stress", &opts, st);
+}
+
+static std::string make_key(int writer, int i) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "stress:w%d:k%d", writer, i);
+  return buf;
+}
+
+/*
+ * a value checks itself: it names its key and write, and ends with a crc of
+ * the rest, so a torn or misplaced value never goes unnoticed
+ */
+struct value_header {
+  uint32_t writer;
+  uint32_t key;
+  uint32_t seq;
+  uint32_t size;
+};
+
+static uint32_t make_value(char* buf, uint32_t writer, uint32_t key, uint32_t seq) {
+  value_header* h = (value_header*)buf;
+  uint32_t size = sizeof(value_header) + (seq * 37 + key) % (VALUE_MAX - sizeof(value_header) - 4);
+  h->writer = writer;
+  h->key = key;
+  h->seq = seq;
+  h->size = size;
+  for (uint32_t i = sizeof(value_header); i < size; ++i)
+    buf[i] = (char)(seq + i);
+  uint32_t crc = shm_crc32(buf, size);
+  memcpy(buf + size, &crc, sizeof(crc));
+  return size + sizeof(crc);
+}
+
+/* seq of a good value of key, -1 if it is damaged */
+static int64_t check_value(const char* buf, uint32_t n, uint32_t writer, uint32_t key) {
+  const value_header* h = (const value_header*)buf;
+  uint32_t crc = 0;
+  if (n < sizeof(value_header) + sizeof(crc) || h->size != n - sizeof(crc))
+    return -1;
+  memcpy(&crc, buf + h->size, sizeof(crc));
+  if (crc != shm_crc32((char*)buf, h->size) || h->writer != writer || h->key != key)
+    return -1;
+  return h->seq;
+}
+
+/* latencies in buckets of 1/8 of a power of 2 */
+struct histogram {
+  uint64_t b[512];
+  uint64_t count;
+
+  histogram() { memset(this, 0, sizeof(*this)); }
+
+  void add(uint64_t ns) {
+    int e = ns < 8 ? 0 : 63 - __builtin_clzll(ns);
+    ++b[ns < 8 ? ns : (e - 2) * 8 + ((ns >> (e - 3)) & 7)];
+    ++count;
+  }
+
+  void merge(const histogram& o) {
+    for (int i = 0; i < 512; ++i)
+      b[i] += o.b[i];
+    count += o.count;
+  }
+
+  uint64_t percentile(double p) const {
+    uint64_t n = 0, want = (uint64_t)(count * p);
+    for (int i = 0; i < 512; ++i) {
+      if ((n += b[i]) > want)
+        return i < 8 ? i : (uint64_t)(8 + i % 8) << (i / 8 - 1);
+    }
+    return 0;
+  }
+};
+
+struct worker_arg {
+  hamster_store* st;
+  int id;
+  int writers;
+  volatile bool* stop;
+  histogram lat;
+  uint64_t ops;
+  uint64_t bad;   /* values which failed their check */
+  int ec;
+};
+
+static void* writer(void* p) {
+  worker_arg* arg = (worker_arg*)p;
+  char buf[VALUE_MAX];
+  h_value_t* val = hamster_value_new(buf, 0, VALUE_MAX);
+  uint32_t seq = 0;
+
+  arg->ec = E_SHM_OK;
+  while (!*arg->stop && arg->ec == E_SHM_OK) {
+    uint32_t key = seq % KEYS_PER_WRITER;
+    hamster_value_free(val);
+    val = hamster_value_new(buf, make_value(buf, arg->id, key, ++seq), VALUE_MAX);
+    uint64_t start = now_ns();
+    arg->ec = hamster_store_set(arg->st, make_key(arg->id, key).c_str(), val);
+    arg->lat.add(now_ns() - start);
+    ++arg->ops;
+  }
+  hamster_value_free(val);
+  return NULL;
+}
+
+static void* reader(void* p) {
+  worker_arg* arg = (worker_arg*)p;
+  char buf[VALUE_MAX + 64];
+  uint32_t i = arg->id * 7919;
+
+  arg->ec = E_SHM_OK;
+  while (!*arg->stop) {
+    uint32_t w = i % arg->writers, key = (i / arg->writers) % KEYS_PER_WRITER;
+    uint32_t size = sizeof(buf);
+    ++i;
+    uint64_t start = now_ns();
+    int ec = hamster_store_get_copy(arg->st, make_key(w, key).c_str(), buf, &size);
+    arg->lat.add(now_ns() - start);
+    ++arg->ops;
+    if (ec == E_SHM_OK && check_value(buf, size, w, key) < 0)
+      ++arg->bad;
+    else if (ec != E_SHM_OK && ec != E_SHM_KEY_NOT_FOUND)
+      arg->ec = ec;
+  }
+  return NULL;
+}
+
+class hamster_stress_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
+  }
+};
+
+TEST_F(hamster_stress_test, scaling) {
+  int run_ms = env_int("HAMSTER_STRESS_MS", 300);
+  int max = env_int("HAMSTER_STRESS_MAX", 4);
+  hamster_store* st = NULL;
+  ASSERT_EQ(E_SHM_OK, open_store(&st));
+
+  printf("%8s %8s %12s %12s %10s %10s %10s %10s\n",
+         "writers", "readers", "set/s", "get/s", "set p50", "set p99", "get p50", "get p99");
+  for (int writers = 1; writers <= max && writers <= MAX_WRITERS; writers *= 2) {
+    for (int readers = 1; readers <= max; readers *= 2) {
+      volatile bool stop = false;
+      std::vector<worker_arg> args(writers + readers);
+      std::vector<pthread_t> threads(writers + readers);
+      histogram set_lat, get_lat;
+      uint64_t sets = 0, gets = 0;
+
+      for (int i = 0; i < writers + readers; ++i) {
+        args[i].st = st;
+        args[i].id = i < writers ? i : i - writers;
+        args[i].writers = writers;
+        args[i].stop = &stop;
+        args[i].ops = args[i].bad = 0;
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, i < writers ? writer : reader, &args[i]));
+      }
+
+      uint64_t start = now_ns();
+      usleep(run_ms * 1000);
+      stop = true;
+      for (int i = 0; i < writers + readers; ++i) {
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+        ASSERT_EQ(E_SHM_OK, args[i].ec);
+        ASSERT_EQ((uint64_t)0, args[i].bad);
+        (i < writers ? set_lat : get_lat).merge(args[i].lat);
+        (i < writers ? sets : gets) += args[i].ops;
+      }
+      double secs = (now_ns() - start) / 1e9;
+
+      printf("%8d %8d %12.0f %12.0f %8luns %8luns %8luns %8luns\n",
+             writers, readers, sets / secs, gets / secs,
+             set_lat.percentile(0.5), set_lat.percentile(0.99),
+             get_lat.percentile(0.5), get_lat.percentile(0.99));
+      ASSERT_GT(sets, (uint64_t)0);
+      ASSERT_GT(gets, (uint64_t)0);
+    }
+  }
+  hamster_close(st);
+}
+
+/*
+ * what the writer process has done, in memory shared with the test: acked
+ * is the last seq a set of each key returned for, inflight the key of the
+ * set in progress of each writer
+ */
+struct crash_log {
+  uint32_t acked[MAX_WRITERS][KEYS_PER_WRITER];
+  int32_t  inflight[MAX_WRITERS];
+  uint32_t seq[MAX_WRITERS];
+  volatile uint32_t started;
+};
+
+struct crash_arg {
+  hamster_store* st;
+  crash_log* log;
+  int id;
+};
+
+static void* crash_writer(void* p) {
+  crash_arg* arg = (crash_arg*)p;
+  crash_log* log = arg->log;
+  char buf[VALUE_MAX];
+
+  __sync_fetch_and_add(&log->started, 1);
+  for (;;) {
+    uint32_t seq = ++log->seq[arg->id], key = seq % KEYS_PER_WRITER;
+    h_value_t* val = hamster_value_new(buf, make_value(buf, arg->id, key, seq), VALUE_MAX);
+    log->inflight[arg->id] = key;
+    __sync_synchronize();
+    if (E_SHM_OK == hamster_store_set(arg->st, make_key(arg->id, key).c_str(), val))
+      log->acked[arg->id][key] = seq;
+    __sync_synchronize();
+    log->inflight[arg->id] = -1;
+    hamster_value_free(val);
+  }
+  return NULL;
+}
+
+/* the writer process, it never returns but is killed */
+static void crash_child(crash_log* log, int writers) {
+  hamster_store* st = NULL;
+  std::vector<pthread_t> threads(writers);
+  std::vector<crash_arg> args(writers);
+
+  if (E_SHM_OK != open_store(&st))
+    _exit(1);
+  for (int i = 0; i < writers; ++i) {
+    args[i].st = st;
+    args[i].log = log;
+    args[i].id = i;
+    pthread_create(&threads[i], NULL, crash_writer, &args[i]);
+  }
+  for (;;)
+    pause();
+}
+
+TEST_F(hamster_stress_test, crash_recovery) {
+  int rounds = env_int("HAMSTER_STRESS_CRASHES", 5);
+  int writers = env_int("HAMSTER_STRESS_MAX", 4);
+  writers = writers > MAX_WRITERS ? MAX_WRITERS : writers;
+  crash_log* log = (crash_log*)mmap(NULL, sizeof(crash_log), PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  ASSERT_NE(MAP_FAILED, (void*)log);
+  memset(log, 0, sizeof(crash_log));
+  srand(time(NULL));
+
+  printf("%6s %12s %12s %10s\n", "round", "keys", "recovery", "torn");
+  for (int round = 0; round < rounds; ++round) {
+    log->started = 0;
+    for (int w = 0; w < writers; ++w)
+      log->inflight[w] = -1;
+
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+      crash_child(log, writers);
+
+    while (log->started < (uint32_t)writers)
+      usleep(1000);
+    usleep(20000 + rand() % 100000);
+    ASSERT_EQ(0, kill(pid, SIGKILL));
+    int status = 0;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFSIGNALED(status));
+
+    // a set cut in the middle of an in place update leaves a torn record,
+    // which recovery quarantines
+    hamster_store* st = NULL;
+    uint64_t start = now_ns();
+    int ec = open_store(&st);
+    uint64_t recovery_us = (now_ns() - start) / 1000;
+    ASSERT_TRUE(ec == E_SHM_OK || ec == E_SHM_DATA_CORRUPTED) << ec;
+
+    // every acked set is there, or a later one of the same key. only the key
+    // a writer was setting when killed might be lost
+    char buf[VALUE_MAX + 64];
+    int inflight_lost = 0;
+    for (int w = 0; w < writers; ++w) {
+      for (int key = 0; key < KEYS_PER_WRITER; ++key) {
+        uint32_t size = sizeof(buf);
+        int64_t seq = -1;
+        ec = hamster_store_get_copy(st, make_key(w, key).c_str(), buf, &size);
+        if (ec == E_SHM_OK) {
+          seq = check_value(buf, size, w, key);
+          ASSERT_GE(seq, 0) << make_key(w, key);
+          ASSERT_GE(seq, (int64_t)log->acked[w][key]) << make_key(w, key);
+          log->acked[w][key] = seq;
+        } else {
+          ASSERT_EQ(E_SHM_KEY_NOT_FOUND, ec);
+          if (log->acked[w][key] > 0) {
+            ASSERT_EQ(key, log->inflight[w]) << make_key(w, key);
+            log->acked[w][key] = 0;
+            ++inflight_lost;
+          }
+        }
+      }
+    }
+
+    printf("%6d %12zu %10luus %10d\n", round, hamster_store_count(st), recovery_us, 
+           inflight_lost);
+    ASSERT_LE(inflight_lost, writers);
+
+    // keep the shm for the next round
+    unittest_hamster_store_sim_crash(st);
+  }
+
+  hamster_store* st = NULL;
+  int ec = open_store(&st);
+  ASSERT_TRUE(ec == E_SHM_OK || ec == E_SHM_DATA_CORRUPTED) << ec;
+  hamster_close(st);
+  munmap(log, sizeof(crash_log));
+}
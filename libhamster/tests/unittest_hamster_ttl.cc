@@ -0,0 +1,139 @@
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "hamster.h"
+#include "shm_error.h"
+#include "shm_config.h"
+}
+
+#define TTL_MS 50
+
+static void set(const char* key, int64_t v, uint32_t ttl_ms) {
+  h_value_t* val = hamster_value_new(&v, sizeof(v), sizeof(v));
+  ASSERT_EQ(E_SHM_OK, hamster_set_ttl(key, val, ttl_ms));
+  hamster_value_free(val);
+}
+
+static void check(const char* key, int64_t v) {
+  h_value_t* val = hamster_value_empty();
+  ASSERT_EQ(E_SHM_OK, hamster_get(key, val));
+  ASSERT_EQ(v, *(int64_t*)hamster_value_ptr(val));
+  hamster_value_free(val);
+}
+
+static void check_missing(const char* key) {
+  h_value_t* val = hamster_value_empty();
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, hamster_get(key, val));
+  hamster_value_free(val);
+}
+
+static void* value_ptr(const char* key) {
+  h_value_t* val = hamster_value_empty();
+  hamster_get(key, val);
+  void* ptr = hamster_value_ptr(val);
+  hamster_value_free(val);
+  return ptr;
+}
+
+class hamster_ttl_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
+  }
+
+  static void TearDownTestCase() {
+    hamster_shutdown();
+  }
+
+  static void* short_ptr_;
+};
+
+void* hamster_ttl_test::short_ptr_;
+
+TEST_F(hamster_ttl_test, init) {
+  ASSERT_EQ(E_SHM_OK, hamster_init());
+}
+
+TEST_F(hamster_ttl_test, lazy_expiry) {
+  set("short", 1, TTL_MS);
+  set("forever", 2, 0);
+  check("short", 1);
+  check("forever", 2);
+  short_ptr_ = value_ptr("short");
+
+  usleep((TTL_MS + SHM_TTL_TICK_MS) * 1000);
+  check_missing("short");
+  check("forever", 2);
+
+  // still there until reclaimed
+  ASSERT_EQ((size_t)2, hamster_count());
+}
+
+TEST_F(hamster_ttl_test, reclaim) {
+  ASSERT_EQ((size_t)1, hamster_expire());
+  ASSERT_EQ((size_t)0, hamster_expire());
+  ASSERT_EQ((size_t)1, hamster_count());
+  check("forever", 2);
+
+  // a key of the same size takes over the reclaimed space
+  set("other", 3, 0);
+  check("other", 3);
+  ASSERT_EQ(short_ptr_, value_ptr("other"));
+  ASSERT_EQ((size_t)2, hamster_count());
+}
+
+TEST_F(hamster_ttl_test, update_ttl) {
+  // set again before the deadline moves it
+  set("renewed", 4, TTL_MS);
+  usleep(TTL_MS / 2 * 1000);
+  set("renewed", 5, TTL_MS * 4);
+  usleep(TTL_MS * 1000);
+  ASSERT_EQ((size_t)0, hamster_expire());
+  check("renewed", 5);
+
+  // hamster_set clears the ttl
+  set("renewed", 6, 0);
+  usleep(TTL_MS * 4 * 1000);
+  ASSERT_EQ((size_t)0, hamster_expire());
+  check("renewed", 6);
+}
+
+extern "C" void unittest_hamster_sim_crash();
+TEST_F(hamster_ttl_test, crash_recovery) {
+  set("expire_in_crash", 7, TTL_MS);
+  set("expire_after_crash", 8, TTL_MS * 10);
+  size_t count = hamster_count();
+
+  unittest_hamster_sim_crash();
+  usleep((TTL_MS + SHM_TTL_TICK_MS) * 1000);
+  ASSERT_EQ(E_SHM_OK, hamster_init());
+
+  // deadlines passed during the crash are dropped by recovery
+  check_missing("expire_in_crash");
+  check("expire_after_crash", 8);
+  check("forever", 2);
+  check("other", 3);
+  check("renewed", 6);
+  ASSERT_EQ(count - 1, hamster_count());
+
+  // and the wheel is rebuilt from the stored deadlines
+  usleep((TTL_MS * 10 + SHM_TTL_TICK_MS) * 1000);
+  ASSERT_EQ((size_t)1, hamster_expire());
+  check_missing("expire_after_crash");
+  ASSERT_EQ(count - 2, hamster_count());
+
+  // both records are free for reuse
+  set("expire_in_crasH", 9, 0);
+  set("expire_after_crasH", 10, 0);
+  unittest_hamster_sim_crash();
+  ASSERT_EQ(E_SHM_OK, hamster_init());
+  check("expire_in_crasH", 9);
+  check("expire_after_crasH", 10);
+  ASSERT_EQ(count, hamster_count());
+}
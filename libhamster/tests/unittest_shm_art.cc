@@ -0,0 +1,171 @@
+#include <map>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "shm_art.h"
+#include "shm_error.h"
+}
+
+struct item {
+  std::string key;
+};
+
+static const char* key_of(void* data) {
+  return ((item*)data)->key.c_str();
+}
+
+static int released = 0;
+static void release(void* data) {
+  ++released;
+}
+
+static void collect(void* data, void* ctx) {
+  ((std::vector<std::string>*)ctx)->push_back(((item*)data)->key);
+}
+
+static int query(art_tree* t, const std::string& key, item** found) {
+  item stub = { key };
+  void* data = &stub;
+  int ec = art_query(t, &data);
+  *found = ec == E_SHM_OK ? (item*)data : NULL;
+  return ec;
+}
+
+static int del(art_tree* t, const std::string& key) {
+  item stub = { key };
+  void* data = &stub;
+  return art_del(t, &data);
+}
+
+class shm_art_test : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    released = 0;
+    ASSERT_TRUE(NULL != (t_ = art_new(key_of, release)));
+  }
+
+  virtual void TearDown() {
+    art_free(t_);
+  }
+
+  // every key of items_ is found, and only those, in order
+  void check() {
+    item* found = NULL;
+    for (std::map<std::string, item>::iterator it = items_.begin(); it != items_.end(); ++it) {
+      ASSERT_EQ(E_SHM_OK, query(t_, it->first, &found)) << it->first;
+      ASSERT_EQ(&it->second, found);
+    }
+
+    std::vector<std::string> keys;
+    art_foreach(t_, collect, &keys);
+    ASSERT_EQ(items_.size(), keys.size());
+    ASSERT_EQ(items_.size(), t_->count);
+    size_t i = 0;
+    for (std::map<std::string, item>::iterator it = items_.begin(); it != items_.end(); ++it)
+      ASSERT_EQ(it->first, keys[i++]);
+  }
+
+  void add(const std::string& key) {
+    item& it = items_[key];
+    it.key = key;
+    ASSERT_EQ(E_SHM_OK, art_add(t_, &it));
+  }
+
+  art_tree* t_;
+  std::map<std::string, item> items_;
+};
+
+TEST_F(shm_art_test, add_query) {
+  item* found = NULL;
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, query(t_, "a", &found));
+
+  const char* keys[] = { "a", "ab", "abc", "b", "", "abd", "\xff", "a\x80" };
+  for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i)
+    add(keys[i]);
+  check();
+
+  item dup = { "ab" };
+  ASSERT_EQ(E_SHM_SAME_KEY_EXIST, art_add(t_, &dup));
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, query(t_, "abcd", &found));
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, query(t_, "c", &found));
+}
+
+TEST_F(shm_art_test, grow_shrink) {
+  // one inner node through every size and back
+  char key[3] = { 'k', 0, 0 };
+  for (int c = 1; c < 256; ++c) {
+    key[1] = (char)c;
+    add(key);
+    if (c == 4 || c == 16 || c == 48 || c == 255)
+      check();
+  }
+
+  for (int c = 255; c > 0; --c) {
+    key[1] = (char)c;
+    ASSERT_EQ(E_SHM_OK, del(t_, key));
+    items_.erase(key);
+    if (c == 40 || c == 13 || c == 4 || c == 2)
+      check();
+  }
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, del(t_, key));
+  ASSERT_EQ(0u, t_->count);
+  ASSERT_TRUE(NULL == t_->root);
+}
+
+TEST_F(shm_art_test, long_prefix) {
+  // paths longer than a node keeps are checked on the leaves
+  std::string prefix = "svc:region-eu-west:tenant-0042:";
+  for (int i = 0; i < 100; ++i) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", i * 7);
+    add(prefix + buf);
+  }
+  add(prefix.substr(0, 20));
+  add(prefix.substr(0, 12) + "x");
+  check();
+
+  item* found = NULL;
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, query(t_, "svc:region-eu-east:tenant-0042:7", &found));
+  ASSERT_EQ(E_SHM_KEY_NOT_FOUND, query(t_, prefix, &found));
+
+  // deleting collapses the paths back together
+  for (int i = 0; i < 100; i += 2) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", i * 7);
+    ASSERT_EQ(E_SHM_OK, del(t_, prefix + buf));
+    items_.erase(prefix + buf);
+  }
+  ASSERT_EQ(E_SHM_OK, del(t_, prefix.substr(0, 12) + "x"));
+  items_.erase(prefix.substr(0, 12) + "x");
+  check();
+}
+
+TEST_F(shm_art_test, random) {
+  srand(7);
+  for (int round = 0; round < 20000; ++round) {
+    // few letters, so keys share prefixes and run into each other
+    std::string key(1 + rand() % 8, 'a');
+    for (size_t i = 0; i < key.size(); ++i)
+      key[i] = "abc:"[rand() % 4];
+
+    if (items_.count(key) > 0) {
+      ASSERT_EQ(E_SHM_OK, del(t_, key));
+      items_.erase(key);
+    } else {
+      add(key);
+    }
+  }
+  check();
+  ASSERT_LT(0u, art_bytes(t_));
+
+  // the release callback sees every data once
+  size_t n = items_.size();
+  art_free(t_);
+  ASSERT_EQ((int)n, released);
+  t_ = art_new(key_of, release);
+}
@@ -0,0 +1,56 @@
+#include <stdint.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "shm_bloom.h"
+}
+
+static uint64_t mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return x;
+}
+
+TEST(shm_bloom_test, no_false_negatives) {
+  struct shm_bloom* b = shm_bloom_new(10000, 10);
+  ASSERT_NE((shm_bloom*)NULL, b);
+
+  for (uint64_t i = 0; i < 10000; ++i)
+    shm_bloom_add(b, mix(i));
+  for (uint64_t i = 0; i < 10000; ++i)
+    ASSERT_EQ(1, shm_bloom_maybe(b, mix(i)));
+  shm_bloom_free(b);
+}
+
+TEST(shm_bloom_test, false_positive_rate) {
+  struct shm_bloom* b = shm_bloom_new(10000, 10);
+  int fp = 0;
+
+  for (uint64_t i = 0; i < 10000; ++i)
+    shm_bloom_add(b, mix(i));
+  for (uint64_t i = 10000; i < 110000; ++i)
+    fp += shm_bloom_maybe(b, mix(i));
+
+  // about 1% for 10 bits per key, blocking costs a bit of it
+  ASSERT_LT(fp, 2000);
+  shm_bloom_free(b);
+}
+
+TEST(shm_bloom_test, empty) {
+  struct shm_bloom* b = shm_bloom_new(0, 0);
+  ASSERT_NE((shm_bloom*)NULL, b);
+  ASSERT_EQ(0, shm_bloom_maybe(b, mix(1)));
+  shm_bloom_add(b, mix(1));
+  ASSERT_EQ(1, shm_bloom_maybe(b, mix(1)));
+  shm_bloom_free(b);
+  shm_bloom_free(NULL);
+}
+
+TEST(shm_bloom_test, too_large) {
+  // more blocks than a uint32 counts
+  ASSERT_EQ((shm_bloom*)NULL, shm_bloom_new(1 << 20, UINT32_MAX));
+}
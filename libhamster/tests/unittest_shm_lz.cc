@@ -0,0 +1,72 @@
+#include <string>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "shm_lz.h"
+}
+
+static void roundtrip(const std::string& src, bool shrink) {
+  std::string packed(src.size() + src.size() / 16 + 16, '\0');
+  std::string unpacked(src.size(), '\0');
+
+  uint32_t n = shm_lz_compress(src.data(), src.size(), &packed[0], packed.size());
+  ASSERT_GT(n, (uint32_t)0);
+  if (shrink) {
+    ASSERT_LT(n, src.size());
+  }
+
+  ASSERT_EQ((int)src.size(), 
+            shm_lz_decompress(packed.data(), n, &unpacked[0], unpacked.size()));
+  ASSERT_EQ(src, unpacked);
+}
+
+TEST(shm_lz_test, repetitive) {
+  std::string src;
+  for (int i = 0; i < 200; ++i)
+    src += "{\"id\":" + std::to_string(i) + ",\"name\":\"hamster\",\"tags\":[\"a\",\"b\"]}";
+  roundtrip(src, true);
+
+  // long runs need the extra length bytes
+  roundtrip(std::string(100000, 'x'), true);
+  roundtrip(std::string(300, 'a') + std::string(5, 'b') + std::string(300, 'a'), true);
+}
+
+TEST(shm_lz_test, random) {
+  std::string src(4096, '\0');
+  srand(0);
+  for (size_t i = 0; i < src.size(); ++i)
+    src[i] = (char)rand();
+  roundtrip(src, false);
+
+  // it does not fit without a gain
+  std::string packed(src.size() - src.size() / 8, '\0');
+  ASSERT_EQ((uint32_t)0, shm_lz_compress(src.data(), src.size(), 
+                                         &packed[0], packed.size()));
+}
+
+TEST(shm_lz_test, tiny) {
+  roundtrip("", false);
+  roundtrip("a", false);
+  roundtrip("abcabcabc", false);
+}
+
+TEST(shm_lz_test, malformed) {
+  std::string src(1000, 'z');
+  std::string packed(1100, '\0'), unpacked(1000, '\0');
+  uint32_t n = shm_lz_compress(src.data(), src.size(), &packed[0], packed.size());
+  ASSERT_GT(n, (uint32_t)0);
+
+  // output buffer too small
+  ASSERT_EQ(-1, shm_lz_decompress(packed.data(), n, &unpacked[0], 999));
+  // truncated input never gives the whole value back, the last token is an
+  // empty literal run which ends the stream
+  for (uint32_t i = 2; i < n; ++i)
+    ASSERT_NE(1000, shm_lz_decompress(packed.data(), n - i, &unpacked[0], unpacked.size()));
+  // offset before the start of output
+  packed[2] = (char)0xff;
+  packed[3] = (char)0xff;
+  ASSERT_EQ(-1, shm_lz_decompress(packed.data(), n, &unpacked[0], unpacked.size()));
+}
@@ -0,0 +1,54 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "gtest/gtest.h"
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#include <numaif.h>
+#endif
+
+extern "C" {
+#include "shm_numa.h"
+}
+
+TEST(shm_numa_test, nodes) {
+  int nodes = shm_numa_nodes();
+  ASSERT_GE(nodes, 1);
+
+  int node = shm_numa_node();
+  ASSERT_GE(node, 0);
+  ASSERT_LT(node, nodes);
+}
+
+TEST(shm_numa_test, place) {
+  size_t len = 16 * sysconf(_SC_PAGESIZE);
+  void* addr = mmap(NULL, len, PROT_READ | PROT_WRITE, 
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ASSERT_NE(MAP_FAILED, addr);
+
+#ifdef HAVE_LIBNUMA
+  if (numa_available() >= 0) {
+    int mode = -1;
+    ASSERT_EQ(0, shm_numa_bind(addr, len, 0));
+    ASSERT_EQ(0, get_mempolicy(&mode, NULL, 0, addr, MPOL_F_ADDR));
+    ASSERT_EQ(MPOL_BIND, mode);
+
+    ASSERT_EQ(0, shm_numa_interleave(addr, len));
+    ASSERT_EQ(0, get_mempolicy(&mode, NULL, 0, addr, MPOL_F_ADDR));
+    ASSERT_EQ(MPOL_INTERLEAVE, mode);
+
+    // no such node
+    ASSERT_EQ(-1, shm_numa_bind(addr, len, shm_numa_nodes() + 1));
+  }
+#else
+  // placement is not available, it fails without harm
+  ASSERT_EQ(-1, shm_numa_bind(addr, len, 0));
+  ASSERT_EQ(-1, shm_numa_interleave(addr, len));
+#endif
+
+  memset(addr, 1, len);
+  munmap(addr, len);
+}
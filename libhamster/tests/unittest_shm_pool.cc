@@ -0,0 +1,91 @@
+#include <set>
+#include <vector>
+#include <stdint.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "shm_error.h"
+#include "shm_pool.h"
+#include "shm_config.h"
+}
+
+struct item {
+  uint64_t a;
+  uint64_t b;
+  uint32_t c;
+};
+
+TEST(shm_pool_test, alloc_free) {
+  struct shm_pool p;
+  shm_pool_init(&p, sizeof(item));
+  ASSERT_EQ((void*)NULL, shm_pool_ptr(&p, 0));
+  ASSERT_EQ((size_t)0, shm_pool_bytes(&p));
+
+  // several chunks worth, each slot zeroed and where its handle says
+  std::vector<uint32_t> handles;
+  const uint32_t n = 3 * SHM_POOL_CHUNK / sizeof(item);
+  for (uint32_t i = 0; i < n; ++i) {
+    uint32_t h = shm_pool_alloc(&p);
+    ASSERT_NE((uint32_t)0, h);
+    item* it = (item*)shm_pool_ptr(&p, h);
+    ASSERT_EQ((uint64_t)0, it->a | it->b | it->c);
+    ASSERT_EQ(h, shm_pool_handle(&p, it));
+    ASSERT_EQ((uintptr_t)0, (uintptr_t)it % 8);
+    it->a = i;
+    handles.push_back(h);
+  }
+  ASSERT_EQ(n, p.used);
+  ASSERT_GE(shm_pool_bytes(&p), (size_t)n * sizeof(item));
+
+  for (uint32_t i = 0; i < n; ++i)
+    ASSERT_EQ((uint64_t)i, ((item*)shm_pool_ptr(&p, handles[i]))->a);
+
+  // freed slots come back before the pool grows
+  size_t bytes = shm_pool_bytes(&p);
+  std::set<uint32_t> freed;
+  for (uint32_t i = 0; i < n; i += 3) {
+    shm_pool_free(&p, handles[i]);
+    freed.insert(handles[i]);
+  }
+  for (size_t i = 0; i < freed.size(); ++i) {
+    uint32_t h = shm_pool_alloc(&p);
+    ASSERT_EQ((size_t)1, freed.count(h));
+    ASSERT_EQ((uint64_t)0, ((item*)shm_pool_ptr(&p, h))->a);
+  }
+  ASSERT_EQ(bytes, shm_pool_bytes(&p));
+  ASSERT_EQ(n, p.used);
+
+  shm_pool_destroy(&p);
+  ASSERT_EQ((size_t)0, shm_pool_bytes(&p));
+  ASSERT_NE((uint32_t)0, shm_pool_alloc(&p));
+  shm_pool_destroy(&p);
+}
+
+TEST(shm_pool_test, small_slots) {
+  struct shm_pool p;
+  shm_pool_init(&p, 1);
+  uint32_t a = shm_pool_alloc(&p), b = shm_pool_alloc(&p);
+  ASSERT_GE((char*)shm_pool_ptr(&p, b) - (char*)shm_pool_ptr(&p, a), (ptrdiff_t)sizeof(uint32_t));
+  shm_pool_free(&p, a);
+  shm_pool_free(&p, b);
+  ASSERT_EQ(b, shm_pool_alloc(&p));
+  ASSERT_EQ(a, shm_pool_alloc(&p));
+  shm_pool_destroy(&p);
+}
+
+TEST(shm_pool_test, reserve) {
+  struct shm_pool p;
+  shm_pool_init(&p, sizeof(item));
+  const uint32_t n = SHM_POOL_CHUNK / sizeof(item) + 1;
+
+  // the slots are mapped up front, and handed out without growing
+  ASSERT_EQ(E_SHM_OK, shm_pool_reserve(&p, n));
+  size_t bytes = shm_pool_bytes(&p);
+  ASSERT_LE((size_t)2 * SHM_POOL_CHUNK, bytes);
+  ASSERT_EQ(E_SHM_OK, shm_pool_reserve(&p, n));
+  for (uint32_t i = 0; i < n; ++i)
+    ASSERT_NE((uint32_t)0, shm_pool_alloc(&p));
+  ASSERT_EQ(bytes, shm_pool_bytes(&p));
+  shm_pool_destroy(&p);
+}
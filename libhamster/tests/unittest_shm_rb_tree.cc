@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <vector>
+#include <algorithm>
 
 #include "gtest/gtest.h"
 
@@ -188,6 +190,67 @@ TEST_F(shm_rb_tree_test, worse_case_add) {
   red_black_prop_guarantee(fixture::wc_t_);
 }
 
+TEST_F(shm_rb_tree_test, del) {
+  rb_tree* t = rb_tree_new(less, release);
+  ASSERT_NE(t, (rb_tree*)NULL);
+
+  const int count = 100;
+  for (int i = 0; i < count; i++)
+    ASSERT_EQ(E_SHM_OK, rb_tree_add(t, new p_info(i)));
+
+  int order[count];
+  for (int i = 0; i < count; i++)
+    order[i] = i;
+  for (int i = count - 1; i > 0; i--)
+    std::swap(order[i], order[rand() % (i + 1)]);
+
+  for (int i = 0; i < count; i++) {
+    p_info stub(order[i]);
+    void* data = &stub;
+    ASSERT_EQ(E_SHM_OK, rb_tree_del(t, &data));
+    ASSERT_EQ(order[i], ((p_info*)data)->id);
+    delete (p_info*)data;
+
+    data = &stub;
+    ASSERT_EQ(E_SHM_KEY_NOT_FOUND, rb_tree_del(t, &data));
+    ASSERT_EQ(E_SHM_KEY_NOT_FOUND, rb_tree_query(t, &data));
+    ASSERT_EQ((size_t)(count - i - 1), t->count);
+    if (t->root != NULL) {
+      tree_guarantee(t, t->root);
+      red_black_prop_guarantee(t);
+    }
+  }
+  ASSERT_EQ(t->root, (rb_node*)NULL);
+
+  // the emptied tree is still usable
+  ASSERT_EQ(E_SHM_OK, rb_tree_add(t, new p_info(42)));
+  p_info stub(42);
+  void* data = &stub;
+  ASSERT_EQ(E_SHM_OK, rb_tree_query(t, &data));
+  rb_tree_free(t);
+}
+
+static void collect(void* data, void* ctx) {
+  ((std::vector<int>*)ctx)->push_back(((p_info*)data)->id);
+}
+
+TEST_F(shm_rb_tree_test, foreach) {
+  rb_tree* t = rb_tree_new(less, release);
+  std::vector<int> ids;
+
+  rb_tree_foreach(t, collect, &ids);
+  ASSERT_TRUE(ids.empty());
+
+  for (int i = 0; i < 100; i++)
+    ASSERT_EQ(E_SHM_OK, rb_tree_add(t, new p_info((i * 37) % 100)));
+
+  rb_tree_foreach(t, collect, &ids);
+  ASSERT_EQ((size_t)100, ids.size());
+  for (int i = 0; i < 100; i++)
+    ASSERT_EQ(i, ids[i]);
+  rb_tree_free(t);
+}
+
 /*
 TEST_F(shm_rb_tree_test, binary_tree_guarantee) {
   tree_guarantee(fixture::t_, fixture::t_->root);
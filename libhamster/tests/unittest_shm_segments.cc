@@ -1,7 +1,11 @@
+#include <string>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <signal.h>
+#include <unistd.h>
 #include <sys/shm.h>
+#include <sys/wait.h>
 
 #include "gtest/gtest.h"
 
@@ -9,11 +13,20 @@ extern "C" {
 #include "shm_error.h"
 #include "shm_config.h"
 #include "shm_segments.h"
+#include "shm_lock.h"
 }
 
 struct seg_header {
   uint32_t off;          /* offset of used part */
   key_t    next_shm_key; /* next shm segment */
+  uint32_t commit_off;   /* records below this offset are committed */
+  uint32_t epoch;        /* chain epoch of the last commit in this segment */
+  struct shm_lock        lock;
+  struct shmseg_ptr_base alloc;
+  struct shmseg_ptr_base link;
+  struct shmseg_ptr_base first;
+  uint64_t owner;
+  uint32_t format;
 } __attribute__((aligned(16)));
 
 struct test_data {
@@ -56,11 +69,13 @@ test_data shm_segments_test::data1;
 test_data shm_segments_test::data2; 
 test_data shm_segments_test::data3; 
 
+static shmseg_chain chain;
+
 TEST_F(shm_segments_test, fresh_init) {
   // 1. clean up all existing shm
   system("ipcs -m|sed -n '4,$s/\\(\\S\\+\\).*/ipcrm -M \\1/p'|sh");
   // 2. check init result
-  ASSERT_EQ(E_SHM_OK, shmseg_init(SHM_KEY));
+  ASSERT_EQ(E_SHM_OK, shmseg_init(&chain, SHM_KEY, SHM_KEY_RANGE, 0, 0));
   // 3. manually check the stat of this shm
   int shm_id = shmget(SHM_KEY, 0, 0600);
   ASSERT_NE(shm_id, -1);
@@ -71,6 +86,8 @@ TEST_F(shm_segments_test, fresh_init) {
   seg_header* hdr = (seg_header*)base_ptr;
   ASSERT_EQ(hdr->off, sizeof(seg_header));
   ASSERT_EQ(hdr->next_shm_key, -1);
+  ASSERT_EQ(hdr->commit_off, sizeof(seg_header));
+  ASSERT_EQ(hdr->epoch, (uint32_t)0);
 
   ASSERT_EQ(shmdt(base_ptr), 0);
 }
@@ -79,10 +96,10 @@ TEST_F(shm_segments_test, shmseg_get_within_one_segment) {
   // allocate a full segment size minus size of seg_header
   test_data data1 = shm_segments_test::data1;
   shmseg_ptr sptr;
-  ASSERT_EQ(E_SHM_OK, shmseg_get(&data1.len, &sptr));
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&chain, &data1.len, &sptr));
   ASSERT_EQ(sptr.base.off, sizeof(seg_header));
 
-  void* ptr = shmseg_ptr_ptr(&sptr);
+  void* ptr = shmseg_ptr_ptr(&chain, &sptr);
   ASSERT_NE(ptr, (void*)NULL);
 
   memcpy(ptr, data1.ptr, data1.len);
@@ -97,11 +114,11 @@ TEST_F(shm_segments_test, shmseg_get_cross_segment) {
   test_data data2 = shm_segments_test::data2;
   // this shmget will trigger the new allocation
   shmseg_ptr sptr;
-  ASSERT_EQ(E_SHM_OK, shmseg_get(&data2.len, &sptr));
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&chain, &data2.len, &sptr));
   ASSERT_NE(sptr.base.shm_key, (key_t)SHM_KEY);
   ASSERT_EQ(sptr.base.off, sizeof(seg_header));
 
-  void* ptr = shmseg_ptr_ptr(&sptr);
+  void* ptr = shmseg_ptr_ptr(&chain, &sptr);
   ASSERT_NE(ptr, (void*)NULL);
 
   memcpy(ptr, data2.ptr, data2.len);
@@ -112,8 +129,8 @@ TEST_F(shm_segments_test, shmseg_get_cross_segment) {
 
   key_t this_key = sptr.base.shm_key;
   shmseg_ptr_reset(&sptr);
-  ASSERT_EQ(E_SHM_OK, shmseg_first_ptr(&sptr));
-  hdr = (seg_header*)((char*)shmseg_ptr_ptr(&sptr) - sizeof(seg_header));
+  ASSERT_EQ(E_SHM_OK, shmseg_first_ptr(&chain, &sptr));
+  hdr = (seg_header*)((char*)shmseg_ptr_ptr(&chain, &sptr) - sizeof(seg_header));
   ASSERT_EQ(hdr->next_shm_key, this_key);
 
 }
@@ -122,11 +139,11 @@ TEST_F(shm_segments_test, shmseg_get_exceed_segment) {
   test_data data3 = shm_segments_test::data3;
 
   shmseg_ptr sptr;
-  ASSERT_EQ(E_SHM_OK, shmseg_get(&data3.len, &sptr));
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&chain, &data3.len, &sptr));
   ASSERT_NE(sptr.base.shm_key, (key_t)SHM_KEY);
   ASSERT_EQ(sptr.base.off, sizeof(seg_header));
 
-  void* ptr = shmseg_ptr_ptr(&sptr);
+  void* ptr = shmseg_ptr_ptr(&chain, &sptr);
   ASSERT_NE(ptr, (void*)NULL);
 
   memcpy(ptr, data3.ptr, data3.len);
@@ -139,15 +156,16 @@ TEST_F(shm_segments_test, shmseg_get_exceed_segment) {
 // simulate a crash, init the segments again and check the data
 extern "C" {
   struct seg_t;
-  void unittest_shmseg_sim_crash();
-  struct seg_t* unittest_seg_head();
+  void unittest_shmseg_sim_crash(struct shmseg_chain* c);
+  struct seg_t* unittest_seg_head(struct shmseg_chain* c);
   struct seg_t* unittest_seg_next(struct seg_t* s);
   void* unittest_seg_base(struct seg_t* s);
+  bool unittest_shmseg_spare_done(struct shmseg_chain* c);
 }
 
 TEST_F(shm_segments_test, recovery_init) {
-  unittest_shmseg_sim_crash();
-  ASSERT_EQ(E_SHM_OK, shmseg_init(SHM_KEY));
+  unittest_shmseg_sim_crash(&chain);
+  ASSERT_EQ(E_SHM_OK, shmseg_init(&chain, SHM_KEY, SHM_KEY_RANGE, 0, 0));
 
   test_data datas[3] = {
     shm_segments_test::data1,
@@ -156,7 +174,7 @@ TEST_F(shm_segments_test, recovery_init) {
   };
 
   int k = 0;
-  for (seg_t* s = unittest_seg_head();
+  for (seg_t* s = unittest_seg_head(&chain);
        s != NULL;
        s = unittest_seg_next(s), ++k) {
     void* base_ptr = unittest_seg_base(s);
@@ -165,3 +183,279 @@ TEST_F(shm_segments_test, recovery_init) {
     ASSERT_EQ(0, memcmp(base_ptr, datas[k].ptr, datas[k].len));
   }
 }
+
+TEST_F(shm_segments_test, commit_marker) {
+  test_data data2 = shm_segments_test::data2;
+  shmseg_ptr sptr;
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&chain, &data2.len, &sptr));
+  ASSERT_FALSE(shmseg_committed(&chain, &sptr));
+
+  ASSERT_EQ(E_SHM_OK, shmseg_commit(&chain, &sptr, data2.len));
+  ASSERT_TRUE(shmseg_committed(&chain, &sptr));
+
+  seg_header* hdr = (seg_header*)((char*)shmseg_ptr_ptr(&chain, &sptr) - sptr.base.off);
+  ASSERT_EQ(hdr->commit_off, sptr.base.off + data2.len);
+  ASSERT_EQ(hdr->epoch, (uint32_t)1);
+
+  // can not commit beyond what has been allocated
+  ASSERT_EQ(E_SHM_PTR_INVALID, shmseg_commit(&chain, &sptr, data2.len + 16));
+
+  // the marker survives a crash
+  key_t key = sptr.base.shm_key;
+  uint32_t off = sptr.base.off;
+  unittest_shmseg_sim_crash(&chain);
+  ASSERT_EQ(E_SHM_OK, shmseg_init(&chain, SHM_KEY, SHM_KEY_RANGE, 0, 0));
+  shmseg_ptr_reset(&sptr);
+  sptr.base.shm_key = key;
+  sptr.base.off = off;
+  ASSERT_TRUE(shmseg_committed(&chain, &sptr));
+}
+
+TEST_F(shm_segments_test, key_range) {
+  // a chain of two keys can hold two segments only
+  shmseg_chain small;
+  ASSERT_EQ(E_SHM_OK, shmseg_init(&small, SHM_KEY + SHM_KEY_RANGE, 2, 0, 0));
+
+  test_data data1 = shm_segments_test::data1;
+  shmseg_ptr sptr;
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&small, &data1.len, &sptr));
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&small, &data1.len, &sptr));
+  ASSERT_EQ(sptr.base.shm_key, (key_t)(SHM_KEY + SHM_KEY_RANGE + 1));
+  ASSERT_EQ(E_SHM_CREAT_SEGINFO_FAILED, shmseg_get(&small, &data1.len, &sptr));
+
+  shmseg_shutdown(&small);
+  ASSERT_EQ(-1, shmget(SHM_KEY + SHM_KEY_RANGE, 0, 0600));
+}
+
+TEST_F(shm_segments_test, geometric_growth) {
+  shmseg_chain grow;
+  size_t page = shm_pagesize;
+  ASSERT_EQ(E_SHM_OK, shmseg_init(&grow, SHM_KEY + 2 * SHM_KEY_RANGE, 
+                                  SHM_KEY_RANGE, page, 4 * page));
+
+  // every new segment is as big as the chain so far, up to the max
+  size_t expect[] = { 1, 1, 2, 4, 4, 4 };
+  size_t total = page;
+  shmseg_ptr sptr;
+  key_t last = -1;
+  for (size_t i = 1; i < sizeof(expect) / sizeof(expect[0]); ) {
+    uint32_t size = 256;
+    ASSERT_EQ(E_SHM_OK, shmseg_get(&grow, &size, &sptr));
+    if (sptr.base.shm_key != last && last != -1) {
+      total += expect[i++] * page;
+      ASSERT_EQ(total, grow.size);
+    }
+    last = sptr.base.shm_key;
+  }
+
+  // a large value gets a segment of its own size
+  size_t before = grow.size;
+  uint32_t size = 4 * page;
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&grow, &size, &sptr));
+  ASSERT_NE(last, sptr.base.shm_key);
+  ASSERT_EQ(before + 5 * page, grow.size);
+
+  // and the segment being filled stays the current one
+  size = 256;
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&grow, &size, &sptr));
+  ASSERT_EQ(last, sptr.base.shm_key);
+
+  shmseg_shutdown(&grow);
+}
+
+TEST_F(shm_segments_test, precreate) {
+  shmseg_chain ahead;
+  key_t entry = SHM_KEY + 3 * SHM_KEY_RANGE;
+  ASSERT_EQ(E_SHM_OK, shmseg_init(&ahead, entry, SHM_KEY_RANGE, 0, 0));
+  shmseg_set_flags(&ahead, SHMSEG_F_PRECREATE | SHMSEG_F_PREFAULT | SHMSEG_F_MLOCK, 0);
+
+  // fill 3/4 of the entry segment, the next one gets created ahead
+  shmseg_ptr sptr;
+  uint32_t size = shm_pagesize * SHM_SIZE_IN_PAGES * 3 / 4;
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&ahead, &size, &sptr));
+  for (int i = 0; i < 1000 && !unittest_shmseg_spare_done(&ahead); ++i)
+    usleep(1000);
+  ASSERT_NE(-1, shmget(entry + 1, 0, 0600));
+  ASSERT_EQ((size_t)shm_pagesize * SHM_SIZE_IN_PAGES, ahead.size);
+
+  // and linked once the entry segment is full
+  size = shm_pagesize * SHM_SIZE_IN_PAGES / 4;
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&ahead, &size, &sptr));
+  ASSERT_EQ(entry + 1, sptr.base.shm_key);
+  ASSERT_EQ((size_t)2 * shm_pagesize * SHM_SIZE_IN_PAGES, ahead.size);
+
+  // an unlinked spare is left by a crash, the chain reuses its key
+  size = shm_pagesize * SHM_SIZE_IN_PAGES / 2;
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&ahead, &size, &sptr));
+  for (int i = 0; i < 1000 && shmget(entry + 2, 0, 0600) < 0; ++i)
+    usleep(1000);
+  unittest_shmseg_sim_crash(&ahead);
+  ASSERT_NE(-1, shmget(entry + 2, 0, 0600));
+
+  ASSERT_EQ(E_SHM_OK, shmseg_init(&ahead, entry, SHM_KEY_RANGE, 0, 0));
+  size = shm_pagesize * SHM_SIZE_IN_PAGES;
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&ahead, &size, &sptr));
+  ASSERT_EQ(entry + 2, sptr.base.shm_key);
+
+  // a spare is deleted with the chain
+  shmseg_set_flags(&ahead, SHMSEG_F_PRECREATE, 0);
+  size = shm_pagesize * SHM_SIZE_IN_PAGES;
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&ahead, &size, &sptr));
+  shmseg_shutdown(&ahead);
+  for (key_t k = entry; k < entry + 5; ++k)
+    ASSERT_EQ(-1, shmget(k, 0, 0600));
+}
+
+TEST_F(shm_segments_test, owner_dead) {
+  shmseg_chain c;
+  key_t entry = SHM_KEY + 4 * SHM_KEY_RANGE;
+  ASSERT_EQ(E_SHM_OK, shmseg_init(&c, entry, SHM_KEY_RANGE, 0, 0));
+
+  // a committed record, its first bytes are its link to the next one
+  shmseg_ptr first, sptr;
+  uint32_t size = 64;
+  ASSERT_EQ(E_SHM_OK, shmseg_lock(&c, NULL));
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&c, &size, &first));
+  shmseg_ptr_base* link = (shmseg_ptr_base*)shmseg_ptr_ptr(&c, &first);
+  link->shm_key = -1;
+  ASSERT_EQ(E_SHM_OK, shmseg_commit(&c, &first, size));
+  shmseg_unlock(&c);
+
+  // the next one is linked, and its writer killed before the commit
+  pid_t pid = fork();
+  if (pid == 0) {
+    uint32_t n = 64;
+    if (E_SHM_OK == shmseg_lock(&c, &first.base) && E_SHM_OK == shmseg_get(&c, &n, &sptr))
+      *link = sptr.base;
+    kill(getpid(), SIGKILL);
+  }
+  int status = 0;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFSIGNALED(status));
+  ASSERT_NE(-1, link->shm_key);
+
+  // whoever locks it next undoes the write, without waiting for the dead
+  unittest_shmseg_sim_crash(&c);
+  ASSERT_EQ(E_SHM_OK, shmseg_init(&c, entry, SHM_KEY_RANGE, 0, 0));
+  ASSERT_EQ(E_SHM_OWNER_DEAD, shmseg_lock(&c, NULL));
+  shmseg_unlock(&c);
+  ASSERT_EQ(E_SHM_OK, shmseg_lock(&c, NULL));
+  size = 64;
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&c, &size, &sptr));
+  shmseg_unlock(&c);
+
+  link = (shmseg_ptr_base*)shmseg_ptr_ptr(&c, &first);
+  ASSERT_EQ(-1, link->shm_key);
+  ASSERT_EQ(first.base.off + 64, sptr.base.off);
+  shmseg_shutdown(&c);
+}
+
+TEST_F(shm_segments_test, first_beyond_entry) {
+  shmseg_chain c;
+  key_t entry = SHM_KEY + 5 * SHM_KEY_RANGE;
+  ASSERT_EQ(E_SHM_OK, shmseg_init(&c, entry, SHM_KEY_RANGE, 0, 0));
+
+  // the first record does not fit into the entry segment, which stays empty
+  shmseg_ptr first, sptr;
+  uint32_t size = data3.len;
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&c, &size, &first));
+  ASSERT_NE(entry, first.base.shm_key);
+  ASSERT_EQ(E_SHM_OK, shmseg_commit(&c, &first, size));
+
+  // and the chain still starts at it, before and after a crash
+  ASSERT_EQ(E_SHM_OK, shmseg_first_ptr(&c, &sptr));
+  ASSERT_EQ(first.base.shm_key, sptr.base.shm_key);
+  ASSERT_EQ(first.base.off, sptr.base.off);
+  unittest_shmseg_sim_crash(&c);
+  ASSERT_EQ(E_SHM_OK, shmseg_init(&c, entry, SHM_KEY_RANGE, 0, 0));
+  ASSERT_EQ(E_SHM_OK, shmseg_first_ptr(&c, &sptr));
+  ASSERT_EQ(first.base.shm_key, sptr.base.shm_key);
+  ASSERT_EQ(first.base.off, sptr.base.off);
+  shmseg_shutdown(&c);
+}
+
+TEST_F(shm_segments_test, reopen_larger_min) {
+  shmseg_chain c;
+  size_t page = shm_pagesize;
+  key_t entry = SHM_KEY + 6 * SHM_KEY_RANGE;
+  ASSERT_EQ(E_SHM_OK, shmseg_init(&c, entry, SHM_KEY_RANGE, page, 0));
+
+  // a record in the entry segment and one in the next
+  shmseg_ptr a, b;
+  uint32_t size = page / 2;
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&c, &size, &a));
+  memset(shmseg_ptr_ptr(&c, &a), 'a', size);
+  ASSERT_EQ(E_SHM_OK, shmseg_commit(&c, &a, size));
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&c, &size, &b));
+  ASSERT_NE(a.base.shm_key, b.base.shm_key);
+  memset(shmseg_ptr_ptr(&c, &b), 'b', size);
+  ASSERT_EQ(E_SHM_OK, shmseg_commit(&c, &b, size));
+  size_t before = c.size;
+  shmseg_detach(&c);
+
+  // segments of the chain keep their size, and what is in them
+  ASSERT_EQ(E_SHM_OK, shmseg_init(&c, entry, SHM_KEY_RANGE, 4 * page, 0));
+  ASSERT_EQ(before, c.size);
+  std::string expect(size, 'a');
+  ASSERT_EQ(0, memcmp(expect.data(), shmseg_ptr_ptr(&c, &a), size));
+  expect.assign(size, 'b');
+  ASSERT_EQ(0, memcmp(expect.data(), shmseg_ptr_ptr(&c, &b), size));
+
+  // a new one is as big as asked for now
+  size = page / 2 + 64;
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&c, &size, &b));
+  ASSERT_LE(before + 4 * page, c.size);
+  shmseg_shutdown(&c);
+}
+
+TEST_F(shm_segments_test, format_mismatch) {
+  shmseg_chain c;
+  key_t entry = SHM_KEY + 7 * SHM_KEY_RANGE;
+  ASSERT_EQ(E_SHM_OK, shmseg_init(&c, entry, SHM_KEY_RANGE, 0, 0));
+  test_data data1 = shm_segments_test::data1;
+  shmseg_ptr sptr;
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&c, &data1.len, &sptr));
+  memcpy(shmseg_ptr_ptr(&c, &sptr), data1.ptr, data1.len);
+  ASSERT_EQ(E_SHM_OK, shmseg_commit(&c, &sptr, data1.len));
+
+  // a chain of another layout is neither opened nor read, and left as it is
+  seg_header* hdr = (seg_header*)((char*)shmseg_ptr_ptr(&c, &sptr) - sptr.base.off);
+  uint32_t format = hdr->format;
+  hdr->format = format - 1;
+  shmseg_detach(&c);
+  ASSERT_EQ(E_SHM_FORMAT_MISMATCH, shmseg_init(&c, entry, SHM_KEY_RANGE, 0, 0));
+  ASSERT_EQ(E_SHM_FORMAT_MISMATCH, shmseg_attach(&c, entry, SHM_KEY_RANGE));
+  ASSERT_NE(-1, shmget(entry, 0, 0600));
+
+  void* p = shmat(shmget(entry, 0, 0600), 0, 0);
+  ((seg_header*)p)->format = format;
+  shmdt(p);
+  ASSERT_EQ(E_SHM_OK, shmseg_init(&c, entry, SHM_KEY_RANGE, 0, 0));
+  ASSERT_EQ(0, memcmp(data1.ptr, shmseg_ptr_ptr(&c, &sptr), data1.len));
+  shmseg_shutdown(&c);
+}
+
+TEST_F(shm_segments_test, room) {
+  // a chain of two keys, its entry segment full
+  shmseg_chain c;
+  key_t entry = SHM_KEY + 8 * SHM_KEY_RANGE;
+  ASSERT_EQ(E_SHM_OK, shmseg_init(&c, entry, 2, 0, 0));
+  test_data data1 = shm_segments_test::data1;
+  shmseg_ptr sptr;
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&c, &data1.len, &sptr));
+
+  // the segment for the next record is created ahead, and taken by it
+  size_t before = c.size;
+  ASSERT_EQ(E_SHM_OK, shmseg_room(&c, data1.len));
+  ASSERT_NE(-1, shmget(entry + 1, 0, 0600));
+  ASSERT_EQ(before, c.size);
+  ASSERT_EQ(E_SHM_OK, shmseg_room(&c, data1.len));
+  ASSERT_EQ(E_SHM_OK, shmseg_get(&c, &data1.len, &sptr));
+  ASSERT_EQ(entry + 1, sptr.base.shm_key);
+  ASSERT_LT(before, c.size);
+
+  // no key is left for another one
+  ASSERT_EQ(E_SHM_CREAT_SEGINFO_FAILED, shmseg_room(&c, data1.len));
+  ASSERT_EQ(E_SHM_CREAT_SEGINFO_FAILED, shmseg_get(&c, &data1.len, &sptr));
+  shmseg_shutdown(&c);
+}
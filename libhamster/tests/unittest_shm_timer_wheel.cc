@@ -0,0 +1,104 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "shm_timer_wheel.h"
+}
+
+#define NODE_NUM 4096
+
+struct fire_ctx {
+  uint64_t last;   /* ticks before last are processed */
+  uint64_t now;
+  size_t   fired;
+};
+
+static void check_fire(struct timer_node* n, void* p) {
+  fire_ctx* ctx = (fire_ctx*)p;
+  // fires late never, early never, once only
+  ASSERT_LE(n->expire, ctx->now);
+  ASSERT_GT(n->expire, ctx->last);
+  ASSERT_EQ(n->data, (void*)0);
+  n->data = (void*)1;
+  ++ctx->fired;
+}
+
+static uint64_t rand_delay() {
+  switch (rand() % 4) {
+    case 0:  return rand() % 64;
+    case 1:  return rand() % 4096;
+    case 2:  return rand() % (1 << 20);
+    default: return ((uint64_t)rand() << 8) % ((uint64_t)1 << 32);
+  }
+}
+
+class shm_timer_wheel_test : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    srand(time(NULL));
+  }
+};
+
+TEST_F(shm_timer_wheel_test, expire_in_order) {
+  const uint64_t start = 1000;
+  timer_wheel* tw = timer_wheel_new(start);
+  ASSERT_NE(tw, (timer_wheel*)NULL);
+
+  static timer_node nodes[NODE_NUM];
+  uint64_t max_expire = 0;
+  for (int i = 0; i < NODE_NUM; ++i) {
+    nodes[i].expire = start + 1 + rand_delay();
+    nodes[i].data = (void*)0;
+    if (nodes[i].expire > max_expire)
+      max_expire = nodes[i].expire;
+    timer_wheel_add(tw, &nodes[i]);
+  }
+  ASSERT_EQ((size_t)NODE_NUM, tw->count);
+
+  fire_ctx ctx = { start, start, 0 };
+  while (ctx.last < max_expire) {
+    ctx.now = ctx.last + 1 + rand() % 100000;
+    timer_wheel_advance(tw, ctx.now, check_fire, &ctx);
+    ctx.last = ctx.now;
+  }
+
+  ASSERT_EQ((size_t)NODE_NUM, ctx.fired);
+  ASSERT_EQ((size_t)0, tw->count);
+  for (int i = 0; i < NODE_NUM; ++i)
+    ASSERT_EQ(nodes[i].data, (void*)1);
+  timer_wheel_free(tw);
+}
+
+TEST_F(shm_timer_wheel_test, del) {
+  timer_wheel* tw = timer_wheel_new(0);
+  timer_node a, b;
+  a.expire = 10; a.data = (void*)0;
+  b.expire = 5000; b.data = (void*)0;
+  timer_wheel_add(tw, &a);
+  timer_wheel_add(tw, &b);
+  timer_wheel_del(tw, &a);
+  timer_wheel_del(tw, &a);
+  ASSERT_EQ((size_t)1, tw->count);
+
+  fire_ctx ctx = { 0, 10000, 0 };
+  ASSERT_EQ((size_t)1, timer_wheel_advance(tw, ctx.now, check_fire, &ctx));
+  ASSERT_EQ(a.data, (void*)0);
+  ASSERT_EQ(b.data, (void*)1);
+  timer_wheel_free(tw);
+}
+
+TEST_F(shm_timer_wheel_test, already_expired) {
+  timer_wheel* tw = timer_wheel_new(100);
+  timer_node a;
+  a.expire = 3;
+  a.data = (void*)0;
+  timer_wheel_add(tw, &a);
+
+  fire_ctx ctx = { 0, 101, 0 };
+  ASSERT_EQ((size_t)1, timer_wheel_advance(tw, ctx.now, check_fire, &ctx));
+  timer_wheel_free(tw);
+}
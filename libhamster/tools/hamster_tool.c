@@ -0,0 +1,148 @@
+/*
+ * hamster-tool: look into a store, or move it
+ *
+ *   hamster-tool dump [-k KEY] [NAME] > FILE   stream the live records out
+ *   hamster-tool load [-k KEY] [-s SHARDS] [NAME] < FILE
+ *                                              load a dump into a store
+ *   hamster-tool stat [-k KEY] [NAME]          segments and occupancy
+ *
+ * a store is given by its name, its first shm key, or neither for the
+ * default store on SHM_KEY. dump and stat only attach the shm read only and
+ * work on a live store. load is meant for a store no other process has open,
+ * its shm is left behind for the process to open it next
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hamster.h"
+#include "shm_error.h"
+#include "shm_config.h"
+
+static void usage() {
+  fprintf(stderr,
+          "usage: hamster-tool dump [-k KEY] [NAME] > FILE\n"
+          "       hamster-tool load [-k KEY] [-s SHARDS] [NAME] < FILE\n"
+          "       hamster-tool stat [-k KEY] [NAME]\n");
+  exit(2);
+}
+
+static int cmd_dump(const char* name, key_t key) {
+  int ec = E_SHM_OK;
+  struct hamster_reader* r = NULL;
+
+  if (E_SHM_OK != (ec = hamster_reader_open(name, key, &r)))
+    return ec;
+
+  ec = hamster_reader_dump(r, STDOUT_FILENO);
+  hamster_reader_close(r);
+  return ec;
+}
+
+static int cmd_load(const char* name, key_t key, uint32_t shards) {
+  int ec = E_SHM_OK;
+  struct hamster_options opts;
+  struct hamster_store* st = NULL;
+
+  memset(&opts, 0, sizeof(opts));
+  opts.key = key;
+  opts.shards = shards;
+  if (E_SHM_OK != (ec = hamster_open(name, &opts, &st)))
+    return ec;
+
+  if (E_SHM_OK == (ec = hamster_store_load(st, STDIN_FILENO)))
+    fprintf(stderr, "%zu keys\n", hamster_store_count(st));
+  hamster_detach(st);
+  return ec;
+}
+
+static int cmd_stat(const char* name, key_t key) {
+  int ec = E_SHM_OK;
+  uint32_t shard = 0, i = 0;
+  struct hamster_reader* r = NULL;
+  struct hamster_occupancy o, all;
+  struct hamster_segment seg;
+
+  if (E_SHM_OK != (ec = hamster_reader_open(name, key, &r)))
+    return ec;
+
+  memset(&all, 0, sizeof(all));
+  for (shard = 0; shard < hamster_reader_shards(r); ++shard) {
+    if (E_SHM_OK != (ec = hamster_reader_occupancy(r, shard, &o)))
+      break;
+
+    printf("shard %u: %u segments, %llu bytes, %llu used\n", shard, o.segments,
+           (unsigned long long)o.bytes, (unsigned long long)o.used);
+    for (i = 0; E_SHM_OK == hamster_reader_segment(r, shard, i, &seg); ++i)
+      printf("  segment 0x%08x: %zu bytes, %u used, %u committed\n",
+             (unsigned)seg.shm_key, seg.size, seg.used, seg.committed);
+    printf("  %llu live (%llu bytes, %llu of values), %llu free (%llu bytes), %llu bad\n",
+           (unsigned long long)o.live, (unsigned long long)o.live_bytes,
+           (unsigned long long)o.value_bytes, (unsigned long long)o.free,
+           (unsigned long long)o.free_bytes, (unsigned long long)o.bad);
+
+    all.segments += o.segments;
+    all.bytes += o.bytes;
+    all.used += o.used;
+    all.live += o.live;
+    all.live_bytes += o.live_bytes;
+    all.free_bytes += o.free_bytes;
+  }
+
+  if (ec == E_SHM_OK)
+    printf("total: %u shards, %u segments, %llu bytes, %llu live keys, %.1f%% live, %.1f%% free\n",
+           hamster_reader_shards(r), all.segments, (unsigned long long)all.bytes,
+           (unsigned long long)all.live,
+           all.bytes > 0 ? 100.0 * all.live_bytes / all.bytes : 0.0,
+           all.bytes > 0 ? 100.0 * all.free_bytes / all.bytes : 0.0);
+  hamster_reader_close(r);
+  return ec;
+}
+
+int main(int argc, char** argv) {
+  int ec = E_SHM_OK, opt = 0;
+  const char* cmd = NULL;
+  const char* name = NULL;
+  key_t key = 0;
+  uint32_t shards = 0;
+
+  if (argc < 2)
+    usage();
+  cmd = argv[1];
+
+  optind = 2;
+  while ((opt = getopt(argc, argv, "k:s:")) != -1) {
+    if (opt == 'k')
+      key = (key_t)strtoul(optarg, NULL, 0);
+    else if (opt == 's')
+      shards = (uint32_t)strtoul(optarg, NULL, 0);
+    else
+      usage();
+  }
+  if (optind < argc)
+    name = argv[optind++];
+  if (optind < argc)
+    usage();
+
+  // neither a name nor a key is the default store
+  if (name == NULL && key == 0)
+    key = SHM_KEY;
+  if (name == NULL)
+    name = "default";
+
+  if (strcmp(cmd, "dump") == 0)
+    ec = cmd_dump(name, key);
+  else if (strcmp(cmd, "load") == 0)
+    ec = cmd_load(name, key, shards);
+  else if (strcmp(cmd, "stat") == 0)
+    ec = cmd_stat(name, key);
+  else
+    usage();
+
+  if (ec != E_SHM_OK) {
+    fprintf(stderr, "hamster-tool %s: error %d\n", cmd, ec);
+    return 1;
+  }
+  return 0;
+}